@@ -0,0 +1,144 @@
+/**
+ * Allocation-per-request benchmark for the daemon hot path
+ *
+ * Runs a LohostDaemon in-process in front of a Unix-socket backend, drives
+ * it closed-loop and samples the V8 heap (including objects already
+ * collected) while the load runs. Bytes are attributed to lohost when a
+ * daemon source frame is on the allocating stack; allocations made by Node's
+ * own HTTP machinery on the daemon's behalf are reported separately, as is
+ * the whole-process total (which includes the in-process load generator and
+ * backend).
+ *
+ * Usage:
+ *   tsx bench/alloc.ts [--seconds N] [--port PORT] [--path PATH]
+ */
+
+import { createServer, request } from "node:http";
+import { mkdtempSync, rmSync } from "node:fs";
+import { tmpdir } from "node:os";
+import { join } from "node:path";
+import { parseArgs } from "node:util";
+import { LohostDaemon } from "../src/daemon.js";
+import { runLoad } from "../src/loadgen.js";
+import { Profiler } from "../src/profiler.js";
+
+// Source files that run inside the daemon (the generator is excluded)
+const LOHOST_FRAME = /\/src\/(?!loadgen|client)[\w-]+\.[jt]s$/;
+
+interface ProfileNode {
+  callFrame: { functionName: string; url: string };
+  selfSize: number;
+  children?: ProfileNode[];
+}
+
+async function main(): Promise<void> {
+  const { values } = parseArgs({
+    options: {
+      seconds: { type: "string", default: "5" },
+      port: { type: "string", default: "18090" },
+      path: { type: "string", default: "/" },
+      connections: { type: "string", default: "8" },
+    },
+    strict: true,
+  });
+  const port = Number(values.port);
+  const seconds = Number(values.seconds);
+
+  const dir = mkdtempSync(join(tmpdir(), "lohost-alloc-"));
+  const socketPath = join(dir, "alloc.sock");
+  const body = Buffer.from("hello, world\n");
+  const backend = createServer((_req, res) => {
+    res.writeHead(200, { "Content-Type": "text/plain", "Content-Length": body.length });
+    res.end(body);
+  });
+  await new Promise<void>((resolve) => backend.listen(socketPath, resolve));
+
+  const daemon = new LohostDaemon({ port, socketDir: dir });
+  await daemon.start();
+  await register(port, socketPath);
+
+  const load = {
+    host: "127.0.0.1",
+    port,
+    hostHeader: `alloc.localhost:${port}`,
+    request: { method: "GET", path: values.path },
+    rate: 0,
+    connections: Number(values.connections),
+  };
+
+  // Warm up so JIT and pools settle before sampling
+  await runLoad({ ...load, duration: 1000 });
+
+  const profiler = new Profiler();
+  const [profile, result] = await Promise.all([
+    profiler.allocationSample(seconds * 1000, 256) as Promise<{ head: ProfileNode }>,
+    runLoad({ ...load, duration: seconds * 1000 }),
+  ]);
+
+  const totals = { lohost: 0, nodeHttp: 0, all: 0 };
+  const byFunction = new Map<string, number>();
+  const walk = (node: ProfileNode, lohostFrame: string | null) => {
+    const { url, functionName } = node.callFrame;
+    const frame = LOHOST_FRAME.test(url)
+      ? `${functionName || "(anonymous)"} ${url.slice(url.lastIndexOf("/") + 1)}`
+      : lohostFrame;
+    totals.all += node.selfSize;
+    if (frame) {
+      totals.lohost += node.selfSize;
+      byFunction.set(frame, (byFunction.get(frame) ?? 0) + node.selfSize);
+    } else if (url.startsWith("node:_http") || url.startsWith("node:http")) {
+      totals.nodeHttp += node.selfSize;
+    }
+    for (const child of node.children ?? []) walk(child, frame);
+  };
+  walk(profile.head, null);
+
+  const perRequest = (bytes: number) => Math.round(bytes / Math.max(result.completed, 1));
+  const top = [...byFunction.entries()]
+    .sort((a, b) => b[1] - a[1])
+    .slice(0, 10)
+    .map(([frame, bytes]) => ({ frame, bytesPerRequest: perRequest(bytes) }));
+
+  console.log(JSON.stringify({
+    requests: result.completed,
+    errors: result.errors,
+    rps: Math.round(result.completed / (result.elapsedMs / 1000)),
+    bytesPerRequest: {
+      lohost: perRequest(totals.lohost),
+      nodeHttp: perRequest(totals.nodeHttp),
+      process: perRequest(totals.all),
+    },
+    topLohostFrames: top,
+  }, null, 2));
+
+  await daemon.stop();
+  backend.close();
+  rmSync(dir, { recursive: true, force: true });
+  process.exit(0);
+}
+
+function register(port: number, socketPath: string): Promise<void> {
+  return new Promise((resolve, reject) => {
+    const data = JSON.stringify({ name: "alloc", socketPath, port: 1 });
+    const req = request(
+      {
+        host: "127.0.0.1",
+        port,
+        path: "/_lohost/register",
+        method: "POST",
+        headers: { "Content-Type": "application/json", "Content-Length": Buffer.byteLength(data) },
+      },
+      (res) => {
+        res.resume();
+        res.on("end", () => (res.statusCode === 200 ? resolve() : reject(new Error("register failed"))));
+      }
+    );
+    req.on("error", reject);
+    req.end(data);
+  });
+}
+
+main().catch((err) => {
+  console.error("bench error:", err.message);
+  process.exit(1);
+});
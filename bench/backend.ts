@@ -0,0 +1,113 @@
+/**
+ * Benchmark backend - plain node:http echo/static server
+ *
+ * Listens on $PORT (as set by `lohost -n`), speaking HTTP/1.1 or, to
+ * connections that open with the HTTP/2 preface, h2c. Serves:
+ *   GET  /small          13-byte text response
+ *   GET  /bytes/<n>      n bytes of static payload
+ *   POST /upload         drains the body, replies with the byte count
+ *   WebSocket upgrade    echoes every data frame back
+ */
+
+import { createServer, type IncomingMessage, type ServerResponse } from "node:http";
+import { createServer as createHttp2Server } from "node:http2";
+import { createServer as createNetServer, type Socket } from "node:net";
+import { acceptKey, encodeFrame, FrameDecoder } from "./ws.js";
+
+const SMALL_BODY = Buffer.from("hello, world\n");
+const CHUNK = Buffer.alloc(64 * 1024, "x");
+
+function handle(req: IncomingMessage, res: ServerResponse): void {
+  const url = req.url ?? "/";
+
+  if (url.startsWith("/bytes/")) {
+    const total = Number(url.slice("/bytes/".length)) || 0;
+    res.writeHead(200, {
+      "Content-Type": "application/octet-stream",
+      "Content-Length": total,
+    });
+    let remaining = total;
+    const pump = () => {
+      while (remaining > 0) {
+        const n = Math.min(remaining, CHUNK.length);
+        remaining -= n;
+        if (!res.write(n === CHUNK.length ? CHUNK : CHUNK.subarray(0, n))) {
+          res.once("drain", pump);
+          return;
+        }
+      }
+      res.end();
+    };
+    pump();
+    return;
+  }
+
+  if (req.method === "POST" || req.method === "PUT") {
+    let received = 0;
+    req.on("data", (chunk: Buffer) => (received += chunk.length));
+    req.on("end", () => {
+      res.writeHead(200, { "Content-Type": "application/json" });
+      res.end(JSON.stringify({ received }));
+    });
+    return;
+  }
+
+  res.writeHead(200, {
+    "Content-Type": "text/plain",
+    "Content-Length": SMALL_BODY.length,
+  });
+  res.end(SMALL_BODY);
+}
+
+const server = createServer(handle);
+// The compatibility API has what handle() uses
+const h2Server = createHttp2Server(handle as never);
+
+server.on("upgrade", (req, socket: Socket, head: Buffer) => {
+  const key = req.headers["sec-websocket-key"];
+  if (typeof key !== "string") {
+    socket.destroy();
+    return;
+  }
+  socket.setNoDelay(true);
+  socket.write(
+    "HTTP/1.1 101 Switching Protocols\r\n" +
+      "Upgrade: websocket\r\n" +
+      "Connection: Upgrade\r\n" +
+      `Sec-WebSocket-Accept: ${acceptKey(key)}\r\n\r\n`
+  );
+
+  const decoder = new FrameDecoder(({ opcode, payload }) => {
+    if (opcode === 0x8) {
+      socket.end(encodeFrame(0x8, payload, false));
+    } else if (opcode === 0x9) {
+      socket.write(encodeFrame(0xa, payload, false));
+    } else if (opcode === 0x1 || opcode === 0x2) {
+      socket.write(encodeFrame(opcode, payload, false));
+    }
+  });
+  if (head.length > 0) decoder.push(head);
+  socket.on("data", (chunk: Buffer) => decoder.push(chunk));
+  socket.on("error", () => socket.destroy());
+});
+
+server.keepAliveTimeout = 60_000;
+
+// The preface starts "PRI * HTTP/2.0"; no HTTP/1.1 method starts with "PRI"
+const front = createNetServer((socket) => {
+  socket.once("data", (head: Buffer) => {
+    socket.pause();
+    socket.unshift(head);
+    if (head.toString("latin1", 0, 3) === "PRI") {
+      // The session reads what is already buffered itself
+      h2Server.emit("connection", socket);
+    } else {
+      server.emit("connection", socket);
+      socket.resume();
+    }
+  });
+  socket.on("error", () => socket.destroy());
+});
+front.listen(Number(process.env.PORT ?? 3000), () => {
+  console.log(`bench-backend pid=${process.pid}`);
+});
@@ -0,0 +1,251 @@
+/**
+ * Native relay benchmark
+ *
+ * Puts each relay engine (the daemon's Node forwarding, and lohost-relay on
+ * epoll + splice, on io_uring and with sockmap redirection) between a load
+ * generator and an echo backend, and reports what the relay process itself
+ * spends:
+ *
+ *   ping-pong  Many connections each sending a small message and waiting for
+ *              the echo: requests/s, relay CPU µs and syscalls per request
+ *   bulk       A few connections streaming in both directions: MB/s and
+ *              relay CPU ms per GB relayed
+ *
+ * Syscalls are counted by the relay (io_uring_enter counts as one), so they
+ * are only reported for the native engines. The backend listens on a Unix
+ * socket, or with --backend tcp on a loopback port, which sockmap needs to
+ * redirect anything. Build the relay first with native/build.sh.
+ *
+ * Usage:
+ *   tsx bench/relay.ts [--engines node,epoll,io_uring,sockmap] [--conns 50]
+ *                      [--seconds 5] [--size 64] [--bulk-mb 1024]
+ *                      [--backend unix|tcp]
+ */
+
+import { spawn, type ChildProcess } from "node:child_process";
+import { createConnection, createServer, type Socket } from "node:net";
+import { unlinkSync } from "node:fs";
+import { tmpdir } from "node:os";
+import { join } from "node:path";
+import { parseArgs } from "node:util";
+import { performance } from "node:perf_hooks";
+import { sampleProcess } from "../src/procstat.js";
+import { NativeRelay, findRelayBinary, type RelayStats } from "../src/relay.js";
+
+const LISTEN_HOST = "127.0.0.1";
+const LISTEN_PORT = 19432;
+const BACKEND_PORT = 19433;
+const BULK_CONNS = 4;
+const BULK_CHUNK = 256 * 1024;
+
+interface Relay {
+  pid: number;
+  stats(): Promise<RelayStats | null>;
+  stop(): void;
+}
+
+async function main(): Promise<void> {
+  // Child roles: the echo backend and the Node relay run in their own processes
+  if (process.argv[2] === "--echo") return serveEcho(process.argv[3]);
+  if (process.argv[2] === "--node-relay") return serveNodeRelay(process.argv[3]);
+
+  const { values } = parseArgs({
+    options: {
+      engines: { type: "string", default: "node,epoll,io_uring" },
+      conns: { type: "string", default: "50" },
+      seconds: { type: "string", default: "5" },
+      size: { type: "string", default: "64" },
+      "bulk-mb": { type: "string", default: "1024" },
+      backend: { type: "string", default: "unix" },
+    },
+    strict: true,
+  });
+  const conns = Number(values.conns);
+  const seconds = Number(values.seconds);
+  const size = Number(values.size);
+  const bulkBytes = Number(values["bulk-mb"]) * 1024 * 1024;
+
+  // A backend in the relay's syntax: unix:<path> or <host>:<port>
+  const backend = values.backend === "tcp"
+    ? `${LISTEN_HOST}:${BACKEND_PORT}`
+    : `unix:${join(tmpdir(), `lohost-bench-echo-${process.pid}.sock`)}`;
+  const echo = spawnSelf(["--echo", backend]);
+  await waitForLine(echo, "ready");
+
+  console.log(
+    `ping-pong: ${conns} connections, ${size}-byte messages, ${seconds}s; ` +
+      `bulk: ${BULK_CONNS} connections, ${values["bulk-mb"]}MB each way; ${values.backend} backend\n`
+  );
+  console.log(
+    "engine".padEnd(10) +
+      "req/s".padStart(10) + "µs/req".padStart(10) + "sys/req".padStart(10) +
+      "MB/s".padStart(10) + "ms/GB".padStart(10)
+  );
+
+  for (const engine of values.engines.split(",")) {
+    const relay = await startRelay(engine, backend);
+    if (!relay) continue;
+
+    const cpu0 = await sampleProcess(relay.pid);
+    const stats0 = await relay.stats();
+    const requests = await pingPong(conns, size, seconds);
+    const cpu1 = await sampleProcess(relay.pid);
+    const stats1 = await relay.stats();
+
+    const bulkStart = performance.now();
+    const relayed = await bulk(bulkBytes);
+    const bulkSeconds = (performance.now() - bulkStart) / 1000;
+    const cpu2 = await sampleProcess(relay.pid);
+    relay.stop();
+
+    const label = stats1 ? stats1.engine : engine;
+    console.log(
+      label.padEnd(10) +
+        (requests / seconds).toFixed(0).padStart(10) +
+        (((cpu1!.cpuMs - cpu0!.cpuMs) * 1000) / requests).toFixed(1).padStart(10) +
+        (stats0 && stats1 ? ((stats1.syscalls - stats0.syscalls) / requests).toFixed(2) : "-")
+          .padStart(10) +
+        (relayed / 1048576 / bulkSeconds).toFixed(0).padStart(10) +
+        ((cpu2!.cpuMs - cpu1!.cpuMs) / (relayed / 1073741824)).toFixed(0).padStart(10)
+    );
+  }
+
+  echo.kill();
+}
+
+/** Request/response round trips completed by `conns` connections in `seconds`. */
+async function pingPong(conns: number, size: number, seconds: number): Promise<number> {
+  const message = Buffer.alloc(size, "x");
+  const deadline = performance.now() + seconds * 1000;
+  let requests = 0;
+
+  await Promise.all(Array.from({ length: conns }, () => new Promise<void>((resolve, reject) => {
+    const socket = createConnection({ host: LISTEN_HOST, port: LISTEN_PORT, noDelay: true });
+    let pending = 0;
+    socket.on("connect", () => {
+      pending = size;
+      socket.write(message);
+    });
+    socket.on("data", (data) => {
+      pending -= data.length;
+      if (pending > 0) return;
+      requests++;
+      if (performance.now() >= deadline) {
+        socket.end();
+        return;
+      }
+      pending = size;
+      socket.write(message);
+    });
+    socket.on("close", () => resolve());
+    socket.on("error", reject);
+  })));
+  return requests;
+}
+
+/** Stream `bytes` through each of a few connections; returns bytes relayed both ways. */
+async function bulk(bytes: number): Promise<number> {
+  const chunk = Buffer.alloc(BULK_CHUNK, "y");
+  let relayed = 0;
+
+  await Promise.all(Array.from({ length: BULK_CONNS }, () => new Promise<void>((resolve, reject) => {
+    const socket = createConnection({ host: LISTEN_HOST, port: LISTEN_PORT, allowHalfOpen: true });
+    let sent = 0;
+    const pump = (): void => {
+      while (sent < bytes) {
+        sent += chunk.length;
+        relayed += chunk.length;
+        if (!socket.write(chunk)) {
+          socket.once("drain", pump);
+          return;
+        }
+      }
+      socket.end();
+    };
+    socket.on("connect", pump);
+    socket.on("data", (data) => (relayed += data.length));
+    socket.on("end", () => resolve());
+    socket.on("error", reject);
+  })));
+  return relayed;
+}
+
+async function startRelay(engine: string, backend: string): Promise<Relay | null> {
+  if (engine === "node") {
+    const child = spawnSelf(["--node-relay", backend]);
+    await waitForLine(child, "ready");
+    return { pid: child.pid!, stats: async () => null, stop: () => child.kill() };
+  }
+
+  const binary = findRelayBinary();
+  if (!binary) {
+    console.error(`${engine}: lohost-relay not built (run native/build.sh)`);
+    return null;
+  }
+  const relay = new NativeRelay(
+    binary,
+    engine === "io_uring" || engine === "epoll" || engine === "sockmap" ? engine : "native"
+  );
+  const key = `${LISTEN_HOST}:${LISTEN_PORT}`;
+  relay.listen(key, "bench", [backend]);
+  const started = performance.now();
+  while (!relay.isListening(key)) {
+    if (performance.now() - started > 5000) throw new Error(`${engine}: relay did not listen`);
+    await new Promise((resolve) => setTimeout(resolve, 10));
+  }
+  return { pid: relay.pid!, stats: () => relay.stats(), stop: () => relay.stop() };
+}
+
+function spawnSelf(args: string[]): ChildProcess {
+  return spawn(process.execPath, [...process.execArgv, process.argv[1], ...args], {
+    stdio: ["ignore", "pipe", "inherit"],
+  });
+}
+
+function waitForLine(child: ChildProcess, line: string): Promise<void> {
+  return new Promise((resolve, reject) => {
+    child.stdout!.on("data", (data: Buffer) => {
+      if (data.toString().includes(line)) resolve();
+    });
+    child.on("exit", () => reject(new Error(`child exited before "${line}"`)));
+  });
+}
+
+function serveEcho(backend: string): void {
+  const server = createServer({ allowHalfOpen: true }, (socket) => {
+    socket.on("error", () => socket.destroy());
+    socket.pipe(socket);
+  });
+  const onListening = (): void => console.log("ready");
+  if (backend.startsWith("unix:")) {
+    const socketPath = backend.slice("unix:".length);
+    try {
+      unlinkSync(socketPath);
+    } catch {
+      // Ignore - not there yet
+    }
+    server.listen(socketPath, onListening);
+  } else {
+    server.listen(BACKEND_PORT, LISTEN_HOST, onListening);
+  }
+  process.on("SIGTERM", () => {
+    server.close();
+    process.exit(0);
+  });
+}
+
+/** The daemon's own forwarding path, as used without --relay */
+function serveNodeRelay(backend: string): void {
+  const server = createServer({ allowHalfOpen: true, noDelay: true }, (socket: Socket) => {
+    const upstream = backend.startsWith("unix:")
+      ? createConnection({ path: backend.slice("unix:".length), allowHalfOpen: true })
+      : createConnection({ host: LISTEN_HOST, port: BACKEND_PORT, allowHalfOpen: true, noDelay: true });
+    socket.pipe(upstream);
+    upstream.pipe(socket);
+    socket.on("error", () => upstream.destroy());
+    upstream.on("error", () => socket.destroy());
+  });
+  server.listen(LISTEN_PORT, LISTEN_HOST, () => console.log("ready"));
+}
+
+main();
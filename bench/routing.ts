@@ -0,0 +1,103 @@
+/**
+ * Routing rule benchmark
+ *
+ * Measures the cost of one uncached routing decision as the number of rules
+ * grows: host patterns through the compiled DFA and path prefixes through
+ * the radix trie, each next to the obvious linear scan (first matching
+ * RegExp / longest matching startsWith) for comparison. The daemon caches
+ * results per Host header, so these numbers are what a new host or every
+ * request's path lookup costs.
+ *
+ * Usage:
+ *   tsx bench/routing.ts [--iterations N] [--rules 10,100,1000]
+ */
+
+import { parseArgs } from "node:util";
+import { performance } from "node:perf_hooks";
+import { HostPatternSet, PrefixTrie, type HostPattern } from "../src/router.js";
+
+function main(): void {
+  const { values } = parseArgs({
+    options: {
+      iterations: { type: "string", default: "200000" },
+      rules: { type: "string", default: "10,100,1000" },
+    },
+    strict: true,
+  });
+  const iterations = Number(values.iterations);
+  const counts = values.rules.split(",").map(Number);
+
+  console.log(`${iterations} lookups per cell, ns per lookup\n`);
+  console.log(
+    "rules".padStart(6) +
+      "host DFA".padStart(12) + "host scan".padStart(12) +
+      "path trie".padStart(12) + "path scan".padStart(12)
+  );
+
+  for (const n of counts) {
+    // Branch-preview style patterns; hosts hit the last rule, a middle one, or none
+    const patterns: HostPattern[] = [];
+    for (let i = 0; i < n; i++) {
+      patterns.push(
+        i % 2 === 0
+          ? { pattern: `pr-*-web${i}`, service: `web${i}-$1` }
+          : { pattern: `*-api${i}`, service: `api${i}` }
+      );
+    }
+    const hosts = [`pr-1234-web${n - 2}`, `feature-api${(n >> 1) | 1}`, "nothing-matches-here"];
+    const set = new HostPatternSet(patterns);
+    const regexes = patterns.map((p) => ({
+      regex: new RegExp(`^${p.pattern.replace(/[.-]/g, "\\$&").replace(/\*/g, "([^.]*)")}$`),
+      service: p.service,
+    }));
+    const scanHost = (host: string): string | null => {
+      for (const { regex, service } of regexes) {
+        const m = regex.exec(host);
+        if (m) return service.replace(/\$(\d)/g, (_, k: string) => m[Number(k)] ?? "");
+      }
+      return null;
+    };
+    for (const host of hosts) {
+      if (set.match(host) !== scanHost(host)) throw new Error(`Mismatch for ${host}`);
+    }
+
+    // Per-service API prefixes on one host
+    const prefixes = Array.from({ length: n }, (_, i) => `/svc${i}/v1`);
+    const trie = new PrefixTrie<string>();
+    for (const prefix of prefixes) trie.insert(prefix, prefix);
+    const paths = [`/svc${n - 1}/v1/users/42?x=1`, `/svc${n >> 1}/v1`, "/static/app.js"];
+    const scanPath = (path: string): string | undefined => {
+      let best: string | undefined;
+      for (const prefix of prefixes) {
+        if (path.startsWith(prefix) && (path.length === prefix.length || path[prefix.length] === "/" ||
+            path[prefix.length] === "?") && (!best || prefix.length > best.length)) {
+          best = prefix;
+        }
+      }
+      return best;
+    };
+    for (const path of paths) {
+      if (trie.match(path) !== scanPath(path)) throw new Error(`Mismatch for ${path}`);
+    }
+
+    console.log(
+      String(n).padStart(6) +
+        time(iterations, hosts, (h) => set.match(h)).padStart(12) +
+        time(iterations, hosts, scanHost).padStart(12) +
+        time(iterations, paths, (p) => trie.match(p)).padStart(12) +
+        time(iterations, paths, scanPath).padStart(12)
+    );
+  }
+}
+
+/** Average ns per call of `fn` over `inputs`, after a warm-up pass. */
+function time(iterations: number, inputs: string[], fn: (input: string) => unknown): string {
+  let sink = 0;
+  for (let i = 0; i < 10_000; i++) sink ^= fn(inputs[i % inputs.length]) ? 1 : 0;
+  const start = performance.now();
+  for (let i = 0; i < iterations; i++) sink ^= fn(inputs[i % inputs.length]) ? 1 : 0;
+  const ns = ((performance.now() - start) * 1e6) / iterations;
+  return sink === 2 ? "" : ns.toFixed(0);
+}
+
+main();
@@ -0,0 +1,499 @@
+/**
+ * lohost benchmark suite
+ *
+ * Starts a daemon and a `lohost -n` client wrapping bench/backend.ts, then
+ * drives each scenario with the open-loop generator against every target:
+ *
+ *   direct   load generator → backend TCP port
+ *   relay    load generator → daemon → client UDS relay → backend
+ *   splice   as relay, with the service's `splice` option: connections are
+ *            routed by their first Host header and relayed unparsed
+ *
+ * Results (RPS, latency percentiles, CPU per request and RSS of every
+ * process on the path) are written as JSON so runs can be diffed. With
+ * `--transport shm` the client serves the backend through lohost-relay and
+ * shared memory (Linux); diff against a default run to compare the hop
+ * (small-get for latency, download-10mb and upload-1mb for throughput).
+ * With `--upstream h2c` the daemon speaks HTTP/2 to the backend, so
+ * keepalive-512 multiplexes its requests over one session instead of
+ * opening a backend connection per client connection.
+ *
+ * Usage:
+ *   tsx bench/run.ts [options]
+ *
+ * Options:
+ *   --scenario <name>   Run only this scenario (repeatable)
+ *   --target <name>     Run only this target (repeatable)
+ *   --duration <sec>    Measured seconds per run (default: 10)
+ *   --warmup <sec>      Unmeasured seconds before each run (default: 2)
+ *   --rate-scale <x>    Multiply every scenario's offered rate (default: 1)
+ *   --port <port>       Port for the benchmark daemon (default: 18080)
+ *   --transport <t>     Client transport, uds or shm (default: uds)
+ *   --upstream <p>      Daemon-to-backend protocol, http1 or h2c (default: http1)
+ *   --out <file>        Write JSON here instead of stdout
+ */
+
+import { spawn, type ChildProcess } from "node:child_process";
+import { mkdtempSync, readdirSync, readFileSync, rmSync, writeFileSync } from "node:fs";
+import { request } from "node:http";
+import { tmpdir, cpus, platform, arch } from "node:os";
+import { join } from "node:path";
+import { fileURLToPath } from "node:url";
+import { parseArgs } from "node:util";
+import { performance } from "node:perf_hooks";
+import { checkDaemonRunning, updateServiceOptions } from "../src/client.js";
+import { Histogram, type HistogramSummary } from "../src/histogram.js";
+import { runLoad, type LoadRequest } from "../src/loadgen.js";
+import { sampleProcess, type ProcessSample } from "../src/procstat.js";
+import { connectWebSocket, encodeFrame, FrameDecoder } from "./ws.js";
+
+const CLI = fileURLToPath(new URL("../src/index.ts", import.meta.url));
+const BACKEND = fileURLToPath(new URL("./backend.ts", import.meta.url));
+const SERVICE = "bench";
+
+interface Scenario {
+  name: string;
+  description: string;
+  /** Offered load: requests (or WebSocket messages) per second. */
+  rate: number;
+  connections: number;
+  request?: LoadRequest;
+  /** WebSocket message size; set for the echo scenario. */
+  messageSize?: number;
+}
+
+const UPLOAD_BODY = Buffer.alloc(1024 * 1024, "u");
+
+const SCENARIOS: Scenario[] = [
+  {
+    name: "small-get",
+    description: "13-byte GET over a few keep-alive connections",
+    rate: 2000,
+    connections: 16,
+    request: { method: "GET", path: "/small" },
+  },
+  {
+    name: "download-10mb",
+    description: "10 MB GET responses",
+    rate: 10,
+    connections: 8,
+    request: { method: "GET", path: `/bytes/${10 * 1024 * 1024}` },
+  },
+  {
+    name: "upload-1mb",
+    description: "1 MB POST bodies",
+    rate: 50,
+    connections: 8,
+    request: { method: "POST", path: "/upload", body: UPLOAD_BODY },
+  },
+  {
+    name: "keepalive-512",
+    description: "small GETs spread over 512 keep-alive connections",
+    rate: 4000,
+    connections: 512,
+    request: { method: "GET", path: "/small" },
+  },
+  {
+    name: "websocket-echo",
+    description: "128-byte messages echoed over 64 WebSockets",
+    rate: 2000,
+    connections: 64,
+    messageSize: 128,
+  },
+];
+
+interface Target {
+  name: string;
+  port: number;
+  hostHeader: string;
+  /** Value of the service's `splice` option for daemon targets. */
+  splice?: boolean;
+}
+
+interface Processes {
+  daemon: ChildProcess;
+  client: ChildProcess;
+  backendPid: number;
+  /** The client's lohost-relay, with --transport shm. */
+  nativeRelayPid: number | null;
+}
+
+interface RunResult {
+  scenario: string;
+  target: string;
+  offeredRate: number;
+  connections: number;
+  rps: number;
+  completed: number;
+  errors: number;
+  timeouts: number;
+  statuses: Record<number, number>;
+  throughputMBps: number;
+  latencyMs: HistogramSummary;
+  cpuUsPerRequest: Record<string, number | null>;
+  rssBytes: Record<string, number | null>;
+}
+
+async function main(): Promise<void> {
+  const { values } = parseArgs({
+    options: {
+      scenario: { type: "string", multiple: true },
+      target: { type: "string", multiple: true },
+      duration: { type: "string", default: "10" },
+      warmup: { type: "string", default: "2" },
+      "rate-scale": { type: "string", default: "1" },
+      port: { type: "string", default: "18080" },
+      transport: { type: "string", default: "uds" },
+      upstream: { type: "string", default: "http1" },
+      out: { type: "string" },
+    },
+    strict: true,
+  });
+
+  const duration = Number(values.duration) * 1000;
+  const warmup = Number(values.warmup) * 1000;
+  const rateScale = Number(values["rate-scale"]);
+  const daemonPort = Number(values.port);
+
+  const scenarios = SCENARIOS.filter(
+    (s) => !values.scenario || values.scenario.includes(s.name)
+  );
+  if (scenarios.length === 0) {
+    throw new Error(`Unknown scenario; choose from ${SCENARIOS.map((s) => s.name).join(", ")}`);
+  }
+
+  const socketDir = mkdtempSync(join(tmpdir(), "lohost-bench-"));
+  const procs = await startStack(daemonPort, socketDir, values.transport!, values.upstream!);
+
+  try {
+    const backendPort = await lookupPort(daemonPort);
+    const targets: Target[] = [
+      { name: "direct", port: backendPort, hostHeader: `${SERVICE}.localhost:${backendPort}` },
+      { name: "relay", port: daemonPort, hostHeader: `${SERVICE}.localhost:${daemonPort}`, splice: false },
+      { name: "splice", port: daemonPort, hostHeader: `${SERVICE}.localhost:${daemonPort}`, splice: true },
+    ].filter((t) => !values.target || values.target.includes(t.name));
+
+    const results: RunResult[] = [];
+    for (const scenario of scenarios) {
+      for (const target of targets) {
+        const scaled = { ...scenario, rate: Math.max(1, Math.round(scenario.rate * rateScale)) };
+        console.error(`bench: ${scenario.name} via ${target.name} @ ${scaled.rate}/s`);
+        if (target.splice !== undefined) {
+          await updateServiceOptions(SERVICE, { splice: target.splice }, daemonPort);
+        }
+        if (warmup > 0) await runScenario(scaled, target, warmup);
+        const result = await measure(scaled, target, duration, procs);
+        printRow(result);
+        results.push(result);
+      }
+    }
+
+    const report = JSON.stringify(
+      {
+        startedAt: new Date().toISOString(),
+        node: process.version,
+        platform: `${platform()}-${arch()}`,
+        transport: values.transport,
+        upstream: values.upstream,
+        cpus: cpus().length,
+        durationSec: duration / 1000,
+        results,
+      },
+      null,
+      2
+    );
+    if (values.out) {
+      writeFileSync(values.out, report + "\n");
+      console.error(`bench: wrote ${values.out}`);
+    } else {
+      console.log(report);
+    }
+  } finally {
+    await stopStack(procs);
+    rmSync(socketDir, { recursive: true, force: true });
+  }
+}
+
+/** Re-run the CLI with the same loader flags (tsx) this process was started with. */
+function spawnCli(args: string[], stdio: "ignore" | "pipe"): ChildProcess {
+  return spawn(process.execPath, [...process.execArgv, CLI, ...args], {
+    stdio: ["ignore", stdio, "ignore"],
+  });
+}
+
+async function startStack(
+  daemonPort: number,
+  socketDir: string,
+  transport: string,
+  upstream: string
+): Promise<Processes> {
+  if (await checkDaemonRunning(daemonPort)) {
+    throw new Error(`Port ${daemonPort} already has a daemon; pass --port`);
+  }
+
+  const daemon = spawnCli(["daemon", "-p", String(daemonPort)], "ignore");
+  for (let i = 0; i < 50 && !(await checkDaemonRunning(daemonPort)); i++) {
+    await sleep(100);
+  }
+
+  const client = spawnCli(
+    [
+      "-n", SERVICE,
+      "-d", socketDir,
+      "-p", String(daemonPort),
+      "--transport", transport,
+      "-o", `upstream=${upstream}`,
+      "--", process.execPath, ...process.execArgv, BACKEND,
+    ],
+    "pipe"
+  );
+
+  // The backend announces its pid on stdout once it is listening.
+  const backendPid = await new Promise<number>((resolve, reject) => {
+    let out = "";
+    const timer = setTimeout(() => reject(new Error("Backend did not start")), 10_000);
+    client.stdout?.on("data", (chunk: Buffer) => {
+      out += chunk;
+      const match = out.match(/bench-backend pid=(\d+)/);
+      if (match) {
+        clearTimeout(timer);
+        client.stdout?.resume();
+        resolve(Number(match[1]));
+      }
+    });
+    client.on("exit", () => reject(new Error("lohost client exited during startup")));
+  });
+
+  const nativeRelayPid = transport === "shm" ? findChild(client.pid!, "lohost-relay") : null;
+  if (transport === "shm" && nativeRelayPid === null) {
+    console.error("bench: no lohost-relay under the client; it fell back to the socket proxy");
+  }
+  return { daemon, client, backendPid, nativeRelayPid };
+}
+
+/** A direct child of `pid` running `command` (Linux /proc). */
+function findChild(pid: number, command: string): number | null {
+  try {
+    for (const tid of readdirSync(`/proc/${pid}/task`)) {
+      const children = readFileSync(`/proc/${pid}/task/${tid}/children`, "utf8").trim().split(" ");
+      for (const child of children) {
+        if (child && readFileSync(`/proc/${child}/comm`, "utf8").trim() === command) return Number(child);
+      }
+    }
+  } catch {
+    // Not Linux, or the client is gone
+  }
+  return null;
+}
+
+async function stopStack(procs: Processes): Promise<void> {
+  const exited = (child: ChildProcess) =>
+    child.exitCode !== null || child.signalCode !== null
+      ? Promise.resolve()
+      : new Promise<void>((resolve) => child.once("exit", () => resolve()));
+
+  procs.client.kill("SIGTERM");
+  await Promise.race([exited(procs.client), sleep(3000)]);
+  procs.daemon.kill("SIGTERM");
+  await Promise.race([exited(procs.daemon), sleep(3000)]);
+}
+
+function lookupPort(daemonPort: number): Promise<number> {
+  return new Promise((resolve, reject) => {
+    const req = request(
+      `http://localhost:${daemonPort}/_lohost/services/${SERVICE}`,
+      (res) => {
+        let body = "";
+        res.on("data", (chunk) => (body += chunk));
+        res.on("end", () => {
+          try {
+            resolve(JSON.parse(body).port);
+          } catch {
+            reject(new Error(`Service ${SERVICE} not registered`));
+          }
+        });
+      }
+    );
+    req.on("error", reject);
+    req.end();
+  });
+}
+
+interface ScenarioOutcome {
+  latency: Histogram;
+  completed: number;
+  errors: number;
+  timeouts: number;
+  statuses: Record<number, number>;
+  bytes: number;
+  elapsedMs: number;
+}
+
+async function runScenario(
+  scenario: Scenario,
+  target: Target,
+  duration: number
+): Promise<ScenarioOutcome> {
+  if (scenario.messageSize !== undefined) {
+    return runWebSocketEcho(scenario, target, duration);
+  }
+  const result = await runLoad({
+    host: "127.0.0.1",
+    port: target.port,
+    hostHeader: target.hostHeader,
+    request: scenario.request!,
+    rate: scenario.rate,
+    duration,
+    connections: scenario.connections,
+  });
+  return {
+    latency: result.latency,
+    completed: result.completed,
+    errors: result.errors,
+    timeouts: result.timeouts,
+    statuses: result.statuses,
+    bytes: result.bytesReceived,
+    elapsedMs: result.elapsedMs,
+  };
+}
+
+/**
+ * Open-loop WebSocket echo: messages are scheduled at a fixed total rate,
+ * round-robin across sockets, and timed from their intended send time.
+ */
+async function runWebSocketEcho(
+  scenario: Scenario,
+  target: Target,
+  duration: number
+): Promise<ScenarioOutcome> {
+  const latency = new Histogram();
+  const intended = new Map<number, number>();
+  let completed = 0;
+  let errors = 0;
+  let bytes = 0;
+
+  const sockets = await Promise.all(
+    Array.from({ length: scenario.connections }, async () => {
+      const { socket, head } = await connectWebSocket(
+        "127.0.0.1", target.port, target.hostHeader, "/ws"
+      );
+      const decoder = new FrameDecoder(({ opcode, payload }) => {
+        if (opcode !== 0x2) return;
+        const seq = payload.readUInt32BE(0);
+        const sentAt = intended.get(seq);
+        if (sentAt === undefined) return;
+        intended.delete(seq);
+        latency.record((performance.now() - sentAt) * 1000);
+        bytes += payload.length;
+        completed++;
+      });
+      if (head.length > 0) decoder.push(head);
+      socket.on("data", (chunk: Buffer) => decoder.push(chunk));
+      socket.on("error", () => errors++);
+      return socket;
+    })
+  );
+
+  const payload = Buffer.alloc(scenario.messageSize!, "m");
+  const interval = 1000 / scenario.rate;
+  const start = performance.now();
+  let seq = 0;
+
+  await new Promise<void>((resolve) => {
+    const tick = () => {
+      const elapsed = performance.now() - start;
+      while (seq * interval <= elapsed && seq * interval < duration) {
+        payload.writeUInt32BE(seq, 0);
+        intended.set(seq, start + seq * interval);
+        sockets[seq % sockets.length].write(encodeFrame(0x2, payload, true));
+        seq++;
+      }
+      if (seq * interval >= duration) {
+        resolve();
+        return;
+      }
+      setTimeout(tick, Math.max(0, start + seq * interval - performance.now()));
+    };
+    tick();
+  });
+
+  for (let i = 0; i < 100 && intended.size > 0; i++) await sleep(50);
+  const timeouts = intended.size;
+  const elapsedMs = performance.now() - start;
+  for (const socket of sockets) socket.end(encodeFrame(0x8, Buffer.alloc(0), true));
+
+  return { latency, completed, errors, timeouts, statuses: {}, bytes, elapsedMs };
+}
+
+async function measure(
+  scenario: Scenario,
+  target: Target,
+  duration: number,
+  procs: Processes
+): Promise<RunResult> {
+  const pids: Record<string, number | undefined> = {
+    daemon: procs.daemon.pid,
+    relay: procs.client.pid,
+    backend: procs.backendPid,
+  };
+  if (procs.nativeRelayPid !== null) pids["native-relay"] = procs.nativeRelayPid;
+  const sampleAll = async () => {
+    const samples: Record<string, ProcessSample | null> = {};
+    for (const [role, pid] of Object.entries(pids)) {
+      samples[role] = pid ? await sampleProcess(pid) : null;
+    }
+    return samples;
+  };
+
+  const before = await sampleAll();
+  const outcome = await runScenario(scenario, target, duration);
+  const after = await sampleAll();
+
+  const cpuUsPerRequest: Record<string, number | null> = {};
+  const rssBytes: Record<string, number | null> = {};
+  for (const role of Object.keys(pids)) {
+    const a = before[role];
+    const b = after[role];
+    cpuUsPerRequest[role] =
+      a && b && outcome.completed > 0
+        ? Math.round(((b.cpuMs - a.cpuMs) * 1000) / outcome.completed)
+        : null;
+    rssBytes[role] = b ? b.rssBytes : null;
+  }
+
+  const seconds = outcome.elapsedMs / 1000;
+  return {
+    scenario: scenario.name,
+    target: target.name,
+    offeredRate: scenario.rate,
+    connections: scenario.connections,
+    rps: Math.round(outcome.completed / seconds),
+    completed: outcome.completed,
+    errors: outcome.errors,
+    timeouts: outcome.timeouts,
+    statuses: outcome.statuses,
+    throughputMBps: Math.round((outcome.bytes / seconds / 1e6) * 100) / 100,
+    latencyMs: outcome.latency.summary(),
+    cpuUsPerRequest,
+    rssBytes,
+  };
+}
+
+function printRow(r: RunResult): void {
+  const cpu = Object.entries(r.cpuUsPerRequest)
+    .map(([role, us]) => `${role}=${us ?? "-"}µs`)
+    .join(" ");
+  console.error(
+    `  ${r.rps} rps  p50=${r.latencyMs.p50}ms p99=${r.latencyMs.p99}ms ` +
+      `p999=${r.latencyMs.p999}ms  errors=${r.errors + r.timeouts}  cpu/req ${cpu}`
+  );
+}
+
+function sleep(ms: number): Promise<void> {
+  return new Promise((resolve) => setTimeout(resolve, ms));
+}
+
+main().catch((err) => {
+  console.error("bench error:", err.message);
+  process.exit(1);
+});
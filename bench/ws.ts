@@ -0,0 +1,121 @@
+/**
+ * Minimal RFC 6455 helpers for the WebSocket echo scenario.
+ *
+ * Only what the benchmark needs: the handshake, unfragmented binary frames
+ * and close. Not a general-purpose WebSocket implementation.
+ */
+
+import { createHash, randomBytes } from "node:crypto";
+import { request, type IncomingMessage } from "node:http";
+import type { Socket } from "node:net";
+
+const GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+export function acceptKey(key: string): string {
+  return createHash("sha1").update(key + GUID).digest("base64");
+}
+
+/** Encode a single FIN frame; client frames must be masked. */
+export function encodeFrame(opcode: number, payload: Buffer, mask: boolean): Buffer {
+  const len = payload.length;
+  const lenBytes = len < 126 ? 0 : len < 65536 ? 2 : 8;
+  const header = Buffer.alloc(2 + lenBytes + (mask ? 4 : 0));
+  header[0] = 0x80 | opcode;
+  header[1] = (mask ? 0x80 : 0) | (lenBytes === 0 ? len : lenBytes === 2 ? 126 : 127);
+  if (lenBytes === 2) header.writeUInt16BE(len, 2);
+  if (lenBytes === 8) header.writeBigUInt64BE(BigInt(len), 2);
+  if (!mask) return Buffer.concat([header, payload]);
+
+  const key = randomBytes(4);
+  key.copy(header, 2 + lenBytes);
+  const masked = Buffer.allocUnsafe(len);
+  for (let i = 0; i < len; i++) masked[i] = payload[i] ^ key[i & 3];
+  return Buffer.concat([header, masked]);
+}
+
+export interface Frame {
+  opcode: number;
+  payload: Buffer;
+}
+
+/**
+ * Incremental frame decoder. Feed it raw socket chunks; it invokes
+ * `onFrame` for every complete frame, unmasking as needed.
+ */
+export class FrameDecoder {
+  private buffer = Buffer.alloc(0);
+  private onFrame: (frame: Frame) => void;
+
+  constructor(onFrame: (frame: Frame) => void) {
+    this.onFrame = onFrame;
+  }
+
+  push(chunk: Buffer): void {
+    this.buffer = this.buffer.length === 0 ? chunk : Buffer.concat([this.buffer, chunk]);
+    for (;;) {
+      const buf = this.buffer;
+      if (buf.length < 2) return;
+      const masked = (buf[1] & 0x80) !== 0;
+      let len = buf[1] & 0x7f;
+      let offset = 2;
+      if (len === 126) {
+        if (buf.length < 4) return;
+        len = buf.readUInt16BE(2);
+        offset = 4;
+      } else if (len === 127) {
+        if (buf.length < 10) return;
+        len = Number(buf.readBigUInt64BE(2));
+        offset = 10;
+      }
+      const maskOffset = offset;
+      if (masked) offset += 4;
+      if (buf.length < offset + len) return;
+
+      const payload = Buffer.from(buf.subarray(offset, offset + len));
+      if (masked) {
+        for (let i = 0; i < len; i++) payload[i] ^= buf[maskOffset + (i & 3)];
+      }
+      this.buffer = buf.subarray(offset + len);
+      this.onFrame({ opcode: buf[0] & 0x0f, payload });
+    }
+  }
+}
+
+/** Open a client WebSocket; resolves with the raw upgraded socket. */
+export function connectWebSocket(
+  host: string,
+  port: number,
+  hostHeader: string,
+  path: string
+): Promise<{ socket: Socket; head: Buffer }> {
+  return new Promise((resolve, reject) => {
+    const key = randomBytes(16).toString("base64");
+    const req = request({
+      host,
+      port,
+      path,
+      headers: {
+        host: hostHeader,
+        connection: "Upgrade",
+        upgrade: "websocket",
+        "sec-websocket-version": "13",
+        "sec-websocket-key": key,
+      },
+    });
+    req.on("upgrade", (res: IncomingMessage, socket: Socket, head: Buffer) => {
+      if (res.headers["sec-websocket-accept"] !== acceptKey(key)) {
+        socket.destroy();
+        reject(new Error("Invalid Sec-WebSocket-Accept"));
+        return;
+      }
+      socket.setNoDelay(true);
+      resolve({ socket, head });
+    });
+    req.on("response", (res) => {
+      res.resume();
+      reject(new Error(`WebSocket upgrade refused: ${res.statusCode}`));
+    });
+    req.on("error", reject);
+    req.end();
+  });
+}
@@ -24,6 +24,13 @@
         libExt = if isDarwin then "dylib" else "so";
         libName = "liblohost_dns.${libExt}";
 
+        # Native TCP relay for `daemon --relay native` and the shared-memory
+        # transport's addon (Linux only)
+        relayEnv = pkgs.lib.optionalString (!isDarwin) ''
+          export LOHOST_RELAY_BIN="${lohost-dns}/bin/lohost-relay"
+          export LOHOST_SHM_ADDON="${lohost-dns}/lib/lohost_shm.node"
+        '';
+
         version = "0.0.1";
 
         # Native DNS interposition library (build from source - fast C compile)
@@ -36,11 +43,17 @@
             $CC -dynamiclib -o ${libName} darwin/lohost_dns.c
           '' else ''
             $CC -shared -fPIC -o ${libName} linux/lohost_dns.c -ldl
+            $CC -O2 -o lohost-relay linux/lohost_relay.c
+            $CC -shared -fPIC -O2 -I${pkgs.nodejs_22}/include/node -o lohost_shm.node linux/lohost_shm.c
           '';
 
           installPhase = ''
             mkdir -p $out/lib
             cp ${libName} $out/lib/
+          '' + pkgs.lib.optionalString (!isDarwin) ''
+            mkdir -p $out/bin
+            cp lohost-relay $out/bin/
+            cp lohost_shm.node $out/lib/
           '';
         };
 
@@ -90,6 +103,7 @@
 #!/bin/sh
 export LOHOST_NATIVE_LIB="${lohost-dns}/lib/${libName}"
 export ${preloadVar}="\$LOHOST_NATIVE_LIB"
+${relayEnv}
 exec $out/bin/.lohost-unwrapped "\$@"
 EOF
             chmod +x $out/bin/lohost
@@ -128,6 +142,7 @@ EOF
 #!/bin/sh
 export LOHOST_NATIVE_LIB="${lohost-dns}/lib/${libName}"
 export ${preloadVar}="\$LOHOST_NATIVE_LIB"
+${relayEnv}
 exec $out/bin/.lohost-unwrapped "\$@"
 EOF
             chmod +x $out/bin/lohost
@@ -1,5 +1,6 @@
 #!/bin/bash
-# Build native DNS interposition libraries for lohost
+# Build native DNS interposition libraries (and, on Linux, the TCP relay
+# and the daemon's shared-memory addon) for lohost
 #
 # Usage:
 #   ./build.sh              # Build for current platform
@@ -26,22 +27,41 @@ build_darwin() {
     echo "Built: liblohost_dns.dylib (darwin-$arch)"
 }
 
+# Node-API headers for the addon: NODE_INCLUDE, else those of the node on PATH
+node_include() {
+    if [ -n "$NODE_INCLUDE" ]; then
+        echo "$NODE_INCLUDE"
+    elif command -v node >/dev/null; then
+        node -p 'require("path").resolve(process.execPath, "../../include/node")'
+    fi
+}
+
 build_linux() {
     local arch="$1"
+    local cc=gcc
     echo "Building for linux-$arch..."
 
     if [ "$arch" = "arm64" ] && [ "$(uname -m)" != "aarch64" ]; then
         # Cross-compile for ARM64
-        aarch64-linux-gnu-gcc -shared -fPIC \
-            -o "liblohost_dns.so" \
-            linux/lohost_dns.c -ldl
-    else
-        gcc -shared -fPIC \
-            -o "liblohost_dns.so" \
-            linux/lohost_dns.c -ldl
+        cc=aarch64-linux-gnu-gcc
     fi
+    $cc -shared -fPIC \
+        -o "liblohost_dns.so" \
+        linux/lohost_dns.c -ldl
+    $cc -O2 \
+        -o "lohost-relay" \
+        linux/lohost_relay.c
 
-    echo "Built: liblohost_dns.so (linux-$arch)"
+    local include
+    include="$(node_include)"
+    if [ -f "$include/node_api.h" ]; then
+        $cc -shared -fPIC -O2 -I"$include" \
+            -o "lohost_shm.node" \
+            linux/lohost_shm.c
+        echo "Built: liblohost_dns.so, lohost-relay, lohost_shm.node (linux-$arch)"
+    else
+        echo "Built: liblohost_dns.so, lohost-relay (linux-$arch; no Node headers for lohost_shm.node)"
+    fi
 }
 
 build_darwin_universal() {
@@ -9,6 +9,7 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <string.h>
+#include <strings.h>
 #include <arpa/inet.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -35,9 +36,40 @@ static int is_localhost_domain(const char *hostname) {
     return 0;
 }
 
+/*
+ * Find the loopback address the daemon assigned to a *.localhost name in the
+ * hosts file named by LOHOST_HOSTS ("<address> <name>" per line). As in the
+ * daemon's routing, the longest service name that is a label-aligned suffix
+ * wins, so tenant.db.localhost resolves like db.localhost. Anything else
+ * gets 127.0.0.1, which the daemon's HTTP port also listens on.
+ */
+static void service_address(const char *hostname, char *out, size_t outlen) {
+    snprintf(out, outlen, "127.0.0.1");
+    const char *path = getenv("LOHOST_HOSTS");
+    if (!path) return;
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+
+    size_t host_len = strlen(hostname) - 10;
+    size_t best = 0;
+    char line[512], addr[64], name[256];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || sscanf(line, "%63s %255s", addr, name) != 2) continue;
+        size_t len = strlen(name);
+        if (len > host_len || len <= best) continue;
+        const char *tail = hostname + host_len - len;
+        if (strncasecmp(tail, name, len) != 0) continue;
+        if (tail != hostname && tail[-1] != '.') continue;
+        best = len;
+        snprintf(out, outlen, "%s", addr);
+    }
+    fclose(f);
+}
+
 // ============ Synchronous getaddrinfo hook ============
 
-static struct addrinfo* make_localhost_result(const char *service,
+static struct addrinfo* make_localhost_result(const char *address,
+                                               const char *service,
                                                const struct addrinfo *hints) {
     struct addrinfo *ai = calloc(1, sizeof(struct addrinfo));
     if (!ai) return NULL;
@@ -47,7 +79,7 @@ static struct addrinfo* make_localhost_result(const char *service,
 
     sa->sin_len = sizeof(struct sockaddr_in);
     sa->sin_family = AF_INET;
-    inet_pton(AF_INET, "127.0.0.1", &sa->sin_addr);
+    inet_pton(AF_INET, address, &sa->sin_addr);
     if (service) {
         int port = atoi(service);
         sa->sin_port = htons(port > 0 ? port : 0);
@@ -71,13 +103,15 @@ int hooked_getaddrinfo(const char *node, const char *service,
                        const struct addrinfo *hints,
                        struct addrinfo **res) {
     if (is_localhost_domain(node)) {
-        debug_log("getaddrinfo: intercepted %s -> 127.0.0.1", node);
+        char address[64];
+        service_address(node, address, sizeof(address));
+        debug_log("getaddrinfo: intercepted %s -> %s", node, address);
 
         if (hints && hints->ai_family == AF_INET6) {
             goto fallthrough;
         }
 
-        struct addrinfo *result = make_localhost_result(service, hints);
+        struct addrinfo *result = make_localhost_result(address, service, hints);
         if (result) {
             *res = result;
             return 0;
@@ -116,10 +150,12 @@ static int32_t hooked_getaddrinfo_async_start(
     debug_log("getaddrinfo_async_start: node=%s", node ? node : "(null)");
 
     if (is_localhost_domain(node)) {
-        debug_log("getaddrinfo_async_start: intercepted %s -> 127.0.0.1", node);
+        char address[64];
+        service_address(node, address, sizeof(address));
+        debug_log("getaddrinfo_async_start: intercepted %s -> %s", node, address);
 
         // Create synthetic result
-        struct addrinfo *result = make_localhost_result(service, hints);
+        struct addrinfo *result = make_localhost_result(address, service, hints);
         if (result) {
             // Call callback immediately with success
             if (callback) {
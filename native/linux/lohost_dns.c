@@ -1,7 +1,8 @@
 /**
  * lohost_dns.c - DNS interposition for Linux (LD_PRELOAD)
  *
- * Hooks getaddrinfo to resolve *.localhost to 127.0.0.1.
+ * Hooks getaddrinfo to resolve *.localhost to the service's loopback address
+ * (see service_address), or 127.0.0.1.
  * Simpler than macOS version - no async API or dlsym hook needed.
  *
  * Compile: gcc -shared -fPIC -o liblohost_dns.so lohost_dns.c -ldl
@@ -12,6 +13,7 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <string.h>
+#include <strings.h>
 #include <arpa/inet.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -41,7 +43,38 @@ static int is_localhost_domain(const char *hostname) {
     return 0;
 }
 
-static struct addrinfo* make_localhost_result(const char *service,
+/*
+ * Find the loopback address the daemon assigned to a *.localhost name in the
+ * hosts file named by LOHOST_HOSTS ("<address> <name>" per line). As in the
+ * daemon's routing, the longest service name that is a label-aligned suffix
+ * wins, so tenant.db.localhost resolves like db.localhost. Anything else
+ * gets 127.0.0.1, which the daemon's HTTP port also listens on.
+ */
+static void service_address(const char *hostname, char *out, size_t outlen) {
+    snprintf(out, outlen, "127.0.0.1");
+    const char *path = getenv("LOHOST_HOSTS");
+    if (!path) return;
+    FILE *f = fopen(path, "r");
+    if (!f) return;
+
+    size_t host_len = strlen(hostname) - 10;
+    size_t best = 0;
+    char line[512], addr[64], name[256];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || sscanf(line, "%63s %255s", addr, name) != 2) continue;
+        size_t len = strlen(name);
+        if (len > host_len || len <= best) continue;
+        const char *tail = hostname + host_len - len;
+        if (strncasecmp(tail, name, len) != 0) continue;
+        if (tail != hostname && tail[-1] != '.') continue;
+        best = len;
+        snprintf(out, outlen, "%s", addr);
+    }
+    fclose(f);
+}
+
+static struct addrinfo* make_localhost_result(const char *address,
+                                               const char *service,
                                                const struct addrinfo *hints) {
     struct addrinfo *ai = calloc(1, sizeof(struct addrinfo));
     if (!ai) return NULL;
@@ -50,7 +83,7 @@ static struct addrinfo* make_localhost_result(const char *service,
     if (!sa) { free(ai); return NULL; }
 
     sa->sin_family = AF_INET;
-    inet_pton(AF_INET, "127.0.0.1", &sa->sin_addr);
+    inet_pton(AF_INET, address, &sa->sin_addr);
     if (service) {
         int port = atoi(service);
         sa->sin_port = htons(port > 0 ? port : 0);
@@ -81,13 +114,15 @@ int getaddrinfo(const char *node, const char *service,
     }
 
     if (is_localhost_domain(node)) {
-        debug_log("getaddrinfo: intercepted %s -> 127.0.0.1", node);
+        char address[64];
+        service_address(node, address, sizeof(address));
+        debug_log("getaddrinfo: intercepted %s -> %s", node, address);
 
         if (hints && hints->ai_family == AF_INET6) {
             goto fallthrough;
         }
 
-        struct addrinfo *result = make_localhost_result(service, hints);
+        struct addrinfo *result = make_localhost_result(address, service, hints);
         if (result) {
             *res = result;
             return 0;
@@ -0,0 +1,1926 @@
+/**
+ * lohost_relay.c - Native TCP relay for lohostd (Linux)
+ *
+ * Serves the daemon's tcp-ports listeners outside its JavaScript event loop,
+ * and a client's Unix socket under `lohost --transport shm`. The parent
+ * drives it over stdin, one command per line:
+ *
+ *   listen <listener> <backend>...   Listen, or replace the backends
+ *   shm unix:<path> <backend>...     Offer shared-memory regions (epoll only)
+ *   close <listener>                 Stop listening
+ *   stats                            Print counters
+ *
+ * A listener is <address>:<port> or unix:<path>; a backend is either of
+ * those too. New connections go to the backends round-robin, trying the
+ * next one when a connect is refused. Replies go to stdout ("listening
+ * <id>", "failed <id>", "stats ..."), diagnostics to stderr.
+ *
+ * A connection to an "shm" listener gets a region shared with the daemon
+ * (see lohost_shm.h); each channel the daemon opens in it becomes one
+ * connection to a backend.
+ *
+ * Two engines do the forwarding:
+ *
+ *   io_uring  Multishot accept straight into the fixed-file table, socket,
+ *             connect, send and shutdown on fixed files, and multishot recv
+ *             into a registered provided-buffer ring. A busy relay makes one
+ *             io_uring_enter per batch of completions.
+ *   epoll     Edge-triggered epoll, with splice() through a pipe per
+ *             direction so bytes never enter user space.
+ *   sockmap   The epoll engine, plus a BPF sk_skb program that redirects
+ *             each established pair's payload from one socket to the other
+ *             inside the kernel. The relay only sets pairs up, tears them
+ *             down and passes end-of-stream on. Needs CAP_BPF and
+ *             CAP_NET_ADMIN (or root).
+ *
+ * "auto" picks io_uring when the kernel has everything above (6.0+) and
+ * falls back to epoll otherwise, including when io_uring is disabled by
+ * sysctl or a seccomp filter. "sockmap" falls back to "auto" when BPF is
+ * not permitted.
+ *
+ * Compile: gcc -O2 -o lohost-relay lohost_relay.c
+ * Usage: lohost-relay [--engine auto|io_uring|epoll|sockmap]
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/bpf.h>
+#include <linux/tcp.h>
+#include <linux/io_uring.h>
+#include <linux/sockios.h>
+
+#include "lohost_shm.h"
+
+#define MAX_BACKENDS 16
+#define MAX_ARGS (2 + MAX_BACKENDS)
+#define LINE_MAX_BYTES 8192
+
+/* Data-path counters, reported by "stats" */
+static unsigned long long stat_syscalls, stat_bytes, stat_accepted, stat_active;
+/* Bytes the sockmap engine moved without the relay touching them */
+static unsigned long long stat_redirected;
+
+#define SYS(call) (stat_syscalls++, (call))
+
+static void log_error(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    fprintf(stderr, "[lohost-relay] ");
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+}
+
+static void reply(const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    putchar('\n');
+    fflush(stdout);
+}
+
+// ============ Listeners and backends ============
+
+struct backend {
+    struct sockaddr_storage addr;
+    socklen_t len;
+};
+
+struct listener {
+    char id[128];
+    int fd;
+    int closing;
+    int shm;                        /* a setup socket for shared-memory regions */
+    unsigned refs;                  /* epoll connections and regions still using the backends */
+    struct backend backends[MAX_BACKENDS];
+    int nbackends;
+    unsigned next;
+    struct listener *next_listener;
+} __attribute__((aligned(16)));
+
+static struct listener *listeners;
+
+struct engine {
+    const char *name;
+    int (*add_listener)(struct listener *l);
+    /* Stop accepting; the engine closes the socket and frees `l` */
+    void (*remove_listener)(struct listener *l);
+    void (*run)(void);
+};
+
+static const struct engine *engine;
+
+static void *alloc_zeroed(size_t size) {
+    void *p = aligned_alloc(16, (size + 15) & ~(size_t)15);
+    if (p) memset(p, 0, size);
+    return p;
+}
+
+/* "host:port" or "[v6]:port" to a socket address */
+static int resolve_host_port(const char *spec, struct sockaddr_storage *addr, socklen_t *len) {
+    const char *colon = strrchr(spec, ':');
+    if (!colon || colon == spec) return -1;
+    char host[256];
+    size_t host_len = colon - spec;
+    if (host_len >= sizeof(host)) return -1;
+    memcpy(host, spec, host_len);
+    host[host_len] = 0;
+    char *h = host;
+    if (h[0] == '[' && host_len > 1 && h[host_len - 1] == ']') {
+        h[host_len - 1] = 0;
+        h++;
+    }
+
+    struct addrinfo hints = {0}, *res;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    if (getaddrinfo(h, colon + 1, &hints, &res) != 0) return -1;
+    memcpy(addr, res->ai_addr, res->ai_addrlen);
+    *len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+static int parse_backend(const char *spec, struct backend *b) {
+    memset(b, 0, sizeof(*b));
+    if (strncmp(spec, "unix:", 5) == 0) {
+        struct sockaddr_un *sun = (struct sockaddr_un *)&b->addr;
+        if (strlen(spec + 5) >= sizeof(sun->sun_path)) return -1;
+        sun->sun_family = AF_UNIX;
+        strcpy(sun->sun_path, spec + 5);
+        b->len = sizeof(*sun);
+        return 0;
+    }
+    return resolve_host_port(spec, &b->addr, &b->len);
+}
+
+/* The id is an address like a backend's, "unix:<path>" included */
+static int open_listener(const char *id) {
+    struct backend local;
+    if (parse_backend(id, &local) < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    int unix_socket = local.addr.ss_family == AF_UNIX;
+    /* A socket file left behind by a previous run would fail the bind */
+    if (unix_socket) unlink(((struct sockaddr_un *)&local.addr)->sun_path);
+    int fd = socket(local.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    /* Accepted sockets inherit it, including those accepted by io_uring */
+    if (!unix_socket) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr *)&local.addr, local.len) < 0 || listen(fd, SOMAXCONN) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+static struct backend *pick_backend(struct listener *l) {
+    return &l->backends[l->next++ % l->nbackends];
+}
+
+/* The next backend for a connection's attempt `*tried`, each tried once from a round-robin start */
+static struct backend *next_backend(struct listener *l, unsigned *first, int *tried) {
+    if (*tried >= l->nbackends) return NULL;
+    if ((*tried)++ == 0) *first = l->next++;
+    return &l->backends[(*first + *tried - 1) % l->nbackends];
+}
+
+/* A non-blocking socket connecting to `b`; `*connected` says whether it already is */
+static int connect_backend(const struct backend *b, int *connected) {
+    int fd = SYS(socket(b->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+    if (fd < 0) return -1;
+    if (b->addr.ss_family != AF_UNIX) {
+        int one = 1;
+        SYS(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)));
+    }
+    int r = SYS(connect(fd, (struct sockaddr *)&b->addr, b->len));
+    if (r < 0 && errno != EINPROGRESS) {
+        int err = errno;
+        SYS(close(fd));
+        errno = err;
+        return -1;
+    }
+    *connected = r == 0;
+    return fd;
+}
+
+/*
+ * Drop a connection's hold on a listener's backends. The epoll engine
+ * marks a closed listener that is still held with closing = 2, and the
+ * last hold then frees it.
+ */
+static void listener_unref(struct listener *l) {
+    if (--l->refs == 0 && l->closing == 2) free(l);
+}
+
+static void handle_line(char *line) {
+    char *argv[MAX_ARGS];
+    int argc = 0;
+    for (char *tok = strtok(line, " \t\r"); tok && argc < MAX_ARGS; tok = strtok(NULL, " \t\r")) {
+        argv[argc++] = tok;
+    }
+    if (argc == 0) return;
+
+    /* "shm" takes a setup socket rather than a port; both update in place */
+    if ((strcmp(argv[0], "listen") == 0 || strcmp(argv[0], "shm") == 0) && argc >= 3) {
+        int shm = argv[0][0] == 's';
+        struct backend backends[MAX_BACKENDS];
+        int n = 0;
+        for (int i = 2; i < argc; i++) {
+            if (parse_backend(argv[i], &backends[n]) == 0) {
+                n++;
+            } else {
+                log_error("%s: bad backend %s", argv[1], argv[i]);
+            }
+        }
+        if (n == 0) {
+            reply("failed %s", argv[1]);
+            return;
+        }
+
+        struct listener *l;
+        for (l = listeners; l; l = l->next_listener) {
+            if (strcmp(l->id, argv[1]) == 0) break;
+        }
+        if (l && l->shm != shm) {
+            reply("failed %s", argv[1]);
+            return;
+        }
+        if (l) {
+            memcpy(l->backends, backends, sizeof(backends));
+            l->nbackends = n;
+            reply("listening %s", l->id);
+            return;
+        }
+
+        l = alloc_zeroed(sizeof(*l));
+        if (!l || strlen(argv[1]) >= sizeof(l->id)) {
+            free(l);
+            reply("failed %s", argv[1]);
+            return;
+        }
+        strcpy(l->id, argv[1]);
+        memcpy(l->backends, backends, sizeof(backends));
+        l->nbackends = n;
+        l->shm = shm;
+        l->fd = open_listener(l->id);
+        if (l->fd < 0 || engine->add_listener(l) < 0) {
+            log_error("listen %s: %s", l->id, strerror(errno));
+            if (l->fd >= 0) close(l->fd);
+            reply("failed %s", l->id);
+            free(l);
+            return;
+        }
+        l->next_listener = listeners;
+        listeners = l;
+        reply("listening %s", l->id);
+    } else if (strcmp(argv[0], "close") == 0 && argc == 2) {
+        for (struct listener **p = &listeners; *p; p = &(*p)->next_listener) {
+            if (strcmp((*p)->id, argv[1]) == 0) {
+                struct listener *l = *p;
+                *p = l->next_listener;
+                engine->remove_listener(l);
+                break;
+            }
+        }
+    } else if (strcmp(argv[0], "stats") == 0) {
+        reply("stats engine=%s syscalls=%llu bytes=%llu accepted=%llu active=%llu redirected=%llu",
+              engine->name, stat_syscalls, stat_bytes, stat_accepted, stat_active, stat_redirected);
+    } else {
+        log_error("unknown command: %s", argv[0]);
+    }
+}
+
+/* Feed bytes read from stdin; complete lines are executed */
+static void handle_input(const char *data, size_t n) {
+    static char line[LINE_MAX_BYTES];
+    static size_t len;
+    for (size_t i = 0; i < n; i++) {
+        if (data[i] == '\n') {
+            line[len] = 0;
+            handle_line(line);
+            len = 0;
+        } else if (len < sizeof(line) - 1) {
+            line[len++] = data[i];
+        }
+    }
+}
+
+// ============ sockmap: in-kernel redirection ============
+
+#define SOCKMAP_SLOTS 65536
+/* Bytes per direction redirected in the kernel before it falls back to copying */
+#define SOCKMAP_BUDGET (8 << 20)
+
+#define INSN(c, d, s, o, i) \
+    ((struct bpf_insn){ .code = (c), .dst_reg = (d), .src_reg = (s), .off = (o), .imm = (i) })
+
+/*
+ * Redirected bytes skip the source's receive buffer, so TCP's window never
+ * closes on them and nothing limits how much the kernel queues for a slow
+ * reader. Each direction is therefore redirected only up to a budget; past
+ * it the program "latches" and passes bytes up to the relay, which copies
+ * them with the usual backpressure. Latching is one-way, which keeps the
+ * order: everything redirected comes before everything copied.
+ */
+struct sockmap_peer {
+    unsigned peer_slot, self_slot;
+};
+
+struct sockmap_flow {
+    uint64_t redirected;
+    unsigned latched, pad;
+};
+
+/* One direction of a redirected pair, keyed by its source socket */
+struct sockmap_dir {
+    unsigned slot;
+    uint64_t cookie;
+    uint64_t src_base;              /* source's received bytes when redirection began */
+    uint64_t dst_base;              /* destination's written bytes then */
+    uint64_t received, copied;      /* bytes read and written by user space since */
+    int flushed;                    /* everything redirected has reached the destination */
+};
+
+static struct {
+    int sockmap;                    /* slot → socket */
+    int peers;                      /* socket cookie → sockmap_peer */
+    int flows;                      /* slot → sockmap_flow, written by the program */
+    int gates;                      /* slot → nonzero to stop redirecting, written by us */
+    unsigned *free_slots;
+    unsigned nfree;
+} bpf_maps = { -1, -1, -1, -1, NULL, 0 };
+
+static int sockmap_enabled;
+
+static int bpf_call(int cmd, union bpf_attr *attr) {
+    return (int)syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static int bpf_create_map(unsigned type, unsigned key_size, unsigned value_size) {
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = type;
+    attr.key_size = key_size;
+    attr.value_size = value_size;
+    attr.max_entries = SOCKMAP_SLOTS;
+    return bpf_call(BPF_MAP_CREATE, &attr);
+}
+
+static int bpf_map_op(int cmd, int map, const void *key, void *value) {
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map;
+    attr.key = (uintptr_t)key;
+    attr.value = (uintptr_t)value;
+    attr.flags = cmd == BPF_MAP_UPDATE_ELEM ? BPF_ANY : 0;
+    return SYS(bpf_call(cmd, &attr));
+}
+
+static int sockmap_gate(unsigned slot, unsigned closed) {
+    return bpf_map_op(BPF_MAP_UPDATE_ELEM, bpf_maps.gates, &slot, &closed);
+}
+
+/*
+ * Load the stream verdict program and attach it to the socket map:
+ *
+ *   if (!len) return SK_DROP          // a bare FIN; TCP has marked the socket done
+ *   peer = peers[socket_cookie(skb)], flow = flows[peer->self_slot]
+ *   if (!peer || flow->latched) return SK_PASS
+ *   if (gates[peer->self_slot] || flow->redirected + len > budget) {
+ *       flow->latched = 1
+ *       return SK_PASS
+ *   }
+ *   flow->redirected += len
+ *   return sk_redirect_map(skb, sockmap, peer->peer_slot, 0)   // peer's egress
+ */
+static int sockmap_setup(void) {
+    bpf_maps.sockmap = bpf_create_map(BPF_MAP_TYPE_SOCKMAP, sizeof(unsigned), sizeof(int));
+    bpf_maps.peers = bpf_create_map(BPF_MAP_TYPE_HASH, sizeof(uint64_t), sizeof(struct sockmap_peer));
+    bpf_maps.flows = bpf_create_map(BPF_MAP_TYPE_ARRAY, sizeof(unsigned), sizeof(struct sockmap_flow));
+    bpf_maps.gates = bpf_create_map(BPF_MAP_TYPE_ARRAY, sizeof(unsigned), sizeof(unsigned));
+    if (bpf_maps.sockmap < 0 || bpf_maps.peers < 0 || bpf_maps.flows < 0 || bpf_maps.gates < 0) {
+        return -1;
+    }
+
+    struct bpf_insn prog[] = {
+        INSN(BPF_ALU64 | BPF_MOV | BPF_X, 6, 1, 0, 0),
+        INSN(BPF_LDX | BPF_MEM | BPF_W, 7, 6, offsetof(struct __sk_buff, len), 0),
+        INSN(BPF_JMP | BPF_JEQ | BPF_K, 7, 0, 41, 0),                 /* → drop */
+        INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_get_socket_cookie),
+        INSN(BPF_STX | BPF_MEM | BPF_DW, 10, 0, -8, 0),
+        INSN(BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0),
+        INSN(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, -8),
+        INSN(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, bpf_maps.peers),
+        INSN(0, 0, 0, 0, 0),
+        INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem),
+        INSN(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 31, 0),                 /* → pass */
+        INSN(BPF_ALU64 | BPF_MOV | BPF_X, 8, 0, 0, 0),
+        INSN(BPF_LDX | BPF_MEM | BPF_W, 1, 8, offsetof(struct sockmap_peer, self_slot), 0),
+        INSN(BPF_STX | BPF_MEM | BPF_W, 10, 1, -12, 0),
+        INSN(BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0),
+        INSN(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, -12),
+        INSN(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, bpf_maps.gates),
+        INSN(0, 0, 0, 0, 0),
+        INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem),
+        INSN(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 22, 0),                 /* → pass */
+        INSN(BPF_LDX | BPF_MEM | BPF_W, 9, 0, 0, 0),
+        INSN(BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0),
+        INSN(BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, -12),
+        INSN(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, bpf_maps.flows),
+        INSN(0, 0, 0, 0, 0),
+        INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem),
+        INSN(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 15, 0),                 /* → pass */
+        INSN(BPF_LDX | BPF_MEM | BPF_W, 1, 0, offsetof(struct sockmap_flow, latched), 0),
+        INSN(BPF_JMP | BPF_JNE | BPF_K, 1, 0, 13, 0),                 /* → pass */
+        INSN(BPF_JMP | BPF_JNE | BPF_K, 9, 0, 11, 0),                 /* → latch */
+        INSN(BPF_LDX | BPF_MEM | BPF_DW, 1, 0, offsetof(struct sockmap_flow, redirected), 0),
+        INSN(BPF_ALU64 | BPF_ADD | BPF_X, 1, 7, 0, 0),
+        INSN(BPF_JMP | BPF_JGT | BPF_K, 1, 0, 8, SOCKMAP_BUDGET),     /* → latch */
+        INSN(BPF_STX | BPF_MEM | BPF_DW, 0, 1, offsetof(struct sockmap_flow, redirected), 0),
+        INSN(BPF_LDX | BPF_MEM | BPF_W, 3, 8, offsetof(struct sockmap_peer, peer_slot), 0),
+        INSN(BPF_ALU64 | BPF_MOV | BPF_X, 1, 6, 0, 0),
+        INSN(BPF_LD | BPF_DW | BPF_IMM, 2, BPF_PSEUDO_MAP_FD, 0, bpf_maps.sockmap),
+        INSN(0, 0, 0, 0, 0),
+        INSN(BPF_ALU64 | BPF_MOV | BPF_K, 4, 0, 0, 0),
+        INSN(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_sk_redirect_map),
+        INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        INSN(BPF_ST | BPF_MEM | BPF_W, 0, 0, offsetof(struct sockmap_flow, latched), 1),  /* latch */
+        INSN(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, SK_PASS),                           /* pass */
+        INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+        INSN(BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, SK_DROP),                           /* drop */
+        INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+    };
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_SK_SKB;
+    attr.insns = (uintptr_t)prog;
+    attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+    attr.license = (uintptr_t)"Dual MIT/GPL";
+    int prog_fd = bpf_call(BPF_PROG_LOAD, &attr);
+    if (prog_fd < 0) return -1;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.target_fd = bpf_maps.sockmap;
+    attr.attach_bpf_fd = prog_fd;
+    attr.attach_type = BPF_SK_SKB_STREAM_VERDICT;
+    if (bpf_call(BPF_PROG_ATTACH, &attr) < 0) return -1;
+
+    bpf_maps.free_slots = malloc(SOCKMAP_SLOTS * sizeof(unsigned));
+    if (!bpf_maps.free_slots) return -1;
+    for (unsigned i = 0; i < SOCKMAP_SLOTS; i++) bpf_maps.free_slots[i] = SOCKMAP_SLOTS - 1 - i;
+    bpf_maps.nfree = SOCKMAP_SLOTS;
+    sockmap_enabled = 1;
+    return 0;
+}
+
+/* Bytes a TCP socket has received and that have been read from it */
+static int sockmap_consumed(int fd, uint64_t *consumed) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    int queued;
+    if (SYS(getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len)) < 0 ||
+        SYS(ioctl(fd, SIOCINQ, &queued)) < 0) {
+        return -1;
+    }
+    /* Before either side is shut, CLOSE_WAIT is the one state with a FIN in */
+    int fin = info.tcpi_state == BPF_TCP_CLOSE_WAIT;
+    *consumed = info.tcpi_bytes_received - (uint64_t)fin - (uint64_t)queued;
+    return 0;
+}
+
+/* Bytes a TCP socket has taken for sending: acknowledged plus still queued */
+static int sockmap_written(int fd, uint64_t *written) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    int queued, err;
+    if (SYS(getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len)) < 0 ||
+        SYS(ioctl(fd, SIOCOUTQ, &queued)) < 0) {
+        return -1;
+    }
+    /* Redirected bytes still in the kernel's backlog go nowhere from here */
+    if (info.tcpi_state != BPF_TCP_ESTABLISHED && info.tcpi_state != BPF_TCP_CLOSE_WAIT) {
+        errno = EPIPE;
+        return -1;
+    }
+    /* Nor once the backlog failed a send, which the kernel reports as a socket error */
+    len = sizeof(err);
+    if (SYS(getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len)) < 0) return -1;
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    *written = info.tcpi_bytes_acked + (uint64_t)queued;
+    return 0;
+}
+
+/*
+ * Whether everything redirected for `d`, and everything copied since, has
+ * reached `dst`'s send queue. Only asked once the direction has stopped
+ * redirecting (it latched, or its source hit end-of-stream), so the answer
+ * stays true. Returns -1 when `dst` can no longer send.
+ */
+static int sockmap_flushed(struct sockmap_dir *d, int dst) {
+    if (d->flushed) return 1;
+    struct sockmap_flow flow;
+    uint64_t written;
+    if (bpf_map_op(BPF_MAP_LOOKUP_ELEM, bpf_maps.flows, &d->slot, &flow) < 0 ||
+        sockmap_written(dst, &written) < 0) {
+        return -1;
+    }
+    if (written - d->dst_base < flow.redirected + d->copied) return 0;
+    d->flushed = 1;
+    return 1;
+}
+
+/*
+ * Whether a zero-byte read from `src` is really its end: everything it
+ * received before the FIN was redirected or read. Bytes passed up after a
+ * latch can still be queued in the kernel behind redirected ones when the
+ * FIN is read.
+ */
+static int sockmap_ended(struct sockmap_dir *d, int src) {
+    struct sockmap_flow flow;
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (bpf_map_op(BPF_MAP_LOOKUP_ELEM, bpf_maps.flows, &d->slot, &flow) < 0 ||
+        SYS(getsockopt(src, IPPROTO_TCP, TCP_INFO, &info, &len)) < 0) {
+        return -1;
+    }
+    /* The FIN takes a sequence number but is no byte */
+    return info.tcpi_bytes_received - 1 - d->src_base <= flow.redirected + d->received;
+}
+
+/*
+ * Start redirecting between two connected TCP sockets whose queues have
+ * been relayed. Returns -1 when the pair stays on splice. Once a socket is
+ * in the map it stays there until closed (removing it drops whatever the
+ * kernel holds for it), so a later failure only keeps the gates closed and
+ * the pair is copied through user space instead.
+ */
+static int sockmap_add(struct sockmap_dir *d0, int fd0, struct sockmap_dir *d1, int fd1) {
+    socklen_t len = sizeof(uint64_t);
+    if (bpf_maps.nfree < 2 ||
+        SYS(getsockopt(fd0, SOL_SOCKET, SO_COOKIE, &d0->cookie, &len)) < 0 ||
+        SYS(getsockopt(fd1, SOL_SOCKET, SO_COOKIE, &d1->cookie, &len)) < 0) {
+        return -1;
+    }
+    /* Measured before the insert, while the receive queues still tell */
+    if (sockmap_consumed(fd0, &d0->src_base) < 0 || sockmap_consumed(fd1, &d1->src_base) < 0) {
+        return -1;
+    }
+    d0->slot = bpf_maps.free_slots[--bpf_maps.nfree];
+    d1->slot = bpf_maps.free_slots[--bpf_maps.nfree];
+
+    struct sockmap_flow flow = { 0, 0, 0 };
+    struct sockmap_peer p0 = { d1->slot, d0->slot }, p1 = { d0->slot, d1->slot };
+    if (sockmap_gate(d0->slot, 1) < 0 || sockmap_gate(d1->slot, 1) < 0 ||
+        bpf_map_op(BPF_MAP_UPDATE_ELEM, bpf_maps.flows, &d0->slot, &flow) < 0 ||
+        bpf_map_op(BPF_MAP_UPDATE_ELEM, bpf_maps.flows, &d1->slot, &flow) < 0 ||
+        bpf_map_op(BPF_MAP_UPDATE_ELEM, bpf_maps.peers, &d0->cookie, &p0) < 0 ||
+        bpf_map_op(BPF_MAP_UPDATE_ELEM, bpf_maps.peers, &d1->cookie, &p1) < 0 ||
+        bpf_map_op(BPF_MAP_UPDATE_ELEM, bpf_maps.sockmap, &d0->slot, &fd0) < 0) {
+        bpf_map_op(BPF_MAP_DELETE_ELEM, bpf_maps.peers, &d0->cookie, NULL);
+        bpf_map_op(BPF_MAP_DELETE_ELEM, bpf_maps.peers, &d1->cookie, NULL);
+        bpf_maps.free_slots[bpf_maps.nfree++] = d1->slot;
+        bpf_maps.free_slots[bpf_maps.nfree++] = d0->slot;
+        return -1;
+    }
+
+    /* Closed gates pass everything up, so nothing is redirected yet */
+    d0->received = d1->received = d0->copied = d1->copied = 0;
+    d0->flushed = d1->flushed = 1;
+    if (bpf_map_op(BPF_MAP_UPDATE_ELEM, bpf_maps.sockmap, &d1->slot, &fd1) < 0 ||
+        sockmap_written(fd1, &d0->dst_base) < 0 || sockmap_written(fd0, &d1->dst_base) < 0 ||
+        sockmap_gate(d0->slot, 0) < 0 || sockmap_gate(d1->slot, 0) < 0) {
+        return 0;
+    }
+    d0->flushed = d1->flushed = 0;
+
+    /*
+     * Bytes that arrived just before the insert wait in the receive queue
+     * until more follow. Copy such a direction instead of racing them.
+     */
+    char byte;
+    if (SYS(recv(fd0, &byte, 1, MSG_PEEK | MSG_DONTWAIT)) > 0) sockmap_gate(d0->slot, 1);
+    if (SYS(recv(fd1, &byte, 1, MSG_PEEK | MSG_DONTWAIT)) > 0) sockmap_gate(d1->slot, 1);
+    return 0;
+}
+
+/* Forget a pair; closing its sockets drops them from the socket map */
+static void sockmap_remove(struct sockmap_dir *d0, struct sockmap_dir *d1) {
+    struct sockmap_dir *dirs[2] = { d0, d1 };
+    for (int i = 0; i < 2; i++) {
+        struct sockmap_flow flow;
+        if (bpf_map_op(BPF_MAP_LOOKUP_ELEM, bpf_maps.flows, &dirs[i]->slot, &flow) == 0) {
+            stat_redirected += flow.redirected;
+        }
+        bpf_map_op(BPF_MAP_DELETE_ELEM, bpf_maps.peers, &dirs[i]->cookie, NULL);
+        bpf_maps.free_slots[bpf_maps.nfree++] = dirs[i]->slot;
+    }
+}
+
+// ============ epoll engine: splice through pipes ============
+
+#define EP_PIPE_CHUNK (64 * 1024)
+
+enum { EP_STDIN, EP_LISTENER, EP_CLIENT, EP_UPSTREAM, EP_SHM_SETUP, EP_SHM_BELL, EP_SHM_CONN };
+
+/* One direction of a connection */
+struct ep_half {
+    int src, dst;
+    int pipe[2];
+    size_t inpipe;
+    int eof, shut;
+    /* sockmap pairs: bytes passed up by the program are copied */
+    struct sockmap_dir k;
+    char *buf;
+    size_t buf_off, buf_len;
+};
+
+struct ep_conn {
+    int client, upstream;
+    int connected, closed;
+    struct listener *l;
+    unsigned first;
+    int tried;                      /* backends tried, each once, until one connects */
+    int tcp;                        /* upstream is TCP, so the pair can be redirected */
+    int accel_tried, accel;
+    int waiting;
+    struct ep_half up, down;
+    struct ep_conn *next_dead;
+    struct ep_conn *next_waiting;
+} __attribute__((aligned(16)));
+
+static int ep_fd;
+static struct ep_conn *ep_dead;
+/* sockmap pairs waiting for redirected bytes to drain, polled every millisecond */
+static struct ep_conn *ep_waiting;
+static struct listener *ep_dead_listeners;
+
+#define EP_TAG(ptr, kind) ((uint64_t)(uintptr_t)(ptr) | (kind))
+#define EP_PTR(data) ((void *)(uintptr_t)((data) & ~(uint64_t)15))
+#define EP_KIND(data) ((int)((data) & 15))
+
+static int ep_add_listener(struct listener *l) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = EP_TAG(l, EP_LISTENER) };
+    return epoll_ctl(ep_fd, EPOLL_CTL_ADD, l->fd, &ev);
+}
+
+static void ep_remove_listener(struct listener *l) {
+    close(l->fd);
+    l->fd = -1;
+    l->closing = 1;
+    /* Events for it may still be in the current batch */
+    l->next_listener = ep_dead_listeners;
+    ep_dead_listeners = l;
+}
+
+/* Closes the sockets now, frees the memory after the current event batch */
+static void ep_close(struct ep_conn *c) {
+    if (c->closed) return;
+    c->closed = 1;
+    if (c->accel) sockmap_remove(&c->up.k, &c->down.k);
+    SYS(close(c->client));
+    if (c->upstream >= 0) SYS(close(c->upstream));
+    SYS(close(c->up.pipe[0]));
+    SYS(close(c->up.pipe[1]));
+    SYS(close(c->down.pipe[0]));
+    SYS(close(c->down.pipe[1]));
+    free(c->up.buf);
+    free(c->down.buf);
+    listener_unref(c->l);
+    stat_active--;
+    c->next_dead = ep_dead;
+    ep_dead = c;
+}
+
+/* Move what is readable; returns -1 when the connection failed */
+static int ep_pump(struct ep_half *h) {
+    for (;;) {
+        if (h->inpipe > 0) {
+            ssize_t n = SYS(splice(h->pipe[0], NULL, h->dst, NULL, h->inpipe,
+                                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+            if (n < 0) return errno == EAGAIN ? 0 : -1;
+            h->inpipe -= n;
+            continue;
+        }
+        if (h->eof) {
+            if (!h->shut) {
+                SYS(shutdown(h->dst, SHUT_WR));
+                h->shut = 1;
+            }
+            return 0;
+        }
+        ssize_t n = SYS(splice(h->src, NULL, h->pipe[1], NULL, EP_PIPE_CHUNK,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK));
+        if (n == 0) {
+            h->eof = 1;
+            continue;
+        }
+        if (n < 0) return errno == EAGAIN ? 0 : -1;
+        h->inpipe += n;
+        stat_bytes += n;
+    }
+}
+
+static void ep_wait(struct ep_conn *c) {
+    if (c->waiting) return;
+    c->waiting = 1;
+    c->next_waiting = ep_waiting;
+    ep_waiting = c;
+}
+
+/*
+ * ep_pump for sockmap pairs. Bytes the program passed up sit in the
+ * socket's own queue, which splice cannot read, so they are copied; and
+ * neither copied bytes nor end-of-stream may overtake what the kernel is
+ * still redirecting.
+ */
+static int ep_copy(struct ep_conn *c, struct ep_half *h) {
+    for (;;) {
+        if (h->buf_off < h->buf_len || (h->eof && !h->shut)) {
+            int flushed = sockmap_flushed(&h->k, h->dst);
+            if (flushed < 0) return -1;
+            if (!flushed) {
+                ep_wait(c);
+                return 0;
+            }
+        }
+        if (h->buf_off < h->buf_len) {
+            ssize_t n = SYS(send(h->dst, h->buf + h->buf_off, h->buf_len - h->buf_off,
+                                 MSG_NOSIGNAL | MSG_DONTWAIT));
+            if (n < 0) return errno == EAGAIN ? 0 : -1;
+            h->buf_off += n;
+            h->k.copied += n;
+            continue;
+        }
+        if (h->eof) {
+            if (!h->shut) {
+                SYS(shutdown(h->dst, SHUT_WR));
+                h->shut = 1;
+            }
+            return 0;
+        }
+        if (!h->buf && !(h->buf = malloc(EP_PIPE_CHUNK))) return -1;
+        ssize_t n = SYS(recv(h->src, h->buf, EP_PIPE_CHUNK, MSG_DONTWAIT));
+        if (n == 0) {
+            int ended = sockmap_ended(&h->k, h->src);
+            if (ended < 0) return -1;
+            if (!ended) {
+                ep_wait(c);
+                return 0;
+            }
+            h->eof = 1;
+            continue;
+        }
+        if (n < 0) return errno == EAGAIN ? 0 : -1;
+        h->buf_off = 0;
+        h->buf_len = n;
+        h->k.received += n;
+        stat_bytes += n;
+    }
+}
+
+/*
+ * Connect to the listener's next backend that takes the connection. An app
+ * on localhost may listen on 127.0.0.1 or ::1 only, so a refused connect
+ * moves on rather than failing the client.
+ */
+static int ep_connect(struct ep_conn *c) {
+    struct backend *b;
+    while ((b = next_backend(c->l, &c->first, &c->tried))) {
+        c->upstream = connect_backend(b, &c->connected);
+        if (c->upstream < 0) continue;
+        c->tcp = b->addr.ss_family != AF_UNIX;
+        c->up.dst = c->upstream;
+        c->down.src = c->upstream;
+        return 0;
+    }
+    return -1;
+}
+
+static void ep_add_upstream(struct ep_conn *c) {
+    /* Registration reports current readiness, which starts the pumps */
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET };
+    ev.data.u64 = EP_TAG(c, EP_UPSTREAM);
+    SYS(epoll_ctl(ep_fd, EPOLL_CTL_ADD, c->upstream, &ev));
+}
+
+static void shm_accept(struct listener *l);
+
+static void ep_accept(struct listener *l) {
+    if (l->shm) {
+        shm_accept(l);
+        return;
+    }
+    for (;;) {
+        int client = SYS(accept4(l->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC));
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN) log_error("accept %s: %s", l->id, strerror(errno));
+            return;
+        }
+
+        struct ep_conn *c = alloc_zeroed(sizeof(*c));
+        if (!c || SYS(pipe2(c->up.pipe, O_NONBLOCK | O_CLOEXEC)) < 0) {
+            SYS(close(client));
+            free(c);
+            continue;
+        }
+        if (SYS(pipe2(c->down.pipe, O_NONBLOCK | O_CLOEXEC)) < 0) {
+            SYS(close(client));
+            SYS(close(c->up.pipe[0]));
+            SYS(close(c->up.pipe[1]));
+            free(c);
+            continue;
+        }
+        c->client = client;
+        c->up.src = client;
+        c->down.dst = client;
+        c->l = l;
+        l->refs++;
+        stat_accepted++;
+        stat_active++;
+        if (ep_connect(c) < 0) {
+            c->upstream = -1;
+            ep_close(c);
+            continue;
+        }
+
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET };
+        ev.data.u64 = EP_TAG(c, EP_CLIENT);
+        SYS(epoll_ctl(ep_fd, EPOLL_CTL_ADD, client, &ev));
+        ep_add_upstream(c);
+    }
+}
+
+static void ep_event(struct ep_conn *c, int kind, uint32_t events) {
+    if (c->closed) return;
+    if (!c->connected) {
+        if (kind != EP_UPSTREAM || !(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) return;
+        int err = 0;
+        socklen_t len = sizeof(err);
+        SYS(getsockopt(c->upstream, SOL_SOCKET, SO_ERROR, &err, &len));
+        if (err) {
+            SYS(close(c->upstream));
+            c->upstream = -1;
+            if (ep_connect(c) < 0) {
+                ep_close(c);
+                return;
+            }
+            ep_add_upstream(c);
+            if (!c->connected) return;
+        }
+        c->connected = 1;
+    }
+    int failed = c->accel ? ep_copy(c, &c->up) < 0 || ep_copy(c, &c->down) < 0
+                          : ep_pump(&c->up) < 0 || ep_pump(&c->down) < 0;
+    if (failed || (c->up.shut && c->down.shut)) {
+        ep_close(c);
+        return;
+    }
+    /* Hand the pair to the kernel once what was queued before has been relayed */
+    if (sockmap_enabled && c->tcp && !c->accel_tried && c->up.inpipe == 0 &&
+        c->down.inpipe == 0 && !c->up.eof && !c->down.eof) {
+        c->accel_tried = 1;
+        c->accel = sockmap_add(&c->up.k, c->client, &c->down.k, c->upstream) == 0;
+        if (c->accel) ep_event(c, kind, 0);
+    }
+}
+
+
+// ============ shm: the daemon's connections over shared memory ============
+
+/* A channel's connection to the app */
+struct shm_conn {
+    struct shm_region *region;
+    unsigned ch;
+    int fd;
+    int connected, tried;
+    unsigned first;
+    int eof;                        /* the app ended its side */
+    int shut;                       /* the daemon's side was passed on */
+    int closed;
+    struct shm_conn *next_dead;
+} __attribute__((aligned(16)));
+
+/* One daemon's region, alive while its setup connection is */
+struct shm_region {
+    struct listener *l;
+    int setup, to_relay, to_daemon;
+    struct shm_header *h;
+    int closed;
+    uint32_t gen[SHM_CHANNELS];
+    struct shm_conn *conns[SHM_CHANNELS];
+    struct shm_region *next_dead;
+} __attribute__((aligned(16)));
+
+static struct shm_conn *shm_dead_conns;
+static struct shm_region *shm_dead_regions;
+
+static void shm_notify(struct shm_region *r, unsigned ch) {
+    if (shm_post(&r->h->to_daemon, ch)) {
+        stat_syscalls++;
+        shm_kick(r->to_daemon);
+    }
+}
+
+/* Let go of a channel; a nonzero err aborts it, for the daemon and the app alike */
+static void shm_conn_close(struct shm_conn *sc, int err) {
+    if (sc->closed) return;
+    sc->closed = 1;
+    struct shm_region *r = sc->region;
+    struct shm_channel *c = &r->h->channel[sc->ch];
+    if (sc->fd >= 0) {
+        if (err) {
+            struct linger lg = { .l_onoff = 1, .l_linger = 0 };
+            SYS(setsockopt(sc->fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg)));
+        }
+        SYS(close(sc->fd));
+    }
+    if (err) atomic_store(&c->error, err);
+    atomic_fetch_or(&c->cflags, (err ? SHM_ABORT : 0) | SHM_DONE);
+    shm_notify(r, sc->ch);
+    r->conns[sc->ch] = NULL;
+    listener_unref(r->l);
+    stat_active--;
+    sc->next_dead = shm_dead_conns;
+    shm_dead_conns = sc;
+}
+
+/* Like ep_connect, for a channel */
+static int shm_connect(struct shm_conn *sc) {
+    struct backend *b;
+    while ((b = next_backend(sc->region->l, &sc->first, &sc->tried))) {
+        sc->fd = connect_backend(b, &sc->connected);
+        if (sc->fd < 0) continue;
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+                                  .data.u64 = EP_TAG(sc, EP_SHM_CONN) };
+        SYS(epoll_ctl(ep_fd, EPOLL_CTL_ADD, sc->fd, &ev));
+        return 0;
+    }
+    return -1;
+}
+
+/* Move bytes between the rings and the app; returns an errno when the connection failed */
+static int shm_pump(struct shm_conn *sc) {
+    struct shm_region *r = sc->region;
+    struct shm_channel *c = &r->h->channel[sc->ch];
+    struct iovec iov[2];
+    int iovcnt;
+
+    /* Daemon to app. Flags first: bytes written before SHM_EOF are then visible too */
+    while (!sc->shut) {
+        uint32_t dflags = atomic_load_explicit(&c->dflags, memory_order_acquire);
+        if (dflags & SHM_ABORT) return ECONNRESET;
+        size_t len = shm_ring_iov(r->h, sc->ch, &c->d2c, 0, iov, &iovcnt);
+        if (len == 0) {
+            if (!(dflags & SHM_EOF)) break;
+            SYS(shutdown(sc->fd, SHUT_WR));
+            sc->shut = 1;
+            break;
+        }
+        ssize_t n = SYS(writev(sc->fd, iov, iovcnt));
+        if (n < 0) {
+            if (errno == EAGAIN) break;
+            return errno;
+        }
+        stat_bytes += n;
+        uint64_t tail = atomic_load_explicit(&c->d2c.tail, memory_order_relaxed) + n;
+        if (shm_ring_consumed(&c->d2c, tail)) shm_notify(r, sc->ch);
+    }
+
+    /* App to daemon, until the ring is full; the daemon's read brings us back */
+    while (!sc->eof) {
+        size_t len = shm_ring_iov(r->h, sc->ch, &c->c2d, 1, iov, &iovcnt);
+        if (len == 0) {
+            if (shm_ring_wait(&c->c2d)) break;
+            continue;
+        }
+        ssize_t n = SYS(readv(sc->fd, iov, iovcnt));
+        if (n == 0) {
+            sc->eof = 1;
+            atomic_fetch_or(&c->cflags, SHM_EOF);
+        } else if (n < 0) {
+            if (errno == EAGAIN) break;
+            return errno;
+        } else {
+            stat_bytes += n;
+            uint64_t head = atomic_load_explicit(&c->c2d.head, memory_order_relaxed) + n;
+            atomic_store_explicit(&c->c2d.head, head, memory_order_release);
+        }
+        shm_notify(r, sc->ch);
+    }
+
+    if (sc->shut && sc->eof) shm_conn_close(sc, 0);
+    return 0;
+}
+
+static void shm_conn_event(struct shm_conn *sc, uint32_t events) {
+    if (sc->closed) return;
+    if (!sc->connected) {
+        if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) return;
+        int err = 0;
+        socklen_t len = sizeof(err);
+        SYS(getsockopt(sc->fd, SOL_SOCKET, SO_ERROR, &err, &len));
+        if (err) {
+            SYS(close(sc->fd));
+            if (shm_connect(sc) < 0) {
+                sc->fd = -1;
+                shm_conn_close(sc, err);
+                return;
+            }
+            if (!sc->connected) return;
+        }
+        sc->connected = 1;
+        atomic_fetch_or(&sc->region->h->channel[sc->ch].cflags, SHM_CONNECTED);
+        shm_notify(sc->region, sc->ch);
+    }
+    int err = shm_pump(sc);
+    if (err) shm_conn_close(sc, err);
+}
+
+/* The daemon has news for a channel: a new connection, bytes, room or an end */
+static void shm_channel(struct shm_region *r, unsigned ch) {
+    struct shm_channel *c = &r->h->channel[ch];
+    uint32_t gen = atomic_load_explicit(&c->gen, memory_order_acquire);
+    struct shm_conn *sc = r->conns[ch];
+    if (gen != r->gen[ch]) {
+        /* The daemon only reopens channels we let go of */
+        r->gen[ch] = gen;
+        if (sc) shm_conn_close(sc, ECONNRESET);
+        sc = alloc_zeroed(sizeof(*sc));
+        if (!sc) {
+            atomic_store(&c->error, ENOMEM);
+            atomic_fetch_or(&c->cflags, SHM_ABORT | SHM_DONE);
+            shm_notify(r, ch);
+            return;
+        }
+        sc->region = r;
+        sc->ch = ch;
+        r->conns[ch] = sc;
+        r->l->refs++;
+        stat_accepted++;
+        stat_active++;
+        if (shm_connect(sc) < 0) {
+            int err = errno;
+            sc->fd = -1;
+            shm_conn_close(sc, err);
+            return;
+        }
+        if (!sc->connected) return;
+        atomic_fetch_or(&c->cflags, SHM_CONNECTED);
+        shm_notify(r, ch);
+    }
+    if (sc && sc->connected) {
+        int err = shm_pump(sc);
+        if (err) shm_conn_close(sc, err);
+    }
+}
+
+static void shm_bell(struct shm_region *r) {
+    if (r->closed) return;
+    uint64_t n;
+    SYS(read(r->to_relay, &n, sizeof(n)));
+    uint64_t mask = atomic_exchange(&r->h->to_relay, 0);
+    while (mask) {
+        unsigned ch = __builtin_ctzll(mask);
+        mask &= mask - 1;
+        shm_channel(r, ch);
+    }
+}
+
+static void shm_region_close(struct shm_region *r) {
+    if (r->closed) return;
+    r->closed = 1;
+    for (unsigned ch = 0; ch < SHM_CHANNELS; ch++) {
+        if (r->conns[ch]) shm_conn_close(r->conns[ch], ECONNRESET);
+    }
+    munmap(r->h, SHM_SIZE);
+    close(r->setup);
+    close(r->to_relay);
+    close(r->to_daemon);
+    listener_unref(r->l);
+    r->next_dead = shm_dead_regions;
+    shm_dead_regions = r;
+}
+
+/* A daemon connected to the setup socket: hand it a fresh region */
+static void shm_accept(struct listener *l) {
+    for (;;) {
+        int setup = accept4(l->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (setup < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN) log_error("accept %s: %s", l->id, strerror(errno));
+            return;
+        }
+
+        struct shm_region *r = alloc_zeroed(sizeof(*r));
+        int memfd = memfd_create("lohost-shm", MFD_CLOEXEC);
+        if (!r || memfd < 0 || ftruncate(memfd, SHM_SIZE) < 0 ||
+            (r->h = mmap(NULL, SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0)) == MAP_FAILED) {
+            log_error("shm %s: %s", l->id, strerror(errno));
+            if (memfd >= 0) close(memfd);
+            close(setup);
+            free(r);
+            continue;
+        }
+        r->h->magic = SHM_MAGIC;
+        r->h->version = SHM_VERSION;
+        r->h->channels = SHM_CHANNELS;
+        r->h->ring_bytes = SHM_RING_BYTES;
+        r->setup = setup;
+        r->to_relay = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        r->to_daemon = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        uint32_t magic = SHM_MAGIC;
+        int fds[3] = { memfd, r->to_relay, r->to_daemon };
+        char control[CMSG_SPACE(sizeof(fds))] = {0};
+        struct iovec iov = { .iov_base = &magic, .iov_len = sizeof(magic) };
+        struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                              .msg_control = control, .msg_controllen = sizeof(control) };
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+        int sent = r->to_relay >= 0 && r->to_daemon >= 0 &&
+                   sendmsg(setup, &msg, MSG_NOSIGNAL) == sizeof(magic);
+        /* The daemon maps its own copy */
+        close(memfd);
+
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP,
+                                  .data.u64 = EP_TAG(r, EP_SHM_SETUP) };
+        if (sent && epoll_ctl(ep_fd, EPOLL_CTL_ADD, setup, &ev) == 0) {
+            ev.events = EPOLLIN;
+            ev.data.u64 = EP_TAG(r, EP_SHM_BELL);
+            sent = epoll_ctl(ep_fd, EPOLL_CTL_ADD, r->to_relay, &ev) == 0;
+        }
+        r->l = l;
+        l->refs++;
+        if (!sent) {
+            log_error("shm %s: setup failed: %s", l->id, strerror(errno));
+            shm_region_close(r);
+        }
+    }
+}
+
+/* The setup connection is only ever read for its end */
+static void shm_setup_event(struct shm_region *r) {
+    if (r->closed) return;
+    char buf[64];
+    ssize_t n = read(r->setup, buf, sizeof(buf));
+    if (n == 0 || (n < 0 && errno != EAGAIN)) shm_region_close(r);
+}
+
+static void ep_run(void) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.u64 = EP_TAG(NULL, EP_STDIN) };
+    epoll_ctl(ep_fd, EPOLL_CTL_ADD, STDIN_FILENO, &ev);
+
+    struct epoll_event events[256];
+    for (;;) {
+        int n = SYS(epoll_wait(ep_fd, events, 256, ep_waiting ? 1 : -1));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            log_error("epoll_wait: %s", strerror(errno));
+            return;
+        }
+        for (int i = 0; i < n; i++) {
+            uint64_t data = events[i].data.u64;
+            switch (EP_KIND(data)) {
+            case EP_STDIN: {
+                char buf[4096];
+                ssize_t r = read(STDIN_FILENO, buf, sizeof(buf));
+                if (r <= 0) return; /* daemon went away */
+                handle_input(buf, r);
+                break;
+            }
+            case EP_LISTENER: {
+                struct listener *l = EP_PTR(data);
+                if (l->fd >= 0) ep_accept(l);
+                break;
+            }
+            case EP_SHM_SETUP:
+                shm_setup_event(EP_PTR(data));
+                break;
+            case EP_SHM_BELL:
+                shm_bell(EP_PTR(data));
+                break;
+            case EP_SHM_CONN:
+                shm_conn_event(EP_PTR(data), events[i].events);
+                break;
+            default:
+                ep_event(EP_PTR(data), EP_KIND(data), events[i].events);
+            }
+        }
+        struct ep_conn *waiting = ep_waiting;
+        ep_waiting = NULL;
+        while (waiting) {
+            struct ep_conn *c = waiting;
+            waiting = c->next_waiting;
+            c->waiting = 0;
+            ep_event(c, EP_CLIENT, 0);
+        }
+        for (struct ep_conn **w = &ep_waiting; *w;) {
+            if ((*w)->closed) *w = (*w)->next_waiting;
+            else w = &(*w)->next_waiting;
+        }
+        while (ep_dead) {
+            struct ep_conn *c = ep_dead;
+            ep_dead = c->next_dead;
+            free(c);
+        }
+        while (ep_dead_listeners) {
+            struct listener *l = ep_dead_listeners;
+            ep_dead_listeners = l->next_listener;
+            if (l->refs) l->closing = 2;
+            else free(l);
+        }
+        while (shm_dead_conns) {
+            struct shm_conn *sc = shm_dead_conns;
+            shm_dead_conns = sc->next_dead;
+            free(sc);
+        }
+        while (shm_dead_regions) {
+            struct shm_region *r = shm_dead_regions;
+            shm_dead_regions = r->next_dead;
+            free(r);
+        }
+    }
+}
+
+static int ep_init(void) {
+    ep_fd = epoll_create1(EPOLL_CLOEXEC);
+    return ep_fd < 0 ? -1 : 0;
+}
+
+static const struct engine epoll_engine = {
+    .name = "epoll",
+    .add_listener = ep_add_listener,
+    .remove_listener = ep_remove_listener,
+    .run = ep_run,
+};
+
+static const struct engine sockmap_engine = {
+    .name = "sockmap",
+    .add_listener = ep_add_listener,
+    .remove_listener = ep_remove_listener,
+    .run = ep_run,
+};
+
+// ============ io_uring engine ============
+
+#define URING_ENTRIES 4096
+#define BUF_GROUP 1
+#define BUF_SIZE (32 * 1024)
+#define BUF_COUNT 1024              /* power of two, as the ring requires */
+#define MAX_FILES 65536
+
+/*
+ * Received chunks a direction may hold before its recv is paused. The queue
+ * itself grows past this: completions already posted still have to land.
+ */
+#define QUEUE_INITIAL 8
+#define QUEUE_PAUSE 16
+
+/* Operation kind, kept in the low bits of user_data (pointers are 16-aligned) */
+enum {
+    U_STDIN = 1, U_ACCEPT, U_SOCKET, U_CONNECT, U_RECV, U_SEND,
+    U_SHUTDOWN, U_CLOSE, U_CANCEL, U_PAUSE, U_LISTEN_CANCEL,
+};
+
+#define U_TAG(ptr, kind) ((uint64_t)(uintptr_t)(ptr) | (kind))
+#define U_PTR(data) ((void *)(uintptr_t)((data) & ~(uint64_t)15))
+#define U_KIND(data) ((int)((data) & 15))
+
+struct chunk {
+    unsigned short bid;
+    unsigned len, off;
+};
+
+struct u_conn;
+
+struct u_half {
+    struct u_conn *conn;
+    int src, dst;                   /* fixed-file indexes */
+    struct chunk *queue;
+    unsigned qcap, qhead, qlen;
+    unsigned char recv_armed, send_busy, eof, shut_sent, done, paused, starved;
+    struct u_half *next_starved;
+} __attribute__((aligned(16)));
+
+struct u_conn {
+    struct u_half up, down;         /* client → upstream, upstream → client */
+    int client, upstream;           /* fixed-file indexes, -1 when none */
+    struct backend backend;
+    unsigned refs;                  /* submitted operations not yet final */
+    unsigned char closing;
+} __attribute__((aligned(16)));
+
+static struct {
+    int fd;
+    int enter_fd;
+    unsigned enter_flags;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned sq_entries, sq_local_tail;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    struct io_uring_buf_ring *buf_ring;
+    unsigned short buf_tail;
+    char *buffers;
+} ring;
+
+static struct u_half *starved;
+static int stdin_closed;
+static char stdin_buf[4096] __attribute__((aligned(16)));
+
+static int uring_enter(unsigned to_submit, unsigned wait_nr, unsigned flags) {
+    return (int)SYS(syscall(__NR_io_uring_enter, ring.enter_fd, to_submit, wait_nr,
+                            flags | ring.enter_flags, NULL, 0));
+}
+
+/* Publish queued SQEs and optionally wait for completions */
+static int uring_submit(unsigned wait_nr) {
+    unsigned to_submit = ring.sq_local_tail - *ring.sq_tail;
+    __atomic_store_n(ring.sq_tail, ring.sq_local_tail, __ATOMIC_RELEASE);
+    for (;;) {
+        int r = uring_enter(to_submit, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0);
+        if (r >= 0 || errno != EINTR) return r;
+    }
+}
+
+static struct io_uring_sqe *get_sqe(void) {
+    unsigned head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    if (ring.sq_local_tail - head >= ring.sq_entries) {
+        uring_submit(0);
+        head = __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE);
+    }
+    struct io_uring_sqe *sqe = &ring.sqes[ring.sq_local_tail & *ring.sq_mask];
+    ring.sq_local_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static void buf_return(unsigned short bid) {
+    struct io_uring_buf *b = &ring.buf_ring->bufs[ring.buf_tail & (BUF_COUNT - 1)];
+    b->addr = (uintptr_t)(ring.buffers + (size_t)bid * BUF_SIZE);
+    b->len = BUF_SIZE;
+    b->bid = bid;
+    ring.buf_tail++;
+    __atomic_store_n(&ring.buf_ring->tail, ring.buf_tail, __ATOMIC_RELEASE);
+}
+
+static int u_add_listener(struct listener *l) {
+    if (l->shm) {
+        /* Shared-memory regions are served by the epoll engine only */
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = l->fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->file_index = IORING_FILE_INDEX_ALLOC;
+    sqe->user_data = U_TAG(l, U_ACCEPT);
+    return 0;
+}
+
+static void u_remove_listener(struct listener *l) {
+    /* The final accept completion closes and frees it */
+    l->closing = 1;
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = U_TAG(l, U_ACCEPT);
+    sqe->user_data = U_TAG(NULL, U_LISTEN_CANCEL);
+}
+
+static void u_close_file(struct u_conn *c, int index) {
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = index + 1;
+    sqe->user_data = U_TAG(c, U_CLOSE);
+    c->refs++;
+}
+
+static void u_cancel_file(struct u_conn *c, int index) {
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = index;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_FD_FIXED |
+                        IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = U_TAG(c, U_CANCEL);
+    c->refs++;
+}
+
+static void u_release_queue(struct u_half *h) {
+    for (; h->qlen > 0; h->qlen--, h->qhead++) {
+        buf_return(h->queue[h->qhead % h->qcap].bid);
+    }
+}
+
+/* Tear down: cancel what is in flight, close both files, free when idle */
+static void u_conn_close(struct u_conn *c) {
+    if (c->closing) return;
+    c->closing = 1;
+    stat_active--;
+    if (c->client >= 0) {
+        u_cancel_file(c, c->client);
+        u_close_file(c, c->client);
+    }
+    if (c->upstream >= 0) {
+        u_cancel_file(c, c->upstream);
+        u_close_file(c, c->upstream);
+    }
+    u_release_queue(&c->up);
+    u_release_queue(&c->down);
+}
+
+static void u_arm_recv(struct u_half *h) {
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = h->src;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = U_TAG(h, U_RECV);
+    h->recv_armed = 1;
+    h->paused = 0;
+    h->starved = 0;
+    h->conn->refs++;
+}
+
+static void u_send_next(struct u_half *h) {
+    if (h->qlen == 0 || h->send_busy) return;
+    struct chunk *ch = &h->queue[h->qhead % h->qcap];
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = h->dst;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = (uintptr_t)(ring.buffers + (size_t)ch->bid * BUF_SIZE + ch->off);
+    sqe->len = ch->len - ch->off;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = U_TAG(h, U_SEND);
+    h->send_busy = 1;
+    h->conn->refs++;
+}
+
+/* Pass a finished direction's EOF on once everything before it is sent */
+static void u_maybe_shutdown(struct u_half *h) {
+    if (!h->eof || h->qlen > 0 || h->send_busy || h->shut_sent) return;
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_SHUTDOWN;
+    sqe->fd = h->dst;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->len = SHUT_WR;
+    sqe->user_data = U_TAG(h, U_SHUTDOWN);
+    h->shut_sent = 1;
+    h->conn->refs++;
+}
+
+/* Buffers came back: resume directions that ran out */
+static void u_wake_starved(void) {
+    while (starved) {
+        struct u_half *h = starved;
+        starved = h->next_starved;
+        if (!h->conn->closing && h->starved && !h->recv_armed) u_arm_recv(h);
+    }
+}
+
+/* Double the queue, unwrapping it so the head starts at 0 */
+static int u_grow_queue(struct u_half *h) {
+    unsigned cap = h->qcap ? h->qcap * 2 : QUEUE_INITIAL;
+    struct chunk *queue = malloc(cap * sizeof(*queue));
+    if (!queue) return -1;
+    for (unsigned i = 0; i < h->qlen; i++) queue[i] = h->queue[(h->qhead + i) % h->qcap];
+    free(h->queue);
+    h->queue = queue;
+    h->qcap = cap;
+    h->qhead = 0;
+    return 0;
+}
+
+static void u_on_recv(struct u_half *h, int res, unsigned flags) {
+    struct u_conn *c = h->conn;
+    int more = flags & IORING_CQE_F_MORE;
+    if (!more) {
+        h->recv_armed = 0;
+        c->refs--;
+    }
+
+    if (res > 0) {
+        unsigned short bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (c->closing || (h->qlen == h->qcap && u_grow_queue(h) < 0)) {
+            buf_return(bid);
+            if (!c->closing) u_conn_close(c);
+            return;
+        }
+        h->queue[(h->qhead + h->qlen) % h->qcap] = (struct chunk){ bid, (unsigned)res, 0 };
+        h->qlen++;
+        stat_bytes += res;
+        u_send_next(h);
+        if (h->qlen >= QUEUE_PAUSE && more && !h->paused) {
+            /* Backpressure: stop receiving until the queue drains */
+            h->paused = 1;
+            struct io_uring_sqe *sqe = get_sqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = U_TAG(h, U_RECV);
+            sqe->user_data = U_TAG(h, U_PAUSE);
+            c->refs++;
+        }
+        if (!more && !h->paused && !c->closing) u_arm_recv(h);
+        return;
+    }
+    if (c->closing) return;
+    if (res == 0) {
+        h->eof = 1;
+        u_maybe_shutdown(h);
+    } else if (res == -ENOBUFS) {
+        h->starved = 1;
+        h->next_starved = starved;
+        starved = h;
+    } else if (res == -ECANCELED && h->paused) {
+        /* Re-armed when the queue drains */
+    } else {
+        u_conn_close(c);
+    }
+}
+
+static void u_on_send(struct u_half *h, int res) {
+    struct u_conn *c = h->conn;
+    h->send_busy = 0;
+    c->refs--;
+    if (c->closing) return;
+    if (res < 0) {
+        u_conn_close(c);
+        return;
+    }
+    struct chunk *ch = &h->queue[h->qhead % h->qcap];
+    ch->off += res;
+    if (ch->off == ch->len) {
+        buf_return(ch->bid);
+        h->qhead++;
+        h->qlen--;
+        u_wake_starved();
+    }
+    u_send_next(h);
+    u_maybe_shutdown(h);
+    if (h->paused && !h->recv_armed && !h->eof && h->qlen <= QUEUE_PAUSE / 2) u_arm_recv(h);
+}
+
+static void u_on_accept(struct listener *l, int res, unsigned flags) {
+    if (!(flags & IORING_CQE_F_MORE)) {
+        if (l->closing) {
+            close(l->fd);
+            free(l);
+            if (res >= 0) {
+                /* Accepted while being cancelled; let it go */
+                struct io_uring_sqe *sqe = get_sqe();
+                sqe->opcode = IORING_OP_CLOSE;
+                sqe->file_index = res + 1;
+                sqe->user_data = U_TAG(NULL, U_LISTEN_CANCEL);
+            }
+            return;
+        }
+        u_add_listener(l);
+    }
+    if (res < 0) {
+        if (res != -ECANCELED) log_error("accept %s: %s", l->id, strerror(-res));
+        return;
+    }
+
+    struct u_conn *c = alloc_zeroed(sizeof(*c));
+    if (!c) {
+        struct io_uring_sqe *sqe = get_sqe();
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->file_index = res + 1;
+        sqe->user_data = U_TAG(NULL, U_LISTEN_CANCEL);
+        return;
+    }
+    c->client = res;
+    c->upstream = -1;
+    c->backend = *pick_backend(l);
+    c->up.conn = c;
+    c->down.conn = c;
+    stat_accepted++;
+    stat_active++;
+
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_SOCKET;
+    sqe->fd = c->backend.addr.ss_family;
+    sqe->off = SOCK_STREAM;
+    sqe->file_index = IORING_FILE_INDEX_ALLOC;
+    sqe->user_data = U_TAG(c, U_SOCKET);
+    c->refs++;
+}
+
+static void u_on_socket(struct u_conn *c, int res) {
+    c->refs--;
+    if (res >= 0) c->upstream = res;
+    if (c->closing) {
+        if (res >= 0) u_close_file(c, res);
+        return;
+    }
+    if (res < 0) {
+        u_conn_close(c);
+        return;
+    }
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_CONNECT;
+    sqe->fd = c->upstream;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->addr = (uintptr_t)&c->backend.addr;
+    sqe->off = c->backend.len;
+    sqe->user_data = U_TAG(c, U_CONNECT);
+    c->refs++;
+}
+
+static void u_on_connect(struct u_conn *c, int res) {
+    c->refs--;
+    if (c->closing) return;
+    if (res < 0) {
+        u_conn_close(c);
+        return;
+    }
+    c->up.src = c->client;
+    c->up.dst = c->upstream;
+    c->down.src = c->upstream;
+    c->down.dst = c->client;
+    u_arm_recv(&c->up);
+    u_arm_recv(&c->down);
+}
+
+static void u_on_shutdown(struct u_half *h) {
+    struct u_conn *c = h->conn;
+    c->refs--;
+    h->done = 1;
+    if (c->up.done && c->down.done) u_conn_close(c);
+}
+
+static void u_read_stdin(void) {
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = STDIN_FILENO;
+    sqe->addr = (uintptr_t)stdin_buf;
+    sqe->len = sizeof(stdin_buf);
+    sqe->off = (uint64_t)-1;
+    sqe->user_data = U_TAG(stdin_buf, U_STDIN);
+}
+
+static void u_complete(struct io_uring_cqe *cqe) {
+    void *ptr = U_PTR(cqe->user_data);
+    struct u_conn *c = NULL;
+
+    switch (U_KIND(cqe->user_data)) {
+    case U_STDIN:
+        if (cqe->res <= 0) {
+            stdin_closed = 1;
+            return;
+        }
+        handle_input(stdin_buf, cqe->res);
+        u_read_stdin();
+        return;
+    case U_ACCEPT:
+        u_on_accept(ptr, cqe->res, cqe->flags);
+        return;
+    case U_SOCKET:
+        c = ptr;
+        u_on_socket(c, cqe->res);
+        break;
+    case U_CONNECT:
+        c = ptr;
+        u_on_connect(c, cqe->res);
+        break;
+    case U_RECV:
+        c = ((struct u_half *)ptr)->conn;
+        u_on_recv(ptr, cqe->res, cqe->flags);
+        break;
+    case U_SEND:
+        c = ((struct u_half *)ptr)->conn;
+        u_on_send(ptr, cqe->res);
+        break;
+    case U_SHUTDOWN:
+        c = ((struct u_half *)ptr)->conn;
+        u_on_shutdown(ptr);
+        break;
+    case U_PAUSE:
+        c = ((struct u_half *)ptr)->conn;
+        c->refs--;
+        break;
+    case U_CLOSE:
+    case U_CANCEL:
+        c = ptr;
+        c->refs--;
+        break;
+    default:
+        return;
+    }
+    if (c->closing && c->refs == 0) {
+        /* A starved half may still be listed; unlink it before freeing */
+        for (struct u_half **p = &starved; *p;) {
+            if ((*p)->conn == c) *p = (*p)->next_starved;
+            else p = &(*p)->next_starved;
+        }
+        free(c->up.queue);
+        free(c->down.queue);
+        free(c);
+    }
+}
+
+static void u_run(void) {
+    u_read_stdin();
+    while (!stdin_closed) {
+        if (uring_submit(1) < 0 && errno != EBUSY && errno != EAGAIN) {
+            log_error("io_uring_enter: %s", strerror(errno));
+            return;
+        }
+        unsigned head = *ring.cq_head;
+        unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            u_complete(&ring.cqes[head & *ring.cq_mask]);
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+static int u_setup(void) {
+    struct io_uring_params p;
+    static const unsigned flag_sets[] = {
+        IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN,
+        /* Single-issuer (6.0) also implies multishot recv is available */
+        IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN,
+    };
+    ring.fd = -1;
+    for (size_t i = 0; i < sizeof(flag_sets) / sizeof(flag_sets[0]) && ring.fd < 0; i++) {
+        memset(&p, 0, sizeof(p));
+        p.flags = flag_sets[i] | IORING_SETUP_CQSIZE;
+        p.cq_entries = URING_ENTRIES * 4;
+        ring.fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+        if (ring.fd < 0 && errno != EINVAL) return -1;
+    }
+    if (ring.fd < 0) return -1;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_NODROP) ||
+        !(p.features & IORING_FEAT_FAST_POLL)) {
+        errno = ENOSYS;
+        return -1;
+    }
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    size_t size = sq_size > cq_size ? sq_size : cq_size;
+    char *sq = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring.fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) return -1;
+    ring.sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring.sq_entries = p.sq_entries;
+    ring.sq_local_tail = *ring.sq_tail;
+    ring.cq_head = (unsigned *)(sq + p.cq_off.head);
+    ring.cq_tail = (unsigned *)(sq + p.cq_off.tail);
+    ring.cq_mask = (unsigned *)(sq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(sq + p.cq_off.cqes);
+    for (unsigned i = 0; i < p.sq_entries; i++) ring.sq_array[i] = i;
+    ring.sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED) return -1;
+
+    /* Every operation the engine issues must be supported */
+    static const int ops[] = {
+        IORING_OP_ACCEPT, IORING_OP_SOCKET, IORING_OP_CONNECT, IORING_OP_RECV,
+        IORING_OP_SEND, IORING_OP_SHUTDOWN, IORING_OP_CLOSE, IORING_OP_READ,
+        IORING_OP_ASYNC_CANCEL,
+    };
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, probe_size);
+    if (!probe || syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        free(probe);
+        return -1;
+    }
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+            free(probe);
+            errno = ENOSYS;
+            return -1;
+        }
+    }
+    free(probe);
+
+    /* Sparse fixed-file table that accept and socket allocate from */
+    struct rlimit rl;
+    unsigned files = MAX_FILES;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < files) files = rl.rlim_cur;
+    struct io_uring_rsrc_register files_reg = { .nr = files, .flags = IORING_RSRC_REGISTER_SPARSE };
+    if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_FILES2,
+                &files_reg, sizeof(files_reg)) < 0) {
+        return -1;
+    }
+
+    /* Provided-buffer ring for multishot recv */
+    ring.buf_ring = mmap(NULL, BUF_COUNT * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ring.buffers = mmap(NULL, (size_t)BUF_COUNT * BUF_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring.buf_ring == MAP_FAILED || ring.buffers == MAP_FAILED) return -1;
+    struct io_uring_buf_reg buf_reg = {
+        .ring_addr = (uintptr_t)ring.buf_ring,
+        .ring_entries = BUF_COUNT,
+        .bgid = BUF_GROUP,
+    };
+    if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PBUF_RING, &buf_reg, 1) < 0) {
+        return -1;
+    }
+    for (unsigned i = 0; i < BUF_COUNT; i++) buf_return(i);
+
+    /* Registered ring fd saves a file lookup per io_uring_enter; optional */
+    ring.enter_fd = ring.fd;
+    struct io_uring_rsrc_update ring_reg = { .offset = -1U, .data = (uint64_t)ring.fd };
+    if (syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_RING_FDS, &ring_reg, 1) == 1) {
+        ring.enter_fd = ring_reg.offset;
+        ring.enter_flags = IORING_ENTER_REGISTERED_RING;
+    }
+    return 0;
+}
+
+static const struct engine uring_engine = {
+    .name = "io_uring",
+    .add_listener = u_add_listener,
+    .remove_listener = u_remove_listener,
+    .run = u_run,
+};
+
+// ============ Main ============
+
+int main(int argc, char **argv) {
+    const char *wanted = "auto";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            wanted = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--engine auto|io_uring|epoll|sockmap]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    if (strcmp(wanted, "sockmap") == 0) {
+        if (sockmap_setup() == 0) {
+            engine = &sockmap_engine;
+        } else {
+            log_error("sockmap unavailable (%s), using auto", strerror(errno));
+            wanted = "auto";
+        }
+    }
+    if (!engine && strcmp(wanted, "epoll") != 0) {
+        if (u_setup() == 0) {
+            engine = &uring_engine;
+        } else {
+            log_error("io_uring unavailable (%s), using epoll", strerror(errno));
+            if (ring.fd >= 0) close(ring.fd);
+        }
+    }
+    if (!engine || engine == &sockmap_engine) {
+        if (ep_init() < 0) {
+            log_error("epoll: %s", strerror(errno));
+            return 1;
+        }
+        if (!engine) engine = &epoll_engine;
+    }
+    reply("ready %s", engine->name);
+    engine->run();
+    return 0;
+}
@@ -0,0 +1,433 @@
+/**
+ * lohost_shm.c - The daemon's end of the shared-memory transport (Linux)
+ *
+ * A Node-API addon. It connects to a client relay's setup socket, maps the
+ * region the relay hands over (see lohost_shm.h) and watches the daemon's
+ * eventfd from libuv, so channel news arrives as ordinary event-loop
+ * callbacks. src/shm.ts builds sockets for http.request on top:
+ *
+ *   open(path, onReady, onClose, onChannels)  Connect; onChannels(lo, hi)
+ *                                             gets the mask of busy channels
+ *   connect(region)                           A free channel, or -1
+ *   write(region, ch, buffer, offset)         Bytes copied into the ring
+ *   read(region, ch)                          A Buffer, or null when empty
+ *   state(region, ch)                         cflags | error << 8
+ *   end / abort / release(region, ch)
+ *   close(region)
+ *
+ * Compile: gcc -shared -fPIC -O2 -I<node>/include/node -o lohost_shm.node lohost_shm.c
+ */
+
+#define _GNU_SOURCE
+#define NAPI_VERSION 8
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <node_api.h>
+#include <uv.h>
+
+#include "lohost_shm.h"
+
+/* Longest read() result; the rest stays in the ring for the next call */
+#define READ_MAX (64 * 1024)
+
+struct region {
+    napi_env env;
+    napi_ref on_ready, on_close, on_channels;
+    napi_async_context context;
+    int setup, to_relay, to_daemon;
+    struct shm_header *h;
+    uv_poll_t setup_poll, bell_poll;
+    int bell_started;
+    int closed;
+    int handles;                    /* uv handles still to be closed */
+    int finalized;                  /* JS let go of the region's external */
+    unsigned char busy[SHM_CHANNELS];
+    unsigned char used[SHM_CHANNELS];
+};
+
+#define CHECK(call)                                                          \
+    do {                                                                     \
+        if ((call) != napi_ok) return NULL;                                  \
+    } while (0)
+
+static napi_value throw_errno(napi_env env, const char *what, int err) {
+    napi_value msg, code, error;
+    char text[256];
+    snprintf(text, sizeof(text), "%s: %s", what, strerror(err));
+    napi_create_string_utf8(env, text, NAPI_AUTO_LENGTH, &msg);
+    napi_create_int32(env, err, &code);
+    napi_create_error(env, NULL, msg, &error);
+    napi_set_named_property(env, error, "errno", code);
+    napi_throw(env, error);
+    return NULL;
+}
+
+static void call(struct region *r, napi_ref ref, size_t argc, const napi_value *argv) {
+    napi_handle_scope scope;
+    napi_value fn, recv;
+    napi_open_handle_scope(r->env, &scope);
+    napi_get_reference_value(r->env, ref, &fn);
+    napi_get_global(r->env, &recv);
+    napi_make_callback(r->env, r->context, recv, fn, argc, argv, NULL);
+    napi_close_handle_scope(r->env, scope);
+}
+
+/* Freed once both libuv and JS are done with it; calls on a closed region do nothing */
+static void region_free(struct region *r) {
+    napi_delete_reference(r->env, r->on_ready);
+    napi_delete_reference(r->env, r->on_close);
+    napi_delete_reference(r->env, r->on_channels);
+    napi_async_destroy(r->env, r->context);
+    free(r);
+}
+
+static void on_handle_closed(uv_handle_t *handle) {
+    struct region *r = handle->data;
+    if (--r->handles == 0 && r->finalized) region_free(r);
+}
+
+static void region_close(struct region *r) {
+    if (r->closed) return;
+    r->closed = 1;
+    r->handles = 1 + r->bell_started;
+    uv_close((uv_handle_t *)&r->setup_poll, on_handle_closed);
+    if (r->bell_started) uv_close((uv_handle_t *)&r->bell_poll, on_handle_closed);
+    close(r->setup);
+    if (r->h) munmap(r->h, SHM_SIZE);
+    if (r->to_relay >= 0) close(r->to_relay);
+    if (r->to_daemon >= 0) close(r->to_daemon);
+}
+
+static void notify(struct region *r, unsigned ch) {
+    if (shm_post(&r->h->to_relay, ch)) shm_kick(r->to_relay);
+}
+
+static void on_bell(uv_poll_t *poll, int status, int events) {
+    struct region *r = poll->data;
+    (void)status;
+    (void)events;
+    if (r->closed) return;
+    uint64_t n;
+    (void)!read(r->to_daemon, &n, sizeof(n));
+    uint64_t mask = atomic_exchange(&r->h->to_daemon, 0);
+    if (!mask) return;
+    napi_handle_scope scope;
+    napi_value argv[2];
+    napi_open_handle_scope(r->env, &scope);
+    napi_create_uint32(r->env, (uint32_t)mask, &argv[0]);
+    napi_create_uint32(r->env, (uint32_t)(mask >> 32), &argv[1]);
+    call(r, r->on_channels, 2, argv);
+    napi_close_handle_scope(r->env, scope);
+}
+
+/* The relay's fds arrive once; after that the setup socket only ends */
+static int receive_region(struct region *r) {
+    uint32_t magic = 0;
+    int fds[3] = { -1, -1, -1 };
+    char control[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = { .iov_base = &magic, .iov_len = sizeof(magic) };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                          .msg_control = control, .msg_controllen = sizeof(control) };
+    ssize_t n = recvmsg(r->setup, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0 && errno == EAGAIN) return 0;
+    struct cmsghdr *cmsg = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+        cmsg->cmsg_len == CMSG_LEN(sizeof(fds))) {
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    }
+    struct stat st;
+    void *h = MAP_FAILED;
+    if (n == sizeof(magic) && magic == SHM_MAGIC && fds[0] >= 0 &&
+        fstat(fds[0], &st) == 0 && (size_t)st.st_size >= SHM_SIZE) {
+        h = mmap(NULL, SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    }
+    if (fds[0] >= 0) close(fds[0]);
+    r->to_relay = fds[1];
+    r->to_daemon = fds[2];
+    if (h == MAP_FAILED) return -1;
+    r->h = h;
+    /* A relay built from another lohost_shm.h */
+    if (r->h->version != SHM_VERSION || r->h->channels != SHM_CHANNELS ||
+        r->h->ring_bytes != SHM_RING_BYTES || r->to_relay < 0 || r->to_daemon < 0) {
+        return -1;
+    }
+    if (uv_poll_init(uv_handle_get_loop((uv_handle_t *)&r->setup_poll), &r->bell_poll, r->to_daemon) != 0) {
+        return -1;
+    }
+    r->bell_poll.data = r;
+    r->bell_started = 1;
+    uv_poll_start(&r->bell_poll, UV_READABLE, on_bell);
+    uv_unref((uv_handle_t *)&r->bell_poll);
+    return 1;
+}
+
+static void on_setup(uv_poll_t *poll, int status, int events) {
+    struct region *r = poll->data;
+    if (r->closed) return;
+    if (!r->h && status == 0 && (events & UV_READABLE)) {
+        int got = receive_region(r);
+        if (got == 0) return;
+        if (got > 0) {
+            call(r, r->on_ready, 0, NULL);
+            return;
+        }
+    } else if (r->h && status == 0 && !(events & UV_DISCONNECT)) {
+        char buf[64];
+        ssize_t n = read(r->setup, buf, sizeof(buf));
+        if (n > 0 || (n < 0 && errno == EAGAIN)) return;
+    }
+    region_close(r);
+    call(r, r->on_close, 0, NULL);
+}
+
+static void on_finalize(napi_env env, void *data, void *hint) {
+    struct region *r = data;
+    (void)env;
+    (void)hint;
+    r->finalized = 1;
+    if (!r->closed) region_close(r);
+    else if (r->handles == 0) region_free(r);
+}
+
+static struct region *get_region(napi_env env, napi_value value) {
+    struct region *r = NULL;
+    napi_get_value_external(env, value, (void **)&r);
+    return r && !r->closed && r->h ? r : NULL;
+}
+
+/* (region, ch, ...) with a usable region and channel */
+static struct region *get_args(napi_env env, napi_callback_info info, size_t want,
+                               napi_value *argv, unsigned *ch) {
+    size_t argc = want;
+    if (napi_get_cb_info(env, info, &argc, argv, NULL, NULL) != napi_ok || argc < want) return NULL;
+    struct region *r = get_region(env, argv[0]);
+    uint32_t c;
+    if (!r || napi_get_value_uint32(env, argv[1], &c) != napi_ok || c >= SHM_CHANNELS) return NULL;
+    *ch = c;
+    return r;
+}
+
+static napi_value js_open(napi_env env, napi_callback_info info) {
+    size_t argc = 4;
+    napi_value argv[4], result, name;
+    CHECK(napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    size_t len;
+    if (argc < 4 || napi_get_value_string_utf8(env, argv[0], path, sizeof(path), &len) != napi_ok ||
+        len >= sizeof(path) - 1) {
+        napi_throw_type_error(env, NULL, "open(path, onReady, onClose, onChannels)");
+        return NULL;
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    memcpy(addr.sun_path, path, len + 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return throw_errno(env, "socket", errno);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int err = errno;
+        close(fd);
+        return throw_errno(env, path, err);
+    }
+
+    uv_loop_t *loop;
+    struct region *r = calloc(1, sizeof(*r));
+    if (!r) {
+        close(fd);
+        return throw_errno(env, "open", ENOMEM);
+    }
+    r->env = env;
+    r->setup = fd;
+    r->to_relay = r->to_daemon = -1;
+    if (napi_get_uv_event_loop(env, &loop) != napi_ok || uv_poll_init(loop, &r->setup_poll, fd) != 0) {
+        close(fd);
+        free(r);
+        return throw_errno(env, "uv_poll_init", EINVAL);
+    }
+    r->setup_poll.data = r;
+    napi_create_reference(env, argv[1], 1, &r->on_ready);
+    napi_create_reference(env, argv[2], 1, &r->on_close);
+    napi_create_reference(env, argv[3], 1, &r->on_channels);
+    napi_create_string_utf8(env, "lohost:shm", NAPI_AUTO_LENGTH, &name);
+    napi_async_init(env, NULL, name, &r->context);
+    uv_poll_start(&r->setup_poll, UV_READABLE | UV_DISCONNECT, on_setup);
+    uv_unref((uv_handle_t *)&r->setup_poll);
+    CHECK(napi_create_external(env, r, on_finalize, NULL, &result));
+    return result;
+}
+
+/* Reset a channel we and the relay are both done with, and open it again */
+static napi_value js_connect(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[1], result;
+    CHECK(napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+    struct region *r = argc == 1 ? get_region(env, argv[0]) : NULL;
+    int found = -1;
+    for (unsigned ch = 0; r && ch < SHM_CHANNELS; ch++) {
+        struct shm_channel *c = &r->h->channel[ch];
+        if (r->busy[ch] || (r->used[ch] && !(atomic_load(&c->cflags) & SHM_DONE))) continue;
+        atomic_store_explicit(&c->d2c.head, 0, memory_order_relaxed);
+        atomic_store_explicit(&c->d2c.tail, 0, memory_order_relaxed);
+        atomic_store_explicit(&c->d2c.waiting, 0, memory_order_relaxed);
+        atomic_store_explicit(&c->c2d.head, 0, memory_order_relaxed);
+        atomic_store_explicit(&c->c2d.tail, 0, memory_order_relaxed);
+        atomic_store_explicit(&c->c2d.waiting, 0, memory_order_relaxed);
+        atomic_store_explicit(&c->dflags, 0, memory_order_relaxed);
+        atomic_store_explicit(&c->cflags, 0, memory_order_relaxed);
+        atomic_store_explicit(&c->error, 0, memory_order_relaxed);
+        /* Publishes the resets above to the relay's acquire load of gen */
+        atomic_fetch_add_explicit(&c->gen, 1, memory_order_release);
+        r->busy[ch] = r->used[ch] = 1;
+        notify(r, ch);
+        found = ch;
+        break;
+    }
+    CHECK(napi_create_int32(env, found, &result));
+    return result;
+}
+
+static napi_value js_write(napi_env env, napi_callback_info info) {
+    napi_value argv[4], result;
+    unsigned ch;
+    struct region *r = get_args(env, info, 4, argv, &ch);
+    char *data;
+    size_t len;
+    uint32_t offset;
+    size_t copied = 0;
+    if (r && napi_get_buffer_info(env, argv[2], (void **)&data, &len) == napi_ok &&
+        napi_get_value_uint32(env, argv[3], &offset) == napi_ok && offset < len) {
+        struct shm_ring *ring = &r->h->channel[ch].d2c;
+        struct iovec iov[2];
+        int iovcnt;
+        data += offset;
+        len -= offset;
+        for (;;) {
+            size_t room = shm_ring_iov(r->h, ch, ring, 1, iov, &iovcnt);
+            if (room == 0) {
+                /* Full: the relay posts the channel once it has read some */
+                if (shm_ring_wait(ring)) break;
+                continue;
+            }
+            for (int i = 0; i < iovcnt && copied < len; i++) {
+                size_t n = iov[i].iov_len < len - copied ? iov[i].iov_len : len - copied;
+                memcpy(iov[i].iov_base, data + copied, n);
+                copied += n;
+            }
+            break;
+        }
+        if (copied) {
+            uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed) + copied;
+            atomic_store_explicit(&ring->head, head, memory_order_release);
+            notify(r, ch);
+        }
+    }
+    CHECK(napi_create_uint32(env, (uint32_t)copied, &result));
+    return result;
+}
+
+static napi_value js_read(napi_env env, napi_callback_info info) {
+    napi_value argv[2], result;
+    unsigned ch;
+    struct region *r = get_args(env, info, 2, argv, &ch);
+    if (!r) {
+        CHECK(napi_get_null(env, &result));
+        return result;
+    }
+    struct shm_ring *ring = &r->h->channel[ch].c2d;
+    struct iovec iov[2];
+    int iovcnt;
+    size_t len = shm_ring_iov(r->h, ch, ring, 0, iov, &iovcnt);
+    if (len == 0) {
+        CHECK(napi_get_null(env, &result));
+        return result;
+    }
+    if (len > READ_MAX) len = READ_MAX;
+    char *out;
+    CHECK(napi_create_buffer(env, len, (void **)&out, &result));
+    size_t copied = 0;
+    for (int i = 0; i < iovcnt && copied < len; i++) {
+        size_t n = iov[i].iov_len < len - copied ? iov[i].iov_len : len - copied;
+        memcpy(out + copied, iov[i].iov_base, n);
+        copied += n;
+    }
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed) + len;
+    if (shm_ring_consumed(ring, tail)) notify(r, ch);
+    return result;
+}
+
+static napi_value js_state(napi_env env, napi_callback_info info) {
+    napi_value argv[2], result;
+    unsigned ch;
+    struct region *r = get_args(env, info, 2, argv, &ch);
+    /* A region that went away reads as an aborted channel */
+    uint32_t state = SHM_ABORT | SHM_DONE | (ECONNRESET << 8);
+    if (r) {
+        struct shm_channel *c = &r->h->channel[ch];
+        uint32_t cflags = atomic_load_explicit(&c->cflags, memory_order_acquire);
+        state = cflags | (uint32_t)atomic_load(&c->error) << 8;
+    }
+    CHECK(napi_create_uint32(env, state, &result));
+    return result;
+}
+
+static napi_value set_dflags(napi_env env, napi_callback_info info, uint32_t flags) {
+    napi_value argv[2];
+    unsigned ch;
+    struct region *r = get_args(env, info, 2, argv, &ch);
+    if (r) {
+        atomic_fetch_or_explicit(&r->h->channel[ch].dflags, flags, memory_order_release);
+        notify(r, ch);
+    }
+    return NULL;
+}
+
+static napi_value js_end(napi_env env, napi_callback_info info) {
+    return set_dflags(env, info, SHM_EOF);
+}
+
+static napi_value js_abort(napi_env env, napi_callback_info info) {
+    return set_dflags(env, info, SHM_ABORT);
+}
+
+/* The socket on this channel is gone; it may be reused once the relay is done too */
+static napi_value js_release(napi_env env, napi_callback_info info) {
+    napi_value argv[2];
+    unsigned ch;
+    struct region *r = get_args(env, info, 2, argv, &ch);
+    if (r) r->busy[ch] = 0;
+    return NULL;
+}
+
+static napi_value js_close(napi_env env, napi_callback_info info) {
+    size_t argc = 1;
+    napi_value argv[1];
+    struct region *r = NULL;
+    CHECK(napi_get_cb_info(env, info, &argc, argv, NULL, NULL));
+    if (argc == 1) napi_get_value_external(env, argv[0], (void **)&r);
+    if (r) region_close(r);
+    return NULL;
+}
+
+static napi_value init(napi_env env, napi_value exports) {
+    napi_property_descriptor props[] = {
+        { "open", NULL, js_open, NULL, NULL, NULL, napi_default_method, NULL },
+        { "connect", NULL, js_connect, NULL, NULL, NULL, napi_default_method, NULL },
+        { "write", NULL, js_write, NULL, NULL, NULL, napi_default_method, NULL },
+        { "read", NULL, js_read, NULL, NULL, NULL, napi_default_method, NULL },
+        { "state", NULL, js_state, NULL, NULL, NULL, napi_default_method, NULL },
+        { "end", NULL, js_end, NULL, NULL, NULL, napi_default_method, NULL },
+        { "abort", NULL, js_abort, NULL, NULL, NULL, napi_default_method, NULL },
+        { "release", NULL, js_release, NULL, NULL, NULL, napi_default_method, NULL },
+        { "close", NULL, js_close, NULL, NULL, NULL, napi_default_method, NULL },
+    };
+    CHECK(napi_define_properties(env, exports, sizeof(props) / sizeof(props[0]), props));
+    return exports;
+}
+
+NAPI_MODULE(NODE_GYP_MODULE_NAME, init)
@@ -0,0 +1,136 @@
+/*
+ * lohost shared-memory transport
+ *
+ * Layout of the region a client's lohost-relay shares with the daemon, so
+ * that requests and responses cross between the two processes without a
+ * Unix socket hop. Included by lohost_relay.c (the client end) and
+ * lohost_shm.c (the daemon's Node addon).
+ *
+ * The region holds SHM_CHANNELS channels. A channel stands for one
+ * connection: the daemon opens it, the relay connects it to the app, and
+ * each direction is a single-producer single-consumer byte ring.
+ *
+ *   to_relay / to_daemon   One bit per channel with news for that side.
+ *                          Whoever sets the first bit of an empty mask
+ *                          writes the other side's eventfd, so a busy
+ *                          peer is not woken once per chunk.
+ *   gen                    Bumped by the daemon to open a channel again.
+ *   dflags / cflags        End-of-stream and abort, from each side; the
+ *                          relay sets SHM_DONE once it has let go.
+ *   waiting                Set by a producer that found its ring full;
+ *                          the consumer rings its doorbell after reading.
+ *
+ * Setup: the relay accepts on the client's setup socket, creates the memfd
+ * and two eventfds, and sends them with SCM_RIGHTS after SHM_MAGIC. The
+ * connection stays open; either side hanging up ends the region.
+ */
+
+#ifndef LOHOST_SHM_H
+#define LOHOST_SHM_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#define SHM_MAGIC 0x53484c4cu       /* "LLHS" */
+#define SHM_VERSION 1
+#define SHM_CHANNELS 64
+#define SHM_RING_BYTES (256 * 1024)
+
+/* dflags and cflags */
+#define SHM_EOF 1u
+#define SHM_ABORT 2u
+#define SHM_CONNECTED 4u            /* cflags only */
+#define SHM_DONE 8u                 /* cflags only */
+
+struct shm_ring {
+    _Atomic uint64_t head;          /* bytes produced */
+    char pad0[56];
+    _Atomic uint64_t tail;          /* bytes consumed */
+    _Atomic uint32_t waiting;
+    char pad1[52];
+};
+
+struct shm_channel {
+    _Atomic uint32_t gen;
+    _Atomic uint32_t dflags;
+    _Atomic uint32_t cflags;
+    _Atomic int32_t error;          /* errno behind a relay-side SHM_ABORT */
+    char pad[48];
+    struct shm_ring d2c;            /* daemon → relay → app */
+    struct shm_ring c2d;            /* app → relay → daemon */
+};
+
+struct shm_header {
+    uint32_t magic, version, channels, ring_bytes;
+    char pad0[48];
+    _Atomic uint64_t to_relay;
+    char pad1[56];
+    _Atomic uint64_t to_daemon;
+    char pad2[56];
+    struct shm_channel channel[SHM_CHANNELS];
+};
+
+#define SHM_DATA_OFFSET ((sizeof(struct shm_header) + 4095) & ~(size_t)4095)
+#define SHM_SIZE (SHM_DATA_OFFSET + (size_t)SHM_CHANNELS * 2 * SHM_RING_BYTES)
+
+/* The ring's bytes: channel ch's d2c ring, then its c2d ring */
+static inline char *shm_ring_data(struct shm_header *h, unsigned ch, const struct shm_ring *r) {
+    char *base = (char *)h + SHM_DATA_OFFSET + (size_t)ch * 2 * SHM_RING_BYTES;
+    return r == &h->channel[ch].d2c ? base : base + SHM_RING_BYTES;
+}
+
+/* Tell the other side that `ch` changed; returns 1 if its eventfd must be written */
+static inline int shm_post(_Atomic uint64_t *mask, unsigned ch) {
+    return atomic_fetch_or(mask, (uint64_t)1 << ch) == 0;
+}
+
+static inline void shm_kick(int eventfd) {
+    uint64_t one = 1;
+    (void)!write(eventfd, &one, sizeof(one));
+}
+
+/*
+ * Up to two iovecs covering the ring's readable (or, with `space`, its
+ * writable) bytes, in order. Returns the total.
+ */
+static inline size_t shm_ring_iov(struct shm_header *h, unsigned ch, struct shm_ring *r,
+                                  int space, struct iovec iov[2], int *iovcnt) {
+    uint64_t head = atomic_load_explicit(&r->head, space ? memory_order_relaxed : memory_order_acquire);
+    uint64_t tail = atomic_load_explicit(&r->tail, space ? memory_order_acquire : memory_order_relaxed);
+    uint64_t start = space ? head : tail;
+    size_t len = space ? SHM_RING_BYTES - (size_t)(head - tail) : (size_t)(head - tail);
+    size_t off = (size_t)(start & (SHM_RING_BYTES - 1));
+    size_t first = len < SHM_RING_BYTES - off ? len : SHM_RING_BYTES - off;
+    char *data = shm_ring_data(h, ch, r);
+    iov[0].iov_base = data + off;
+    iov[0].iov_len = first;
+    iov[1].iov_base = data;
+    iov[1].iov_len = len - first;
+    *iovcnt = len == first ? 1 : 2;
+    return len;
+}
+
+/*
+ * Mark a full ring as waited on. Returns 0 if room appeared meanwhile, in
+ * which case the producer just carries on. The consumer's tail update and
+ * this check are ordered by seq_cst, so one of the two sees the other.
+ */
+static inline int shm_ring_wait(struct shm_ring *r) {
+    atomic_store(&r->waiting, 1);
+    if (atomic_load(&r->head) - atomic_load(&r->tail) < SHM_RING_BYTES) {
+        atomic_store(&r->waiting, 0);
+        return 0;
+    }
+    return 1;
+}
+
+/* After consuming: whether the producer waits for room and must be told */
+static inline int shm_ring_consumed(struct shm_ring *r, uint64_t tail) {
+    atomic_store(&r->tail, tail);
+    return atomic_load(&r->waiting) && atomic_exchange(&r->waiting, 0);
+}
+
+#endif
@@ -0,0 +1,112 @@
+/**
+ * Per-service admission control
+ *
+ * Caps the number of requests a backend sees at once. Requests past the cap
+ * wait in a bounded queue (FIFO, or LIFO to favour fresh requests under
+ * overload) and are turned away when the queue is full or they have waited
+ * too long. Limits are read from the service's options on every call, so
+ * they can change while requests are queued.
+ */
+
+import type { ServiceOptions } from "./options.js";
+
+export type RejectReason = "queue-full" | "timeout";
+
+interface Waiter {
+  admit: () => void;
+  reject: (reason: RejectReason) => void;
+  timer: NodeJS.Timeout;
+}
+
+/** Handle for a queued request, used to withdraw it if the client leaves. */
+export interface Ticket {
+  cancel(): void;
+}
+
+export class AdmissionQueue {
+  /** Requests currently holding a slot. */
+  inFlight = 0;
+
+  private options: ServiceOptions;
+  private waiting: Waiter[] = [];
+
+  constructor(options: ServiceOptions) {
+    this.options = options;
+  }
+
+  /** Requests waiting for a slot. */
+  get queued(): number {
+    return this.waiting.length;
+  }
+
+  /** Point at a new options object (re-registration). */
+  setOptions(options: ServiceOptions): void {
+    this.options = options;
+    this.drain();
+  }
+
+  /** Take a slot if one is free; the caller must `release()` it. */
+  tryAcquire(): boolean {
+    const limit = this.options.maxInFlight;
+    if (limit > 0 && this.inFlight >= limit) return false;
+    this.inFlight++;
+    return true;
+  }
+
+  /**
+   * Wait for a slot. Exactly one of `admit` (holding a slot) or `reject` is
+   * called, unless the ticket is cancelled first.
+   */
+  enqueue(admit: () => void, reject: (reason: RejectReason) => void): Ticket | null {
+    const { queueSize, queueOrder, queueTimeout } = this.options;
+    if (this.waiting.length >= queueSize) {
+      // LIFO sheds the oldest waiter, which is the one most likely to be
+      // abandoned by its client anyway; FIFO turns the newcomer away.
+      const shed = queueOrder === "lifo" ? this.waiting.shift() : undefined;
+      if (!shed) {
+        reject("queue-full");
+        return null;
+      }
+      clearTimeout(shed.timer);
+      shed.reject("queue-full");
+    }
+
+    const waiter: Waiter = {
+      admit,
+      reject,
+      timer: setTimeout(() => {
+        this.remove(waiter);
+        reject("timeout");
+      }, queueTimeout),
+    };
+    this.waiting.push(waiter);
+
+    return {
+      cancel: () => {
+        if (this.remove(waiter)) clearTimeout(waiter.timer);
+      },
+    };
+  }
+
+  /** Give a slot back and hand it to the next waiter, if any. */
+  release(): void {
+    this.inFlight--;
+    this.drain();
+  }
+
+  private drain(): void {
+    while (this.waiting.length > 0 && this.tryAcquire()) {
+      const waiter =
+        this.options.queueOrder === "lifo" ? this.waiting.pop()! : this.waiting.shift()!;
+      clearTimeout(waiter.timer);
+      waiter.admit();
+    }
+  }
+
+  private remove(waiter: Waiter): boolean {
+    const index = this.waiting.indexOf(waiter);
+    if (index === -1) return false;
+    this.waiting.splice(index, 1);
+    return true;
+  }
+}
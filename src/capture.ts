@@ -0,0 +1,253 @@
+/**
+ * Traffic capture format
+ *
+ * A capture is an append-only sequence of length-prefixed binary records:
+ *
+ *   u32 length (LE, of what follows) | u8 type | payload
+ *
+ * The file starts with the magic "LHCAP\x01", then a header record (JSON:
+ * service name, start time) and one exchange record per proxied request,
+ * written when the response completes:
+ *
+ *   f64 offset ms | u16 status | u32 response bytes | u32 response FNV-1a |
+ *   u8 flags | u8+method | u16+path | u16 count, (u16+name, u16+value)* |
+ *   u32+body
+ *
+ * Strings are latin1, as on the wire. A capture cut short (daemon stopped,
+ * Ctrl-C) loses at most its last, partial record.
+ */
+
+import type { IncomingMessage, ServerResponse } from "node:http";
+import { performance } from "node:perf_hooks";
+import type { Readable } from "node:stream";
+
+export const CAPTURE_MAGIC = Buffer.from("LHCAP\x01", "latin1");
+
+const RECORD_HEADER = 1;
+const RECORD_EXCHANGE = 2;
+
+// Request bodies beyond this are cut (and flagged) rather than held in memory
+const MAX_BODY = 8 * 1024 * 1024;
+
+// Unsent capture bytes allowed before records are dropped instead of queued
+const MAX_BACKLOG = 32 * 1024 * 1024;
+
+const FLAG_BODY_TRUNCATED = 1;
+
+// FNV-1a offset basis: the hash of an empty body
+const EMPTY_HASH = 0x811c9dc5;
+
+// Hop-by-hop and framing headers; replay lets the HTTP client set its own
+const SKIPPED_HEADERS = new Set([
+  "connection",
+  "keep-alive",
+  "content-length",
+  "transfer-encoding",
+  "upgrade",
+  "x-lohost-timing",
+]);
+
+export interface CaptureHeader {
+  service: string;
+  startedAt: string;
+}
+
+export interface CapturedExchange {
+  /** Request start, in milliseconds since the capture began. */
+  offsetMs: number;
+  method: string;
+  path: string;
+  /** Flat [name, value, ...] list, as in IncomingMessage.rawHeaders. */
+  headers: string[];
+  body: Buffer;
+  bodyTruncated: boolean;
+  /** What the service answered at capture time, for mismatch detection. */
+  status: number;
+  responseBytes: number;
+  responseHash: number;
+}
+
+/** 32-bit FNV-1a, updated incrementally over response chunks. */
+export function fnv1a(chunk: Buffer, hash = EMPTY_HASH): number {
+  for (let i = 0; i < chunk.length; i++) {
+    hash ^= chunk[i];
+    hash = Math.imul(hash, 0x01000193) >>> 0;
+  }
+  return hash;
+}
+
+/**
+ * Records one service's traffic into `out` (the capture download). Only one
+ * recorder per service runs at a time.
+ */
+export class CaptureRecorder {
+  readonly service: string;
+  recorded = 0;
+  dropped = 0;
+
+  private out: ServerResponse;
+  private startedAt = performance.now();
+
+  constructor(service: string, out: ServerResponse) {
+    this.service = service;
+    this.out = out;
+    const header: CaptureHeader = { service, startedAt: new Date().toISOString() };
+    out.write(CAPTURE_MAGIC);
+    out.write(frame(RECORD_HEADER, Buffer.from(JSON.stringify(header))));
+  }
+
+  /**
+   * Start recording one request. Call it just before the request body is
+   * consumed; returns the response observer the proxy feeds once the
+   * backend answers.
+   */
+  record(req: IncomingMessage, res: ServerResponse): ExchangeObserver {
+    const offsetMs = performance.now() - this.startedAt;
+    const chunks: Buffer[] = [];
+    let bodyBytes = 0;
+    let truncated = false;
+    const observer = new ExchangeObserver();
+
+    const onData = (chunk: Buffer) => {
+      if (bodyBytes + chunk.length > MAX_BODY) {
+        truncated = true;
+        req.off("data", onData);
+        return;
+      }
+      chunks.push(chunk);
+      bodyBytes += chunk.length;
+    };
+    req.on("data", onData);
+
+    res.once("close", () => {
+      if (this.out.writableEnded || this.out.destroyed) return;
+      if (this.out.writableLength > MAX_BACKLOG) {
+        this.dropped++;
+        return;
+      }
+      this.recorded++;
+      // A 304 sends no body, even when `etag` read the backend's 200 to decide on it
+      const bodyless = res.statusCode === 304;
+      this.out.write(encodeExchange({
+        offsetMs,
+        method: req.method ?? "GET",
+        path: req.url ?? "/",
+        headers: req.rawHeaders,
+        body: Buffer.concat(chunks, bodyBytes),
+        bodyTruncated: truncated,
+        status: res.statusCode,
+        responseBytes: bodyless ? 0 : observer.bytes,
+        responseHash: bodyless ? EMPTY_HASH : observer.hash,
+      }));
+    });
+    return observer;
+  }
+}
+
+/** Running length and hash of a backend response body. */
+export class ExchangeObserver {
+  bytes = 0;
+  hash = EMPTY_HASH;
+
+  observe(proxyRes: Readable): void {
+    proxyRes.on("data", (chunk: Buffer) => {
+      this.bytes += chunk.length;
+      this.hash = fnv1a(chunk, this.hash);
+    });
+  }
+}
+
+export function encodeExchange(e: CapturedExchange): Buffer {
+  const headers: string[] = [];
+  for (let i = 0; i < e.headers.length; i += 2) {
+    if (SKIPPED_HEADERS.has(e.headers[i].toLowerCase())) continue;
+    headers.push(e.headers[i], e.headers[i + 1]);
+  }
+
+  let size = 8 + 2 + 4 + 4 + 1 + 1 + e.method.length + 2 + e.path.length + 2 + 4 + e.body.length;
+  for (const h of headers) size += 2 + Buffer.byteLength(h, "latin1");
+
+  const buf = Buffer.allocUnsafe(size);
+  let o = buf.writeDoubleLE(e.offsetMs, 0);
+  o = buf.writeUInt16LE(e.status, o);
+  o = buf.writeUInt32LE(e.responseBytes >>> 0, o);
+  o = buf.writeUInt32LE(e.responseHash >>> 0, o);
+  o = buf.writeUInt8(e.bodyTruncated ? FLAG_BODY_TRUNCATED : 0, o);
+  o = buf.writeUInt8(e.method.length, o);
+  o += buf.write(e.method, o, "latin1");
+  o = buf.writeUInt16LE(e.path.length, o);
+  o += buf.write(e.path, o, "latin1");
+  o = buf.writeUInt16LE(headers.length / 2, o);
+  for (const h of headers) {
+    o = buf.writeUInt16LE(Buffer.byteLength(h, "latin1"), o);
+    o += buf.write(h, o, "latin1");
+  }
+  o = buf.writeUInt32LE(e.body.length, o);
+  e.body.copy(buf, o);
+  return frame(RECORD_EXCHANGE, buf);
+}
+
+/** Parse a whole capture file; a truncated final record is ignored. */
+export function readCapture(data: Buffer): { header: CaptureHeader; exchanges: CapturedExchange[] } {
+  if (data.length < CAPTURE_MAGIC.length || !data.subarray(0, CAPTURE_MAGIC.length).equals(CAPTURE_MAGIC)) {
+    throw new Error("Not a lohost capture file");
+  }
+
+  let header: CaptureHeader | null = null;
+  const exchanges: CapturedExchange[] = [];
+  let pos = CAPTURE_MAGIC.length;
+  while (pos + 5 <= data.length) {
+    const length = data.readUInt32LE(pos);
+    if (pos + 4 + length > data.length) break;
+    const type = data[pos + 4];
+    const payload = data.subarray(pos + 5, pos + 4 + length);
+    pos += 4 + length;
+
+    if (type === RECORD_HEADER) {
+      header = JSON.parse(payload.toString()) as CaptureHeader;
+    } else if (type === RECORD_EXCHANGE) {
+      exchanges.push(decodeExchange(payload));
+    }
+  }
+  if (!header) throw new Error("Capture has no header record");
+  return { header, exchanges };
+}
+
+function decodeExchange(buf: Buffer): CapturedExchange {
+  let o = 0;
+  const offsetMs = buf.readDoubleLE(o); o += 8;
+  const status = buf.readUInt16LE(o); o += 2;
+  const responseBytes = buf.readUInt32LE(o); o += 4;
+  const responseHash = buf.readUInt32LE(o); o += 4;
+  const flags = buf[o++];
+  const methodLength = buf[o++];
+  const method = buf.toString("latin1", o, o + methodLength); o += methodLength;
+  const pathLength = buf.readUInt16LE(o); o += 2;
+  const path = buf.toString("latin1", o, o + pathLength); o += pathLength;
+  const headerCount = buf.readUInt16LE(o); o += 2;
+  const headers: string[] = [];
+  for (let i = 0; i < headerCount * 2; i++) {
+    const length = buf.readUInt16LE(o); o += 2;
+    headers.push(buf.toString("latin1", o, o + length)); o += length;
+  }
+  const bodyLength = buf.readUInt32LE(o); o += 4;
+  const body = buf.subarray(o, o + bodyLength);
+  return {
+    offsetMs,
+    method,
+    path,
+    headers,
+    body,
+    bodyTruncated: (flags & FLAG_BODY_TRUNCATED) !== 0,
+    status,
+    responseBytes,
+    responseHash,
+  };
+}
+
+function frame(type: number, payload: Buffer): Buffer {
+  const head = Buffer.allocUnsafe(5);
+  head.writeUInt32LE(payload.length + 1, 0);
+  head[4] = type;
+  return Buffer.concat([head, payload]);
+}
@@ -12,12 +12,15 @@ import {
   type Server,
 } from "node:net";
 import { spawn, type ChildProcess } from "node:child_process";
-import { unlinkSync, existsSync } from "node:fs";
+import { unlinkSync, existsSync, createWriteStream } from "node:fs";
 import { request } from "node:http";
 import { platform, arch } from "node:os";
 import { createRequire } from "node:module";
 import { dirname, join } from "node:path";
 import { fileURLToPath } from "node:url";
+import type { ServiceOptions } from "./options.js";
+import type { HostPattern, PathRule } from "./router.js";
+import { startShmRelay, type Transport } from "./shm.js";
 
 const DEFAULT_DAEMON_PORT = 8080;
 const DEFAULT_SOCKET_DIR = "/tmp";
@@ -38,47 +41,50 @@ const PLATFORM_PACKAGES: Record<string, string> = {
  * 3. Local native/ directory (development mode)
  */
 function getNativeLibPath(): string | null {
-  const plat = platform();
-  const ar = arch();
-
   // 1. Check environment variable (Nix flake sets this)
   const envLib = process.env.LOHOST_NATIVE_LIB;
   if (envLib && existsSync(envLib)) {
     return envLib;
   }
 
+  const ext = platform() === "darwin" ? "dylib" : "so";
+  return findNativeFile(`liblohost_dns.${ext}`);
+}
+
+/**
+ * Find a file shipped with the native build: in the platform package when
+ * installed from npm, otherwise in the local native/ directory.
+ */
+export function findNativeFile(fileName: string): string | null {
   // Map node arch names to package names
   const archMap: Record<string, string> = {
     arm64: "arm64",
     x64: "x64",
   };
 
-  const normalizedArch = archMap[ar];
+  const normalizedArch = archMap[arch()];
   if (!normalizedArch) return null;
 
-  const pkgName = PLATFORM_PACKAGES[`${plat}-${normalizedArch}`];
+  const pkgName = PLATFORM_PACKAGES[`${platform()}-${normalizedArch}`];
   if (!pkgName) return null;
 
-  const ext = plat === "darwin" ? "dylib" : "so";
-  const libName = `liblohost_dns.${ext}`;
-
-  // 2. Try to load from npm package
+  // Try to load from npm package
   try {
     const require = createRequire(import.meta.url);
     const pkgPath = require.resolve(`${pkgName}/package.json`);
     const pkgDir = dirname(pkgPath);
-    const libPath = join(pkgDir, libName);
-    if (existsSync(libPath)) {
-      return libPath;
+    const filePath = join(pkgDir, fileName);
+    if (existsSync(filePath)) {
+      return filePath;
     }
   } catch {
     // Package not installed, try local development path
   }
 
-  // 3. Fallback: local native/ directory (development mode)
+  // Fallback: local native/ directory (development mode)
   try {
     const __dirname = dirname(fileURLToPath(import.meta.url));
-    const localPath = join(__dirname, "..", "native", libName);
+    const localPath = join(__dirname, "..", "native", fileName);
     if (existsSync(localPath)) {
       return localPath;
     }
@@ -107,6 +113,12 @@ interface ClientOptions {
   name: string;
   socketDir?: string;
   daemonPort?: number;
+  /** Per-service proxy options sent with the registration. */
+  serviceOptions?: Partial<ServiceOptions>;
+  /** Join an existing service as an additional backend instead of replacing it. */
+  replica?: boolean;
+  /** How the daemon reaches the app: the Node proxy's socket, or shared memory. */
+  transport?: Transport;
 }
 
 export class LohostClient {
@@ -115,7 +127,13 @@ export class LohostClient {
   private socketPath: string;
   private daemonPort: number;
   private daemonUrl: string;
+  private serviceOptions: Partial<ServiceOptions>;
+  private replica: boolean;
+  private transport: Transport;
+  /** Setup socket of the shared-memory relay, next to socketPath. */
+  private shmPath: string;
   private proxy: Server | null = null;
+  private relay: ChildProcess | null = null;
   private child: ChildProcess | null = null;
   private connections = new Set<Socket>();
   private tcpPort: number = 0;
@@ -123,9 +141,16 @@ export class LohostClient {
   constructor(options: ClientOptions) {
     this.name = options.name;
     this.socketDir = options.socketDir ?? DEFAULT_SOCKET_DIR;
-    this.socketPath = `${this.socketDir}/${this.name}.sock`;
+    this.replica = options.replica ?? false;
+    // Replicas need their own socket next to the primary's
+    this.socketPath = this.replica
+      ? `${this.socketDir}/${this.name}.${process.pid}.sock`
+      : `${this.socketDir}/${this.name}.sock`;
+    this.shmPath = this.socketPath.replace(/\.sock$/, ".shm.sock");
+    this.transport = options.transport ?? "uds";
     this.daemonPort = options.daemonPort ?? DEFAULT_DAEMON_PORT;
     this.daemonUrl = `http://localhost:${this.daemonPort}`;
+    this.serviceOptions = options.serviceOptions ?? {};
   }
 
   async run(command: string, args: string[]): Promise<number> {
@@ -141,11 +166,18 @@ export class LohostClient {
     // 4. Ensure daemon is running
     await this.ensureDaemon();
 
-    // 5. Register with daemon
-    await this.register();
+    // 5. Spawn child
+    const exited = this.spawnChild(command, args);
+
+    // 6. Register with daemon (with the child's pid, for CPU/RSS metrics)
+    try {
+      await this.register();
+    } catch (err) {
+      this.child?.kill("SIGTERM");
+      throw err;
+    }
 
-    // 6. Spawn child
-    return this.spawnChild(command, args);
+    return exited;
   }
 
   private async findFreePort(): Promise<number> {
@@ -165,21 +197,36 @@ export class LohostClient {
   }
 
   private cleanupSocket(): void {
-    try {
-      unlinkSync(this.socketPath);
-    } catch {
-      // Ignore - socket may not exist
+    for (const path of [this.socketPath, this.shmPath]) {
+      try {
+        unlinkSync(path);
+      } catch {
+        // Ignore - socket may not exist
+      }
     }
   }
 
   private async startProxy(): Promise<void> {
+    if (this.transport === "shm") {
+      this.relay = await startShmRelay(this.socketPath, this.shmPath, this.tcpPort);
+      if (this.relay) {
+        console.error(`lohost: ${this.socketPath} → 127.0.0.1:${this.tcpPort} (shared memory via ${this.shmPath})`);
+        return;
+      }
+      console.error("lohost: shared memory needs lohost-relay on Linux; using the socket proxy");
+    }
     return new Promise((resolve, reject) => {
-      this.proxy = createServer((udsConn) => {
+      // Half-open, so raw TCP forwarded by the daemon (tcp-ports) can shut
+      // down one direction and still read the other's reply
+      this.proxy = createServer({ allowHalfOpen: true }, (udsConn) => {
         this.connections.add(udsConn);
 
+        // No Nagle: multiplexed HTTP/2 frames are small writes that must not wait
         const tcpConn = createConnection({
           port: this.tcpPort,
           host: "localhost", // Use localhost to support both IPv4 and IPv6
+          allowHalfOpen: true,
+          noDelay: true,
         });
         this.connections.add(tcpConn);
 
@@ -193,10 +240,11 @@ export class LohostClient {
           tcpConn.destroy();
         };
 
+        // Each side closes once both directions have ended
         udsConn.on("error", cleanup);
-        udsConn.on("close", cleanup);
         tcpConn.on("error", cleanup);
-        tcpConn.on("close", cleanup);
+        udsConn.on("close", () => this.connections.delete(udsConn));
+        tcpConn.on("close", () => this.connections.delete(tcpConn));
       });
 
       this.proxy.on("error", reject);
@@ -269,6 +317,10 @@ export class LohostClient {
         name: this.name,
         socketPath: this.socketPath,
         port: this.tcpPort,
+        pid: this.child?.pid,
+        options: this.serviceOptions,
+        replica: this.replica,
+        shmSocket: this.relay ? this.shmPath : undefined,
       });
 
       const req = request(
@@ -288,6 +340,10 @@ export class LohostClient {
               try {
                 const result = JSON.parse(body);
                 console.error(`lohost: ${result.url}`);
+                const tcpPorts = this.serviceOptions.tcpPorts ?? [];
+                if (tcpPorts.length > 0) {
+                  console.error(`lohost: tcp ${result.address}:${tcpPorts.join(",")}`);
+                }
                 resolve();
               } catch {
                 resolve();
@@ -307,7 +363,7 @@ export class LohostClient {
   private async deregister(): Promise<void> {
     return new Promise((resolve) => {
       const req = request(
-        `${this.daemonUrl}/_lohost/register/${this.name}`,
+        `${this.daemonUrl}/_lohost/register/${this.name}?socketPath=${encodeURIComponent(this.socketPath)}`,
         { method: "DELETE" },
         () => resolve()
       );
@@ -322,7 +378,13 @@ export class LohostClient {
       const preloadEnv = getPreloadEnv();
 
       this.child = spawn(command, args, {
-        env: { ...process.env, ...preloadEnv, PORT: String(this.tcpPort) },
+        env: {
+          ...process.env,
+          ...preloadEnv,
+          // Where the preload finds each service's loopback address
+          LOHOST_HOSTS: join(this.socketDir, `lohost-${this.daemonPort}.hosts`),
+          PORT: String(this.tcpPort),
+        },
         stdio: "inherit",
       });
 
@@ -344,6 +406,7 @@ export class LohostClient {
 
         // Close proxy
         this.proxy?.close();
+        this.relay?.kill();
 
         // Clean up socket
         this.cleanupSocket();
@@ -386,6 +449,231 @@ export async function listServices(
   });
 }
 
+/**
+ * Send a JSON API request to the daemon. Resolves with the parsed body of a
+ * 200 response and rejects with the daemon's error message otherwise.
+ */
+async function apiRequest<T>(
+  method: string,
+  path: string,
+  body: unknown,
+  daemonPort: number
+): Promise<T> {
+  return new Promise((resolve, reject) => {
+    const data = body === undefined ? "" : JSON.stringify(body);
+    const req = request(
+      `http://localhost:${daemonPort}${path}`,
+      {
+        method,
+        headers: data
+          ? { "Content-Type": "application/json", "Content-Length": Buffer.byteLength(data) }
+          : {},
+      },
+      (res) => {
+        let text = "";
+        res.on("data", (chunk) => (text += chunk));
+        res.on("end", () => {
+          try {
+            const parsed = JSON.parse(text);
+            if (res.statusCode === 200) resolve(parsed as T);
+            else reject(new Error(parsed.error ?? `HTTP ${res.statusCode}`));
+          } catch {
+            reject(new Error("Invalid response"));
+          }
+        });
+      }
+    );
+    req.on("error", reject);
+    req.end(data);
+  });
+}
+
+/**
+ * Change options of a running service; unspecified options keep their
+ * values. Resolves with the service's full options after the change.
+ */
+export async function updateServiceOptions(
+  name: string,
+  options: Partial<ServiceOptions>,
+  daemonPort: number = DEFAULT_DAEMON_PORT
+): Promise<ServiceOptions> {
+  const result = await apiRequest<{ options: ServiceOptions }>(
+    "PATCH",
+    `/_lohost/services/${encodeURIComponent(name)}/options`,
+    options,
+    daemonPort
+  );
+  return result.options;
+}
+
+export async function listRoutes(
+  daemonPort: number = DEFAULT_DAEMON_PORT
+): Promise<PathRule[]> {
+  return apiRequest("GET", "/_lohost/routes", undefined, daemonPort);
+}
+
+/** Add a path rule, replacing any rule for the same host and prefix. */
+export async function addRoute(
+  rule: PathRule,
+  daemonPort: number = DEFAULT_DAEMON_PORT
+): Promise<PathRule> {
+  return apiRequest("PUT", "/_lohost/routes", rule, daemonPort);
+}
+
+export async function listHostPatterns(
+  daemonPort: number = DEFAULT_DAEMON_PORT
+): Promise<HostPattern[]> {
+  return apiRequest("GET", "/_lohost/host-patterns", undefined, daemonPort);
+}
+
+/** Add a host pattern (ranked last), or retarget an existing one. */
+export async function addHostPattern(
+  pattern: HostPattern,
+  daemonPort: number = DEFAULT_DAEMON_PORT
+): Promise<HostPattern> {
+  return apiRequest("PUT", "/_lohost/host-patterns", pattern, daemonPort);
+}
+
+export async function removeHostPattern(
+  pattern: string,
+  daemonPort: number = DEFAULT_DAEMON_PORT
+): Promise<void> {
+  const query = new URLSearchParams({ pattern });
+  await apiRequest("DELETE", `/_lohost/host-patterns?${query}`, undefined, daemonPort);
+}
+
+export async function removeRoute(
+  host: string,
+  prefix: string,
+  daemonPort: number = DEFAULT_DAEMON_PORT
+): Promise<void> {
+  const query = new URLSearchParams({ host, prefix });
+  await apiRequest("DELETE", `/_lohost/routes?${query}`, undefined, daemonPort);
+}
+
+export interface ResolvedHost {
+  host: string;
+  service: string;
+  port: number;
+  socketPath: string;
+}
+
+/**
+ * Ask the daemon which service a Host header routes to.
+ * Resolves null if no service matches.
+ */
+export async function resolveHost(
+  host: string,
+  daemonPort: number = DEFAULT_DAEMON_PORT,
+  path = "/"
+): Promise<ResolvedHost | null> {
+  return new Promise((resolve, reject) => {
+    const query = new URLSearchParams({ host, path });
+    const req = request(
+      `http://localhost:${daemonPort}/_lohost/resolve?${query}`,
+      (res) => {
+        let body = "";
+        res.on("data", (chunk) => (body += chunk));
+        res.on("end", () => {
+          if (res.statusCode !== 200) {
+            resolve(null);
+            return;
+          }
+          try {
+            resolve(JSON.parse(body));
+          } catch {
+            reject(new Error("Invalid response"));
+          }
+        });
+      }
+    );
+    req.on("error", reject);
+    req.end();
+  });
+}
+
+/**
+ * Subscribe to the daemon's once-a-second metrics stream.
+ * Returns a function that closes the subscription.
+ */
+export function streamMetrics(
+  daemonPort: number,
+  onSnapshot: (snapshot: unknown) => void,
+  onEnd: (err?: Error) => void
+): () => void {
+  const req = request(
+    `http://localhost:${daemonPort}/_lohost/metrics/stream`,
+    (res) => {
+      let buffer = "";
+      res.setEncoding("utf8");
+      res.on("data", (chunk: string) => {
+        buffer += chunk;
+        let boundary;
+        while ((boundary = buffer.indexOf("\n\n")) !== -1) {
+          const event = buffer.slice(0, boundary);
+          buffer = buffer.slice(boundary + 2);
+          if (event.startsWith("data: ")) {
+            try {
+              onSnapshot(JSON.parse(event.slice(6)));
+            } catch {
+              // Ignore malformed frames
+            }
+          }
+        }
+      });
+      res.on("end", () => onEnd());
+    }
+  );
+  req.on("error", (err) => onEnd(err));
+  req.end();
+  return () => req.destroy();
+}
+
+/**
+ * Download a debug capture (profile, heap snapshot) from the daemon's
+ * owner-only control socket into `outFile`.
+ */
+export async function fetchDebugCapture(
+  socketDir: string,
+  daemonPort: number,
+  path: string,
+  outFile: string,
+  signal?: AbortSignal
+): Promise<void> {
+  return new Promise((resolve, reject) => {
+    const req = request(
+      {
+        socketPath: join(socketDir, `lohostd-${daemonPort}.sock`),
+        path,
+      },
+      (res) => {
+        if (res.statusCode !== 200) {
+          let body = "";
+          res.on("data", (chunk) => (body += chunk));
+          res.on("end", () => reject(new Error(`Capture failed: ${body}`)));
+          return;
+        }
+        const out = createWriteStream(outFile);
+        res.pipe(out);
+        out.on("finish", () => resolve());
+        out.on("error", reject);
+        res.on("error", reject);
+
+        // Open-ended captures stop on abort: keep what arrived, close the file
+        signal?.addEventListener("abort", () => {
+          res.unpipe(out);
+          req.destroy();
+          out.end();
+        }, { once: true });
+      }
+    );
+    req.on("error", (err) => {
+      if (!signal?.aborted) reject(err);
+    });
+    req.end();
+  });
+}
+
 export async function stopDaemon(
   daemonPort: number = DEFAULT_DAEMON_PORT
 ): Promise<void> {
@@ -0,0 +1,236 @@
+/**
+ * Request coalescing
+ *
+ * With `-o coalesce`, a GET or HEAD that arrives while an identical one is
+ * waiting for its backend response does not go upstream itself: it waits
+ * for the same response, which is fanned out to every waiter as it
+ * streams. On a cold dev-server start, the browser and several test
+ * workers asking for the same expensive module cost the backend one
+ * request instead of many.
+ *
+ * Requests are identical when method, Host, URL and the headers that
+ * commonly select a representation match. Once the response arrives, its
+ * Vary header is checked against the rest. Waiters that differ, and all
+ * waiters when the response sets a cookie, go upstream on their own. If
+ * the first request ends without a backend response (its client left, or
+ * the backend failed), the next waiter takes its place.
+ */
+
+import type { IncomingMessage, ServerResponse } from "node:http";
+import type { Readable, Writable } from "node:stream";
+import { withoutConnectionHeaders } from "./h2.js";
+import type { ServiceMetrics } from "./metrics.js";
+
+// Part of every key: requests differing in these never share a response
+const KEY_HEADERS = [
+  "accept",
+  "accept-encoding",
+  "accept-language",
+  "authorization",
+  "cookie",
+  "range",
+  "if-range",
+  "if-none-match",
+  "if-modified-since",
+];
+
+// Unsent bytes a waiter may fall behind by before it is cut off
+const MAX_WAITER_BACKLOG = 8 * 1024 * 1024;
+
+const kFlight = Symbol("lohost.flight");
+
+type FlightResponse = ServerResponse & { [kFlight]?: Flight };
+
+interface Waiter {
+  req: IncomingMessage;
+  res: ServerResponse;
+  /** Send the request upstream (through admission), as if it had not waited. */
+  dispatch: () => void;
+  /** The client went away. */
+  gone: boolean;
+}
+
+/** A waiter that gets the response, and the headers to send it with. */
+export interface Sharer {
+  req: IncomingMessage;
+  res: ServerResponse;
+  headers: string[];
+}
+
+interface Flight {
+  key: string;
+  leader: Waiter;
+  waiters: Waiter[];
+  answered: boolean;
+  coalescer: Coalescer;
+}
+
+/** One service's requests in flight, by key. */
+export class Coalescer {
+  private flights = new Map<string, Flight>();
+  private metrics: ServiceMetrics;
+
+  constructor(metrics: ServiceMetrics) {
+    this.metrics = metrics;
+  }
+
+  /**
+   * Wait for an identical request already in flight, or else become the
+   * one in flight and `dispatch`. For GET and HEAD requests without a body.
+   */
+  join(req: IncomingMessage, res: ServerResponse, dispatch: () => void): void {
+    const key = flightKey(req);
+    const waiter: Waiter = { req, res, dispatch, gone: false };
+    res.once("close", () => {
+      waiter.gone = true;
+    });
+    const flight = this.flights.get(key);
+    if (flight) {
+      flight.waiters.push(waiter);
+      return;
+    }
+    this.lead(key, waiter, []);
+  }
+
+  /**
+   * Close `flight` and return the waiters that may share a response with
+   * `rawHeaders`; the others go upstream on their own.
+   */
+  claim(flight: Flight, rawHeaders: string[]): Sharer[] {
+    flight.answered = true;
+    if (this.flights.get(flight.key) === flight) this.flights.delete(flight.key);
+
+    const varied = variedHeaders(rawHeaders);
+    const sharers: Sharer[] = [];
+    for (const waiter of flight.waiters) {
+      if (waiter.gone) continue;
+      if (!varied || !sameHeaders(waiter.req, flight.leader.req, varied)) {
+        waiter.dispatch();
+        continue;
+      }
+      const headers = waiter.req.httpVersionMajor === 2 ? withoutConnectionHeaders(rawHeaders) : rawHeaders;
+      sharers.push({ req: waiter.req, res: waiter.res, headers });
+    }
+    flight.waiters = [];
+    this.metrics.coalesced += sharers.length;
+    return sharers;
+  }
+
+  /** Hand the backend's response for `flight` to its waiters as well. */
+  answer(
+    flight: Flight,
+    status: number,
+    rawHeaders: string[],
+    body: Readable,
+    headersOnly: boolean,
+    sink: (res: ServerResponse) => Writable
+  ): void {
+    const receivers: Writable[] = [];
+    for (const { res, headers } of this.claim(flight, rawHeaders)) {
+      res.writeHead(status, headers);
+      if (headersOnly) {
+        res.end();
+      } else {
+        receivers.push(sink(res));
+      }
+    }
+    if (receivers.length === 0) return;
+
+    // Waiters are written to without backpressure; one that falls too far
+    // behind is dropped rather than allowed to slow the others
+    body.on("data", (chunk: Buffer) => {
+      for (const receiver of receivers) {
+        if (receiver.destroyed) continue;
+        if (receiver.writableLength > MAX_WAITER_BACKLOG) receiver.destroy();
+        else receiver.write(chunk);
+      }
+    });
+    body.on("end", () => {
+      for (const receiver of receivers) receiver.end();
+    });
+    body.on("close", () => {
+      if (body.readableEnded) return;
+      for (const receiver of receivers) receiver.destroy();
+    });
+  }
+
+  private lead(key: string, leader: Waiter, waiters: Waiter[]): void {
+    const flight: Flight = { key, leader, waiters, answered: false, coalescer: this };
+    this.flights.set(key, flight);
+    (leader.res as FlightResponse)[kFlight] = flight;
+    leader.res.once("close", () => {
+      if (this.flights.get(key) === flight) this.flights.delete(key);
+      if (flight.answered) return;
+      // No backend response to share; the next waiter goes itself, the rest wait for it.
+      // A response that still arrives for the departed leader is no longer theirs.
+      const live = flight.waiters.filter((w) => !w.gone);
+      flight.waiters = [];
+      const next = live.shift();
+      if (next) this.lead(key, next, live);
+    });
+    leader.dispatch();
+  }
+}
+
+/**
+ * Called by the proxy as a backend response's headers arrive for `res`:
+ * requests coalesced onto it get the same response.
+ */
+export function shareResponse(
+  res: ServerResponse,
+  status: number,
+  rawHeaders: string[],
+  body: Readable,
+  headersOnly: boolean,
+  sink: (res: ServerResponse) => Writable
+): void {
+  const flight = (res as FlightResponse)[kFlight];
+  if (!flight || flight.answered) return;
+  flight.coalescer.answer(flight, status, rawHeaders, body, headersOnly, sink);
+}
+
+/**
+ * Like shareResponse, but only claims the requests coalesced onto `res`,
+ * for a caller that answers them itself.
+ */
+export function claimSharers(res: ServerResponse, rawHeaders: string[]): Sharer[] {
+  const flight = (res as FlightResponse)[kFlight];
+  if (!flight || flight.answered) return [];
+  return flight.coalescer.claim(flight, rawHeaders);
+}
+
+function flightKey(req: IncomingMessage): string {
+  let key = `${req.method} ${req.headers.host} ${req.url}`;
+  for (const name of KEY_HEADERS) {
+    const value = req.headers[name];
+    key += `\n${value === undefined ? "" : value}`;
+  }
+  return key;
+}
+
+/**
+ * Request headers named by the response's Vary beyond those in the key,
+ * or null when the response may not be shared at all (Vary: *, or a
+ * Set-Cookie meant for one client).
+ */
+function variedHeaders(rawHeaders: string[]): string[] | null {
+  const varied: string[] = [];
+  for (let i = 0; i < rawHeaders.length; i += 2) {
+    const name = rawHeaders[i].toLowerCase();
+    if (name === "set-cookie") return null;
+    if (name !== "vary") continue;
+    for (const field of rawHeaders[i + 1].split(",")) {
+      const header = field.trim().toLowerCase();
+      if (header === "*") return null;
+      if (header && !KEY_HEADERS.includes(header)) varied.push(header);
+    }
+  }
+  return varied;
+}
+
+function sameHeaders(a: IncomingMessage, b: IncomingMessage, names: string[]): boolean {
+  for (const name of names) {
+    if (String(a.headers[name]) !== String(b.headers[name])) return false;
+  }
+  return true;
+}
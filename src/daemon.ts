@@ -9,46 +9,268 @@
  */
 
 import {
+  ClientRequest,
   createServer as createHttpServer,
   type IncomingMessage,
+  type RequestOptions,
   type ServerResponse,
   request as httpRequest,
 } from "node:http";
+import {
+  constants as http2Constants,
+  createServer as createHttp2Server,
+  type ClientHttp2Stream,
+  type Http2Server,
+  type IncomingHttpHeaders,
+  type IncomingHttpStatusHeader,
+} from "node:http2";
 import { createConnection, type Socket } from "node:net";
+import { pipeline, type Readable, type Writable } from "node:stream";
+import { unlinkSync } from "node:fs";
+import { platform } from "node:os";
+import { join } from "node:path";
+import { performance } from "node:perf_hooks";
+import { ServiceMetrics, type ServiceSnapshot } from "./metrics.js";
+import { DaemonDiagnostics, type DiagnosticsSnapshot } from "./diagnostics.js";
+import { Profiler } from "./profiler.js";
+import { parseServiceOptions, type ServiceOptions } from "./options.js";
+import { Spool } from "./spool.js";
+import { AdmissionQueue, type RejectReason, type Ticket } from "./admission.js";
+import { HedgeDelay, RetryBudget } from "./hedging.js";
+import { MirrorStats } from "./mirror.js";
+import { Coalescer, claimSharers, shareResponse } from "./coalesce.js";
+import { EtagHasher } from "./etag.js";
+import { CaptureRecorder, type ExchangeObserver } from "./capture.js";
+import { RoutesFileWatcher, type RoutesFile } from "./routesfile.js";
+import { Throttle, TokenBucket, shapedDelay } from "./shaping.js";
+import { MAX_SNIFF_BYTES, sniff } from "./sniff.js";
+import { LoopbackAllocator, TcpForwarder, writeHostsFile, type ForwardSpec } from "./loopback.js";
+import { NativeRelay, findRelayBinary, type RelayMode } from "./relay.js";
+import { ShmTransport } from "./shm.js";
+import { WebSocketStats, negotiateDeflate, relayWebSocket } from "./websocket.js";
+import {
+  H2Pool,
+  asHttp1Request,
+  h2HasBody,
+  h2RawHeaders,
+  h2RequestHeaders,
+  respondHeadersOnly,
+  withoutConnectionHeaders,
+} from "./h2.js";
+import {
+  RoutingTable,
+  normalizePrefix,
+  parseHostPattern,
+  parsePathRule,
+  ruleHost,
+  stripPrefix,
+  type HostPattern,
+  type PathRule,
+  type PrefixTrie,
+} from "./router.js";
 
 const VERSION = "0.0.1";
 const DEFAULT_PORT = 8080;
 const DEFAULT_ROUTE_DOMAIN = "localhost";
 const DEFAULT_SOCKET_DIR = "/tmp";
 
+// Requests carrying this header get a Server-Timing breakdown in the response
+const TIMING_HEADER = "x-lohost-timing";
+
+// Longest CPU profile / allocation sample the debug endpoints will take
+const MAX_DEBUG_SECONDS = 300;
+
+// Host headers whose service lookup is remembered; cleared on any registry change
+const ROUTE_CACHE_SIZE = 1024;
+
+// Static API headers and error bodies, built once instead of per response
+const JSON_HEADERS = { "Content-Type": "application/json" };
+const CORS_HEADERS = {
+  "Access-Control-Allow-Origin": "*",
+  "Access-Control-Allow-Methods": "GET, POST, DELETE, OPTIONS",
+  "Access-Control-Allow-Headers": "Content-Type",
+};
+const API_HEADERS = { ...JSON_HEADERS, ...CORS_HEADERS };
+const BAD_GATEWAY_BODY = Buffer.from(
+  JSON.stringify({ error: "Bad Gateway", message: "Backend unavailable" })
+);
+const API_NOT_FOUND_BODY = Buffer.from(JSON.stringify({ error: "Not found" }));
+const OVERLOAD_MESSAGES: Record<RejectReason, string> = {
+  "queue-full": "Too many requests queued for this service",
+  timeout: "Timed out waiting for a free backend slot",
+};
+
+// Connection errors that mean the backend never saw the request
+const CONNECT_ERRORS = new Set(["ECONNREFUSED", "ENOENT", "EAGAIN"]);
+
+// Per-attempt proxy state lives on the ClientRequest under these keys, so the
+// response and error handlers can be shared functions instead of closures.
+const kDownstream = Symbol("lohost.downstream");
+const kIncoming = Symbol("lohost.incoming");
+const kReceivedAt = Symbol("lohost.receivedAt");
+const kUpstreamStart = Symbol("lohost.upstreamStart");
+const kService = Symbol("lohost.service");
+const kBackend = Symbol("lohost.backend");
+const kRetries = Symbol("lohost.retries");
+const kHasBody = Symbol("lohost.hasBody");
+const kHedge = Symbol("lohost.hedge");
+
+// One upstream attempt: an HTTP/1.1 request, or a stream on an h2c session
+type ProxyRequest = (ClientRequest | ClientHttp2Stream) & {
+  [kDownstream]: ServerResponse;
+  [kIncoming]: IncomingMessage;
+  [kReceivedAt]: number;
+  [kUpstreamStart]: number;
+  [kService]: Service;
+  [kBackend]: Backend;
+  [kRetries]: number;
+  [kHasBody]: boolean;
+  [kHedge]: HedgeGroup | null;
+};
+
+// Set on the downstream response while its service is being captured
+const kCapture = Symbol("lohost.capture");
+
+type CapturedResponse = ServerResponse & { [kCapture]?: ExchangeObserver };
+
+// Per-connection bandwidth bucket, shared by requests on one keep-alive socket
+const kBucket = Symbol("lohost.bucket");
+
+type ShapedSocket = Socket & { [kBucket]?: TokenBucket };
+
+/** Attempts racing for one hedged request; the first to get headers wins. */
+interface HedgeGroup {
+  attempts: ProxyRequest[];
+  settled: boolean;
+  timer: NodeJS.Timeout | null;
+}
+
+// Reused for every upstream request; http.request copies what it needs
+const proxyOptions: RequestOptions = { socketPath: "", path: "/", method: "GET" };
+
+// Whether any 127.0.x.y reaches the loopback interface without configuration
+const LOOPBACK_ROUTABLE = platform() === "linux";
+
+const METRICS_INTERVAL_MS = 1000;
+// Backend CPU/RSS is sampled for this long after a metrics read
+const PROCESS_SAMPLE_GRACE_MS = 10_000;
+
+interface Backend {
+  /** Unix socket to connect to; null for a TCP backend from the routes file. */
+  socketPath: string | null;
+  /** TCP host when socketPath is null. */
+  host: string | null;
+  port: number;
+  pid: number | null;
+  /** Shared memory with the client's relay (`lohost --transport shm`). */
+  transport: ShmTransport | null;
+  /** Sessions for `upstream: "h2c"`, opened on the first such request. */
+  h2: H2Pool | null;
+}
+
 interface Service {
   name: string;
-  socketPath: string;
-  port: number;
+  /** One entry per registered process; `lohost --replica` adds more. */
+  backends: Backend[];
+  /** Declared in the routes file rather than registered by a client. */
+  static: boolean;
+  nextBackend: number;
   registeredAt: Date;
+  metrics: ServiceMetrics;
+  options: ServiceOptions;
+  admission: AdmissionQueue;
+  hedgeDelay: HedgeDelay;
+  retryBudget: RetryBudget;
+  /** GET/HEAD requests in flight, for `coalesce`. */
+  coalescer: Coalescer;
+  /** Hashes validator-less responses into ETags, for `etag`. */
+  etags: EtagHasher;
+  /** Bandwidth bucket for `bandwidthScope: "service"`. */
+  bucket: TokenBucket;
+}
+
+/** What a Host header resolves to: a service, path rules, or both. */
+interface HostRoute {
+  service: Service | null;
+  paths: PrefixTrie<PathRule> | undefined;
 }
 
 interface DaemonConfig {
   port: number;
   routeDomain: string;
   socketDir: string;
+  /** Capture a CPU profile into socketDir when event-loop lag exceeds this (0 = off) */
+  lagProfileThresholdMs: number;
+  /** Declarative routes file to load and watch, if any. */
+  routesFile: string | null;
+  /** Who serves tcp-ports: the daemon itself, or the native relay. */
+  relay: RelayMode;
 }
 
 export class LohostDaemon {
   private services = new Map<string, Service>();
+  /** Services from the routes file; replaced as a whole on every reload. */
+  private fileServices = new Map<string, Service>();
+  private routesWatcher: RoutesFileWatcher | null = null;
+  private routeCache = new Map<string, HostRoute>();
+  private routes = new RoutingTable();
+  private healthCache: { uptime: number; services: number; body: Buffer } | null = null;
+  private badRequestBody: Buffer;
   private server: ReturnType<typeof createHttpServer> | null = null;
+  /** The HTTP server's own connection listener, wrapped by handleConnection. */
+  private httpConnection: ((socket: Socket) => void) | null = null;
+  /** h2c clients, handed over by handleConnection. */
+  private h2Server: Http2Server | null = null;
+  /** Some service has `splice` on, so new connections are sniffed first. */
+  private sniffing = false;
+  private controlServer: ReturnType<typeof createHttpServer> | null = null;
   private config: DaemonConfig;
   private startedAt: Date = new Date();
+  private metrics = new Map<string, ServiceMetrics>();
+  private metricsTimer: NodeJS.Timeout | null = null;
+  private lastTick = performance.now();
+  private sampleProcessesUntil = 0;
+  private metricsSubscribers = new Set<ServerResponse>();
+  private captures = new Map<string, CaptureRecorder>();
+  private profiler = new Profiler();
+  private diagnostics: DaemonDiagnostics;
+  private loopback = new LoopbackAllocator();
+  private tcpForwarder = new TcpForwarder((name, socket) => this.forwardTcp(name, socket));
+  private relay: NativeRelay | null = null;
 
   constructor(config: Partial<DaemonConfig> = {}) {
     this.config = {
       port: config.port ?? DEFAULT_PORT,
       routeDomain: config.routeDomain ?? DEFAULT_ROUTE_DOMAIN,
       socketDir: config.socketDir ?? DEFAULT_SOCKET_DIR,
+      lagProfileThresholdMs: config.lagProfileThresholdMs ?? 0,
+      routesFile: config.routesFile ?? null,
+      relay: config.relay ?? "node",
     };
+    this.badRequestBody = Buffer.from(JSON.stringify({
+      error: "Bad Request",
+      message: `Host must end with .${this.config.routeDomain}`,
+    }));
+    this.diagnostics = new DaemonDiagnostics(
+      {
+        lagProfileThresholdMs: this.config.lagProfileThresholdMs,
+        profileDir: this.config.socketDir,
+      },
+      this.profiler
+    );
   }
 
   async start(): Promise<void> {
+    if (this.config.relay !== "node") this.startRelay(this.config.relay);
+    if (this.config.routesFile) {
+      this.routesWatcher = new RoutesFileWatcher(
+        this.config.routesFile,
+        this.config.routeDomain,
+        (file) => this.installRoutesFile(file)
+      );
+      await this.routesWatcher.start();
+    }
+
     return new Promise((resolve, reject) => {
       this.server = createHttpServer((req, res) => {
         this.handleRequest(req, res);
@@ -58,7 +280,23 @@ export class LohostDaemon {
         this.handleUpgrade(req, socket as Socket, head);
       });
 
-      this.server.on("error", (err: NodeJS.ErrnoException) => {
+      // The compatibility API covers what the proxy uses of IncomingMessage
+      // and ServerResponse, once the headers have the HTTP/1.1 view
+      this.h2Server = createHttp2Server();
+      this.h2Server.on("request", (req, res) => {
+        this.handleRequest(asHttp1Request(req), res as unknown as ServerResponse);
+      });
+
+      // The HTTP server owns the port, which keeps its connection tracking
+      // (header and request deadlines, idle closing); handleConnection
+      // decides which connections reach its own listener
+      const server = this.server;
+      const [httpConnection] = server.listeners("connection") as ((socket: Socket) => void)[];
+      server.removeListener("connection", httpConnection);
+      this.httpConnection = (socket) => httpConnection.call(server, socket);
+      server.on("connection", (socket: Socket) => this.handleConnection(socket));
+
+      server.on("error", (err: NodeJS.ErrnoException) => {
         if (err.code === "EADDRINUSE") {
           reject(new Error(`Port ${this.config.port} is already in use`));
         } else {
@@ -66,16 +304,81 @@ export class LohostDaemon {
         }
       });
 
-      this.server.listen(this.config.port, () => {
+      server.listen(this.config.port, () => {
         this.startedAt = new Date();
+        this.lastTick = performance.now();
+        this.metricsTimer = setInterval(() => this.tickMetrics(), METRICS_INTERVAL_MS);
+        this.metricsTimer.unref();
+        this.diagnostics.start();
+        this.startControlSocket();
         resolve();
       });
     });
   }
 
+  /**
+   * Path of the owner-only Unix socket serving the API plus debug endpoints.
+   * Access is authenticated by filesystem permissions on the socket.
+   */
+  get controlSocketPath(): string {
+    return join(this.config.socketDir, `lohostd-${this.config.port}.sock`);
+  }
+
+  /** Hosts-style file mapping service names to their loopback addresses. */
+  get hostsFilePath(): string {
+    return join(this.config.socketDir, `lohost-${this.config.port}.hosts`);
+  }
+
+  private startControlSocket(): void {
+    const path = this.controlSocketPath;
+    try {
+      unlinkSync(path);
+    } catch {
+      // Ignore - socket may not exist
+    }
+
+    this.controlServer = createHttpServer((req, res) => {
+      this.handleApi(req, res, true);
+    });
+    this.controlServer.on("error", (err) => {
+      console.error(`[lohostd] Control socket unavailable: ${err.message}`);
+    });
+
+    // Create the socket file 0600 rather than chmod-ing it after bind
+    const umask = process.umask(0o177);
+    try {
+      this.controlServer.listen(path);
+    } finally {
+      process.umask(umask);
+    }
+  }
+
   async stop(): Promise<void> {
+    if (this.metricsTimer) clearInterval(this.metricsTimer);
+    this.routesWatcher?.stop();
+    this.diagnostics.stop();
+    this.tcpForwarder.close();
+    this.relay?.stop();
+    try {
+      unlinkSync(this.hostsFilePath);
+    } catch {
+      // Ignore - never written
+    }
+    for (const res of this.metricsSubscribers) res.end();
+    this.metricsSubscribers.clear();
+
+    if (this.controlServer) {
+      this.controlServer.close();
+      try {
+        unlinkSync(this.controlSocketPath);
+      } catch {
+        // Ignore - already removed
+      }
+    }
+
     return new Promise((resolve) => {
       if (this.server) {
+        this.server.closeIdleConnections();
         this.server.close(() => resolve());
       } else {
         resolve();
@@ -83,7 +386,70 @@ export class LohostDaemon {
     });
   }
 
+  /**
+   * A new client connection. Unless a service splices or speaks h2c, it goes
+   * straight to the HTTP server. Otherwise its first bytes are read to find
+   * the Host (or TLS server name): a splicing service gets the connection as
+   * raw bytes, an HTTP/2 preface goes to the HTTP/2 server, and anything
+   * else is handed to the HTTP server with those bytes put back.
+   */
+  private handleConnection(socket: Socket): void {
+    if (!this.sniffing) {
+      this.httpConnection!(socket);
+      return;
+    }
+
+    let head = Buffer.alloc(0);
+    const onData = (chunk: Buffer) => {
+      head = head.length === 0 ? chunk : Buffer.concat([head, chunk]);
+      const sniffed = sniff(head);
+      if (sniffed === undefined && head.length < MAX_SNIFF_BYTES) return;
+      socket.off("data", onData);
+      socket.off("end", onEnd);
+      socket.off("timeout", onTimeout);
+      socket.setTimeout(0);
+      socket.pause();
+
+      const route = sniffed?.host ? this.route(sniffed.host) : null;
+      const service = route?.service;
+      if (service && !route.paths && service.options.splice) {
+        this.splice(socket, service, head);
+      } else if (sniffed?.h2) {
+        // The session reads what is already buffered itself; resuming would lose it
+        socket.unshift(head);
+        this.h2Server!.emit("connection", socket);
+      } else if (sniffed?.tls) {
+        // TLS can only be passed through, and nothing here will take it
+        socket.destroy();
+      } else {
+        socket.unshift(head);
+        this.httpConnection!(socket);
+        socket.resume();
+      }
+    };
+    const onEnd = () => socket.destroy();
+    // Until routing is decided no server's deadlines apply; a client that
+    // connects and never finishes its first bytes gets the header deadline
+    const onTimeout = () => socket.destroy();
+    socket.setTimeout(this.server!.headersTimeout, onTimeout);
+    socket.on("data", onData);
+    socket.on("end", onEnd);
+    socket.on("error", () => socket.destroy());
+  }
+
+  /**
+   * Relay a whole client connection to one backend, starting with the bytes
+   * already read. Per-request features (admission, shaping, capture) and
+   * request metrics do not apply; traffic is counted as bytes.
+   */
+  private splice(socket: Socket, service: Service, head: Buffer): void {
+    relay(socket, pickBackend(service, null), head);
+    socket.resume();
+    service.metrics.trackRelay(socket);
+  }
+
   private handleRequest(req: IncomingMessage, res: ServerResponse): void {
+    const receivedAt = req.headers[TIMING_HEADER] !== undefined ? performance.now() : 0;
     const url = req.url ?? "/";
 
     // API routes
@@ -92,30 +458,229 @@ export class LohostDaemon {
       return;
     }
 
-    // Extract subdomain from host
-    const subdomain = this.extractSubdomain(req.headers.host);
-    if (!subdomain) {
-      res.writeHead(400, { "Content-Type": "application/json" });
-      res.end(JSON.stringify({
-        error: "Bad Request",
-        message: `Host must end with .${this.config.routeDomain}`,
-      }));
+    const route = this.route(req.headers.host);
+    const service = route && this.routePath(route, req);
+    if (!service) {
+      this.rejectUnrouted(req.headers.host, res);
       return;
     }
 
-    // Find matching service using longest-suffix match
-    const service = this.findService(subdomain);
-    if (!service) {
-      res.writeHead(404, { "Content-Type": "application/json" });
-      res.end(JSON.stringify({
-        error: "Not Found",
-        message: `No service matches "${subdomain}"`,
-      }));
+    service.metrics.trackRequest(req, res);
+
+    // Network-condition emulation: injected resets, then added latency
+    const { resetPercent, latency, jitter } = service.options;
+    if (resetPercent > 0 && Math.random() * 100 < resetPercent) {
+      const socket = req.socket;
+      if (typeof socket.resetAndDestroy === "function") socket.resetAndDestroy();
+      else socket.destroy();
       return;
     }
+    if (latency > 0 || jitter > 0) {
+      setTimeout(() => {
+        if (!req.socket.destroyed) this.forward(req, res, service, receivedAt);
+      }, shapedDelay(latency, jitter));
+      return;
+    }
+    this.forward(req, res, service, receivedAt);
+  }
 
+  private forward(
+    req: IncomingMessage,
+    res: ServerResponse,
+    service: Service,
+    receivedAt: number
+  ): void {
     // Forward to backend with original Host header preserved
-    this.proxyToSocket(req, res, service.socketPath);
+    const withBody = hasBody(req);
+    if (service.options.bufferRequests && withBody) {
+      this.bufferRequest(req, res, service, receivedAt);
+    } else if (service.options.coalesce && !withBody && (req.method === "GET" || req.method === "HEAD")) {
+      // Before admission: requests waiting on an identical one hold no slot
+      service.coalescer.join(req, res, () => this.admit(req, res, service, receivedAt));
+    } else {
+      this.admit(req, res, service, receivedAt);
+    }
+  }
+
+  /**
+   * Resolve a Host header to its service and path rules. Hits are remembered
+   * per exact header value, so steady-state routing is one map lookup plus,
+   * for hosts with path rules, one trie walk.
+   */
+  private route(host: string | undefined): HostRoute | null {
+    if (!host) return null;
+
+    const cached = this.routeCache.get(host);
+    if (cached) return cached;
+
+    const subdomain = this.extractSubdomain(host);
+    const route = subdomain ? this.findRoute(subdomain) : null;
+    if (route) {
+      if (this.routeCache.size >= ROUTE_CACHE_SIZE) this.routeCache.clear();
+      this.routeCache.set(host, route);
+    }
+    return route;
+  }
+
+  /**
+   * The service for one request on a routed host. A matching path rule
+   * overrides the host's own service and may strip its prefix from req.url.
+   */
+  private routePath(route: HostRoute, req: IncomingMessage): Service | null {
+    const rule = route.paths?.match(req.url ?? "/");
+    if (!rule) return route.service;
+    if (rule.strip) req.url = stripPrefix(req.url ?? "/", rule.prefix);
+    return this.lookup(rule.service) ?? null;
+  }
+
+  /** A service by name; registered services shadow routes-file ones. */
+  private lookup(name: string): Service | undefined {
+    return this.services.get(name) ?? this.fileServices.get(name);
+  }
+
+  /**
+   * Install a new version of the routes file. Everything is built first and
+   * then swapped in with plain assignments, so no request ever sees half a
+   * reload; requests already in flight keep the Service they started with.
+   */
+  private installRoutesFile(file: RoutesFile): void {
+    const services = new Map<string, Service>();
+    for (const spec of file.services) {
+      const previous = this.fileServices.get(spec.name);
+      const metrics = this.metrics.get(spec.name) ?? new ServiceMetrics(spec.name);
+      const service: Service = {
+        name: spec.name,
+        backends: spec.targets.map((t) => ({ ...t, pid: null, transport: null, h2: null })),
+        static: true,
+        nextBackend: 0,
+        registeredAt: previous?.registeredAt ?? new Date(),
+        metrics,
+        options: spec.options,
+        // Carried over so in-flight slots and budgets survive the reload
+        admission: previous?.admission ?? new AdmissionQueue(spec.options),
+        hedgeDelay: previous?.hedgeDelay ?? new HedgeDelay(),
+        retryBudget: previous?.retryBudget ?? new RetryBudget(),
+        coalescer: previous?.coalescer ?? new Coalescer(metrics),
+        etags: previous?.etags ?? new EtagHasher(metrics),
+        bucket: previous?.bucket ?? new TokenBucket(),
+      };
+      applyOptions(service, spec.options);
+      services.set(spec.name, service);
+    }
+
+    // File rules replace the previous file's; API-added rules stay unless
+    // the file now defines the same host and prefix (or pattern)
+    const fileRules = new Set(file.routes.map((r) => `${r.host}${r.prefix}`));
+    const filePatterns = new Set(file.hostPatterns.map((p) => p.pattern));
+    const routes = new RoutingTable(
+      [
+        ...this.routes.rules.filter((r) => !r.file && !fileRules.has(`${r.host}${r.prefix}`)),
+        ...file.routes,
+      ],
+      [
+        ...this.routes.patterns.filter((p) => !p.file && !filePatterns.has(p.pattern)),
+        ...file.hostPatterns,
+      ]
+    );
+
+    for (const name of this.fileServices.keys()) {
+      if (!services.has(name) && !this.services.has(name)) this.metrics.delete(name);
+    }
+    for (const service of services.values()) this.metrics.set(service.name, service.metrics);
+    for (const previous of this.fileServices.values()) closeTransports(previous.backends, []);
+    this.fileServices = services;
+    this.routes = routes;
+    this.routeCache.clear();
+    this.servicesChanged();
+    console.error(
+      `[lohostd] Routes file loaded: ${services.size} services, ` +
+        `${file.routes.length} path rules, ${file.hostPatterns.length} host patterns`
+    );
+  }
+
+  /** Bring everything derived from the set of services up to date. */
+  private servicesChanged(): void {
+    this.syncLoopback();
+    this.sniffing = [...this.services.values(), ...this.fileServices.values()].some(
+      (s) => s.options.splice || s.options.upstream === "h2c"
+    );
+  }
+
+  /**
+   * Give every service its loopback address, listen on the addresses and
+   * ports services ask for, and republish the hosts file the preload reads.
+   * Called after any change to the set of services or their options.
+   */
+  private syncLoopback(): void {
+    const names = new Set([...this.services.keys(), ...this.fileServices.keys()]);
+    for (const name of this.loopback.names()) {
+      if (!names.has(name)) this.loopback.release(name);
+    }
+
+    const wanted = new Map<string, ForwardSpec>();
+    const published: Array<[string, string]> = [];
+    for (const name of [...names].sort()) {
+      const address = this.loopback.assign(name);
+      const service = this.lookup(name)!;
+      const ports = service.options.tcpPorts;
+      const backends = service.backends.map(relayTarget);
+      for (const port of ports) {
+        wanted.set(`${address}:${port}`, { service: name, address, port, backends });
+      }
+      // Only Linux routes all of 127/8 to lo; elsewhere an address works once
+      // aliased, which is only worth doing (and asking for) for TCP services
+      if (LOOPBACK_ROUTABLE || ports.length > 0) published.push([name, address]);
+    }
+    this.tcpForwarder.sync(wanted);
+
+    try {
+      writeHostsFile(this.hostsFilePath, published);
+    } catch (err) {
+      console.error(`[lohostd] Cannot write ${this.hostsFilePath}: ${(err as Error).message}`);
+    }
+  }
+
+  /**
+   * Hand tcp-ports to the native relay. Should it be missing or die, the
+   * daemon forwards them itself again.
+   */
+  private startRelay(mode: Exclude<RelayMode, "node">): void {
+    const binary = findRelayBinary();
+    if (!binary || platform() !== "linux") {
+      console.error("[lohostd] Native relay not available; forwarding TCP in the daemon");
+      return;
+    }
+    const relay = new NativeRelay(binary, mode);
+    relay.onExit = (reason) => {
+      console.error(`[lohostd] Native relay stopped (${reason}); forwarding TCP in the daemon`);
+      this.relay = null;
+      this.tcpForwarder.setRelay(null);
+      this.servicesChanged();
+    };
+    this.relay = relay;
+    this.tcpForwarder.setRelay(relay);
+  }
+
+  /** Splice a raw TCP connection to one of the service's backends. */
+  private forwardTcp(name: string, socket: Socket): void {
+    const service = this.lookup(name);
+    if (!service) {
+      socket.destroy();
+      return;
+    }
+    relay(socket, pickBackend(service, null), null);
+    service.metrics.trackRelay(socket);
+  }
+
+  private rejectUnrouted(host: string | undefined, res: ServerResponse): void {
+    const subdomain = this.extractSubdomain(host);
+    if (!subdomain) {
+      res.writeHead(400, JSON_HEADERS);
+      res.end(this.badRequestBody);
+      return;
+    }
+    res.writeHead(404, JSON_HEADERS);
+    res.end(`{"error":"Not Found","message":${JSON.stringify(`No service matches "${subdomain}"`)}}`);
   }
 
   private handleUpgrade(
@@ -123,32 +688,47 @@ export class LohostDaemon {
     socket: Socket,
     head: Buffer
   ): void {
-    const subdomain = this.extractSubdomain(req.headers.host);
-    if (!subdomain) {
-      socket.write("HTTP/1.1 400 Bad Request\r\n\r\n");
-      socket.destroy();
-      return;
-    }
-
-    const service = this.findService(subdomain);
+    const route = this.route(req.headers.host);
+    const service = route && this.routePath(route, req);
     if (!service) {
-      socket.write("HTTP/1.1 404 Not Found\r\n\r\n");
+      socket.write(
+        this.extractSubdomain(req.headers.host)
+          ? "HTTP/1.1 404 Not Found\r\n\r\n"
+          : "HTTP/1.1 400 Bad Request\r\n\r\n"
+      );
       socket.destroy();
       return;
     }
 
-    // Connect to UDS and proxy the upgrade
-    const udsSocket = createConnection(service.socketPath);
+    // Connect to UDS and proxy the upgrade. Upgrades bypass the service's
+    // admission queue: a long-lived HMR socket must never wait behind (or
+    // hold a slot from) ordinary requests.
+    const backend = pickBackend(service, null);
+    const udsSocket = backend.socketPath
+      ? createConnection(backend.socketPath)
+      : createConnection(backend.port, backend.host ?? undefined);
+
+    // The `websocket` option decides whether frames are read on the way, and
+    // whether the daemon takes the client's permessage-deflate offer itself
+    const stats = req.headers.upgrade?.toLowerCase() === "websocket" ? service.metrics.websocket : null;
+    const deflate = stats && service.options.websocket === "deflate"
+      ? negotiateDeflate(req.headers["sec-websocket-extensions"])
+      : null;
 
     udsSocket.on("connect", () => {
       const headers = [`${req.method} ${req.url} HTTP/1.1`];
       for (const [key, value] of Object.entries(req.headers)) {
-        if (!value) continue;
+        if (!value || (deflate && key === "sec-websocket-extensions")) continue;
         headers.push(`${key}: ${Array.isArray(value) ? value.join(", ") : value}`);
       }
       headers.push("", "");
 
       udsSocket.write(headers.join("\r\n"));
+      service.metrics.trackUpgrade(socket);
+      if (stats) {
+        relayWebSocket(socket, udsSocket, head, stats, deflate);
+        return;
+      }
       if (head.length > 0) {
         udsSocket.write(head);
       }
@@ -167,34 +747,39 @@ export class LohostDaemon {
     });
   }
 
-  private handleApi(req: IncomingMessage, res: ServerResponse): void {
-    // CORS headers for local dev tools
-    const corsHeaders = {
-      "Access-Control-Allow-Origin": "*",
-      "Access-Control-Allow-Methods": "GET, POST, DELETE, OPTIONS",
-      "Access-Control-Allow-Headers": "Content-Type",
-    };
-
-    // Handle preflight
+  private handleApi(
+    req: IncomingMessage,
+    res: ServerResponse,
+    trusted = false
+  ): void {
+    // Handle preflight (CORS headers for local dev tools)
     if (req.method === "OPTIONS") {
-      res.writeHead(204, corsHeaders);
+      res.writeHead(204, CORS_HEADERS);
       res.end();
       return;
     }
 
     const url = req.url ?? "";
-    const headers = { "Content-Type": "application/json", ...corsHeaders };
+    const headers = API_HEADERS;
 
-    // GET /_lohost/health
+    // GET /_lohost/health (polled by every client; body rebuilt only on change)
     if (url === "/_lohost/health" && req.method === "GET") {
       const uptime = Math.floor((Date.now() - this.startedAt.getTime()) / 1000);
+      let cache = this.healthCache;
+      if (!cache || cache.uptime !== uptime || cache.services !== this.services.size) {
+        cache = this.healthCache = {
+          uptime,
+          services: this.services.size,
+          body: Buffer.from(JSON.stringify({
+            status: "ok",
+            version: VERSION,
+            uptime,
+            services: this.services.size,
+          })),
+        };
+      }
       res.writeHead(200, headers);
-      res.end(JSON.stringify({
-        status: "ok",
-        version: VERSION,
-        uptime,
-        services: this.services.size,
-      }));
+      res.end(cache.body);
       return;
     }
 
@@ -219,18 +804,21 @@ export class LohostDaemon {
     }
 
     // GET /_lohost/services/:name
-    const serviceMatch = url.match(/^\/_lohost\/services\/(.+)$/);
-    if (serviceMatch && req.method === "GET") {
-      const name = serviceMatch[1];
-      const service = this.services.get(name);
+    if (url.startsWith("/_lohost/services/") && req.method === "GET") {
+      const name = url.slice("/_lohost/services/".length);
+      const service = this.lookup(name);
       if (service) {
         res.writeHead(200, headers);
         res.end(JSON.stringify({
           name: service.name,
-          port: service.port,
-          socketPath: service.socketPath,
+          port: service.backends[0].port,
+          socketPath: service.backends[0].socketPath,
           url: `http://${service.name}.${this.config.routeDomain}:${this.config.port}`,
           registeredAt: service.registeredAt.toISOString(),
+          backends: service.backends,
+          options: service.options,
+          address: this.loopback.get(service.name) ?? null,
+          tcpPorts: this.tcpForwarder.ports(service.name),
         }));
       } else {
         res.writeHead(404, headers);
@@ -239,28 +827,258 @@ export class LohostDaemon {
       return;
     }
 
+    // PATCH /_lohost/services/:name/options (JSON; unspecified options keep their values)
+    if (url.startsWith("/_lohost/services/") && url.endsWith("/options") && req.method === "PATCH") {
+      const name = url.slice("/_lohost/services/".length, -"/options".length);
+      let body = "";
+      req.on("data", (chunk) => (body += chunk));
+      req.on("end", () => {
+        const service = this.lookup(name);
+        if (!service) {
+          res.writeHead(404, headers);
+          res.end(JSON.stringify({ error: "Service not found", name }));
+          return;
+        }
+        try {
+          applyOptions(service, parseServiceOptions(JSON.parse(body), service.options));
+        } catch (err) {
+          res.writeHead(400, headers);
+          res.end(JSON.stringify({
+            error: err instanceof SyntaxError ? "Invalid JSON" : (err as Error).message,
+          }));
+          return;
+        }
+        this.servicesChanged();
+        console.error(`[lohostd] ~ ${name} options ${body}`);
+        res.writeHead(200, headers);
+        res.end(JSON.stringify({ name, options: service.options }));
+      });
+      return;
+    }
+
+    // GET /_lohost/routes
+    if (url === "/_lohost/routes" && req.method === "GET") {
+      res.writeHead(200, headers);
+      res.end(JSON.stringify(this.routes.rules));
+      return;
+    }
+
+    // PUT /_lohost/routes (JSON rule; replaces a rule for the same host and prefix)
+    if (url === "/_lohost/routes" && req.method === "PUT") {
+      let body = "";
+      req.on("data", (chunk) => (body += chunk));
+      req.on("end", () => {
+        let rule: PathRule;
+        try {
+          rule = parsePathRule(JSON.parse(body), this.config.routeDomain);
+        } catch (err) {
+          res.writeHead(400, headers);
+          res.end(JSON.stringify({
+            error: err instanceof SyntaxError ? "Invalid JSON" : (err as Error).message,
+          }));
+          return;
+        }
+        this.routes = this.routes.with(rule);
+        this.routeCache.clear();
+        console.error(
+          `[lohostd] + route ${rule.host}${rule.prefix || "/"} → ${rule.service}${rule.strip ? " (strip)" : ""}`
+        );
+        res.writeHead(200, headers);
+        res.end(JSON.stringify(rule));
+      });
+      return;
+    }
+
+    // DELETE /_lohost/routes?host=<host>&prefix=<prefix>
+    if (url.startsWith("/_lohost/routes?") && req.method === "DELETE") {
+      const params = new URL(url, "http://localhost").searchParams;
+      const host = ruleHost(params.get("host") ?? "", this.config.routeDomain);
+      const prefix = normalizePrefix(params.get("prefix") ?? "/");
+      const routes = this.routes.without(host, prefix);
+      if (!routes) {
+        res.writeHead(404, headers);
+        res.end(JSON.stringify({ error: "Not found" }));
+        return;
+      }
+      this.routes = routes;
+      this.routeCache.clear();
+      console.error(`[lohostd] - route ${host}${prefix || "/"}`);
+      res.writeHead(200, headers);
+      res.end(JSON.stringify({ removed: { host, prefix } }));
+      return;
+    }
+
+    // GET /_lohost/host-patterns
+    if (url === "/_lohost/host-patterns" && req.method === "GET") {
+      res.writeHead(200, headers);
+      res.end(JSON.stringify(this.routes.patterns));
+      return;
+    }
+
+    // PUT /_lohost/host-patterns (JSON; new patterns rank last, existing keep their rank)
+    if (url === "/_lohost/host-patterns" && req.method === "PUT") {
+      let body = "";
+      req.on("data", (chunk) => (body += chunk));
+      req.on("end", () => {
+        let pattern: HostPattern;
+        try {
+          pattern = parseHostPattern(JSON.parse(body));
+        } catch (err) {
+          res.writeHead(400, headers);
+          res.end(JSON.stringify({
+            error: err instanceof SyntaxError ? "Invalid JSON" : (err as Error).message,
+          }));
+          return;
+        }
+        this.routes = this.routes.withPattern(pattern);
+        this.routeCache.clear();
+        console.error(`[lohostd] + pattern ${pattern.pattern} → ${pattern.service}`);
+        res.writeHead(200, headers);
+        res.end(JSON.stringify(pattern));
+      });
+      return;
+    }
+
+    // DELETE /_lohost/host-patterns?pattern=<pattern>
+    if (url.startsWith("/_lohost/host-patterns?") && req.method === "DELETE") {
+      const pattern = new URL(url, "http://localhost").searchParams.get("pattern") ?? "";
+      const routes = this.routes.withoutPattern(pattern);
+      if (!routes) {
+        res.writeHead(404, headers);
+        res.end(JSON.stringify({ error: "Not found" }));
+        return;
+      }
+      this.routes = routes;
+      this.routeCache.clear();
+      console.error(`[lohostd] - pattern ${pattern}`);
+      res.writeHead(200, headers);
+      res.end(JSON.stringify({ removed: pattern }));
+      return;
+    }
+
+    // GET /_lohost/debug/* (control socket only)
+    if (url.startsWith("/_lohost/debug/")) {
+      if (!trusted) {
+        res.writeHead(403, headers);
+        res.end(JSON.stringify({
+          error: "Debug endpoints are only served on the control socket",
+          socket: this.controlSocketPath,
+        }));
+        return;
+      }
+      this.handleDebug(req, res, url);
+      return;
+    }
+
+    // GET /_lohost/metrics
+    if (url === "/_lohost/metrics" && req.method === "GET") {
+      this.sampleProcessesUntil = performance.now() + PROCESS_SAMPLE_GRACE_MS;
+      res.writeHead(200, headers);
+      res.end(JSON.stringify(this.metricsSnapshot()));
+      return;
+    }
+
+    // GET /_lohost/metrics/stream (Server-Sent Events, one snapshot per second)
+    if (url === "/_lohost/metrics/stream" && req.method === "GET") {
+      res.writeHead(200, {
+        ...CORS_HEADERS,
+        "Content-Type": "text/event-stream",
+        "Cache-Control": "no-cache",
+      });
+      res.write(`data: ${JSON.stringify(this.metricsSnapshot())}\n\n`);
+      this.metricsSubscribers.add(res);
+      res.on("close", () => this.metricsSubscribers.delete(res));
+      return;
+    }
+
+    // GET /_lohost/resolve?host=<host>[&path=<path>]
+    if (url.startsWith("/_lohost/resolve?") && req.method === "GET") {
+      const params = new URL(url, "http://localhost").searchParams;
+      const host = params.get("host") ?? "";
+      const subdomain = this.extractSubdomain(host);
+      const route = subdomain ? this.findRoute(subdomain) : null;
+      const rule = route?.paths?.match(params.get("path") ?? "/");
+      const service = rule ? this.lookup(rule.service) : route?.service;
+      if (service) {
+        res.writeHead(200, headers);
+        res.end(JSON.stringify({
+          host,
+          service: service.name,
+          port: service.backends[0].port,
+          socketPath: service.backends[0].socketPath,
+        }));
+      } else {
+        res.writeHead(404, headers);
+        res.end(JSON.stringify({ error: "No service matches", host }));
+      }
+      return;
+    }
+
     // POST /_lohost/register
     if (url === "/_lohost/register" && req.method === "POST") {
       let body = "";
       req.on("data", (chunk) => (body += chunk));
       req.on("end", () => {
         try {
-          const { name, socketPath, port } = JSON.parse(body);
+          const { name, socketPath, port, pid, replica, shmSocket, options: rawOptions } = JSON.parse(body);
           if (!name || !socketPath || !port) {
             res.writeHead(400, headers);
             res.end(JSON.stringify({ error: "name, socketPath, and port required" }));
             return;
           }
-          this.services.set(name, {
-            name,
+          // A replica joins an existing service and inherits its options
+          const previous = this.services.get(name);
+          const joining = replica === true && previous !== undefined;
+          let options: ServiceOptions;
+          try {
+            options = parseServiceOptions(rawOptions, joining ? previous.options : undefined);
+          } catch (err) {
+            res.writeHead(400, headers);
+            res.end(JSON.stringify({ error: (err as Error).message }));
+            return;
+          }
+          const backend: Backend = {
             socketPath,
+            host: null,
             port,
-            registeredAt: new Date(),
-          });
+            pid: typeof pid === "number" ? pid : null,
+            transport: typeof shmSocket === "string" ? ShmTransport.open(shmSocket, name) : null,
+            h2: null,
+          };
+          const metrics = this.metrics.get(name) ?? new ServiceMetrics(name);
+          if (!joining) metrics.pid = backend.pid;
+          this.metrics.set(name, metrics);
+          // Keep the queue across re-registration so in-flight slots stay counted
+          const service: Service = {
+            name,
+            backends: joining
+              ? [...previous.backends.filter((b) => b.socketPath !== socketPath), backend]
+              : [backend],
+            static: false,
+            nextBackend: 0,
+            registeredAt: joining ? previous.registeredAt : new Date(),
+            metrics,
+            options,
+            admission: previous?.admission ?? new AdmissionQueue(options),
+            hedgeDelay: previous?.hedgeDelay ?? new HedgeDelay(),
+            retryBudget: previous?.retryBudget ?? new RetryBudget(),
+            coalescer: previous?.coalescer ?? new Coalescer(metrics),
+            etags: previous?.etags ?? new EtagHasher(metrics),
+            bucket: previous?.bucket ?? new TokenBucket(),
+          };
+          applyOptions(service, options);
+          if (previous) closeTransports(previous.backends, service.backends);
+          this.services.set(name, service);
+          this.routeCache.clear();
+          this.servicesChanged();
           const serviceUrl = `http://${name}.${this.config.routeDomain}:${this.config.port}`;
-          console.error(`[lohostd] + ${name} → ${socketPath} (port ${port})`);
+          console.error(
+            joining
+              ? `[lohostd] + ${name} replica → ${socketPath} (port ${port}), ${previous.backends.length + 1} backends`
+              : `[lohostd] + ${name} → ${socketPath} (port ${port})`
+          );
           res.writeHead(200, headers);
-          res.end(JSON.stringify({ url: serviceUrl }));
+          res.end(JSON.stringify({ url: serviceUrl, address: this.loopback.get(name) }));
         } catch {
           res.writeHead(400, headers);
           res.end(JSON.stringify({ error: "Invalid JSON" }));
@@ -269,12 +1087,35 @@ export class LohostDaemon {
       return;
     }
 
-    // DELETE /_lohost/register/:name
-    const deregisterMatch = url.match(/^\/_lohost\/register\/(.+)$/);
-    if (deregisterMatch && req.method === "DELETE") {
-      const name = deregisterMatch[1];
-      if (this.services.has(name)) {
+    // DELETE /_lohost/register/:name[?socketPath=<path>]
+    if (url.startsWith("/_lohost/register/") && req.method === "DELETE") {
+      const rest = url.slice("/_lohost/register/".length);
+      const query = rest.indexOf("?");
+      const name = query === -1 ? rest : rest.slice(0, query);
+      const socketPath =
+        query === -1 ? null : new URLSearchParams(rest.slice(query + 1)).get("socketPath");
+      const service = this.services.get(name);
+
+      // With a socketPath only that backend leaves; a stale client whose
+      // backend was already replaced must not remove its successor.
+      const remaining = service?.backends.filter((b) => b.socketPath !== socketPath) ?? [];
+      if (service && socketPath !== null && remaining.length === service.backends.length) {
+        res.writeHead(404, headers);
+        res.end(JSON.stringify({ error: "Not found" }));
+      } else if (service && socketPath !== null && remaining.length > 0) {
+        const backends = remaining;
+        closeTransports(service.backends, backends);
+        service.backends = backends;
+        this.servicesChanged();
+        console.error(`[lohostd] - ${name} replica ${socketPath}, ${backends.length} backends`);
+        res.writeHead(200, headers);
+        res.end(JSON.stringify({ removed: name, socketPath }));
+      } else if (service) {
+        closeTransports(service.backends, []);
         this.services.delete(name);
+        this.metrics.delete(name);
+        this.routeCache.clear();
+        this.servicesChanged();
         console.error(`[lohostd] - ${name}`);
         res.writeHead(200, headers);
         res.end(JSON.stringify({ removed: name }));
@@ -293,10 +1134,145 @@ export class LohostDaemon {
       return;
     }
 
+    res.writeHead(404, headers);
+    res.end(API_NOT_FOUND_BODY);
+  }
+
+  private handleDebug(req: IncomingMessage, res: ServerResponse, url: string): void {
+    const parsed = new URL(url, "http://localhost");
+    const seconds = Math.min(
+      Math.max(Number(parsed.searchParams.get("seconds") ?? 10) || 10, 1),
+      MAX_DEBUG_SECONDS
+    );
+    const headers = JSON_HEADERS;
+    const stamp = new Date().toISOString().replace(/[:.]/g, "-");
+    const attachment = (ext: string) => ({
+      ...headers,
+      "Content-Disposition": `attachment; filename="lohostd-${stamp}.${ext}"`,
+    });
+    const fail = (err: Error) => {
+      if (!res.headersSent) {
+        res.writeHead(err.message.includes("already") ? 409 : 500, headers);
+        res.end(JSON.stringify({ error: err.message }));
+      } else {
+        res.destroy(err);
+      }
+    };
+
+    if (req.method !== "GET") {
+      res.writeHead(405, headers);
+      res.end(JSON.stringify({ error: "Method not allowed" }));
+      return;
+    }
+
+    // GET /_lohost/debug/capture/:name[?seconds=N] (streams until N or disconnect)
+    if (parsed.pathname.startsWith("/_lohost/debug/capture/")) {
+      this.startCapture(res, parsed);
+      return;
+    }
+
+    switch (parsed.pathname) {
+      // GET /_lohost/debug/cpu-profile?seconds=N
+      case "/_lohost/debug/cpu-profile":
+        console.error(`[lohostd] CPU profile requested (${seconds}s)`);
+        this.profiler.cpuProfile(seconds * 1000).then((profile) => {
+          res.writeHead(200, attachment("cpuprofile"));
+          res.end(JSON.stringify(profile));
+        }, fail);
+        return;
+
+      // GET /_lohost/debug/alloc-sample?seconds=N
+      case "/_lohost/debug/alloc-sample":
+        console.error(`[lohostd] Allocation sample requested (${seconds}s)`);
+        this.profiler.allocationSample(seconds * 1000).then((profile) => {
+          res.writeHead(200, attachment("heapprofile"));
+          res.end(JSON.stringify(profile));
+        }, fail);
+        return;
+
+      // GET /_lohost/debug/heap-snapshot
+      case "/_lohost/debug/heap-snapshot":
+        console.error("[lohostd] Heap snapshot requested");
+        this.profiler.heapSnapshot().then((snapshot) => {
+          res.writeHead(200, attachment("heapsnapshot"));
+          // A client that leaves early must not keep the deleted dump open
+          pipeline(snapshot, res, () => {});
+        }, fail);
+        return;
+    }
+
     res.writeHead(404, headers);
     res.end(JSON.stringify({ error: "Not found" }));
   }
 
+  private startCapture(res: ServerResponse, url: URL): void {
+    const name = url.pathname.slice("/_lohost/debug/capture/".length);
+    if (!this.lookup(name)) {
+      res.writeHead(404, JSON_HEADERS);
+      res.end(JSON.stringify({ error: "Service not found", name }));
+      return;
+    }
+    if (this.captures.has(name)) {
+      res.writeHead(409, JSON_HEADERS);
+      res.end(JSON.stringify({ error: `A capture of ${name} is already running` }));
+      return;
+    }
+
+    const seconds = Number(url.searchParams.get("seconds") ?? 0) || 0;
+    res.writeHead(200, {
+      "Content-Type": "application/octet-stream",
+      "Content-Disposition": `attachment; filename="${name}.lhcap"`,
+    });
+    const recorder = new CaptureRecorder(name, res);
+    this.captures.set(name, recorder);
+    console.error(`[lohostd] Capturing ${name}${seconds > 0 ? ` for ${seconds}s` : ""}`);
+
+    const timer = seconds > 0 ? setTimeout(() => res.end(), seconds * 1000) : null;
+    res.once("close", () => {
+      if (timer) clearTimeout(timer);
+      this.captures.delete(name);
+      console.error(
+        `[lohostd] Capture of ${name} done: ${recorder.recorded} requests` +
+          (recorder.dropped > 0 ? `, ${recorder.dropped} dropped` : "")
+      );
+    });
+  }
+
+  private async tickMetrics(): Promise<void> {
+    const now = performance.now();
+    const elapsed = now - this.lastTick;
+    this.lastTick = now;
+
+    if (this.metricsSubscribers.size > 0 || now < this.sampleProcessesUntil) {
+      await Promise.all(Array.from(this.metrics.values(), (m) => m.sampleProcess()));
+    }
+    for (const m of this.metrics.values()) {
+      m.tick(elapsed);
+    }
+    this.diagnostics.tick();
+
+    if (this.metricsSubscribers.size > 0) {
+      const frame = `data: ${JSON.stringify(this.metricsSnapshot())}\n\n`;
+      for (const res of this.metricsSubscribers) {
+        res.write(frame);
+      }
+    }
+  }
+
+  private metricsSnapshot(): {
+    timestamp: string;
+    daemon: DiagnosticsSnapshot;
+    services: ServiceSnapshot[];
+  } {
+    return {
+      timestamp: new Date().toISOString(),
+      daemon: this.diagnostics.snapshot,
+      services: Array.from(this.metrics.values(), (m) => m.snapshot).sort((a, b) =>
+        a.name.localeCompare(b.name)
+      ),
+    };
+  }
+
   private extractSubdomain(host: string | undefined): string | null {
     if (!host) return null;
 
@@ -311,14 +1287,28 @@ export class LohostDaemon {
     return subdomain || null;
   }
 
-  private findService(subdomain: string): Service | null {
+  /**
+   * The longest suffix of `subdomain` that names a service or has path
+   * rules; failing that, the target of the first matching host pattern.
+   */
+  private findRoute(subdomain: string): HostRoute | null {
     const parts = subdomain.split(".");
 
     for (let i = 0; i < parts.length; i++) {
       const candidate = parts.slice(i).join(".");
-      const service = this.services.get(candidate);
-      if (service) {
-        return service;
+      const service = this.lookup(candidate) ?? null;
+      const paths = this.routes.paths(candidate);
+      if (service || paths) {
+        return { service, paths };
+      }
+    }
+
+    const target = this.routes.matchHost(subdomain);
+    if (target) {
+      const service = this.lookup(target) ?? null;
+      const paths = this.routes.paths(target);
+      if (service || paths) {
+        return { service, paths };
       }
     }
 
@@ -328,46 +1318,547 @@ export class LohostDaemon {
   private getServicesArray(): Array<{
     name: string;
     port: number;
-    socketPath: string;
+    socketPath: string | null;
     url: string;
     registeredAt: string;
+    backends: number;
+    static: boolean;
+    address: string | null;
+    tcpPorts: number[];
   }> {
-    return Array.from(this.services.values())
+    const services = [...this.services.values()];
+    for (const [name, service] of this.fileServices) {
+      if (!this.services.has(name)) services.push(service);
+    }
+    return services
       .sort((a, b) => a.name.localeCompare(b.name))
       .map((s) => ({
         name: s.name,
-        port: s.port,
-        socketPath: s.socketPath,
+        port: s.backends[0].port,
+        socketPath: s.backends[0].socketPath,
         url: `http://${s.name}.${this.config.routeDomain}:${this.config.port}`,
         registeredAt: s.registeredAt.toISOString(),
+        backends: s.backends.length,
+        static: s.static,
+        address: this.loopback.get(s.name) ?? null,
+        tcpPorts: this.tcpForwarder.ports(s.name),
       }));
   }
 
   private proxyToSocket(
     req: IncomingMessage,
     res: ServerResponse,
-    socketPath: string
+    service: Service,
+    receivedAt: number,
+    body?: Spool
+  ): void {
+    const { options: serviceOptions, backends } = service;
+    service.retryBudget.deposit(serviceOptions.retryBudget);
+
+    const proxyReq = startAttempt(
+      req, res, service, pickBackend(service, null), receivedAt, 0, body ? body.size : -1, null
+    );
+
+    if (!body) {
+      if (service.metrics.mirror || this.captures.size > 0) this.observe(req, res, service);
+
+      // Hedge idempotent requests once the first attempt is slower than usual;
+      // a hedge is sent without a body, so only those that have none
+      if (serviceOptions.hedge && backends.length > 1 &&
+          (req.method === "GET" || req.method === "HEAD") && !hasBody(req)) {
+        const delay = service.hedgeDelay.delay(serviceOptions.hedgePercentile);
+        if (delay !== null) {
+          const group: HedgeGroup = { attempts: [proxyReq], settled: false, timer: null };
+          proxyReq[kHedge] = group;
+          group.timer = setTimeout(sendHedge, delay, group);
+        }
+      }
+      req.pipe(proxyReq);
+      return;
+    }
+    body.drainTo(proxyReq).then(
+      () => proxyReq.end(),
+      () => proxyReq.destroy()
+    ).finally(() => body.dispose());
+  }
+
+  /**
+   * Hooks that tee the request body (capture, mirror). Called right before
+   * the body starts flowing to the backend or into the buffer.
+   */
+  private observe(req: IncomingMessage, res: ServerResponse, service: Service): void {
+    const recorder = this.captures.get(service.name);
+    if (recorder) {
+      (res as CapturedResponse)[kCapture] = recorder.record(req, res);
+    }
+    if (service.metrics.mirror) this.mirror(req, res, service);
+  }
+
+  /** Copy a sampled share of requests to the service's mirror target. */
+  private mirror(req: IncomingMessage, res: ServerResponse, service: Service): void {
+    const stats = service.metrics.mirror!;
+    if (Math.random() * 100 >= service.options.mirrorPercent) return;
+    const target = this.lookup(stats.target);
+    if (!target || target === service) {
+      stats.dropped++;
+      return;
+    }
+    stats.mirror(req, res, pickBackend(target, null));
+  }
+
+  /**
+   * Enforce the service's in-flight limit: proxy now if a slot is free,
+   * otherwise wait in its queue or answer 503 with Retry-After.
+   */
+  private admit(
+    req: IncomingMessage,
+    res: ServerResponse,
+    service: Service,
+    receivedAt: number,
+    body?: Spool
   ): void {
-    const options = {
-      socketPath,
-      path: req.url,
-      method: req.method,
-      headers: req.headers,
+    if (service.options.maxInFlight === 0) {
+      this.proxyToSocket(req, res, service, receivedAt, body);
+      return;
+    }
+
+    const { admission, metrics } = service;
+    const dispatch = () => {
+      res.once("close", () => admission.release());
+      this.proxyToSocket(req, res, service, receivedAt, body);
     };
+    if (admission.tryAcquire()) {
+      dispatch();
+      return;
+    }
 
-    const proxyReq = httpRequest(options, (proxyRes) => {
-      res.writeHead(proxyRes.statusCode ?? 500, proxyRes.headers);
-      proxyRes.pipe(res);
-    });
+    const queuedAt = performance.now();
+    let ticket: Ticket | null = null;
+    const onClose = () => {
+      // Client left while queued
+      metrics.queued--;
+      ticket?.cancel();
+      body?.dispose();
+    };
 
-    proxyReq.on("error", (err) => {
-      console.error(`[lohostd] Proxy error: ${err.message}`);
-      if (!res.headersSent) {
-        res.writeHead(502, { "Content-Type": "application/json" });
-        res.end(JSON.stringify({ error: "Bad Gateway", message: "Backend unavailable" }));
+    metrics.queued++;
+    ticket = admission.enqueue(
+      () => {
+        metrics.queued--;
+        res.off("close", onClose);
+        metrics.recordQueueWait(performance.now() - queuedAt);
+        dispatch();
+      },
+      (reason) => {
+        metrics.queued--;
+        metrics.rejected++;
+        res.off("close", onClose);
+        body?.dispose();
+        res.writeHead(503, { ...JSON_HEADERS, "Retry-After": "1" });
+        res.end(JSON.stringify({ error: "Service Unavailable", message: OVERLOAD_MESSAGES[reason] }));
       }
+    );
+    if (ticket) res.once("close", onClose);
+  }
+
+  /**
+   * Receive the whole request body before opening the backend connection,
+   * so a slow upload never ties up a single-threaded backend. The body is
+   * then sent upstream with a Content-Length at local speed.
+   */
+  private bufferRequest(
+    req: IncomingMessage,
+    res: ServerResponse,
+    service: Service,
+    receivedAt: number
+  ): void {
+    if (service.metrics.mirror || this.captures.size > 0) this.observe(req, res, service);
+
+    const body = new Spool(service.options.bufferMemory);
+    req.on("data", (chunk: Buffer) => body.write(chunk));
+    req.on("end", () => {
+      body.end();
+      // Admission only after the upload, so slow clients don't hold slots
+      this.admit(req, res, service, receivedAt, body);
+    });
+    req.on("close", () => {
+      // Client gave up before finishing the upload; the backend never saw it
+      if (!req.complete) body.dispose();
     });
+  }
+}
+
+/** Install new options on a service, updating the state derived from them. */
+function applyOptions(service: Service, options: ServiceOptions): void {
+  service.options = options;
+  service.admission.setOptions(options);
+  // Comparison restarts whenever the mirror target changes
+  const metrics = service.metrics;
+  if (metrics.mirror?.target !== options.mirror) {
+    metrics.mirror = options.mirror ? new MirrorStats(options.mirror) : null;
+  }
+  // Message counts carry over between frames and deflate, and apply to new connections
+  metrics.websocket = options.websocket === "pipe" ? null : metrics.websocket ?? new WebSocketStats();
+}
+
+/**
+ * Round-robin over a service's backends, skipping `avoid` (the backend a
+ * retry or hedge is moving away from) when there is an alternative.
+ */
+function pickBackend(service: Service, avoid: Backend | null): Backend {
+  const backends = service.backends;
+  if (backends.length === 1) return backends[0];
+  let backend = backends[service.nextBackend++ % backends.length];
+  if (backend === avoid) backend = backends[service.nextBackend++ % backends.length];
+  return backend;
+}
+
+/**
+ * Pipe a client socket to `backend` in both directions, sending `head`
+ * (bytes already read from the client) first. Half-closes pass through the
+ * pipes; only a failure tears both sides down.
+ */
+function relay(socket: Socket, backend: Backend, head: Buffer | null): void {
+  const upstream = backend.socketPath
+    ? createConnection({ path: backend.socketPath, allowHalfOpen: true })
+    : createConnection({
+        port: backend.port,
+        host: backend.host ?? undefined,
+        allowHalfOpen: true,
+        noDelay: true,
+      });
+  if (head) upstream.write(head);
+  socket.pipe(upstream);
+  upstream.pipe(socket);
+  socket.on("error", () => upstream.destroy());
+  upstream.on("error", () => socket.destroy());
+}
+
+/** A backend in the native relay's syntax: `unix:<path>` or `<host>:<port>`. */
+function relayTarget(backend: Backend): string {
+  if (backend.socketPath) return `unix:${backend.socketPath}`;
+  const host = backend.host ?? "127.0.0.1";
+  return `${host.includes(":") ? `[${host}]` : host}:${backend.port}`;
+}
+
+/**
+ * Close the shared memory and HTTP/2 sessions of backends that `before`
+ * had and `after` dropped.
+ */
+function closeTransports(before: Backend[], after: Backend[]): void {
+  for (const backend of before) {
+    if (after.includes(backend)) continue;
+    backend.transport?.close();
+    backend.h2?.close();
+  }
+}
+
+/**
+ * Open one upstream attempt. `bodyLength` is -1 when the request body (if
+ * any) is piped through unchanged, otherwise the buffered length to
+ * announce. The caller writes or ends the body.
+ */
+function startAttempt(
+  req: IncomingMessage,
+  res: ServerResponse,
+  service: Service,
+  backend: Backend,
+  receivedAt: number,
+  retries: number,
+  bodyLength: number,
+  hedge: HedgeGroup | null
+): ProxyRequest {
+  const withBody = bodyLength > 0 || (bodyLength < 0 && hasBody(req));
+  let proxyReq: ProxyRequest;
+  if (service.options.upstream === "h2c") {
+    proxyReq = startStream(req, res, backend, bodyLength, withBody) as ProxyRequest;
+    proxyReq.on("response", onStreamResponse);
+    proxyReq.on("trailers", onStreamTrailers);
+  } else {
+    // Raw header arrays are forwarded as-is: no per-header setHeader() calls
+    // and the client's original casing and duplicates are preserved.
+    const options = proxyOptions;
+    if (backend.socketPath) {
+      options.socketPath = backend.socketPath;
+      options.host = options.port = undefined;
+    } else {
+      options.socketPath = undefined;
+      options.host = backend.host;
+      options.port = backend.port;
+    }
+    options.agent = backend.transport?.agent;
+    options.path = req.url;
+    options.method = req.method;
+    options.headers = bodyLength >= 0 ? withContentLength(req.rawHeaders, bodyLength) : req.rawHeaders;
+
+    proxyReq = httpRequest(options) as ProxyRequest;
+    proxyReq.on("response", onProxyResponse);
+  }
+  proxyReq[kDownstream] = res;
+  proxyReq[kIncoming] = req;
+  proxyReq[kReceivedAt] = receivedAt;
+  proxyReq[kUpstreamStart] = performance.now();
+  proxyReq[kService] = service;
+  proxyReq[kBackend] = backend;
+  proxyReq[kRetries] = retries;
+  proxyReq[kHasBody] = withBody;
+  proxyReq[kHedge] = hedge;
+  proxyReq.on("error", onProxyError);
+  return proxyReq;
+}
+
+/** Open an attempt as a stream on one of the backend's h2c sessions. */
+function startStream(
+  req: IncomingMessage,
+  res: ServerResponse,
+  backend: Backend,
+  bodyLength: number,
+  withBody: boolean
+): ClientHttp2Stream {
+  backend.h2 ??= new H2Pool(() =>
+    backend.socketPath
+      ? createConnection({ path: backend.socketPath })
+      : createConnection({ port: backend.port, host: backend.host ?? undefined, noDelay: true })
+  );
+  const stream = backend.h2.request(h2RequestHeaders(req, bodyLength), !withBody);
+  // A client that goes away cancels the stream, so the backend (gRPC) sees it too
+  res.once("close", () => {
+    if (!stream.readableEnded) stream.close(http2Constants.NGHTTP2_CANCEL);
+  });
+  return stream;
+}
+
+/** Hedge timer: race a second attempt on another backend. */
+function sendHedge(group: HedgeGroup): void {
+  group.timer = null;
+  const first = group.attempts[0];
+  if (group.settled || !first) return;
+  const service = first[kService];
+  if (!service.retryBudget.tryWithdraw()) return;
+
+  service.metrics.hedges++;
+  const hedge = startAttempt(
+    first[kIncoming],
+    first[kDownstream],
+    service,
+    pickBackend(service, first[kBackend]),
+    first[kReceivedAt],
+    first[kRetries],
+    -1,
+    group
+  );
+  group.attempts.push(hedge);
+  hedge.end();
+}
+
+/**
+ * An attempt may be retried when the backend provably never processed it:
+ * the connection failed, or a reused keep-alive connection turned out to be
+ * closed (idempotent methods only). Requests with a body never are, since
+ * the body has already been consumed.
+ */
+function isRetriable(attempt: ProxyRequest, err: NodeJS.ErrnoException): boolean {
+  if (attempt[kHasBody]) return false;
+  if (!(attempt instanceof ClientRequest)) {
+    // A stream whose session never connected, or that the backend refused unprocessed
+    const cause = err.cause as NodeJS.ErrnoException | undefined;
+    return (cause?.code !== undefined && CONNECT_ERRORS.has(cause.code)) ||
+      attempt.rstCode === http2Constants.NGHTTP2_REFUSED_STREAM;
+  }
+  if (attempt.res) return false;
+  if (err.code && CONNECT_ERRORS.has(err.code)) return true;
+  const method = attempt.method;
+  return err.code === "ECONNRESET" && attempt.reusedSocket &&
+    (method === "GET" || method === "HEAD" || method === "OPTIONS");
+}
+
+/** True when the request carries a body (chunked or non-zero length). */
+function hasBody(req: IncomingMessage): boolean {
+  if (req.httpVersionMajor === 2) return h2HasBody(req);
+  const length = req.headers["content-length"];
+  return (length !== undefined && length !== "0") || req.headers["transfer-encoding"] !== undefined;
+}
+
+/** Replace the framing headers of a raw header list with a fixed length. */
+function withContentLength(rawHeaders: string[], length: number): string[] {
+  const headers: string[] = [];
+  for (let i = 0; i < rawHeaders.length; i += 2) {
+    const name = rawHeaders[i].toLowerCase();
+    if (name === "content-length" || name === "transfer-encoding") continue;
+    headers.push(rawHeaders[i], rawHeaders[i + 1]);
+  }
+  headers.push("Content-Length", String(length));
+  return headers;
+}
+
+/**
+ * Read the backend response into a spool as fast as it arrives and feed the
+ * client from the spool, so a slow client can't hold the backend's socket.
+ */
+function bufferResponse(proxyRes: Readable, res: Writable, memoryLimit: number): void {
+  const body = new Spool(memoryLimit);
+  proxyRes.on("data", (chunk: Buffer) => body.write(chunk));
+  proxyRes.on("end", () => body.end());
+  proxyRes.on("close", () => {
+    if (!proxyRes.readableEnded) res.destroy();
+  });
+  body.drainTo(res).then(
+    () => res.end(),
+    () => {
+      res.destroy();
+      proxyRes.destroy();
+    }
+  ).finally(() => body.dispose());
+}
+
+function onProxyResponse(this: ProxyRequest, proxyRes: IncomingMessage): void {
+  // An HTTP/2 client's response must not carry HTTP/1.1 connection headers
+  const headers = this[kIncoming].httpVersionMajor === 2
+    ? withoutConnectionHeaders(proxyRes.rawHeaders)
+    : proxyRes.rawHeaders;
+  respond(this, proxyRes.statusCode ?? 500, headers, proxyRes, false);
+}
+
+function onStreamResponse(
+  this: ProxyRequest,
+  headers: IncomingHttpHeaders & IncomingHttpStatusHeader,
+  flags: number
+): void {
+  const headersOnly = (flags & http2Constants.NGHTTP2_FLAG_END_STREAM) !== 0;
+  respond(this, headers[":status"] ?? 500, h2RawHeaders(headers), this as ClientHttp2Stream, headersOnly);
+}
+
+/**
+ * Trailers (gRPC's status) go out with the end of the client's response:
+ * always to HTTP/2 clients, and to HTTP/1.1 ones when it is chunked.
+ */
+function onStreamTrailers(this: ProxyRequest, trailers: IncomingHttpHeaders): void {
+  this[kDownstream].addTrailers(trailers as Record<string, string>);
+}
+
+/**
+ * Send the winning attempt's response to the client. `proxyRes` is its
+ * body; `headersOnly` when the backend ended the response with its headers.
+ */
+function respond(
+  attempt: ProxyRequest,
+  status: number,
+  rawHeaders: string[],
+  proxyRes: Readable,
+  headersOnly: boolean
+): void {
+  const hedge = attempt[kHedge];
+  if (hedge) {
+    if (hedge.settled) {
+      proxyRes.destroy();
+      return;
+    }
+    // First headers win; the other attempts are abandoned
+    hedge.settled = true;
+    if (hedge.timer) clearTimeout(hedge.timer);
+    for (const other of hedge.attempts) {
+      if (other !== attempt) other.destroy();
+    }
+    if (attempt !== hedge.attempts[0]) attempt[kService].metrics.hedgeWins++;
+  }
+
+  const service = attempt[kService];
+  if (service.options.hedge) {
+    service.hedgeDelay.record(performance.now() - attempt[kUpstreamStart]);
+  }
+
+  const res = attempt[kDownstream];
+  const req = attempt[kIncoming];
+  const options = service.options;
+  (res as CapturedResponse)[kCapture]?.observe(proxyRes);
+  const sink = (client: ServerResponse) => (options.bandwidth > 0 ? throttle(client, service) : client);
+  // With `etag`, coalesced requests are answered with the request's own
+  // ETag decision below; otherwise they get the backend's response as is
+  const etag = options.etag && !headersOnly && service.etags.eligible(req, status, rawHeaders);
+  const sharers = etag && options.coalesce ? claimSharers(res, rawHeaders) : [];
+  if (options.coalesce && !etag) {
+    shareResponse(res, status, rawHeaders, proxyRes, headersOnly, sink);
+  }
+  let headers = rawHeaders;
+  const receivedAt = attempt[kReceivedAt];
+  if (receivedAt) {
+    // lohost: routing time before dispatch; upstream: relay + backend time to headers
+    const upstreamStart = attempt[kUpstreamStart];
+    const upstream = performance.now() - upstreamStart;
+    headers = headers.concat(
+      "Server-Timing",
+      `lohost;dur=${(upstreamStart - receivedAt).toFixed(3)}, upstream;dur=${upstream.toFixed(3)}`
+    );
+  }
+  if (headersOnly && req.httpVersionMajor === 2) {
+    respondHeadersOnly(res, status, headers);
+    proxyRes.resume();
+    return;
+  }
+  if (etag) {
+    service.etags.respond([{ req, res, headers }, ...sharers], status, proxyRes, sink);
+    return;
+  }
+  res.writeHead(status, headers);
+
+  const downstream = sink(res);
+  if (options.bufferResponses) {
+    bufferResponse(proxyRes, downstream, options.bufferMemory);
+  } else {
+    proxyRes.pipe(downstream);
+  }
+}
+
+/** Feed `res` through the service's per-connection or shared bandwidth cap. */
+function throttle(res: ServerResponse, service: Service): Throttle {
+  let bucket = service.bucket;
+  const socket = res.socket as ShapedSocket | null;
+  if (socket && service.options.bandwidthScope === "connection") {
+    bucket = socket[kBucket] ??= new TokenBucket();
+  }
+  const throttled = new Throttle(bucket, () => service.options.bandwidth);
+  throttled.pipe(res);
+  res.once("close", () => throttled.destroy());
+  throttled.once("close", () => {
+    if (!throttled.writableFinished) res.destroy();
+  });
+  return throttled;
+}
+
+function onProxyError(this: ProxyRequest, err: NodeJS.ErrnoException): void {
+  const hedge = this[kHedge];
+  // A hedge that lost the race was destroyed on purpose
+  if (hedge?.settled) return;
+
+  const service = this[kService];
+  const res = this[kDownstream];
+  if (hedge) hedge.attempts.splice(hedge.attempts.indexOf(this), 1);
+
+  if (this[kRetries] < service.options.retries && isRetriable(this, err) &&
+      service.retryBudget.tryWithdraw()) {
+    service.metrics.retries++;
+    const retry = startAttempt(
+      this[kIncoming],
+      res,
+      service,
+      pickBackend(service, this[kBackend]),
+      this[kReceivedAt],
+      this[kRetries] + 1,
+      -1,
+      hedge
+    );
+    hedge?.attempts.push(retry);
+    retry.end();
+    return;
+  }
+
+  // Another attempt of the same hedged request is still running
+  if (hedge && hedge.attempts.length > 0) return;
+  if (hedge?.timer) clearTimeout(hedge.timer);
 
-    req.pipe(proxyReq);
+  console.error(`[lohostd] Proxy error: ${err.message}`);
+  if (!res.headersSent) {
+    res.writeHead(502, JSON_HEADERS);
+    res.end(BAD_GATEWAY_BODY);
   }
 }
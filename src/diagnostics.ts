@@ -0,0 +1,185 @@
+/**
+ * Daemon runtime diagnostics
+ *
+ * Continuous event-loop delay histogram, GC pause tracking, heap statistics
+ * and active handle counts, folded into a snapshot once a second alongside
+ * the service metrics. An optional watchdog captures a CPU profile when the
+ * event loop lags past a threshold, so stutters can be explained after the
+ * fact.
+ */
+
+import { writeFile } from "node:fs/promises";
+import { join } from "node:path";
+import {
+  constants,
+  monitorEventLoopDelay,
+  PerformanceObserver,
+  type IntervalHistogram,
+} from "node:perf_hooks";
+import { getHeapStatistics } from "node:v8";
+import { Histogram } from "./histogram.js";
+import type { Profiler } from "./profiler.js";
+
+// Length of the profile the watchdog records, and the minimum gap between two
+const WATCHDOG_PROFILE_MS = 5000;
+const WATCHDOG_COOLDOWN_MS = 60_000;
+
+// Sampling interval of the delay monitor; it reports whole timer periods, so
+// this is subtracted to get the lag itself.
+const LOOP_RESOLUTION_MS = 10;
+
+const GC_KINDS: Record<number, string> = {
+  [constants.NODE_PERFORMANCE_GC_MINOR]: "minor",
+  [constants.NODE_PERFORMANCE_GC_MAJOR]: "major",
+  [constants.NODE_PERFORMANCE_GC_INCREMENTAL]: "incremental",
+  [constants.NODE_PERFORMANCE_GC_WEAKCB]: "weakcb",
+};
+
+export interface DiagnosticsSnapshot {
+  /** Event-loop delay over the last window, in milliseconds. */
+  eventLoopDelay: { p50: number; p99: number; max: number; mean: number };
+  /** GC pauses over the last window. */
+  gc: {
+    count: number;
+    pauseMs: number;
+    maxPauseMs: number;
+    byKind: Record<string, { count: number; pauseMs: number }>;
+  };
+  heap: {
+    usedBytes: number;
+    totalBytes: number;
+    limitBytes: number;
+    externalBytes: number;
+  };
+  /** Active libuv handles and requests keeping the loop alive, by type. */
+  handles: Record<string, number>;
+  watchdog: {
+    thresholdMs: number;
+    profiles: number;
+    lastProfile: string | null;
+  };
+}
+
+export interface DiagnosticsOptions {
+  /** Capture a CPU profile when event-loop delay exceeds this; 0 disables. */
+  lagProfileThresholdMs: number;
+  /** Directory for watchdog profiles. */
+  profileDir: string;
+}
+
+export class DaemonDiagnostics {
+  private options: DiagnosticsOptions;
+  private profiler: Profiler;
+  private loopDelay: IntervalHistogram | null = null;
+  private gcObserver: PerformanceObserver | null = null;
+  private gcPauses = new Histogram();
+  private gcByKind: Record<string, { count: number; pauseMs: number }> = {};
+  private lastProfileAt = -Infinity;
+  private profiles = 0;
+  private lastProfile: string | null = null;
+
+  snapshot: DiagnosticsSnapshot;
+
+  constructor(options: DiagnosticsOptions, profiler: Profiler) {
+    this.options = options;
+    this.profiler = profiler;
+    this.snapshot = this.collect();
+  }
+
+  start(): void {
+    this.loopDelay = monitorEventLoopDelay({ resolution: LOOP_RESOLUTION_MS });
+    this.loopDelay.enable();
+
+    this.gcObserver = new PerformanceObserver((list) => {
+      for (const entry of list.getEntries()) {
+        const detail = entry.detail as { kind?: number } | undefined;
+        const kind = GC_KINDS[detail?.kind ?? -1] ?? "other";
+        const stats = (this.gcByKind[kind] ??= { count: 0, pauseMs: 0 });
+        stats.count++;
+        stats.pauseMs += entry.duration;
+        this.gcPauses.record(entry.duration * 1000);
+      }
+    });
+    this.gcObserver.observe({ entryTypes: ["gc"] });
+  }
+
+  stop(): void {
+    this.loopDelay?.disable();
+    this.gcObserver?.disconnect();
+  }
+
+  /** Fold the last window into `snapshot` and run the watchdog. */
+  tick(): void {
+    this.snapshot = this.collect();
+    this.loopDelay?.reset();
+    this.gcPauses.reset();
+    this.gcByKind = {};
+
+    const threshold = this.options.lagProfileThresholdMs;
+    if (threshold > 0 && this.snapshot.eventLoopDelay.max > threshold) {
+      this.captureLagProfile(this.snapshot.eventLoopDelay.max);
+    }
+  }
+
+  private collect(): DiagnosticsSnapshot {
+    const lag = (ns: number | undefined) =>
+      ns && Number.isFinite(ns)
+        ? Math.max(0, Math.round(ns / 1000 - LOOP_RESOLUTION_MS * 1000) / 1000)
+        : 0;
+    const heap = getHeapStatistics();
+    const handles: Record<string, number> = {};
+    for (const type of process.getActiveResourcesInfo()) {
+      handles[type] = (handles[type] ?? 0) + 1;
+    }
+
+    return {
+      eventLoopDelay: {
+        p50: lag(this.loopDelay?.percentile(50)),
+        p99: lag(this.loopDelay?.percentile(99)),
+        max: lag(this.loopDelay?.max),
+        mean: lag(this.loopDelay?.mean),
+      },
+      gc: {
+        count: this.gcPauses.count,
+        pauseMs: Math.round(this.gcPauses.sum) / 1000,
+        maxPauseMs: this.gcPauses.max / 1000,
+        byKind: this.gcByKind,
+      },
+      heap: {
+        usedBytes: heap.used_heap_size,
+        totalBytes: heap.total_heap_size,
+        limitBytes: heap.heap_size_limit,
+        externalBytes: heap.external_memory,
+      },
+      handles,
+      watchdog: {
+        thresholdMs: this.options.lagProfileThresholdMs,
+        profiles: this.profiles,
+        lastProfile: this.lastProfile,
+      },
+    };
+  }
+
+  private captureLagProfile(lagMs: number): void {
+    const now = Date.now();
+    if (this.profiler.active || now - this.lastProfileAt < WATCHDOG_COOLDOWN_MS) return;
+    this.lastProfileAt = now;
+
+    const path = join(
+      this.options.profileDir,
+      `lohostd-lag-${new Date(now).toISOString().replace(/[:.]/g, "-")}.cpuprofile`
+    );
+    console.error(`[lohostd] Event loop lag ${lagMs}ms, profiling for ${WATCHDOG_PROFILE_MS}ms`);
+    this.profiler
+      .cpuProfile(WATCHDOG_PROFILE_MS)
+      .then((profile) => writeFile(path, JSON.stringify(profile)))
+      .then(() => {
+        this.profiles++;
+        this.lastProfile = path;
+        console.error(`[lohostd] Wrote ${path}`);
+      })
+      .catch((err: Error) => {
+        console.error(`[lohostd] Lag profile failed: ${err.message}`);
+      });
+  }
+}
@@ -0,0 +1,129 @@
+/**
+ * Synthesized validators
+ *
+ * Dev servers often send large responses without ETag or Last-Modified, so
+ * the browser can only fetch them again in full. With `-o etag`, the daemon
+ * reads such a GET response whole from the backend, hashes it, and sends it
+ * with a strong ETag. A later request whose If-None-Match names the hash of
+ * the backend's new response gets a 304 instead of the body. The backend
+ * still answers every request; what is saved is the transfer to the client.
+ *
+ * Only responses with a Content-Length are held, so streams (Server-Sent
+ * Events, chunked progress output) pass straight through. Nothing is kept
+ * between requests: If-None-Match is compared with the hash of the response
+ * just read. The hash is SHA-256, which OpenSSL runs at over 1 GB/s on CPUs
+ * with SHA extensions.
+ */
+
+import { createHash } from "node:crypto";
+import type { IncomingMessage, ServerResponse } from "node:http";
+import type { Readable, Writable } from "node:stream";
+import type { Sharer } from "./coalesce.js";
+import type { ServiceMetrics } from "./metrics.js";
+
+// Largest body held for hashing; bigger ones stream through without an ETag
+const MAX_HASHED_BYTES = 16 * 1024 * 1024;
+
+// What a 304 carries over from the 200 it stands for (RFC 9110 §15.4.5)
+const NOT_MODIFIED_HEADERS = new Set([
+  "cache-control",
+  "content-location",
+  "date",
+  "expires",
+  "vary",
+  "server-timing",
+]);
+
+/** Synthesizes one service's ETags and counts the 304s they allow. */
+export class EtagHasher {
+  private metrics: ServiceMetrics;
+
+  constructor(metrics: ServiceMetrics) {
+    this.metrics = metrics;
+  }
+
+  /**
+   * Whether the response to `req` gets an ETag: a full 200 to a GET, without
+   * validators, whose Content-Length is at most MAX_HASHED_BYTES.
+   */
+  eligible(req: IncomingMessage, status: number, rawHeaders: string[]): boolean {
+    if (status !== 200 || req.method !== "GET") return false;
+    let sized = false;
+    for (let i = 0; i < rawHeaders.length; i += 2) {
+      const name = rawHeaders[i].toLowerCase();
+      const value = rawHeaders[i + 1];
+      if (name === "etag" || name === "last-modified" || name === "content-range") return false;
+      if (name === "transfer-encoding") return false;
+      if (name === "cache-control" && /no-store/i.test(value)) return false;
+      if (name === "content-type" && /^\s*text\/event-stream/i.test(value)) return false;
+      if (name === "content-length") {
+        if (!/^\d+$/.test(value) || Number(value) > MAX_HASHED_BYTES) return false;
+        sized = true;
+      }
+    }
+    return sized;
+  }
+
+  /**
+   * Read `body` whole, then answer each of `targets` (the request and any
+   * coalesced onto it) with 304 if that client already has it, or else
+   * with the body and its ETag. `downstream` opens a client's body stream
+   * (the bandwidth cap, if any).
+   */
+  respond(
+    targets: Sharer[],
+    status: number,
+    body: Readable,
+    downstream: (res: ServerResponse) => Writable
+  ): void {
+    const hash = createHash("sha256");
+    const chunks: Buffer[] = [];
+    let size = 0;
+
+    body.on("data", (chunk: Buffer) => {
+      size += chunk.length;
+      hash.update(chunk);
+      chunks.push(chunk);
+    });
+    body.on("end", () => {
+      const etag = `"${hash.digest("base64url").slice(0, 22)}"`;
+      for (const { req, res, headers } of targets) {
+        if (res.destroyed) continue;
+        if (matches(req.headers["if-none-match"], etag)) {
+          this.metrics.notModified++;
+          this.metrics.notModifiedBytes += size;
+          res.writeHead(304, notModifiedHeaders(headers, etag));
+          res.end();
+          continue;
+        }
+        res.writeHead(status, headers.concat("ETag", etag));
+        const out = downstream(res);
+        for (const held of chunks) out.write(held);
+        out.end();
+      }
+    });
+    body.on("close", () => {
+      // The backend broke off while the body was held: fail the clients' requests as a whole
+      if (body.readableEnded) return;
+      for (const { res } of targets) if (!res.headersSent) res.destroy();
+    });
+  }
+}
+
+/** If-None-Match against a strong ETag; the comparison is weak (RFC 9110 §13.1.2). */
+function matches(ifNoneMatch: string | undefined, etag: string): boolean {
+  if (!ifNoneMatch) return false;
+  for (const tag of ifNoneMatch.split(",")) {
+    const value = tag.trim();
+    if (value === "*" || value === etag || value === `W/${etag}`) return true;
+  }
+  return false;
+}
+
+function notModifiedHeaders(rawHeaders: string[], etag: string): string[] {
+  const headers = ["ETag", etag];
+  for (let i = 0; i < rawHeaders.length; i += 2) {
+    if (NOT_MODIFIED_HEADERS.has(rawHeaders[i].toLowerCase())) headers.push(rawHeaders[i], rawHeaders[i + 1]);
+  }
+  return headers;
+}
@@ -0,0 +1,219 @@
+/**
+ * HTTP/2 on both sides of the proxy
+ *
+ * Upstream: a service with `-o upstream=h2c` is sent its requests as HTTP/2
+ * with prior knowledge over the backend's socket. Each backend keeps one
+ * multiplexed session, and opens a few more only while every open one is at
+ * the backend's concurrent-stream limit. Requests from HTTP/1.1 clients are
+ * converted on the way: connection-level headers are dropped, Host becomes
+ * :authority, and response trailers are passed on when the client's
+ * response is chunked.
+ *
+ * Downstream: clients may speak h2c to the daemon (gRPC clients do). Their
+ * requests get the HTTP/1.1 header view the rest of the proxy works with,
+ * so routing, capture, mirrors and HTTP/1.1 backends treat them alike.
+ */
+
+import type {
+  IncomingHttpHeaders,
+  IncomingMessage,
+  OutgoingHttpHeaders,
+  ServerResponse,
+} from "node:http";
+import {
+  connect as connectHttp2,
+  type ClientHttp2Session,
+  type ClientHttp2Stream,
+  type Http2ServerRequest,
+  type Http2ServerResponse,
+} from "node:http2";
+import type { Socket } from "node:net";
+
+// Sessions per backend; streams past their limits queue in the least busy one
+const MAX_SESSIONS = 4;
+// An idle session is closed after this long; the next request opens another
+const SESSION_IDLE_MS = 30_000;
+// Receive windows and frames large enough that a download is not paced by
+// WINDOW_UPDATE round trips and 16 KB frames
+const SESSION_SETTINGS = { initialWindowSize: 1024 * 1024, maxFrameSize: 256 * 1024 };
+const SESSION_WINDOW = 8 * 1024 * 1024;
+
+// Hop-by-hop headers HTTP/2 forbids (RFC 9113 §8.2.2)
+const CONNECTION_HEADERS = new Set([
+  "connection",
+  "keep-alive",
+  "proxy-connection",
+  "transfer-encoding",
+  "upgrade",
+  "http2-settings",
+]);
+
+interface PooledSession {
+  session: ClientHttp2Session;
+  streams: number;
+}
+
+/** HTTP/2 sessions to one backend. */
+export class H2Pool {
+  private sessions: PooledSession[] = [];
+  private connect: () => Socket;
+
+  constructor(connect: () => Socket) {
+    this.connect = connect;
+  }
+
+  /** Open a stream on a session with room for it, connecting one if needed. */
+  request(headers: OutgoingHttpHeaders, endStream: boolean): ClientHttp2Stream {
+    const pooled = this.pick();
+    const stream = pooled.session.request(headers, { endStream });
+    pooled.streams++;
+    stream.once("close", () => pooled.streams--);
+    return stream;
+  }
+
+  /** How the services API shows it. */
+  toJSON(): { sessions: number; streams: number } {
+    let streams = 0;
+    for (const pooled of this.sessions) streams += pooled.streams;
+    return { sessions: this.sessions.length, streams };
+  }
+
+  /** Close every session once its streams are done. */
+  close(): void {
+    for (const { session } of this.sessions) session.close();
+    this.sessions = [];
+  }
+
+  private pick(): PooledSession {
+    let least: PooledSession | null = null;
+    for (const pooled of this.sessions) {
+      if (pooled.streams < pooled.session.remoteSettings.maxConcurrentStreams!) return pooled;
+      if (!least || pooled.streams < least.streams) least = pooled;
+    }
+    if (least && this.sessions.length >= MAX_SESSIONS) return least;
+
+    const session = connectHttp2("http://localhost", { createConnection: this.connect, settings: SESSION_SETTINGS });
+    session.once("connect", () => session.setLocalWindowSize(SESSION_WINDOW));
+    const pooled: PooledSession = { session, streams: 0 };
+    const remove = () => {
+      const i = this.sessions.indexOf(pooled);
+      if (i !== -1) this.sessions.splice(i, 1);
+    };
+    // Streams report their own errors; the session just leaves the pool
+    session.on("error", remove);
+    session.on("goaway", remove);
+    session.on("close", remove);
+    session.setTimeout(SESSION_IDLE_MS, () => {
+      if (pooled.streams === 0) session.close();
+    });
+    this.sessions.push(pooled);
+    return pooled;
+  }
+}
+
+/**
+ * Request headers for an HTTP/2 upstream, from the request's raw headers.
+ * `bodyLength` is -1 when the body is forwarded as it arrives, otherwise
+ * the buffered length to announce.
+ */
+export function h2RequestHeaders(req: IncomingMessage, bodyLength: number): OutgoingHttpHeaders {
+  const headers: OutgoingHttpHeaders = {
+    ":method": req.method,
+    ":path": req.url,
+    ":scheme": "http",
+  };
+  const raw = req.rawHeaders;
+  let nominated: string[] | null = null;
+  for (let i = 0; i < raw.length; i += 2) {
+    const name = raw[i].toLowerCase();
+    const value = raw[i + 1];
+    if (name === "host") {
+      headers[":authority"] ??= value;
+    } else if (CONNECTION_HEADERS.has(name)) {
+      // Connection also names more headers that stop at this hop
+      if (name === "connection") {
+        nominated = (nominated ?? []).concat(value.toLowerCase().split(",").map((t) => t.trim()));
+      }
+    } else if (name === "te") {
+      // The only TE value HTTP/2 allows, and the one gRPC needs
+      if (value.toLowerCase().includes("trailers")) headers.te = "trailers";
+    } else if (bodyLength < 0 || name !== "content-length") {
+      // Repeats are joined, so a duplicated single-value header cannot throw
+      const prev = headers[name];
+      headers[name] = prev === undefined ? value : `${prev}${name === "cookie" ? "; " : ", "}${value}`;
+    }
+  }
+  if (nominated) {
+    for (const name of nominated) if (name[0] !== ":") delete headers[name];
+  }
+  if (bodyLength >= 0) headers["content-length"] = bodyLength;
+  return headers;
+}
+
+/** Raw [name, value, ...] list of an HTTP/2 response's regular headers. */
+export function h2RawHeaders(headers: IncomingHttpHeaders): string[] {
+  const raw: string[] = [];
+  for (const name in headers) {
+    if (name[0] === ":") continue;
+    const value = headers[name]!;
+    if (Array.isArray(value)) {
+      for (const v of value) raw.push(name, v);
+    } else {
+      raw.push(name, String(value));
+    }
+  }
+  return raw;
+}
+
+/** An HTTP/1.1 backend's raw response headers minus those HTTP/2 forbids. */
+export function withoutConnectionHeaders(raw: string[]): string[] {
+  const headers: string[] = [];
+  for (let i = 0; i < raw.length; i += 2) {
+    if (CONNECTION_HEADERS.has(raw[i].toLowerCase())) continue;
+    headers.push(raw[i], raw[i + 1]);
+  }
+  return headers;
+}
+
+/**
+ * Give a request from an HTTP/2 client the HTTP/1.1 view: rawHeaders
+ * without pseudo-headers, and Host taken from :authority.
+ */
+export function asHttp1Request(req: Http2ServerRequest): IncomingMessage {
+  const raw = req.rawHeaders;
+  const headers: string[] = [];
+  let authority: string | null = null;
+  for (let i = 0; i < raw.length; i += 2) {
+    if (raw[i] === ":authority") authority = raw[i + 1];
+    else if (raw[i][0] !== ":") headers.push(raw[i], raw[i + 1]);
+  }
+  if (authority !== null && req.headers.host === undefined) {
+    headers.unshift("host", authority);
+    req.headers.host = authority;
+  }
+  Object.defineProperty(req, "rawHeaders", { value: headers });
+  return req as unknown as IncomingMessage;
+}
+
+/**
+ * Answer an HTTP/2 client with one HEADERS frame that ends the stream. The
+ * compatibility API always ends a response with a frame of its own, but
+ * gRPC's trailers-only responses (immediate errors) must be a single one.
+ */
+export function respondHeadersOnly(res: ServerResponse, status: number, raw: string[]): void {
+  const headers: OutgoingHttpHeaders = { ":status": status };
+  for (let i = 0; i < raw.length; i += 2) {
+    const name = raw[i].toLowerCase();
+    const prev = headers[name] as string | string[] | undefined;
+    if (prev === undefined) headers[name] = raw[i + 1];
+    else if (name === "set-cookie") headers[name] = ([] as string[]).concat(prev, raw[i + 1]);
+    else headers[name] = `${prev}, ${raw[i + 1]}`;
+  }
+  res.statusCode = status;
+  (res as unknown as Http2ServerResponse).stream.respond(headers, { endStream: true });
+}
+
+/** Whether a request from an HTTP/2 client has a body (no END_STREAM on its headers). */
+export function h2HasBody(req: IncomingMessage): boolean {
+  return !(req as unknown as Http2ServerRequest).stream.endAfterHeaders;
+}
@@ -0,0 +1,96 @@
+/**
+ * Hedging delay and retry budget
+ *
+ * A hedge is a second attempt sent to another backend when the first hasn't
+ * produced response headers within a recent latency percentile, so a stall
+ * in one dev server (GC, module recompile) costs one percentile of latency
+ * instead of the whole stall. Hedges and connect-failure retries both draw
+ * from a budget that only grows with ordinary traffic, so a sick backend
+ * can't make the daemon multiply load.
+ */
+
+import { performance } from "node:perf_hooks";
+import { Histogram } from "./histogram.js";
+
+// Time-to-headers samples older than one to two windows are forgotten
+const WINDOW_MS = 10_000;
+
+// Below this many samples the percentile is noise; don't hedge yet
+const MIN_SAMPLES = 20;
+
+// Recompute the cached percentile after this many new samples
+const RECOMPUTE_EVERY = 64;
+
+// Never hedge sooner than this, whatever the percentile says
+const MIN_DELAY_MS = 2;
+
+// Retry budget: tokens never exceed BUDGET_CAP, and at least
+// MIN_RETRIES_PER_SEC are always available to a quiet service.
+const BUDGET_CAP = 20;
+const MIN_RETRIES_PER_SEC = 1;
+
+export class HedgeDelay {
+  private current = new Histogram();
+  private previous = new Histogram();
+  private merged = new Histogram();
+  private rotatedAt = performance.now();
+  private sinceRecompute = Infinity;
+  private cachedPercentile = 0;
+  private cachedDelay: number | null = null;
+
+  /** Record one attempt's time to response headers. */
+  record(ms: number): void {
+    const now = performance.now();
+    if (now - this.rotatedAt > WINDOW_MS) {
+      const oldest = this.previous;
+      oldest.reset();
+      this.previous = this.current;
+      this.current = oldest;
+      this.rotatedAt = now;
+      this.sinceRecompute = Infinity;
+    }
+    this.current.record(ms * 1000);
+    this.sinceRecompute++;
+  }
+
+  /** Milliseconds to wait before hedging, or null while there is too little data. */
+  delay(percentile: number): number | null {
+    // Until there is enough data, check again as soon as there is, rather
+    // than waiting out a recompute interval
+    const warming = this.cachedDelay === null && this.previous.count + this.current.count >= MIN_SAMPLES;
+    if (warming || this.sinceRecompute >= RECOMPUTE_EVERY || percentile !== this.cachedPercentile) {
+      this.merged.reset();
+      this.merged.merge(this.previous);
+      this.merged.merge(this.current);
+      this.cachedPercentile = percentile;
+      this.cachedDelay = this.merged.count < MIN_SAMPLES
+        ? null
+        : Math.max(MIN_DELAY_MS, this.merged.percentile(percentile) / 1000);
+      this.sinceRecompute = 0;
+    }
+    return this.cachedDelay;
+  }
+}
+
+export class RetryBudget {
+  private balance = BUDGET_CAP;
+  private refilledAt = performance.now();
+
+  /** Credit `percent`% of a token for an ordinary request. */
+  deposit(percent: number): void {
+    this.balance = Math.min(BUDGET_CAP, this.balance + percent / 100);
+  }
+
+  /** Spend one token on a retry or hedge; false when the budget is empty. */
+  tryWithdraw(): boolean {
+    const now = performance.now();
+    this.balance = Math.min(
+      BUDGET_CAP,
+      this.balance + ((now - this.refilledAt) / 1000) * MIN_RETRIES_PER_SEC
+    );
+    this.refilledAt = now;
+    if (this.balance < 1) return false;
+    this.balance--;
+    return true;
+  }
+}
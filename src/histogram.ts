@@ -0,0 +1,120 @@
+/**
+ * Fixed-size log-linear latency histogram
+ *
+ * Values are recorded as integer microseconds into 64 linear sub-buckets per
+ * power of two (~1.5% relative error), so recording is O(1), memory is fixed
+ * and histograms from different windows or workers can be merged exactly.
+ */
+
+const SUB_BITS = 6;
+const SUB_COUNT = 1 << SUB_BITS;
+const MAX_VALUE = 0x7fffffff; // ~35 minutes in microseconds
+const BUCKETS = (31 - SUB_BITS) * SUB_COUNT + SUB_COUNT;
+
+function bucketOf(value: number): number {
+  if (value < SUB_COUNT) return value;
+  const msb = 31 - Math.clz32(value);
+  const shift = msb - SUB_BITS;
+  return shift * SUB_COUNT + (value >>> shift);
+}
+
+function lowerBound(bucket: number): number {
+  if (bucket < SUB_COUNT * 2) return bucket;
+  const shift = (bucket >>> SUB_BITS) - 1;
+  return (bucket - shift * SUB_COUNT) * 2 ** shift;
+}
+
+function upperBound(bucket: number): number {
+  if (bucket < SUB_COUNT * 2) return bucket;
+  const shift = (bucket >>> SUB_BITS) - 1;
+  return lowerBound(bucket) + 2 ** shift - 1;
+}
+
+export interface HistogramSummary {
+  count: number;
+  min: number;
+  mean: number;
+  p50: number;
+  p90: number;
+  p99: number;
+  p999: number;
+  max: number;
+}
+
+export class Histogram {
+  private counts = new Float64Array(BUCKETS);
+  count = 0;
+  sum = 0;
+  min = Infinity;
+  max = 0;
+
+  /** Record a value in microseconds. */
+  record(value: number): void {
+    const v = value <= 0 ? 0 : value >= MAX_VALUE ? MAX_VALUE : Math.round(value);
+    this.counts[bucketOf(v)]++;
+    this.count++;
+    this.sum += v;
+    if (v < this.min) this.min = v;
+    if (v > this.max) this.max = v;
+  }
+
+  merge(other: Histogram): void {
+    for (let i = 0; i < BUCKETS; i++) {
+      this.counts[i] += other.counts[i];
+    }
+    this.count += other.count;
+    this.sum += other.sum;
+    if (other.min < this.min) this.min = other.min;
+    if (other.max > this.max) this.max = other.max;
+  }
+
+  reset(): void {
+    this.counts.fill(0);
+    this.count = 0;
+    this.sum = 0;
+    this.min = Infinity;
+    this.max = 0;
+  }
+
+  /** Value (microseconds) at or below which `p` percent of samples fall. */
+  percentile(p: number): number {
+    if (this.count === 0) return 0;
+    const target = Math.max(1, Math.ceil((p / 100) * this.count));
+    let seen = 0;
+    for (let i = 0; i < BUCKETS; i++) {
+      seen += this.counts[i];
+      if (seen >= target) {
+        return Math.min(upperBound(i), this.max);
+      }
+    }
+    return this.max;
+  }
+
+  mean(): number {
+    return this.count === 0 ? 0 : this.sum / this.count;
+  }
+
+  /** Percentile summary converted to milliseconds. */
+  summary(): HistogramSummary {
+    const ms = (us: number) => Math.round(us) / 1000;
+    return {
+      count: this.count,
+      min: this.count === 0 ? 0 : ms(this.min),
+      mean: ms(this.mean()),
+      p50: ms(this.percentile(50)),
+      p90: ms(this.percentile(90)),
+      p99: ms(this.percentile(99)),
+      p999: ms(this.percentile(99.9)),
+      max: ms(this.max),
+    };
+  }
+
+  /** Non-empty buckets as [upperBoundMicros, count] pairs, for rendering. */
+  buckets(): Array<[number, number]> {
+    const out: Array<[number, number]> = [];
+    for (let i = 0; i < BUCKETS; i++) {
+      if (this.counts[i] > 0) out.push([upperBound(i), this.counts[i]]);
+    }
+    return out;
+  }
+}
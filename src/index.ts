@@ -6,11 +6,43 @@
  *   lohost -n <name> -- <command>   Run command with UDS proxy (auto-starts daemon)
  *   lohost daemon [--stop]          Start or stop the daemon
  *   lohost list                     List registered projects
+ *   lohost set <name> <k=v>...      Change a running service's options
+ *   lohost route [add|rm|pattern|rm-pattern] ...  Manage routing rules
+ *   lohost bench <name> [options]   Load-test a service through the daemon
+ *   lohost top                      Live per-service traffic view
+ *   lohost profile <kind>           Capture a daemon CPU/heap/allocation profile
+ *   lohost capture <name>           Record a service's traffic to a file
+ *   lohost replay <file>            Replay a capture as load
  */
 
+import { readFileSync } from "node:fs";
+import { resolve as resolvePath } from "node:path";
 import { parseArgs } from "node:util";
-import { LohostClient, listServices, stopDaemon, checkDaemonRunning } from "./client.js";
+import {
+  LohostClient,
+  listServices,
+  stopDaemon,
+  checkDaemonRunning,
+  resolveHost,
+  streamMetrics,
+  fetchDebugCapture,
+  updateServiceOptions,
+  listRoutes,
+  addRoute,
+  removeRoute,
+  listHostPatterns,
+  addHostPattern,
+  removeHostPattern,
+} from "./client.js";
 import { LohostDaemon } from "./daemon.js";
+import { RELAY_MODES, type RelayMode } from "./relay.js";
+import { TRANSPORTS, type Transport } from "./shm.js";
+import { parseOptionFlags, type ServiceOptions } from "./options.js";
+import { Histogram } from "./histogram.js";
+import { runLoad, type LoadResult } from "./loadgen.js";
+import { readCapture, fnv1a } from "./capture.js";
+import type { ServiceSnapshot } from "./metrics.js";
+import type { DiagnosticsSnapshot } from "./diagnostics.js";
 
 const DEFAULT_PORT = 8080;
 const DEFAULT_ROUTE_DOMAIN = "localhost";
@@ -22,17 +54,84 @@ Usage:
   lohost daemon                   Start the routing daemon
   lohost daemon --stop            Stop the routing daemon
   lohost list                     List registered projects
+  lohost set <name> <k=v>...      Change a running service's options (same keys as -o)
+  lohost route                    List path rules and host patterns
+  lohost route add <host> <prefix> <service> [--strip]
+                                  Send <host><prefix>* to <service>
+  lohost route rm <host> <prefix> Remove a path rule
+  lohost route pattern <glob|/regex/> <service>
+                                  Route matching hosts to <service> ($1… = captures)
+  lohost route rm-pattern <pattern>  Remove a host pattern
+  lohost bench <name> [options]   Load-test a service through the daemon
+  lohost top                      Live per-service traffic view
+  lohost profile cpu|heap|alloc   Capture a daemon profile (--seconds, --out)
+  lohost capture <name> -o FILE   Record a service's traffic (--seconds, or until Ctrl-C)
+  lohost replay <file>            Replay a capture as load and report mismatches
   lohost help                     Show this help
 
 Options:
   -n, --name <name>      Project name (required for run mode)
   -d, --socket-dir <dir> Socket directory (default: /tmp)
   -p, --port <port>      Daemon port (default: 8080)
+  -o, --option <k=v>     Per-service proxy option (repeatable, see below)
+  --replica              Add this process as another backend of an existing service
+  --transport uds|shm    How the daemon reaches the app: the socket (default), or
+                         shared memory with a native relay (Linux)
   -h, --help             Show this help
 
+Service options (-o):
+  buffer-requests        Receive whole request bodies before contacting the backend
+  buffer-responses       Read responses at full speed, drain to slow clients separately
+  buffer-memory=<size>   In-memory limit per buffered body before a temp file (default: 1m)
+  max-in-flight=<n>      Concurrent requests sent to the backend, 0 = unlimited (default: 0)
+  queue-size=<n>         Requests that may wait for a slot before 503 (default: 100)
+  queue-timeout=<time>   Longest wait for a slot, e.g. 500ms or 10s (default: 10s)
+  queue-order=fifo|lifo  Which waiting request runs next (default: fifo)
+  hedge                  Race a second GET/HEAD on another replica when the first is slow
+  hedge-percentile=<p>   Time-to-headers percentile that triggers a hedge (default: 95)
+  retries=<n>            Retries when a backend connection fails before sending (default: 1)
+  retry-budget=<pct>     Retries + hedges allowed as % of requests (default: 20)
+  coalesce               Identical concurrent GET/HEAD requests share one backend request
+  etag                   Add a strong ETag to validator-less GET responses; answer 304s
+  mirror=<name>          Copy requests to another service, discarding its responses
+  mirror-percent=<pct>   Share of requests mirrored (default: 100)
+  latency=<time>         Delay added before each request is forwarded (default: 0)
+  jitter=<time>          Random ± variation of the added latency (default: 0)
+  bandwidth=<size>       Response bytes per second, e.g. 200k, 0 = unlimited (default: 0)
+  bandwidth-scope=connection|service  Cap each connection or the whole service (default: connection)
+  reset-percent=<pct>    Share of requests answered with a connection reset (default: 0)
+  splice                 Route each connection by its first Host (or TLS SNI), then relay it unparsed
+  tcp-ports=<p,...>      Forward these ports on the service's own 127.0.x.y as raw TCP
+  upstream=http1|h2c     Speak HTTP/1.1 or HTTP/2 (prior knowledge, gRPC) to the backend (default: http1)
+  websocket=pipe|frames|deflate  Relay WebSockets as bytes, frame by frame (message metrics), or compressing for the client (default: pipe)
+
+Daemon options:
+  --lag-profile <ms>     Write a CPU profile when event-loop lag exceeds <ms>
+  --routes <file>        Load and watch a JSON routes file (static backends, rules)
+  --relay <mode>         Who forwards tcp-ports: node (default), native (io_uring,
+                         else epoll), io_uring, epoll, or sockmap (epoll with
+                         in-kernel redirection, needs CAP_BPF); native modes need Linux
+
+Bench options:
+  --rate <n>             Requests per second, 0 = closed loop (default: 100)
+  --duration <sec>       Test length in seconds (default: 10)
+  --path <path>          Request path (default: /)
+  --conns <n>            Keep-alive connections (default: 10)
+  --direct               Also run against the backend port to isolate lohost's cost
+
+Replay options:
+  --service <name>       Target service (default: the captured one)
+  --speed <n>|max        Time scale, e.g. 2 = twice as fast; max = closed loop (default: 1)
+  --conns <n>            Keep-alive connections (default: 50)
+  --loop <n>             Play the capture n times back to back (default: 1)
+
 Environment:
   LOHOST_PORT            Daemon port (default: 8080)
   LOHOST_ROUTE_DOMAIN    Routing domain (default: localhost)
+  LOHOST_LAG_PROFILE_MS  Same as daemon --lag-profile
+  LOHOST_ROUTES          Same as daemon --routes
+  LOHOST_RELAY           Same as daemon --relay
+  LOHOST_TRANSPORT       Same as --transport
 
 Routing:
   {name}.localhost:8080           → /tmp/{name}.sock
@@ -62,6 +161,41 @@ async function main() {
     return;
   }
 
+  if (args[0] === "set") {
+    await runSet(args.slice(1));
+    return;
+  }
+
+  if (args[0] === "route") {
+    await runRoute(args.slice(1));
+    return;
+  }
+
+  if (args[0] === "bench") {
+    await runBench(args.slice(1));
+    return;
+  }
+
+  if (args[0] === "top") {
+    await runTop(args.slice(1));
+    return;
+  }
+
+  if (args[0] === "profile") {
+    await runProfile(args.slice(1));
+    return;
+  }
+
+  if (args[0] === "capture") {
+    await runCapture(args.slice(1));
+    return;
+  }
+
+  if (args[0] === "replay") {
+    await runReplay(args.slice(1));
+    return;
+  }
+
   if (args[0] === "help" || args.length === 0) {
     console.log(HELP);
     return;
@@ -74,6 +208,9 @@ async function main() {
       name: { type: "string", short: "n" },
       "socket-dir": { type: "string", short: "d", default: "/tmp" },
       port: { type: "string", short: "p" },
+      option: { type: "string", short: "o", multiple: true },
+      replica: { type: "boolean" },
+      transport: { type: "string" },
       help: { type: "boolean", short: "h" },
     },
     allowPositionals: true,
@@ -103,10 +240,27 @@ async function main() {
     10
   );
 
+  let serviceOptions: Partial<ServiceOptions>;
+  try {
+    serviceOptions = parseOptionFlags(values.option ?? []);
+  } catch (err) {
+    console.error(`Error: ${(err as Error).message}`);
+    process.exit(1);
+  }
+
+  const transport = values.transport ?? process.env.LOHOST_TRANSPORT ?? "uds";
+  if (!(TRANSPORTS as readonly string[]).includes(transport)) {
+    console.error(`Error: --transport must be one of ${TRANSPORTS.join(", ")}`);
+    process.exit(1);
+  }
+
   const client = new LohostClient({
     name: values.name,
     socketDir: values["socket-dir"],
     daemonPort,
+    serviceOptions,
+    replica: values.replica,
+    transport: transport as Transport,
   });
 
   const exitCode = await client.run(command, cmdArgs);
@@ -119,6 +273,9 @@ async function runDaemon(args: string[]): Promise<void> {
     options: {
       stop: { type: "boolean" },
       port: { type: "string", short: "p" },
+      "lag-profile": { type: "string" },
+      routes: { type: "string" },
+      relay: { type: "string" },
     },
     strict: true,
   });
@@ -140,7 +297,23 @@ async function runDaemon(args: string[]): Promise<void> {
   }
 
   const routeDomain = process.env.LOHOST_ROUTE_DOMAIN ?? DEFAULT_ROUTE_DOMAIN;
-  const daemon = new LohostDaemon({ port, routeDomain });
+  const lagProfileThresholdMs = parseInt(
+    values["lag-profile"] ?? process.env.LOHOST_LAG_PROFILE_MS ?? "0",
+    10
+  );
+  const routesFile = values.routes ?? process.env.LOHOST_ROUTES;
+  const relay = values.relay ?? process.env.LOHOST_RELAY ?? "node";
+  if (!(RELAY_MODES as readonly string[]).includes(relay)) {
+    console.error(`Error: --relay must be one of ${RELAY_MODES.join(", ")}`);
+    process.exit(1);
+  }
+  const daemon = new LohostDaemon({
+    port,
+    routeDomain,
+    lagProfileThresholdMs,
+    routesFile: routesFile ? resolvePath(routesFile) : null,
+    relay: relay as RelayMode,
+  });
 
   try {
     await daemon.start();
@@ -175,8 +348,12 @@ async function runList(): Promise<void> {
 
   const services = (await listServices(port)) as Array<{
     name: string;
-    socketPath: string;
+    socketPath: string | null;
     url: string;
+    backends: number;
+    static: boolean;
+    address: string | null;
+    tcpPorts: number[];
   }>;
 
   if (services.length === 0) {
@@ -187,8 +364,577 @@ async function runList(): Promise<void> {
   console.log("NAME".padEnd(20) + "URL");
   console.log("-".repeat(50));
   for (const s of services) {
-    console.log(s.name.padEnd(20) + s.url);
+    const replicas = s.backends > 1 ? `  (${s.backends} backends)` : "";
+    const tcp = s.tcpPorts.length > 0 ? `  tcp ${s.address}:${s.tcpPorts.join(",")}` : "";
+    console.log(s.name.padEnd(20) + s.url + replicas + tcp + (s.static ? "  (routes file)" : ""));
+  }
+}
+
+async function runSet(args: string[]): Promise<void> {
+  const { values, positionals } = parseArgs({
+    args,
+    options: {
+      port: { type: "string", short: "p" },
+    },
+    allowPositionals: true,
+    strict: true,
+  });
+
+  const [name, ...flags] = positionals;
+  if (!name || flags.length === 0) {
+    console.error("Usage: lohost set <name> <key=value>...");
+    process.exit(1);
+  }
+
+  const port = parseInt(
+    values.port ?? process.env.LOHOST_PORT ?? String(DEFAULT_PORT),
+    10
+  );
+  try {
+    const options = await updateServiceOptions(name, parseOptionFlags(flags), port);
+    for (const [key, value] of Object.entries(options)) {
+      console.log(`${key.padEnd(20)}${value}`);
+    }
+  } catch (err) {
+    console.error(`Error: ${(err as Error).message}`);
+    process.exit(1);
+  }
+}
+
+async function runRoute(args: string[]): Promise<void> {
+  const { values, positionals } = parseArgs({
+    args,
+    options: {
+      strip: { type: "boolean" },
+      port: { type: "string", short: "p" },
+    },
+    allowPositionals: true,
+    strict: true,
+  });
+
+  const port = parseInt(
+    values.port ?? process.env.LOHOST_PORT ?? String(DEFAULT_PORT),
+    10
+  );
+  const [action, first, second, third] = positionals;
+
+  try {
+    if (action === "add" && first && second && third) {
+      await addRoute({ host: first, prefix: second, service: third, strip: values.strip === true }, port);
+    } else if (action === "rm" && first && second) {
+      await removeRoute(first, second, port);
+    } else if (action === "pattern" && first && second) {
+      await addHostPattern({ pattern: first, service: second }, port);
+    } else if (action === "rm-pattern" && first) {
+      await removeHostPattern(first, port);
+    } else if (action !== undefined && action !== "list") {
+      console.error(
+        "Usage: lohost route [add <host> <prefix> <service> [--strip] | rm <host> <prefix> |\n" +
+          "                     pattern <pattern> <service> | rm-pattern <pattern>]"
+      );
+      process.exit(1);
+    }
+
+    const [rules, patterns] = await Promise.all([listRoutes(port), listHostPatterns(port)]);
+    if (rules.length === 0 && patterns.length === 0) {
+      console.log("No routing rules");
+      return;
+    }
+    if (rules.length > 0) {
+      console.log("HOST".padEnd(20) + "PREFIX".padEnd(20) + "SERVICE");
+      console.log("-".repeat(50));
+      for (const rule of rules) {
+        console.log(
+          rule.host.padEnd(20) + (rule.prefix || "/").padEnd(20) + rule.service +
+            (rule.strip ? "  (strip)" : "") + (rule.file ? "  (routes file)" : "")
+        );
+      }
+    }
+    if (patterns.length > 0) {
+      if (rules.length > 0) console.log();
+      console.log("HOST PATTERN".padEnd(40) + "SERVICE");
+      console.log("-".repeat(50));
+      for (const p of patterns) {
+        console.log(p.pattern.padEnd(40) + p.service + (p.file ? "  (routes file)" : ""));
+      }
+    }
+  } catch (err) {
+    console.error(`Error: ${(err as Error).message}`);
+    process.exit(1);
+  }
+}
+
+async function runBench(args: string[]): Promise<void> {
+  const { values, positionals } = parseArgs({
+    args,
+    options: {
+      rate: { type: "string", default: "100" },
+      duration: { type: "string", default: "10" },
+      path: { type: "string", default: "/" },
+      conns: { type: "string", default: "10" },
+      direct: { type: "boolean" },
+      port: { type: "string", short: "p" },
+    },
+    allowPositionals: true,
+    strict: true,
+  });
+
+  const name = positionals[0];
+  if (!name) {
+    console.error("Usage: lohost bench <name> [--rate R --duration D --path P --conns C]");
+    process.exit(1);
+  }
+
+  const port = parseInt(
+    values.port ?? process.env.LOHOST_PORT ?? String(DEFAULT_PORT),
+    10
+  );
+  if (!(await checkDaemonRunning(port))) {
+    console.log("Daemon is not running");
+    process.exit(1);
+  }
+
+  // Route exactly like a browser would: Host header through the daemon's rules
+  const routeDomain = process.env.LOHOST_ROUTE_DOMAIN ?? DEFAULT_ROUTE_DOMAIN;
+  const host = name.endsWith(`.${routeDomain}`) ? name : `${name}.${routeDomain}`;
+  const resolved = await resolveHost(host, port, values.path);
+  if (!resolved) {
+    console.error(`Error: no service matches ${host}`);
+    process.exit(1);
+  }
+
+  const rate = parseInt(values.rate, 10);
+  const duration = parseFloat(values.duration) * 1000;
+  const connections = parseInt(values.conns, 10);
+  const request = { method: "GET", path: values.path, headers: { "x-lohost-timing": "1" } };
+
+  console.log(
+    `Benchmarking ${host} → ${resolved.service} ` +
+      `(${rate > 0 ? `${rate} req/s` : "closed loop"}, ${duration / 1000}s, ${connections} conns)`
+  );
+
+  const upstream = new Histogram();
+  const overhead = new Histogram();
+  const viaDaemon = await runLoad({
+    host: "127.0.0.1",
+    port,
+    hostHeader: `${host}:${port}`,
+    request,
+    rate,
+    duration,
+    connections,
+    onResponse: (res, _seq, _latencyUs, _serviceUs, _body, headersUs) => {
+      const match = /upstream;dur=([\d.]+)/.exec(String(res.headers["server-timing"] ?? ""));
+      if (!match) return;
+      // Both to headers, so body transfer is not counted as overhead
+      const upstreamUs = parseFloat(match[1]) * 1000;
+      upstream.record(upstreamUs);
+      overhead.record(headersUs - upstreamUs);
+    },
+  });
+
+  printLoadResult("via lohost", viaDaemon);
+  if (upstream.count > 0) {
+    console.log("\nBreakdown (per request, to response headers, from Server-Timing):");
+    printPercentiles("backend", upstream);
+    printPercentiles("lohost overhead", overhead);
+  }
+
+  if (values.direct) {
+    const direct = await runLoad({
+      host: "127.0.0.1",
+      port: resolved.port,
+      hostHeader: `${host}:${resolved.port}`,
+      request: { method: "GET", path: values.path },
+      rate,
+      duration,
+      connections,
+    });
+    printLoadResult(`direct to port ${resolved.port}`, direct);
+    const cost = viaDaemon.latency.percentile(50) - direct.latency.percentile(50);
+    console.log(`\nlohost cost at p50: ${(cost / 1000).toFixed(3)}ms`);
+  }
+}
+
+function printLoadResult(label: string, result: LoadResult): void {
+  const seconds = result.elapsedMs / 1000;
+  const statuses = Object.entries(result.statuses)
+    .map(([code, n]) => `${code}×${n}`)
+    .join(" ");
+  console.log(`\n${label}:`);
+  console.log(
+    `  ${(result.completed / seconds).toFixed(1)} req/s, ${result.completed} ok, ` +
+      `${result.errors} errors, ${result.timeouts} timeouts  [${statuses}]`
+  );
+  printPercentiles("latency", result.latency);
+  printHistogram(result.latency);
+}
+
+function printPercentiles(label: string, h: Histogram): void {
+  const ms = (us: number) => (us / 1000).toFixed(3);
+  console.log(
+    `  ${label.padEnd(16)} p50=${ms(h.percentile(50))}ms p90=${ms(h.percentile(90))}ms ` +
+      `p99=${ms(h.percentile(99))}ms p99.9=${ms(h.percentile(99.9))}ms max=${ms(h.max)}ms`
+  );
+}
+
+function printHistogram(h: Histogram): void {
+  // Collapse to power-of-two rows so the chart stays short
+  const rows = new Map<number, number>();
+  for (const [upper, count] of h.buckets()) {
+    const row = 2 ** Math.ceil(Math.log2(upper + 1));
+    rows.set(row, (rows.get(row) ?? 0) + count);
+  }
+  const peak = Math.max(...rows.values(), 1);
+  for (const [upper, count] of rows) {
+    const bar = "█".repeat(Math.max(1, Math.round((count / peak) * 40)));
+    console.log(`  ≤${(upper / 1000).toFixed(3).padStart(10)}ms ${bar} ${count}`);
+  }
+}
+
+const PROFILE_KINDS: Record<string, { endpoint: string; ext: string; timed: boolean }> = {
+  cpu: { endpoint: "cpu-profile", ext: "cpuprofile", timed: true },
+  heap: { endpoint: "heap-snapshot", ext: "heapsnapshot", timed: false },
+  alloc: { endpoint: "alloc-sample", ext: "heapprofile", timed: true },
+};
+
+async function runProfile(args: string[]): Promise<void> {
+  const { values, positionals } = parseArgs({
+    args,
+    options: {
+      seconds: { type: "string", short: "s", default: "10" },
+      out: { type: "string", short: "o" },
+      port: { type: "string", short: "p" },
+      "socket-dir": { type: "string", short: "d", default: "/tmp" },
+    },
+    allowPositionals: true,
+    strict: true,
+  });
+
+  const kind = PROFILE_KINDS[positionals[0] ?? ""];
+  if (!kind) {
+    console.error("Usage: lohost profile cpu|heap|alloc [--seconds N] [--out FILE]");
+    process.exit(1);
+  }
+
+  const port = parseInt(
+    values.port ?? process.env.LOHOST_PORT ?? String(DEFAULT_PORT),
+    10
+  );
+  const out = values.out ?? `lohostd-${Date.now()}.${kind.ext}`;
+  const seconds = parseInt(values.seconds, 10);
+  const path = `/_lohost/debug/${kind.endpoint}${kind.timed ? `?seconds=${seconds}` : ""}`;
+
+  console.error(
+    kind.timed ? `Profiling daemon for ${seconds}s...` : "Taking heap snapshot..."
+  );
+  await fetchDebugCapture(values["socket-dir"], port, path, out);
+  console.error(`Wrote ${out}`);
+}
+
+async function runCapture(args: string[]): Promise<void> {
+  const { values, positionals } = parseArgs({
+    args,
+    options: {
+      seconds: { type: "string", short: "s", default: "0" },
+      out: { type: "string", short: "o" },
+      port: { type: "string", short: "p" },
+      "socket-dir": { type: "string", short: "d", default: "/tmp" },
+    },
+    allowPositionals: true,
+    strict: true,
+  });
+
+  const name = positionals[0];
+  if (!name) {
+    console.error("Usage: lohost capture <name> [--out FILE] [--seconds N]");
+    process.exit(1);
   }
+
+  const port = parseInt(
+    values.port ?? process.env.LOHOST_PORT ?? String(DEFAULT_PORT),
+    10
+  );
+  const out = values.out ?? `${name}-${Date.now()}.lhcap`;
+  const seconds = parseInt(values.seconds, 10);
+
+  // Without --seconds the capture runs until Ctrl-C, which still keeps the file
+  const abort = new AbortController();
+  process.once("SIGINT", () => abort.abort());
+
+  console.error(
+    `Capturing ${name}${seconds > 0 ? ` for ${seconds}s` : " (Ctrl-C to stop)"}...`
+  );
+  await fetchDebugCapture(
+    values["socket-dir"],
+    port,
+    `/_lohost/debug/capture/${encodeURIComponent(name)}?seconds=${seconds}`,
+    out,
+    abort.signal
+  );
+  console.error(`Wrote ${out}`);
+}
+
+// Captured headers a replayed request does not carry over
+const REPLAY_SKIPPED_HEADERS = new Set([
+  "host",
+  "content-length",
+  "transfer-encoding",
+  "connection",
+  "keep-alive",
+]);
+
+async function runReplay(args: string[]): Promise<void> {
+  const { values, positionals } = parseArgs({
+    args,
+    options: {
+      service: { type: "string" },
+      speed: { type: "string", default: "1" },
+      conns: { type: "string", default: "50" },
+      loop: { type: "string", default: "1" },
+      port: { type: "string", short: "p" },
+    },
+    allowPositionals: true,
+    strict: true,
+  });
+
+  const file = positionals[0];
+  const speed = values.speed === "max" ? Infinity : parseFloat(values.speed);
+  if (!file || !(speed > 0)) {
+    console.error("Usage: lohost replay <file> [--service NAME] [--speed N|max] [--conns C]");
+    process.exit(1);
+  }
+
+  const capture = readCapture(readFileSync(file));
+  const header = capture.header;
+  // A request body cut off at the capture limit would be replayed short
+  const exchanges = capture.exchanges.filter((e) => !e.bodyTruncated);
+  const truncated = capture.exchanges.length - exchanges.length;
+  if (exchanges.length === 0) {
+    console.error(
+      `${file} holds no ${truncated > 0 ? "requests with a complete body" : "requests"}`
+    );
+    process.exit(1);
+  }
+
+  const port = parseInt(
+    values.port ?? process.env.LOHOST_PORT ?? String(DEFAULT_PORT),
+    10
+  );
+  if (!(await checkDaemonRunning(port))) {
+    console.log("Daemon is not running");
+    process.exit(1);
+  }
+
+  const routeDomain = process.env.LOHOST_ROUTE_DOMAIN ?? DEFAULT_ROUTE_DOMAIN;
+  const service = values.service ?? header.service;
+  const host = `${service}.${routeDomain}`;
+
+  // Requests keep their captured headers, repeats and order included, except
+  // Host, which names the target, and framing, which the body sets again
+  const requests = exchanges.map((e) => {
+    const headers: string[] = [];
+    for (let i = 0; i < e.headers.length; i += 2) {
+      if (!REPLAY_SKIPPED_HEADERS.has(e.headers[i].toLowerCase())) {
+        headers.push(e.headers[i], e.headers[i + 1]);
+      }
+    }
+    return { method: e.method, path: e.path, headers, body: e.body };
+  });
+
+  // Each loop starts where the previous capture ended
+  const loops = Math.max(1, parseInt(values.loop, 10) || 1);
+  const span = exchanges[exchanges.length - 1].offsetMs;
+  const total = exchanges.length * loops;
+  const schedule = speed === Infinity ? undefined : Array.from(
+    { length: total },
+    (_, seq) =>
+      (exchanges[seq % exchanges.length].offsetMs +
+        Math.floor(seq / exchanges.length) * span) / speed
+  );
+
+  console.log(
+    `Replaying ${exchanges.length} requests from ${header.service} (${header.startedAt}) → ${host} ` +
+      `(${speed === Infinity ? "max speed" : `${speed}x`}` +
+      `${loops > 1 ? `, ${loops} loops` : ""}, ${values.conns} conns)`
+  );
+  if (truncated > 0) {
+    console.log(`Skipping ${truncated} requests whose bodies were truncated in the capture`);
+  }
+
+  // A replay is only meaningful if the service still answers the same way
+  const mismatches: string[] = [];
+  let statusMismatches = 0;
+  let bodyMismatches = 0;
+  const result = await runLoad({
+    host: "127.0.0.1",
+    port,
+    hostHeader: `${host}:${port}`,
+    request: (seq) => requests[seq % requests.length],
+    rate: 0,
+    schedule,
+    limit: total,
+    duration: schedule ? schedule[schedule.length - 1] + 1 : Infinity,
+    connections: parseInt(values.conns, 10),
+    collectBodies: true,
+    onResponse: (res, seq, _latencyUs, _serviceUs, body) => {
+      const e = exchanges[seq % exchanges.length];
+      if (res.statusCode !== e.status) {
+        statusMismatches++;
+        if (mismatches.length < 5) {
+          mismatches.push(`${e.method} ${e.path}: status ${e.status} → ${res.statusCode}`);
+        }
+      } else if (body && (body.length !== e.responseBytes || fnv1a(body) !== e.responseHash)) {
+        bodyMismatches++;
+        if (mismatches.length < 5) {
+          mismatches.push(
+            `${e.method} ${e.path}: body ${e.responseBytes}B → ${body.length}B` +
+              (body.length === e.responseBytes ? " (content differs)" : "")
+          );
+        }
+      }
+    },
+  });
+
+  printLoadResult("replay", result);
+  console.log(
+    `\nMismatches: ${statusMismatches} status, ${bodyMismatches} body ` +
+      `(of ${result.completed} compared)`
+  );
+  for (const m of mismatches) console.log(`  ${m}`);
+}
+
+const TOP_SORT_KEYS: Record<string, { label: string; compare: (a: ServiceSnapshot, b: ServiceSnapshot) => number }> = {
+  r: { label: "rps", compare: (a, b) => b.rps - a.rps },
+  l: { label: "p99", compare: (a, b) => b.p99 - a.p99 },
+  e: { label: "errors", compare: (a, b) => b.errorRate - a.errorRate },
+  a: { label: "active", compare: (a, b) => b.active + b.websockets + b.relayed - (a.active + a.websockets + a.relayed) },
+  c: { label: "cpu", compare: (a, b) => (b.cpuPercent ?? -1) - (a.cpuPercent ?? -1) },
+  m: { label: "rss", compare: (a, b) => (b.rssBytes ?? -1) - (a.rssBytes ?? -1) },
+  n: { label: "name", compare: (a, b) => a.name.localeCompare(b.name) },
+};
+
+async function runTop(args: string[]): Promise<void> {
+  const { values } = parseArgs({
+    args,
+    options: {
+      port: { type: "string", short: "p" },
+      sort: { type: "string", short: "s", default: "r" },
+    },
+    strict: true,
+  });
+
+  const port = parseInt(
+    values.port ?? process.env.LOHOST_PORT ?? String(DEFAULT_PORT),
+    10
+  );
+  if (!(await checkDaemonRunning(port))) {
+    console.log("Daemon is not running");
+    return;
+  }
+
+  let sortKey = TOP_SORT_KEYS[values.sort] ? values.sort : "r";
+  let last: {
+    timestamp: string;
+    daemon: DiagnosticsSnapshot;
+    services: ServiceSnapshot[];
+  } | null = null;
+  const interactive = process.stdout.isTTY && process.stdin.isTTY;
+
+  const render = () => {
+    if (!last) return;
+    const sort = TOP_SORT_KEYS[sortKey];
+    const rows = [...last.services].sort(sort.compare);
+    const lines = [
+      `lohost top — ${rows.length} services — sort: ${sort.label} ` +
+        `[r]ps [l]atency [e]rrors [a]ctive [c]pu [m]em [n]ame  [q]uit`,
+      `daemon: loop lag p99 ${last.daemon.eventLoopDelay.p99.toFixed(1)}ms ` +
+        `max ${last.daemon.eventLoopDelay.max.toFixed(1)}ms, ` +
+        `gc ${last.daemon.gc.pauseMs.toFixed(1)}ms/s, ` +
+        `heap ${formatBytes(last.daemon.heap.usedBytes)}`,
+      "",
+      "NAME".padEnd(20) +
+        "RPS".padStart(9) +
+        "P50ms".padStart(9) +
+        "P99ms".padStart(9) +
+        "ERR%".padStart(7) +
+        "ACTIVE".padStart(8) +
+        "QUEUE".padStart(7) +
+        "WS".padStart(6) +
+        "RELAY".padStart(7) +
+        "IN/s".padStart(9) +
+        "OUT/s".padStart(9) +
+        "CPU%".padStart(7) +
+        "RSS".padStart(8),
+    ];
+    for (const s of rows) {
+      lines.push(
+        s.name.slice(0, 19).padEnd(20) +
+          s.rps.toFixed(1).padStart(9) +
+          s.p50.toFixed(2).padStart(9) +
+          s.p99.toFixed(2).padStart(9) +
+          (s.errorRate * 100).toFixed(1).padStart(7) +
+          String(s.active).padStart(8) +
+          String(s.queued).padStart(7) +
+          String(s.websockets).padStart(6) +
+          String(s.relayed).padStart(7) +
+          formatBytes(s.bytesInPerSec).padStart(9) +
+          formatBytes(s.bytesOutPerSec).padStart(9) +
+          (s.cpuPercent === null ? "-" : s.cpuPercent.toFixed(1)).padStart(7) +
+          (s.rssBytes === null ? "-" : formatBytes(s.rssBytes)).padStart(8)
+      );
+    }
+    if (interactive) {
+      process.stdout.write("\x1b[H\x1b[2J" + lines.join("\n") + "\n");
+    } else {
+      console.log(lines.slice(1).join("\n") + "\n");
+    }
+  };
+
+  await new Promise<void>((resolve) => {
+    const close = streamMetrics(
+      port,
+      (snapshot) => {
+        last = snapshot as typeof last;
+        render();
+      },
+      (err) => {
+        if (err) console.error(`lohost top: ${err.message}`);
+        quit();
+      }
+    );
+
+    const quit = () => {
+      close();
+      if (interactive) {
+        process.stdin.setRawMode(false);
+        process.stdin.pause();
+        process.stdout.write("\x1b[?25h");
+      }
+      resolve();
+    };
+
+    if (interactive) {
+      process.stdout.write("\x1b[?25l");
+      process.stdin.setRawMode(true);
+      process.stdin.setEncoding("utf8");
+      process.stdin.on("data", (key: string) => {
+        if (key === "q" || key === "\u0003") {
+          quit();
+        } else if (TOP_SORT_KEYS[key]) {
+          sortKey = key;
+          render();
+        }
+      });
+    }
+  });
+}
+
+function formatBytes(n: number): string {
+  if (n < 1024) return `${n}B`;
+  if (n < 1024 * 1024) return `${(n / 1024).toFixed(1)}K`;
+  if (n < 1024 * 1024 * 1024) return `${(n / 1024 / 1024).toFixed(1)}M`;
+  return `${(n / 1024 / 1024 / 1024).toFixed(1)}G`;
 }
 
 main().catch((err) => {
@@ -0,0 +1,230 @@
+/**
+ * Open-loop HTTP load generator
+ *
+ * Requests are issued on a fixed schedule regardless of how quickly earlier
+ * ones complete, and each latency is measured from the request's *intended*
+ * start time. A stalled server therefore shows up as queueing delay in the
+ * histogram instead of silently lowering the offered load (coordinated
+ * omission). A rate of 0 switches to closed-loop mode: every connection
+ * issues its next request as soon as the previous one completes. An explicit
+ * schedule (e.g. a replayed capture) replaces the fixed rate.
+ */
+
+import { Agent, request, type IncomingMessage, type OutgoingHttpHeaders } from "node:http";
+import { performance } from "node:perf_hooks";
+import { Histogram } from "./histogram.js";
+
+export interface LoadRequest {
+  method: string;
+  path: string;
+  /** An object, or a raw [name, value, ...] list that keeps repeats and order. */
+  headers?: OutgoingHttpHeaders | string[];
+  body?: Buffer;
+}
+
+export interface LoadOptions {
+  /** Address the generator connects to. */
+  host: string;
+  port: number;
+  /** Host header sent with every request (defaults to host:port). */
+  hostHeader?: string;
+  /** Fixed request, or a function producing the request for sequence number `seq`. */
+  request: LoadRequest | ((seq: number) => LoadRequest);
+  /** Requests per second; 0 runs closed-loop. */
+  rate: number;
+  /**
+   * Intended start of request `seq`, in ms from the beginning, ascending.
+   * Replaces `rate`; sending stops after the last entry.
+   */
+  schedule?: number[];
+  /** Length of the sending phase in milliseconds; may be Infinity with `limit`. */
+  duration: number;
+  /** Closed loop: stop after this many requests even if time remains. */
+  limit?: number;
+  /** Maximum number of keep-alive connections. */
+  connections: number;
+  /** How long to wait for in-flight requests after the sending phase. */
+  drainTimeout?: number;
+  /**
+   * Called for every completed response, e.g. to collect timing headers.
+   * `latencyUs` counts from the scheduled start to the end of the body,
+   * `serviceUs` from the moment the request was actually dispatched, and
+   * `headersUs` from dispatch to the response headers.
+   */
+  onResponse?: (
+    res: IncomingMessage,
+    seq: number,
+    latencyUs: number,
+    serviceUs: number,
+    body: Buffer | undefined,
+    headersUs: number
+  ) => void;
+  /** Keep each response body and pass it to `onResponse`. */
+  collectBodies?: boolean;
+}
+
+export interface LoadResult {
+  latency: Histogram;
+  sent: number;
+  completed: number;
+  errors: number;
+  timeouts: number;
+  statuses: Record<number, number>;
+  bytesReceived: number;
+  elapsedMs: number;
+}
+
+const DEFAULT_DRAIN_TIMEOUT = 10_000;
+
+export function runLoad(opts: LoadOptions): Promise<LoadResult> {
+  const agent = new Agent({ keepAlive: true, maxSockets: opts.connections });
+  const hostHeader = opts.hostHeader ?? `${opts.host}:${opts.port}`;
+  const makeRequest =
+    typeof opts.request === "function" ? opts.request : () => opts.request as LoadRequest;
+
+  const result: LoadResult = {
+    latency: new Histogram(),
+    sent: 0,
+    completed: 0,
+    errors: 0,
+    timeouts: 0,
+    statuses: {},
+    bytesReceived: 0,
+    elapsedMs: 0,
+  };
+
+  const inflight = new Set<ReturnType<typeof request>>();
+  const start = performance.now();
+  let sending = true;
+  let finish: () => void = () => {};
+
+  const fire = (seq: number, intendedStart: number, done?: () => void) => {
+    const spec = makeRequest(seq);
+    let headers: OutgoingHttpHeaders | string[];
+    if (Array.isArray(spec.headers)) {
+      // Sent as is, so Host and the body length are added here
+      headers = ["host", hostHeader, ...spec.headers];
+      if (spec.body) headers.push("content-length", String(spec.body.length));
+    } else {
+      headers = { ...spec.headers, host: hostHeader };
+      if (spec.body) headers["content-length"] = spec.body.length;
+    }
+
+    result.sent++;
+    let dispatchedAt = performance.now();
+    const req = request(
+      {
+        host: opts.host,
+        port: opts.port,
+        method: spec.method,
+        path: spec.path,
+        headers,
+        agent,
+      },
+      (res) => {
+        const headersAt = performance.now();
+        const chunks: Buffer[] | null = opts.collectBodies ? [] : null;
+        res.on("data", (chunk: Buffer) => {
+          result.bytesReceived += chunk.length;
+          chunks?.push(chunk);
+        });
+        res.on("error", failed);
+        res.on("end", () => {
+          if (!inflight.delete(req)) return;
+          const now = performance.now();
+          const latencyUs = (now - intendedStart) * 1000;
+          result.completed++;
+          result.latency.record(latencyUs);
+          const status = res.statusCode ?? 0;
+          result.statuses[status] = (result.statuses[status] ?? 0) + 1;
+          opts.onResponse?.(
+            res,
+            seq,
+            latencyUs,
+            (now - dispatchedAt) * 1000,
+            chunks ? Buffer.concat(chunks) : undefined,
+            (headersAt - dispatchedAt) * 1000
+          );
+          settle();
+        });
+      }
+    );
+    inflight.add(req);
+    // Requests may wait in the agent for a free connection; time from assignment.
+    req.once("socket", () => {
+      dispatchedAt = performance.now();
+    });
+    req.on("error", failed);
+    req.end(spec.body);
+
+    function failed() {
+      if (!inflight.delete(req)) return;
+      result.errors++;
+      settle();
+    }
+
+    function settle() {
+      done?.();
+      if (!sending && inflight.size === 0) finish();
+    }
+  };
+
+  return new Promise((resolve) => {
+    let drainTimer: NodeJS.Timeout | null = null;
+    finish = () => {
+      if (drainTimer) clearTimeout(drainTimer);
+      result.elapsedMs = performance.now() - start;
+      agent.destroy();
+      resolve(result);
+    };
+
+    const stopSending = () => {
+      sending = false;
+      if (inflight.size === 0) {
+        finish();
+        return;
+      }
+      drainTimer = setTimeout(() => {
+        result.timeouts += inflight.size;
+        for (const req of inflight) req.destroy();
+        inflight.clear();
+        finish();
+      }, opts.drainTimeout ?? DEFAULT_DRAIN_TIMEOUT);
+    };
+
+    if (opts.rate > 0 || opts.schedule) {
+      // Open loop: catch up on every tick so timer jitter never thins the schedule.
+      const schedule = opts.schedule;
+      const interval = 1000 / opts.rate;
+      const end = schedule ? schedule.length : Math.ceil(opts.duration / interval);
+      const offset = schedule ? (seq: number) => schedule[seq] : (seq: number) => seq * interval;
+      let seq = 0;
+      const tick = () => {
+        const elapsed = performance.now() - start;
+        while (seq < end && offset(seq) <= elapsed) {
+          fire(seq, start + offset(seq));
+          seq++;
+        }
+        if (seq >= end) {
+          stopSending();
+          return;
+        }
+        setTimeout(tick, Math.max(0, start + offset(seq) - performance.now()));
+      };
+      tick();
+    } else {
+      // Closed loop: one outstanding request per connection.
+      let seq = 0;
+      const limit = opts.limit ?? Infinity;
+      const worker = () => {
+        if (performance.now() - start >= opts.duration || seq >= limit) {
+          if (sending && seq >= limit) stopSending();
+          return;
+        }
+        fire(seq++, performance.now(), worker);
+      };
+      for (let i = 0; i < opts.connections; i++) worker();
+      if (Number.isFinite(opts.duration)) setTimeout(stopSending, opts.duration);
+    }
+  });
+}
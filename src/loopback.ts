@@ -0,0 +1,175 @@
+/**
+ * Per-service loopback addresses
+ *
+ * Every service gets its own 127.0.x.y, derived from its name so it stays the
+ * same across daemon restarts. The daemon publishes the name → address map
+ * as a hosts-style file that the DNS preload reads, so `db.localhost`
+ * resolves to the service's own address, and forwards the service's
+ * `tcpPorts` from that address to its backend as raw TCP. Postgres, Redis or
+ * gRPC are then reachable by name on their usual ports, and the daemon never
+ * parses a byte of them.
+ */
+
+import { createServer, type Server, type Socket } from "node:net";
+import { renameSync, writeFileSync } from "node:fs";
+import { fnv1a } from "./capture.js";
+import type { NativeRelay } from "./relay.js";
+
+// 127.0.1.1 - 127.0.255.254; 127.0.0.x is left to everything else
+const HOSTS_PER_SUBNET = 254;
+const SLOTS = 255 * HOSTS_PER_SUBNET;
+
+/** Hands out stable, unique loopback addresses by service name. */
+export class LoopbackAllocator {
+  private byName = new Map<string, string>();
+  private taken = new Set<string>();
+
+  /** The service's address, allocating one on first use. */
+  assign(name: string): string {
+    const existing = this.byName.get(name);
+    if (existing) return existing;
+
+    // Hash to a slot; probe past collisions with other names
+    let slot = fnv1a(Buffer.from(name)) % SLOTS;
+    let address = slotAddress(slot);
+    while (this.taken.has(address)) {
+      slot = (slot + 1) % SLOTS;
+      address = slotAddress(slot);
+    }
+    this.byName.set(name, address);
+    this.taken.add(address);
+    return address;
+  }
+
+  get(name: string): string | undefined {
+    return this.byName.get(name);
+  }
+
+  release(name: string): void {
+    const address = this.byName.get(name);
+    if (!address) return;
+    this.byName.delete(name);
+    this.taken.delete(address);
+  }
+
+  names(): string[] {
+    return [...this.byName.keys()];
+  }
+}
+
+function slotAddress(slot: number): string {
+  return `127.0.${1 + Math.floor(slot / HOSTS_PER_SUBNET)}.${1 + (slot % HOSTS_PER_SUBNET)}`;
+}
+
+/**
+ * Replace the hosts file in one rename, so the preload never reads half of
+ * it. One `<address> <name>` line per service.
+ */
+export function writeHostsFile(path: string, entries: Array<[name: string, address: string]>): void {
+  const lines = ["# lohost service addresses, rewritten by the daemon"];
+  for (const [name, address] of entries) lines.push(`${address} ${name}`);
+  const tmp = `${path}.${process.pid}.tmp`;
+  writeFileSync(tmp, lines.join("\n") + "\n");
+  renameSync(tmp, path);
+}
+
+export interface ForwardSpec {
+  service: string;
+  address: string;
+  port: number;
+  /** The service's backends as `unix:<path>` or `<host>:<port>`, for the native relay. */
+  backends: string[];
+}
+
+interface Listener {
+  service: string;
+  /** Null when the native relay listens instead. */
+  server: Server | null;
+  /** Backends last sent to the native relay. */
+  backends: string;
+}
+
+/**
+ * Raw TCP listeners on service addresses. `sync` opens and closes listeners
+ * to match the wanted set; connections already open when a listener closes
+ * run to completion. With a native relay the listeners live in the relay
+ * process, and the daemon never sees the connections.
+ */
+export class TcpForwarder {
+  private listeners = new Map<string, Listener>();
+  private onConnection: (service: string, socket: Socket) => void;
+  private relay: NativeRelay | null = null;
+
+  constructor(onConnection: (service: string, socket: Socket) => void) {
+    this.onConnection = onConnection;
+  }
+
+  /**
+   * Serve listeners from `relay`, or from the daemon when null. Existing
+   * listeners are forgotten; the next `sync` opens them on the new side.
+   */
+  setRelay(relay: NativeRelay | null): void {
+    this.close();
+    this.relay = relay;
+  }
+
+  /** Listen on exactly the specs in `wanted`, keyed by `address:port`. */
+  sync(wanted: Map<string, ForwardSpec>): void {
+    for (const [key, listener] of this.listeners) {
+      if (wanted.get(key)?.service === listener.service) continue;
+      this.closeListener(key, listener);
+      this.listeners.delete(key);
+    }
+
+    for (const [key, spec] of wanted) {
+      if (this.relay) {
+        // Re-sending updates the relay's backends in place
+        const backends = spec.backends.join(" ");
+        if (this.listeners.get(key)?.backends === backends) continue;
+        this.relay.listen(key, spec.service, spec.backends);
+        this.listeners.set(key, { service: spec.service, server: null, backends });
+        continue;
+      }
+      if (this.listeners.has(key)) continue;
+      const server = createServer({ allowHalfOpen: true, noDelay: true }, (socket) => {
+        this.onConnection(spec.service, socket);
+      });
+      // A failed listener stays in the map, so it is retried only once the
+      // service stops asking for that port, not on every sync
+      server.on("error", (err: NodeJS.ErrnoException) => {
+        const hint = err.code === "EADDRNOTAVAIL"
+          ? ` (add it with: sudo ifconfig lo0 alias ${spec.address} up)`
+          : "";
+        console.error(`[lohostd] Cannot forward ${key} to ${spec.service}: ${err.message}${hint}`);
+      });
+      server.listen(spec.port, spec.address, () => {
+        console.error(`[lohostd] tcp ${key} → ${spec.service}`);
+      });
+      this.listeners.set(key, { service: spec.service, server, backends: "" });
+    }
+  }
+
+  /** Ports currently forwarded for `service`. */
+  ports(service: string): number[] {
+    const ports: number[] = [];
+    for (const [key, listener] of this.listeners) {
+      const listening = listener.server
+        ? listener.server.listening
+        : this.relay?.isListening(key);
+      if (listener.service === service && listening) {
+        ports.push(Number(key.slice(key.lastIndexOf(":") + 1)));
+      }
+    }
+    return ports;
+  }
+
+  close(): void {
+    for (const [key, listener] of this.listeners) this.closeListener(key, listener);
+    this.listeners.clear();
+  }
+
+  private closeListener(key: string, listener: Listener): void {
+    if (listener.server) listener.server.close();
+    else this.relay?.close(key);
+  }
+}
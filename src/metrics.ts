@@ -0,0 +1,299 @@
+/**
+ * Per-service traffic metrics
+ *
+ * The proxy path only bumps counters and records into a histogram; once a
+ * second `tick()` folds the window into a snapshot of rates and percentiles.
+ * Readers (the metrics API, `lohost top`) only ever see the last snapshot,
+ * so observing the daemon costs nothing per request.
+ */
+
+import type { IncomingMessage, ServerResponse } from "node:http";
+import type { Http2ServerRequest } from "node:http2";
+import type { Socket } from "node:net";
+import { performance } from "node:perf_hooks";
+import { Histogram } from "./histogram.js";
+import { sampleProcess } from "./procstat.js";
+import type { MirrorSnapshot, MirrorStats } from "./mirror.js";
+import type { WebSocketSnapshot, WebSocketStats } from "./websocket.js";
+
+// Bytes of each client connection already attributed to some service. A
+// keep-alive connection may carry requests for several services, and the
+// next request's headers are read before the previous one is accounted.
+const accountedBytes = new WeakMap<Socket, [number, number]>();
+
+// Request state is kept on the response so one shared close listener serves
+// every request, instead of allocating a closure per request.
+const kMetrics = Symbol("lohost.metrics");
+const kStart = Symbol("lohost.start");
+
+type TrackedResponse = ServerResponse & {
+  [kMetrics]: ServiceMetrics;
+  [kStart]: number;
+};
+
+function onResponseClose(this: TrackedResponse): void {
+  this[kMetrics].complete(this, this[kStart]);
+}
+
+/**
+ * The client connection whose bytes a request is accounted against. Each
+ * HTTP/2 stream has its own socket view, so those use their session's,
+ * which is gone (null) once the session has closed.
+ */
+function connectionOf(req: IncomingMessage): Socket | null {
+  if (req.httpVersionMajor !== 2) return req.socket;
+  return ((req as unknown as Http2ServerRequest).stream.session?.socket as Socket | undefined) ?? null;
+}
+
+export interface ServiceSnapshot {
+  name: string;
+  /** Completed requests per second over the last window. */
+  rps: number;
+  /** Fraction of requests in the last window that failed (5xx or aborted). */
+  errorRate: number;
+  /** Latency percentiles over the last window, in milliseconds. */
+  p50: number;
+  p99: number;
+  /** Requests currently in flight to the backend. */
+  active: number;
+  /** Requests waiting for an admission slot. */
+  queued: number;
+  /** 99th percentile time spent queued over the last window, in milliseconds. */
+  queueWaitP99: number;
+  /** Requests turned away with 503 since registration (queue full or timed out). */
+  rejected: number;
+  /** Connect-failure retries, hedges sent, and hedges that answered first. */
+  retries: number;
+  hedges: number;
+  hedgeWins: number;
+  /** Requests answered with another identical request's backend response, since registration. */
+  coalesced: number;
+  /** Share of the last window's requests that were coalesced. */
+  coalesceRatio: number;
+  /** Requests answered 304 from a synthesized ETag, and the body bytes that spared, since registration. */
+  notModified: number;
+  notModifiedBytes: number;
+  /** Primary vs. shadow comparison, when a mirror rule is set. */
+  mirror: MirrorSnapshot | null;
+  /** Open upgraded (WebSocket) connections. */
+  websockets: number;
+  /** Open spliced connections and raw TCP forwards, relayed as bytes. */
+  relayed: number;
+  /** WebSocket messages, when the service's `websocket` option reads frames. */
+  websocketMessages: WebSocketSnapshot | null;
+  bytesInPerSec: number;
+  bytesOutPerSec: number;
+  /** Totals since registration. */
+  requests: number;
+  errors: number;
+  /** Backend process usage, when the client reported its pid. */
+  pid: number | null;
+  cpuPercent: number | null;
+  rssBytes: number | null;
+}
+
+export class ServiceMetrics {
+  readonly name: string;
+  pid: number | null = null;
+
+  requests = 0;
+  errors = 0;
+  active = 0;
+  queued = 0;
+  rejected = 0;
+  retries = 0;
+  hedges = 0;
+  hedgeWins = 0;
+  coalesced = 0;
+  notModified = 0;
+  notModifiedBytes = 0;
+  mirror: MirrorStats | null = null;
+  websocket: WebSocketStats | null = null;
+
+  private windowRequests = 0;
+  private lastCoalesced = 0;
+  private windowErrors = 0;
+  private windowBytesIn = 0;
+  private windowBytesOut = 0;
+  private latency = new Histogram();
+  private queueWait = new Histogram();
+  /** Upgraded and relayed sockets, with their byte counts at the last sample. */
+  private upgraded = new Map<Socket, [number, number]>();
+  private relays = 0;
+
+  private lastCpuMs: number | null = null;
+  private lastSampleAt = 0;
+  private cpuPercent: number | null = null;
+  private rssBytes: number | null = null;
+
+  snapshot: ServiceSnapshot;
+
+  constructor(name: string) {
+    this.name = name;
+    this.snapshot = this.emptySnapshot();
+  }
+
+  /** Account a proxied request; all bookkeeping happens when it closes. */
+  trackRequest(req: IncomingMessage, res: ServerResponse): void {
+    const tracked = res as TrackedResponse;
+    tracked[kMetrics] = this;
+    tracked[kStart] = performance.now();
+    this.active++;
+    res.once("close", onResponseClose);
+  }
+
+  /** Called once per request from the shared close listener. */
+  complete(res: ServerResponse, start: number): void {
+    const socket = connectionOf(res.req);
+    this.active--;
+    this.requests++;
+    this.windowRequests++;
+    if (res.statusCode >= 500 || !res.writableFinished) {
+      this.errors++;
+      this.windowErrors++;
+    }
+    this.latency.record((performance.now() - start) * 1000);
+    if (!socket) return;
+
+    let accounted = accountedBytes.get(socket);
+    if (!accounted) {
+      accounted = [0, 0];
+      accountedBytes.set(socket, accounted);
+    }
+    this.windowBytesIn += socket.bytesRead - accounted[0];
+    this.windowBytesOut += socket.bytesWritten - accounted[1];
+    accounted[0] = socket.bytesRead;
+    accounted[1] = socket.bytesWritten;
+  }
+
+  /** Record how long an admitted request waited for its slot. */
+  recordQueueWait(ms: number): void {
+    this.queueWait.record(ms * 1000);
+  }
+
+  /** Account an upgraded connection; its bytes are sampled every tick. */
+  trackUpgrade(socket: Socket): void {
+    this.trackBytes(socket);
+  }
+
+  /** Account a spliced or forwarded connection, counted apart from WebSockets. */
+  trackRelay(socket: Socket): void {
+    this.relays++;
+    socket.once("close", () => this.relays--);
+    this.trackBytes(socket);
+  }
+
+  private trackBytes(socket: Socket): void {
+    this.upgraded.set(socket, [socket.bytesRead, socket.bytesWritten]);
+    socket.once("close", () => {
+      const last = this.upgraded.get(socket);
+      if (last) {
+        this.windowBytesIn += socket.bytesRead - last[0];
+        this.windowBytesOut += socket.bytesWritten - last[1];
+      }
+      this.upgraded.delete(socket);
+    });
+  }
+
+  /** Fold the current window into `snapshot` and start a new one. */
+  tick(elapsedMs: number): void {
+    for (const [socket, last] of this.upgraded) {
+      this.windowBytesIn += socket.bytesRead - last[0];
+      this.windowBytesOut += socket.bytesWritten - last[1];
+      last[0] = socket.bytesRead;
+      last[1] = socket.bytesWritten;
+    }
+
+    const perSec = 1000 / elapsedMs;
+    this.snapshot = {
+      name: this.name,
+      rps: Math.round(this.windowRequests * perSec * 10) / 10,
+      errorRate: this.windowRequests > 0 ? this.windowErrors / this.windowRequests : 0,
+      p50: this.latency.percentile(50) / 1000,
+      p99: this.latency.percentile(99) / 1000,
+      active: this.active - this.queued,
+      queued: this.queued,
+      queueWaitP99: this.queueWait.percentile(99) / 1000,
+      rejected: this.rejected,
+      retries: this.retries,
+      hedges: this.hedges,
+      hedgeWins: this.hedgeWins,
+      coalesced: this.coalesced,
+      coalesceRatio: this.windowRequests > 0
+        ? Math.min(1, (this.coalesced - this.lastCoalesced) / this.windowRequests)
+        : 0,
+      notModified: this.notModified,
+      notModifiedBytes: this.notModifiedBytes,
+      mirror: this.mirror?.snapshot() ?? null,
+      websockets: this.upgraded.size - this.relays,
+      relayed: this.relays,
+      websocketMessages: this.websocket?.snapshot(perSec) ?? null,
+      bytesInPerSec: Math.round(this.windowBytesIn * perSec),
+      bytesOutPerSec: Math.round(this.windowBytesOut * perSec),
+      requests: this.requests,
+      errors: this.errors,
+      pid: this.pid,
+      cpuPercent: this.cpuPercent,
+      rssBytes: this.rssBytes,
+    };
+
+    this.windowRequests = 0;
+    this.windowErrors = 0;
+    this.lastCoalesced = this.coalesced;
+    this.windowBytesIn = 0;
+    this.windowBytesOut = 0;
+    this.latency.reset();
+    this.queueWait.reset();
+  }
+
+  /** Refresh backend CPU/RSS; only done while someone is watching. */
+  async sampleProcess(): Promise<void> {
+    if (this.pid === null) return;
+    const sample = await sampleProcess(this.pid);
+    const now = performance.now();
+    if (!sample) {
+      this.cpuPercent = null;
+      this.rssBytes = null;
+      return;
+    }
+    if (this.lastCpuMs !== null) {
+      this.cpuPercent =
+        Math.round(((sample.cpuMs - this.lastCpuMs) / (now - this.lastSampleAt)) * 1000) / 10;
+    }
+    this.lastCpuMs = sample.cpuMs;
+    this.lastSampleAt = now;
+    this.rssBytes = sample.rssBytes;
+  }
+
+  private emptySnapshot(): ServiceSnapshot {
+    return {
+      name: this.name,
+      rps: 0,
+      errorRate: 0,
+      p50: 0,
+      p99: 0,
+      active: 0,
+      queued: 0,
+      queueWaitP99: 0,
+      rejected: 0,
+      retries: 0,
+      hedges: 0,
+      hedgeWins: 0,
+      coalesced: 0,
+      coalesceRatio: 0,
+      notModified: 0,
+      notModifiedBytes: 0,
+      mirror: null,
+      websockets: 0,
+      relayed: 0,
+      websocketMessages: null,
+      bytesInPerSec: 0,
+      bytesOutPerSec: 0,
+      requests: 0,
+      errors: 0,
+      pid: this.pid,
+      cpuPercent: null,
+      rssBytes: null,
+    };
+  }
+}
@@ -0,0 +1,165 @@
+/**
+ * Traffic shadowing
+ *
+ * A sampled share of a service's requests is copied, body included, to a
+ * shadow service whose responses are thrown away. Latency and status of the
+ * primary and the shadow are recorded for the same requests, so two builds
+ * or frameworks can be compared on real traffic side by side.
+ */
+
+import {
+  request as httpRequest,
+  type IncomingMessage,
+  type ServerResponse,
+} from "node:http";
+import { performance } from "node:perf_hooks";
+import { Histogram } from "./histogram.js";
+
+// Shadow requests outstanding at once; beyond this, samples are dropped
+const MAX_SHADOW_IN_FLIGHT = 64;
+
+// Unsent body bytes a shadow may fall behind by before it is abandoned
+const MAX_SHADOW_BACKLOG = 8 * 1024 * 1024;
+
+export interface ShadowTarget {
+  socketPath: string | null;
+  host: string | null;
+  port: number;
+}
+
+export interface MirrorSideSnapshot {
+  count: number;
+  /** Time to the end of the response, in milliseconds. */
+  p50: number;
+  p90: number;
+  p99: number;
+  mean: number;
+  /** Responses by status class, plus "error" for failed connections. */
+  statuses: Record<string, number>;
+}
+
+export interface MirrorSnapshot {
+  target: string;
+  /** Requests copied to the shadow since the rule was set. */
+  sampled: number;
+  /** Samples skipped or abandoned because the shadow was missing or too far behind. */
+  dropped: number;
+  primary: MirrorSideSnapshot;
+  shadow: MirrorSideSnapshot;
+}
+
+class MirrorSide {
+  latency = new Histogram();
+  statuses: Record<string, number> = {};
+
+  record(startedAt: number, status: string): void {
+    this.latency.record((performance.now() - startedAt) * 1000);
+    this.statuses[status] = (this.statuses[status] ?? 0) + 1;
+  }
+
+  snapshot(): MirrorSideSnapshot {
+    const ms = (us: number) => Math.round(us) / 1000;
+    return {
+      count: this.latency.count,
+      p50: ms(this.latency.percentile(50)),
+      p90: ms(this.latency.percentile(90)),
+      p99: ms(this.latency.percentile(99)),
+      mean: ms(this.latency.mean()),
+      statuses: { ...this.statuses },
+    };
+  }
+}
+
+/** Paired primary/shadow measurements for one mirror rule. */
+export class MirrorStats {
+  readonly target: string;
+  sampled = 0;
+  dropped = 0;
+  inFlight = 0;
+  private primary = new MirrorSide();
+  private shadow = new MirrorSide();
+
+  constructor(target: string) {
+    this.target = target;
+  }
+
+  /**
+   * Copy `req` to the shadow backend at `target` (a Unix socket, or a TCP
+   * host and port) and time both sides from now. Call it just before the
+   * primary starts consuming the body.
+   */
+  mirror(req: IncomingMessage, res: ServerResponse, target: ShadowTarget): void {
+    if (this.inFlight >= MAX_SHADOW_IN_FLIGHT) {
+      this.dropped++;
+      return;
+    }
+    this.sampled++;
+    this.inFlight++;
+    const startedAt = performance.now();
+
+    // An abandoned shadow leaves both sides unrecorded, keeping them paired
+    let abandoned = false;
+    res.once("close", () => {
+      if (abandoned) return;
+      this.primary.record(startedAt, res.writableFinished ? statusClass(res.statusCode) : "error");
+    });
+
+    const shadowReq = httpRequest({
+      socketPath: target.socketPath ?? undefined,
+      host: target.host ?? undefined,
+      port: target.port,
+      path: req.url,
+      method: req.method,
+      headers: req.rawHeaders,
+    });
+    let done = false;
+    const finish = (status: string) => {
+      if (done) return;
+      done = true;
+      this.inFlight--;
+      if (!abandoned) this.shadow.record(startedAt, status);
+    };
+
+    shadowReq.on("response", (shadowRes) => {
+      const status = statusClass(shadowRes.statusCode ?? 500);
+      shadowRes.on("end", () => finish(status));
+      shadowRes.on("error", () => finish("error"));
+      shadowRes.resume();
+    });
+    shadowReq.on("error", () => finish("error"));
+    shadowReq.on("close", () => finish("error"));
+
+    // Tee the body without ever pausing the client: a shadow that can't
+    // keep up is abandoned rather than allowed to slow the primary.
+    const onData = (chunk: Buffer) => {
+      if (shadowReq.writableLength > MAX_SHADOW_BACKLOG) {
+        req.off("data", onData);
+        abandoned = true;
+        this.sampled--;
+        this.dropped++;
+        shadowReq.destroy();
+        return;
+      }
+      shadowReq.write(chunk);
+    };
+    req.on("data", onData);
+    req.once("end", () => shadowReq.end());
+    req.once("close", () => {
+      if (!req.complete) shadowReq.destroy();
+    });
+  }
+
+  snapshot(): MirrorSnapshot {
+    return {
+      target: this.target,
+      sampled: this.sampled,
+      dropped: this.dropped,
+      primary: this.primary.snapshot(),
+      shadow: this.shadow.snapshot(),
+    };
+  }
+}
+
+function statusClass(status: number): string {
+  return `${Math.floor(status / 100)}xx`;
+}
@@ -0,0 +1,257 @@
+/**
+ * Per-service proxy options
+ *
+ * Sent by the client at registration (`lohost -n api -o key=value`) and kept
+ * on the daemon's Service entry. The same parser validates the JSON from the
+ * registration body and the `key=value` strings from the command line.
+ */
+
+export interface ServiceOptions {
+  /** Receive the whole request body before contacting the backend. */
+  bufferRequests: boolean;
+  /** Read responses from the backend at full speed, independent of the client. */
+  bufferResponses: boolean;
+  /** Bytes a buffered body may hold in memory before spilling to a temp file. */
+  bufferMemory: number;
+  /** Requests allowed at the backend at once; 0 means unlimited. */
+  maxInFlight: number;
+  /** Requests that may wait for a slot before new ones get a 503. */
+  queueSize: number;
+  /** Longest a request may wait for a slot, in milliseconds. */
+  queueTimeout: number;
+  /** Which waiting request gets the next free slot. */
+  queueOrder: "fifo" | "lifo";
+  /** Send a second GET/HEAD to another backend when the first is slow. */
+  hedge: boolean;
+  /** Time-to-headers percentile after which a hedge is sent. */
+  hedgePercentile: number;
+  /** Retries of requests whose connection failed before anything was sent. */
+  retries: number;
+  /** Hedges and retries allowed, as a percentage of ordinary requests. */
+  retryBudget: number;
+  /** Identical concurrent GET/HEAD requests share one backend request. */
+  coalesce: boolean;
+  /** Hash validator-less GET responses with a Content-Length into a strong ETag and answer 304s. */
+  etag: boolean;
+  /** Service that receives a copy of sampled requests; "" disables. */
+  mirror: string;
+  /** Percentage of requests copied to the mirror. */
+  mirrorPercent: number;
+  /** Added delay before each request is forwarded, in milliseconds. */
+  latency: number;
+  /** Random variation of `latency`, ± this many milliseconds. */
+  jitter: number;
+  /** Response body bytes per second; 0 means unlimited. */
+  bandwidth: number;
+  /** Whether each client connection or the whole service shares `bandwidth`. */
+  bandwidthScope: "connection" | "service";
+  /** Percentage of requests answered by resetting the client connection. */
+  resetPercent: number;
+  /**
+   * Route whole client connections by their first request's Host (or TLS
+   * server name) and relay them unparsed.
+   */
+  splice: boolean;
+  /** Ports the daemon forwards, as raw TCP, from the service's loopback address. */
+  tcpPorts: number[];
+  /** Protocol spoken to the backend: HTTP/1.1, or HTTP/2 with prior knowledge. */
+  upstream: "http1" | "h2c";
+  /**
+   * How WebSocket connections are relayed: as opaque bytes, frame by frame
+   * for message metrics, or also terminating permessage-deflate.
+   */
+  websocket: "pipe" | "frames" | "deflate";
+}
+
+export const DEFAULT_SERVICE_OPTIONS: ServiceOptions = {
+  bufferRequests: false,
+  bufferResponses: false,
+  bufferMemory: 1024 * 1024,
+  maxInFlight: 0,
+  queueSize: 100,
+  queueTimeout: 10_000,
+  queueOrder: "fifo",
+  hedge: false,
+  hedgePercentile: 95,
+  retries: 1,
+  retryBudget: 20,
+  coalesce: false,
+  etag: false,
+  mirror: "",
+  mirrorPercent: 100,
+  latency: 0,
+  jitter: 0,
+  bandwidth: 0,
+  bandwidthScope: "connection",
+  resetPercent: 0,
+  splice: false,
+  tcpPorts: [],
+  upstream: "http1",
+  websocket: "pipe",
+};
+
+// A list of strings is an enum option
+type OptionKind =
+  | "boolean"
+  | "size"
+  | "count"
+  | "percent"
+  | "percentile"
+  | "duration"
+  | "name"
+  | "ports"
+  | readonly string[];
+
+const OPTION_KINDS: Record<keyof ServiceOptions, OptionKind> = {
+  bufferRequests: "boolean",
+  bufferResponses: "boolean",
+  bufferMemory: "size",
+  maxInFlight: "count",
+  queueSize: "count",
+  queueTimeout: "duration",
+  queueOrder: ["fifo", "lifo"],
+  hedge: "boolean",
+  hedgePercentile: "percentile",
+  retries: "count",
+  retryBudget: "count",
+  coalesce: "boolean",
+  etag: "boolean",
+  mirror: "name",
+  mirrorPercent: "percent",
+  latency: "duration",
+  jitter: "duration",
+  bandwidth: "size",
+  bandwidthScope: ["connection", "service"],
+  resetPercent: "percent",
+  splice: "boolean",
+  tcpPorts: "ports",
+  upstream: ["http1", "h2c"],
+  websocket: ["pipe", "frames", "deflate"],
+};
+
+const SIZE_UNITS: Record<string, number> = {
+  "": 1,
+  k: 1024,
+  m: 1024 * 1024,
+  g: 1024 * 1024 * 1024,
+};
+
+/**
+ * Validate an options object (from JSON) on top of `base`. Unknown keys and
+ * bad values throw, so a typo fails registration instead of being ignored.
+ */
+export function parseServiceOptions(
+  input: unknown,
+  base: ServiceOptions = DEFAULT_SERVICE_OPTIONS
+): ServiceOptions {
+  const options = { ...base };
+  if (input === undefined || input === null) return options;
+  if (typeof input !== "object" || Array.isArray(input)) {
+    throw new Error("options must be an object");
+  }
+
+  for (const [key, value] of Object.entries(input)) {
+    const kind = OPTION_KINDS[key as keyof ServiceOptions];
+    if (!kind) {
+      throw new Error(`Unknown option "${key}"`);
+    }
+    (options as Record<string, unknown>)[key] = parseValue(key, kind, value);
+  }
+  return options;
+}
+
+/**
+ * Parse `key=value` command-line flags into a partial options object.
+ * Keys may be kebab-case (`buffer-requests`); a bare key means `true`.
+ */
+export function parseOptionFlags(flags: string[]): Partial<ServiceOptions> {
+  const options: Record<string, unknown> = {};
+  for (const flag of flags) {
+    const eq = flag.indexOf("=");
+    const rawKey = eq === -1 ? flag : flag.slice(0, eq);
+    const key = rawKey.replace(/-([a-z])/g, (_, c: string) => c.toUpperCase());
+    const kind = OPTION_KINDS[key as keyof ServiceOptions];
+    if (!kind) {
+      throw new Error(`Unknown option "${rawKey}"`);
+    }
+    options[key] = parseValue(rawKey, kind, eq === -1 ? true : flag.slice(eq + 1));
+  }
+  return options as Partial<ServiceOptions>;
+}
+
+function parseValue(
+  key: string,
+  kind: OptionKind,
+  value: unknown
+): boolean | number | string | number[] {
+  if (kind === "ports") {
+    // A JSON array, or a comma-separated list; empty turns forwarding off
+    const items = Array.isArray(value) ? value
+      : typeof value === "number" ? [value]
+      : typeof value === "string" ? value.split(",").map((p) => p.trim()).filter(Boolean)
+      : null;
+    const ports = items?.map((p) => (typeof p === "string" && /^\d+$/.test(p) ? Number(p) : p));
+    if (ports?.every((p) => Number.isInteger(p) && (p as number) >= 1 && (p as number) <= 65535)) {
+      return [...new Set(ports as number[])];
+    }
+    throw new Error(`Option "${key}" must be a list of ports like 5432,6379`);
+  }
+
+  if (kind === "name") {
+    // Service names as used in hostnames; empty turns the option off
+    if (typeof value === "string" && /^[a-z0-9-]*$/i.test(value)) return value;
+    throw new Error(`Option "${key}" must be a service name`);
+  }
+
+  if (typeof kind !== "string") {
+    if (typeof value === "string" && kind.includes(value)) return value;
+    throw new Error(`Option "${key}" must be one of ${kind.join(", ")}`);
+  }
+
+  if (kind === "boolean") {
+    if (typeof value === "boolean") return value;
+    if (value === "true" || value === "on" || value === "1") return true;
+    if (value === "false" || value === "off" || value === "0") return false;
+    throw new Error(`Option "${key}" must be true or false`);
+  }
+
+  if (kind === "percentile") {
+    // Strictly inside (0, 100): neither end is a latency to wait for
+    const p =
+      typeof value === "number" ? value
+        : typeof value === "string" && /^\d+(?:\.\d+)?$/.test(value.trim()) ? Number(value)
+        : NaN;
+    if (p > 0 && p < 100) return p;
+    throw new Error(`Option "${key}" must be a percentile between 0 and 100, like 95 or 99.9`);
+  }
+
+  if (kind === "count" || kind === "percent") {
+    const count =
+      typeof value === "number" ? value
+        : typeof value === "string" && /^\d+$/.test(value.trim()) ? Number(value)
+        : NaN;
+    if (kind === "percent" && count >= 0 && count <= 100) return count;
+    if (kind === "count" && Number.isInteger(count) && count >= 0) return count;
+    throw new Error(
+      kind === "percent"
+        ? `Option "${key}" must be a percentage from 0 to 100`
+        : `Option "${key}" must be a non-negative integer`
+    );
+  }
+
+  if (typeof value === "number" && Number.isInteger(value) && value >= 0) return value;
+
+  if (kind === "duration") {
+    const match = typeof value === "string" ? /^(\d+(?:\.\d+)?)(ms|s)?$/.exec(value.trim()) : null;
+    if (!match) {
+      throw new Error(`Option "${key}" must be a duration like 500ms or 10s`);
+    }
+    return Math.round(Number(match[1]) * (match[2] === "s" ? 1000 : 1));
+  }
+
+  const match = typeof value === "string" ? /^(\d+)([kmg]?)b?$/i.exec(value.trim()) : null;
+  if (!match) {
+    throw new Error(`Option "${key}" must be a size like 512k or 4m`);
+  }
+  return Number(match[1]) * SIZE_UNITS[match[2].toLowerCase()];
+}
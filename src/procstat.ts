@@ -0,0 +1,79 @@
+/**
+ * Per-process CPU and memory sampling
+ *
+ * Reads /proc on Linux and falls back to ps(1) elsewhere. Used to attribute
+ * CPU time and RSS to the daemon, client relays and child processes.
+ */
+
+import { readFile } from "node:fs/promises";
+import { execFile } from "node:child_process";
+import { platform } from "node:os";
+
+export interface ProcessSample {
+  /** Total user + system CPU time in milliseconds. */
+  cpuMs: number;
+  /** Resident set size in bytes. */
+  rssBytes: number;
+}
+
+// USER_HZ is 100 on every mainstream Linux architecture.
+const CLOCK_TICKS_PER_SEC = 100;
+
+async function sampleLinux(pid: number): Promise<ProcessSample | null> {
+  try {
+    const [stat, status] = await Promise.all([
+      readFile(`/proc/${pid}/stat`, "utf8"),
+      readFile(`/proc/${pid}/status`, "utf8"),
+    ]);
+    // Fields after the parenthesised command name start at field 3 (state).
+    const fields = stat.slice(stat.lastIndexOf(")") + 2).split(" ");
+    const ticks = Number(fields[11]) + Number(fields[12]);
+    const rssMatch = status.match(/^VmRSS:\s+(\d+) kB/m);
+    return {
+      cpuMs: (ticks * 1000) / CLOCK_TICKS_PER_SEC,
+      rssBytes: rssMatch ? Number(rssMatch[1]) * 1024 : 0,
+    };
+  } catch {
+    return null;
+  }
+}
+
+function parseCpuTime(text: string): number {
+  // ps prints [[dd-]hh:]mm:ss[.ss]
+  let days = 0;
+  let rest = text;
+  const dash = rest.indexOf("-");
+  if (dash !== -1) {
+    days = Number(rest.slice(0, dash));
+    rest = rest.slice(dash + 1);
+  }
+  let seconds = 0;
+  for (const part of rest.split(":")) {
+    seconds = seconds * 60 + Number(part);
+  }
+  return (days * 86400 + seconds) * 1000;
+}
+
+function samplePs(pid: number): Promise<ProcessSample | null> {
+  return new Promise((resolve) => {
+    execFile("ps", ["-o", "rss=,time=", "-p", String(pid)], (err, stdout) => {
+      if (err) {
+        resolve(null);
+        return;
+      }
+      const [rss, time] = stdout.trim().split(/\s+/);
+      if (!rss || !time) {
+        resolve(null);
+        return;
+      }
+      resolve({ cpuMs: parseCpuTime(time), rssBytes: Number(rss) * 1024 });
+    });
+  });
+}
+
+/**
+ * Sample CPU time and RSS of a process. Returns null if it has exited.
+ */
+export function sampleProcess(pid: number): Promise<ProcessSample | null> {
+  return platform() === "linux" ? sampleLinux(pid) : samplePs(pid);
+}
@@ -0,0 +1,127 @@
+/**
+ * In-process V8 profiling via the inspector protocol
+ *
+ * Lets the daemon profile itself without being restarted under --inspect,
+ * which would lose the in-memory service registry.
+ */
+
+import { randomBytes } from "node:crypto";
+import { closeSync, createReadStream, openSync, unlinkSync, writeSync } from "node:fs";
+import { Session } from "node:inspector";
+import { tmpdir } from "node:os";
+import { join } from "node:path";
+import type { Readable } from "node:stream";
+
+export class Profiler {
+  private session: Session | null = null;
+  private busy = false;
+
+  /** True while a capture is running; only one capture at a time. */
+  get active(): boolean {
+    return this.busy;
+  }
+
+  /** Sample the CPU for `ms` milliseconds and return the .cpuprofile JSON. */
+  async cpuProfile(ms: number): Promise<object> {
+    return this.exclusive(async () => {
+      await this.post("Profiler.enable");
+      try {
+        await this.post("Profiler.start");
+        await sleep(ms);
+        const { profile } = (await this.post("Profiler.stop")) as { profile: object };
+        return profile;
+      } finally {
+        // Stops a profile still running if the above failed
+        await this.post("Profiler.disable").catch(() => {});
+      }
+    });
+  }
+
+  /**
+   * Take a heap snapshot and return a stream of it. The snapshot is taken
+   * synchronously on the daemon's own thread, so nothing could be sent
+   * while it runs; its chunks go to an unlinked temp file instead of piling
+   * up in memory, and the stream reads that file back.
+   */
+  async heapSnapshot(): Promise<Readable> {
+    return this.exclusive(async () => {
+      const path = join(tmpdir(), `lohost-heap-${process.pid}-${randomBytes(8).toString("hex")}`);
+      const fd = openSync(path, "wx+", 0o600);
+      unlinkSync(path);
+
+      const session = this.connect();
+      const onChunk = (message: { params: { chunk: string } }) => writeSync(fd, message.params.chunk);
+      session.on("HeapProfiler.addHeapSnapshotChunk", onChunk);
+      try {
+        await this.post("HeapProfiler.takeHeapSnapshot", { reportProgress: false });
+      } catch (err) {
+        closeSync(fd);
+        throw err;
+      } finally {
+        session.removeListener("HeapProfiler.addHeapSnapshotChunk", onChunk);
+      }
+      return createReadStream(path, { fd, start: 0 });
+    });
+  }
+
+  /**
+   * Sample allocations for `ms` milliseconds and return the .heapprofile
+   * JSON. Objects already collected by GC are included, so short-lived
+   * per-request garbage shows up too.
+   */
+  async allocationSample(ms: number, samplingInterval = 4096): Promise<object> {
+    return this.exclusive(async () => {
+      await this.post("HeapProfiler.enable");
+      let sampling = false;
+      try {
+        await this.post("HeapProfiler.startSampling", {
+          samplingInterval,
+          includeObjectsCollectedByMajorGC: true,
+          includeObjectsCollectedByMinorGC: true,
+        });
+        sampling = true;
+        await sleep(ms);
+        const { profile } = (await this.post("HeapProfiler.stopSampling")) as { profile: object };
+        sampling = false;
+        return profile;
+      } finally {
+        if (sampling) await this.post("HeapProfiler.stopSampling").catch(() => {});
+        await this.post("HeapProfiler.disable").catch(() => {});
+      }
+    });
+  }
+
+  private async exclusive<T>(fn: () => Promise<T>): Promise<T> {
+    if (this.busy) {
+      throw new Error("A profile is already being captured");
+    }
+    this.busy = true;
+    try {
+      return await fn();
+    } finally {
+      this.busy = false;
+    }
+  }
+
+  private connect(): Session {
+    if (!this.session) {
+      this.session = new Session();
+      this.session.connect();
+    }
+    return this.session;
+  }
+
+  private post(method: string, params?: object): Promise<unknown> {
+    const session = this.connect();
+    return new Promise((resolve, reject) => {
+      session.post(method, params ?? {}, (err, result) => {
+        if (err) reject(err);
+        else resolve(result);
+      });
+    });
+  }
+}
+
+function sleep(ms: number): Promise<void> {
+  return new Promise((resolve) => setTimeout(resolve, ms));
+}
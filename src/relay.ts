@@ -0,0 +1,144 @@
+/**
+ * Native TCP relay
+ *
+ * With `lohost daemon --relay native`, tcp-ports listeners are served by
+ * native/lohost-relay rather than the daemon's event loop: a C process on
+ * io_uring (or epoll and splice on kernels without it) that the daemon
+ * drives over stdin. Raw TCP bytes then never pass through JavaScript; the
+ * daemon only tells the relay which address:port goes to which backends.
+ *
+ * `--relay sockmap` goes one step further for TCP backends: once a pair is
+ * connected, a BPF program redirects its payload from socket to socket in
+ * the kernel, and the relay keeps only the bookkeeping. It needs CAP_BPF
+ * and CAP_NET_ADMIN; without them the relay runs as `native`.
+ */
+
+import { spawn, type ChildProcess } from "node:child_process";
+import { existsSync } from "node:fs";
+import { createInterface } from "node:readline";
+import { findNativeFile } from "./client.js";
+
+export type RelayMode = "node" | "native" | "io_uring" | "epoll" | "sockmap";
+export const RELAY_MODES: readonly RelayMode[] = ["node", "native", "io_uring", "epoll", "sockmap"];
+
+export interface RelayStats {
+  engine: string;
+  /** Syscalls made on the data path, including io_uring_enter. */
+  syscalls: number;
+  /** Bytes the relay moved itself. */
+  bytes: number;
+  accepted: number;
+  active: number;
+  /** Bytes the kernel redirected for closed sockmap pairs. */
+  redirected: number;
+}
+
+/** The relay binary: LOHOST_RELAY_BIN, else the native build. */
+export function findRelayBinary(): string | null {
+  const envBin = process.env.LOHOST_RELAY_BIN;
+  if (envBin && existsSync(envBin)) return envBin;
+  return findNativeFile("lohost-relay");
+}
+
+/** One lohost-relay process. */
+export class NativeRelay {
+  /** Engine the relay settled on, once it is up. */
+  engine: string | null = null;
+  /** Called once if the process exits (or never starts) before `stop()`. */
+  onExit: ((reason: string) => void) | null = null;
+
+  private child: ChildProcess;
+  private services = new Map<string, string>();
+  private listening = new Set<string>();
+  private statsWaiters: Array<(stats: RelayStats) => void> = [];
+  private stopped = false;
+
+  constructor(binary: string, mode: Exclude<RelayMode, "node">) {
+    const engine = mode === "native" ? "auto" : mode;
+    this.child = spawn(binary, ["--engine", engine], { stdio: ["pipe", "pipe", "inherit"] });
+    this.child.on("error", (err) => this.exited(err.message));
+    this.child.on("exit", (code, signal) => this.exited(signal ?? `exit code ${code}`));
+    this.child.stdin!.on("error", () => {
+      // Reported through "exit"
+    });
+    createInterface({ input: this.child.stdout! }).on("line", (line) => this.handleLine(line));
+  }
+
+  /** Listen on `key` (address:port), or point it at new backends. */
+  listen(key: string, service: string, backends: string[]): void {
+    // The protocol is space-separated; such a socket path cannot be passed
+    const usable = backends.filter((b) => !/\s/.test(b));
+    if (usable.length < backends.length) {
+      console.error(`[lohostd] Native relay skips ${service} backends with spaces in their path`);
+    }
+    this.services.set(key, service);
+    if (usable.length === 0) {
+      this.close(key);
+      return;
+    }
+    this.send(`listen ${key} ${usable.join(" ")}`);
+  }
+
+  close(key: string): void {
+    this.services.delete(key);
+    this.listening.delete(key);
+    this.send(`close ${key}`);
+  }
+
+  get pid(): number | undefined {
+    return this.child.pid;
+  }
+
+  isListening(key: string): boolean {
+    return this.listening.has(key);
+  }
+
+  stats(): Promise<RelayStats> {
+    return new Promise((resolve) => {
+      this.statsWaiters.push(resolve);
+      this.send("stats");
+    });
+  }
+
+  /** Close stdin; the relay exits, and open connections with it. */
+  stop(): void {
+    this.stopped = true;
+    this.child.stdin!.end();
+  }
+
+  private send(line: string): void {
+    if (!this.stopped) this.child.stdin!.write(line + "\n");
+  }
+
+  private handleLine(line: string): void {
+    const [kind, ...rest] = line.split(" ");
+    if (kind === "ready") {
+      this.engine = rest[0];
+    } else if (kind === "listening") {
+      const key = rest[0];
+      const service = this.services.get(key);
+      if (service && !this.listening.has(key)) {
+        this.listening.add(key);
+        console.error(`[lohostd] tcp ${key} → ${service} (${this.engine})`);
+      }
+    } else if (kind === "failed") {
+      console.error(`[lohostd] Cannot forward ${rest[0]} to ${this.services.get(rest[0])}`);
+    } else if (kind === "stats") {
+      const fields = Object.fromEntries(rest.map((kv) => kv.split("=")));
+      this.statsWaiters.shift()?.({
+        engine: fields.engine,
+        syscalls: Number(fields.syscalls),
+        bytes: Number(fields.bytes),
+        accepted: Number(fields.accepted),
+        active: Number(fields.active),
+        redirected: Number(fields.redirected),
+      });
+    }
+  }
+
+  private exited(reason: string): void {
+    if (this.stopped) return;
+    this.stopped = true;
+    this.onExit?.(reason);
+  }
+}
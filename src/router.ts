@@ -0,0 +1,389 @@
+/**
+ * Path-prefix routing
+ *
+ * Rules send a path prefix on one host to another service, e.g. everything
+ * under app.localhost/api to the `api` service, so a frontend can stay
+ * same-origin without a dev-server proxy hop. Each host's rules compile into
+ * a radix trie: a lookup walks the request path once, whatever the number of
+ * rules, and the longest matching prefix wins.
+ *
+ * Host patterns cover names that aren't a fixed label, like branch previews
+ * (`pr-*-web`). All glob patterns run together as one lazily built DFA, so a
+ * host is matched in a single pass over its characters whatever the number of
+ * patterns; regex patterns are tried only where they outrank the DFA's pick.
+ * The winner's captures fill `$1`… in its target service name.
+ *
+ * A table is never modified after it is built; changes build a new table
+ * that replaces the old one.
+ */
+
+export interface PathRule {
+  /** Host name below the routing domain (`app` for app.localhost). */
+  host: string;
+  /** Path prefix, matched on segment boundaries: /api matches /api/x, not /apix. */
+  prefix: string;
+  /** Service that receives matching requests. */
+  service: string;
+  /** Remove the prefix from the path before forwarding. */
+  strip: boolean;
+  /** Loaded from the routes file, and replaced when it changes. */
+  file?: boolean;
+}
+
+export interface HostPattern {
+  /** Glob (`*` matches within one label, and is captured) or `/regex/`. */
+  pattern: string;
+  /** Target service; `$1`… are replaced with the pattern's captures. */
+  service: string;
+  /** Loaded from the routes file, and replaced when it changes. */
+  file?: boolean;
+}
+
+interface TrieNode<T> {
+  label: string;
+  children: Map<number, TrieNode<T>>;
+  value: T | undefined;
+}
+
+/** Compressed trie over path prefixes with longest-match lookup. */
+export class PrefixTrie<T> {
+  private root: TrieNode<T> = { label: "", children: new Map(), value: undefined };
+
+  insert(prefix: string, value: T): void {
+    let node = this.root;
+    let i = 0;
+    while (i < prefix.length) {
+      const child = node.children.get(prefix.charCodeAt(i));
+      if (!child) {
+        node.children.set(prefix.charCodeAt(i), {
+          label: prefix.slice(i),
+          children: new Map(),
+          value,
+        });
+        return;
+      }
+
+      let common = 0;
+      const limit = Math.min(child.label.length, prefix.length - i);
+      while (common < limit && child.label.charCodeAt(common) === prefix.charCodeAt(i + common)) {
+        common++;
+      }
+      if (common < child.label.length) {
+        // Split the edge where the new prefix diverges
+        const middle: TrieNode<T> = {
+          label: child.label.slice(0, common),
+          children: new Map([[child.label.charCodeAt(common), child]]),
+          value: undefined,
+        };
+        child.label = child.label.slice(common);
+        node.children.set(middle.label.charCodeAt(0), middle);
+        node = middle;
+      } else {
+        node = child;
+      }
+      i += common;
+    }
+    node.value = value;
+  }
+
+  /** Value of the longest prefix of `path` that ends on a segment boundary. */
+  match(path: string): T | undefined {
+    let node = this.root;
+    let best = atBoundary(path, 0) ? node.value : undefined;
+    let i = 0;
+    while (i < path.length) {
+      const child = node.children.get(path.charCodeAt(i));
+      if (!child || !path.startsWith(child.label, i)) break;
+      i += child.label.length;
+      node = child;
+      if (node.value !== undefined && atBoundary(path, i)) best = node.value;
+    }
+    return best;
+  }
+}
+
+function atBoundary(path: string, i: number): boolean {
+  if (i === path.length) return true;
+  const c = path.charCodeAt(i);
+  return c === 0x2f /* / */ || c === 0x3f /* ? */;
+}
+
+/**
+ * Canonical form of a prefix: leading slash, no trailing slash, and the
+ * root ("/") as the empty string, which matches every path.
+ */
+export function normalizePrefix(prefix: string): string {
+  let normalized = prefix.startsWith("/") ? prefix : `/${prefix}`;
+  while (normalized.endsWith("/")) normalized = normalized.slice(0, -1);
+  return normalized;
+}
+
+/** The request path with a matched prefix removed, keeping the query. */
+export function stripPrefix(path: string, prefix: string): string {
+  const rest = path.slice(prefix.length);
+  return rest.startsWith("/") ? rest : `/${rest}`;
+}
+
+// Service and host names as they appear in hostnames
+const NAME = /^[a-z0-9-]+(\.[a-z0-9-]+)*$/i;
+
+/** A rule's host as a name below the routing domain: app.localhost:8080 → app. */
+export function ruleHost(host: string, routeDomain: string): string {
+  const name = host.split(":")[0].toLowerCase();
+  const suffix = `.${routeDomain}`;
+  return name.endsWith(suffix) && name.length > suffix.length ? name.slice(0, -suffix.length) : name;
+}
+
+/** Validate a path rule (API body or routes file); throws with a message for the user. */
+export function parsePathRule(input: unknown, routeDomain: string): PathRule {
+  const { host, prefix, service, strip } = (input ?? {}) as Record<string, unknown>;
+  if (typeof host !== "string" || typeof prefix !== "string" || typeof service !== "string") {
+    throw new Error("host, prefix, and service required");
+  }
+  const rule: PathRule = {
+    host: ruleHost(host, routeDomain),
+    prefix: normalizePrefix(prefix),
+    service,
+    strip: strip === true,
+  };
+  if (!NAME.test(rule.host) || !NAME.test(service)) {
+    throw new Error("host and service must be service names");
+  }
+  if (/[?#\s]/.test(rule.prefix)) {
+    throw new Error("prefix must be a plain path");
+  }
+  return rule;
+}
+
+/** Validate a host pattern (API body or routes file); throws with a message for the user. */
+export function parseHostPattern(input: unknown): HostPattern {
+  const { pattern, service } = (input ?? {}) as Record<string, unknown>;
+  if (typeof pattern !== "string" || typeof service !== "string") {
+    throw new Error("pattern and service required");
+  }
+  if (!/^\/.+\/$/.test(pattern) && !/^[a-z0-9.*-]+$/i.test(pattern)) {
+    throw new Error("pattern must be a host glob like pr-*-web, or /regex/");
+  }
+  if (!/^[a-z0-9.$-]+$/i.test(service)) {
+    throw new Error("service must be a service name, optionally with $1… captures");
+  }
+  if (pattern.startsWith("/")) {
+    // A bad regex fails here rather than on traffic
+    try {
+      new RegExp(pattern.slice(1, -1));
+    } catch {
+      throw new Error(`Invalid regular expression ${pattern}`);
+    }
+  }
+  return { pattern, service };
+}
+
+/** All path rules, compiled per host, and the host patterns. */
+export class RoutingTable {
+  readonly rules: readonly PathRule[];
+  readonly patterns: readonly HostPattern[];
+  private hosts = new Map<string, PrefixTrie<PathRule>>();
+  private matcher: HostPatternSet;
+
+  constructor(rules: readonly PathRule[] = [], patterns: readonly HostPattern[] = []) {
+    this.rules = rules;
+    this.patterns = patterns;
+    for (const rule of rules) {
+      let trie = this.hosts.get(rule.host);
+      if (!trie) {
+        trie = new PrefixTrie();
+        this.hosts.set(rule.host, trie);
+      }
+      trie.insert(rule.prefix, rule);
+    }
+    this.matcher = new HostPatternSet(patterns);
+  }
+
+  /** Compiled rules for one host, or undefined when it has none. */
+  paths(host: string): PrefixTrie<PathRule> | undefined {
+    return this.hosts.get(host);
+  }
+
+  /** Service name the first matching host pattern points `host` at, or null. */
+  matchHost(host: string): string | null {
+    return this.matcher.match(host);
+  }
+
+  /** A new table with `rule` added, replacing any rule for the same host and prefix. */
+  with(rule: PathRule): RoutingTable {
+    return new RoutingTable(
+      [...this.rules.filter((r) => r.host !== rule.host || r.prefix !== rule.prefix), rule],
+      this.patterns
+    );
+  }
+
+  /** A new table without the rule for `host` and `prefix`, or null if there is none. */
+  without(host: string, prefix: string): RoutingTable | null {
+    const rules = this.rules.filter((r) => r.host !== host || r.prefix !== prefix);
+    return rules.length === this.rules.length ? null : new RoutingTable(rules, this.patterns);
+  }
+
+  /** A new table with `pattern` added last, or updated in place if it exists. */
+  withPattern(pattern: HostPattern): RoutingTable {
+    const index = this.patterns.findIndex((p) => p.pattern === pattern.pattern);
+    const patterns = index === -1
+      ? [...this.patterns, pattern]
+      : this.patterns.map((p, i) => (i === index ? pattern : p));
+    return new RoutingTable(this.rules, patterns);
+  }
+
+  /** A new table without `pattern`, or null if there is none. */
+  withoutPattern(pattern: string): RoutingTable | null {
+    const patterns = this.patterns.filter((p) => p.pattern !== pattern);
+    return patterns.length === this.patterns.length ? null : new RoutingTable(this.rules, patterns);
+  }
+}
+
+// Glob token: a character code, or STAR for `*`
+const STAR = -1;
+
+// DFA states kept before the cache starts over; bounds memory on odd inputs
+const MAX_DFA_STATES = 4096;
+
+interface DfaState {
+  /** NFA positions this state stands for. */
+  positions: Int32Array;
+  /** Lowest-numbered pattern accepting here, or -1. */
+  accept: number;
+  /** Transitions built so far; null is the dead state. */
+  next: Map<number, DfaState | null>;
+}
+
+/**
+ * Prioritised host patterns. Earlier patterns win. Globs are compiled into
+ * one NFA whose DFA states are built on first use and cached; regex patterns
+ * are checked separately, and only those ranked above the DFA's match.
+ */
+export class HostPatternSet {
+  private patterns: readonly HostPattern[];
+  /** Per pattern: capture extractor (every pattern) and glob tokens (globs only). */
+  private extractors: RegExp[] = [];
+  private regexIndexes: number[] = [];
+  private tokens: number[][] = [];
+  /** NFA position id of each glob's first token; ids run contiguously per glob. */
+  private starts: number[] = [];
+  private owner: number[] = [];
+  private startPositions: Int32Array | null = null;
+  private start: DfaState | null = null;
+  private states = new Map<string, DfaState>();
+
+  constructor(patterns: readonly HostPattern[]) {
+    this.patterns = patterns;
+    patterns.forEach((p, index) => {
+      const regex = /^\/(.*)\/$/.exec(p.pattern);
+      if (regex) {
+        this.extractors.push(new RegExp(`^(?:${regex[1]})$`, "i"));
+        this.regexIndexes.push(index);
+        return;
+      }
+      const glob = p.pattern.toLowerCase();
+      const tokens = Array.from(glob, (c) => (c === "*" ? STAR : c.charCodeAt(0)));
+      this.extractors.push(
+        new RegExp(`^${glob.split("*").map(escapeRegExp).join("([^.]*)")}$`)
+      );
+      this.tokens[index] = tokens;
+      this.starts[index] = this.owner.length;
+      // One position per token plus the accepting position after the last
+      for (let i = 0; i <= tokens.length; i++) this.owner.push(index);
+    });
+    if (this.owner.length > 0) {
+      this.startPositions = this.closure(this.starts.filter((s) => s !== undefined));
+      this.start = this.state(this.startPositions);
+    }
+  }
+
+  /** Target service name for `host`, with captures substituted, or null. */
+  match(host: string): string | null {
+    const name = host.toLowerCase();
+    let winner = this.runDfa(name);
+    for (const index of this.regexIndexes) {
+      if (winner !== -1 && index > winner) break;
+      if (this.extractors[index].test(name)) {
+        winner = index;
+        break;
+      }
+    }
+    if (winner === -1) return null;
+
+    const captures = this.extractors[winner].exec(name)!;
+    return this.patterns[winner].service
+      .replace(/\$(\d)/g, (_, n: string) => captures[Number(n)] ?? "")
+      .toLowerCase();
+  }
+
+  private runDfa(name: string): number {
+    let state = this.start;
+    for (let i = 0; i < name.length && state; i++) {
+      const c = name.charCodeAt(i);
+      let next = state.next.get(c);
+      if (next === undefined) {
+        next = this.step(state, c);
+        state.next.set(c, next);
+      }
+      state = next;
+    }
+    return state ? state.accept : -1;
+  }
+
+  private step(state: DfaState, c: number): DfaState | null {
+    const moved: number[] = [];
+    for (const id of state.positions) {
+      const index = this.owner[id];
+      const pos = id - this.starts[index];
+      const token = this.tokens[index][pos];
+      if (token === STAR) {
+        // `*` stays within one label
+        if (c !== 0x2e /* . */) moved.push(id);
+      } else if (token === c) {
+        moved.push(id + 1);
+      }
+    }
+    return moved.length === 0 ? null : this.state(this.closure(moved));
+  }
+
+  /** Add the positions reachable by letting each `*` match nothing. */
+  private closure(ids: number[]): Int32Array {
+    const set = new Set<number>();
+    for (let id of ids) {
+      set.add(id);
+      const index = this.owner[id];
+      const tokens = this.tokens[index];
+      while (tokens[id - this.starts[index]] === STAR) set.add(++id);
+    }
+    return Int32Array.from(set).sort();
+  }
+
+  private state(positions: Int32Array): DfaState {
+    const key = positions.join(",");
+    let state = this.states.get(key);
+    if (state) return state;
+
+    if (this.states.size >= MAX_DFA_STATES) {
+      // The old states still reach each other through their transitions, so
+      // the start state is rebuilt too; then nothing cached refers to them
+      this.states.clear();
+      this.start = null;
+      this.start = this.state(this.startPositions!);
+      return this.state(positions);
+    }
+    let accept = -1;
+    for (const id of positions) {
+      const index = this.owner[id];
+      if (id - this.starts[index] === this.tokens[index].length && (accept === -1 || index < accept)) {
+        accept = index;
+      }
+    }
+    state = { positions, accept, next: new Map() };
+    this.states.set(key, state);
+    return state;
+  }
+}
+
+function escapeRegExp(text: string): string {
+  return text.replace(/[.*+?^${}()|[\]\\]/g, "\\$&");
+}
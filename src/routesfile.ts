@@ -0,0 +1,218 @@
+/**
+ * Declarative routes file
+ *
+ * Backends that never run under `lohost -n` (Docker containers, SSH tunnels,
+ * other machines) are declared in a JSON file, together with path rules and
+ * host patterns:
+ *
+ *   {
+ *     "services": {
+ *       "grafana": "localhost:3000",
+ *       "legacy": "unix:/var/run/legacy.sock",
+ *       "search": { "target": ["127.0.0.1:9200", "127.0.0.1:9201"],
+ *                   "options": { "maxInFlight": 8 } }
+ *     },
+ *     "routes": [{ "host": "app", "prefix": "/api", "service": "api", "strip": true }],
+ *     "hostPatterns": [{ "pattern": "pr-*-web", "service": "web-pr-$1" }]
+ *   }
+ *
+ * The daemon watches the file and hands every valid version to a callback,
+ * which swaps it in whole. A version that fails to parse or validate is
+ * reported and ignored, so the previous routes stay in place.
+ */
+
+import { watch, type FSWatcher } from "node:fs";
+import { readFile } from "node:fs/promises";
+import { basename, dirname, isAbsolute } from "node:path";
+import { parseServiceOptions, type ServiceOptions } from "./options.js";
+import {
+  parseHostPattern,
+  parsePathRule,
+  type HostPattern,
+  type PathRule,
+} from "./router.js";
+
+// Editors write files in several steps; settle before reading
+const RELOAD_DELAY_MS = 50;
+
+/** A Unix socket, or a TCP address. */
+export type StaticTarget =
+  | { socketPath: string; host: null; port: number }
+  | { socketPath: null; host: string; port: number };
+
+export interface StaticService {
+  name: string;
+  targets: StaticTarget[];
+  options: ServiceOptions;
+}
+
+export interface RoutesFile {
+  services: StaticService[];
+  routes: PathRule[];
+  hostPatterns: HostPattern[];
+}
+
+/**
+ * Parse and validate a routes file. Errors name the offending entry, so
+ * the daemon's log says what to fix.
+ */
+export function parseRoutesFile(text: string, routeDomain: string): RoutesFile {
+  const json = JSON.parse(text) as Record<string, unknown>;
+  if (typeof json !== "object" || json === null || Array.isArray(json)) {
+    throw new Error("expected a JSON object");
+  }
+  for (const key of Object.keys(json)) {
+    if (key !== "services" && key !== "routes" && key !== "hostPatterns") {
+      throw new Error(`unknown key "${key}"`);
+    }
+  }
+
+  const services: StaticService[] = [];
+  for (const [name, entry] of Object.entries(asObject(json.services ?? {}, "services"))) {
+    if (!/^[a-z0-9-]+(\.[a-z0-9-]+)*$/i.test(name)) {
+      throw new Error(`services: "${name}" is not a valid service name`);
+    }
+    const spec = typeof entry === "string" || Array.isArray(entry)
+      ? { target: entry }
+      : asObject(entry, `services.${name}`);
+    const targets = ([] as unknown[]).concat(spec.target ?? []);
+    if (targets.length === 0) {
+      throw new Error(`services.${name}: target required`);
+    }
+    try {
+      services.push({
+        name,
+        targets: targets.map(parseTarget),
+        options: parseServiceOptions(spec.options),
+      });
+    } catch (err) {
+      throw new Error(`services.${name}: ${(err as Error).message}`);
+    }
+  }
+
+  const routes = asArray(json.routes ?? [], "routes").map((rule, i) => {
+    try {
+      return { ...parsePathRule(rule, routeDomain), file: true };
+    } catch (err) {
+      throw new Error(`routes[${i}]: ${(err as Error).message}`);
+    }
+  });
+  const hostPatterns = asArray(json.hostPatterns ?? [], "hostPatterns").map((pattern, i) => {
+    try {
+      return { ...parseHostPattern(pattern), file: true };
+    } catch (err) {
+      throw new Error(`hostPatterns[${i}]: ${(err as Error).message}`);
+    }
+  });
+
+  return { services, routes, hostPatterns };
+}
+
+/**
+ * `unix:/path` or an absolute socket path; otherwise `[http://]host:port`,
+ * or a bare port on 127.0.0.1.
+ */
+function parseTarget(target: unknown): StaticTarget {
+  if (typeof target !== "string" || target === "") {
+    throw new Error("target must be a string");
+  }
+  if (target.startsWith("unix:") || isAbsolute(target)) {
+    const socketPath = target.replace(/^unix:/, "");
+    if (!isAbsolute(socketPath)) throw new Error(`socket path must be absolute: ${target}`);
+    return { socketPath, host: null, port: 0 };
+  }
+
+  const match = /^(?:http:\/\/)?(?:(\[[^\]]+\]|[^:/]+):)?(\d+)\/?$/.exec(target);
+  const port = match ? Number(match[2]) : NaN;
+  if (!match || port < 1 || port > 65535) {
+    throw new Error(`target must be host:port or unix:/path, got "${target}"`);
+  }
+  return { socketPath: null, host: match[1]?.replace(/^\[|\]$/g, "") ?? "127.0.0.1", port };
+}
+
+function asObject(value: unknown, where: string): Record<string, unknown> {
+  if (typeof value !== "object" || value === null || Array.isArray(value)) {
+    throw new Error(`${where}: expected an object`);
+  }
+  return value as Record<string, unknown>;
+}
+
+function asArray(value: unknown, where: string): unknown[] {
+  if (!Array.isArray(value)) throw new Error(`${where}: expected an array`);
+  return value;
+}
+
+/**
+ * Watches a routes file and reports each valid version. The directory is
+ * watched rather than the file, so editors that save by renaming a new file
+ * into place (and files created later) are picked up.
+ */
+export class RoutesFileWatcher {
+  private path: string;
+  private routeDomain: string;
+  private onLoad: (file: RoutesFile) => void;
+  private watcher: FSWatcher | null = null;
+  private timer: NodeJS.Timeout | null = null;
+  private lastText: string | null = null;
+
+  constructor(path: string, routeDomain: string, onLoad: (file: RoutesFile) => void) {
+    this.path = path;
+    this.routeDomain = routeDomain;
+    this.onLoad = onLoad;
+  }
+
+  /** Load the file once, then watch it for changes. */
+  async start(): Promise<void> {
+    await this.load();
+    const name = basename(this.path);
+    try {
+      this.watcher = watch(dirname(this.path), (_event, filename) => {
+        if (filename !== null && filename !== name) return;
+        if (this.timer) clearTimeout(this.timer);
+        this.timer = setTimeout(() => {
+          this.timer = null;
+          void this.load();
+        }, RELOAD_DELAY_MS);
+      });
+      this.watcher.on("error", (err) => {
+        console.error(`[lohostd] Routes file watch failed: ${err.message}`);
+      });
+    } catch (err) {
+      console.error(`[lohostd] Cannot watch ${this.path}: ${(err as Error).message}`);
+    }
+  }
+
+  stop(): void {
+    if (this.timer) clearTimeout(this.timer);
+    this.watcher?.close();
+    this.watcher = null;
+  }
+
+  private async load(): Promise<void> {
+    let text: string;
+    try {
+      text = await readFile(this.path, "utf8");
+    } catch (err) {
+      const code = (err as NodeJS.ErrnoException).code;
+      // A missing file means no static routes, e.g. before it is first written
+      if (code !== "ENOENT") {
+        console.error(`[lohostd] Cannot read ${this.path}: ${(err as Error).message}`);
+        return;
+      }
+      text = "{}";
+    }
+    if (text === this.lastText) return;
+
+    let file: RoutesFile;
+    try {
+      file = parseRoutesFile(text, this.routeDomain);
+    } catch (err) {
+      console.error(
+        `[lohostd] ${this.path}: ${(err as Error).message}; keeping the previous routes`
+      );
+      return;
+    }
+    this.lastText = text;
+    this.onLoad(file);
+  }
+}
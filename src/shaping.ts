@@ -0,0 +1,88 @@
+/**
+ * Network-condition emulation
+ *
+ * Per-service shaping rules make every client of a service, browsers and
+ * automated tests alike, see the same mobile-like network: added latency
+ * with jitter before each request is forwarded, a bandwidth cap on response
+ * bodies, and injected connection resets. Rates are read from the service's
+ * options on every slice, so a cap changed through the API applies to
+ * responses already in flight.
+ */
+
+import { Transform, type TransformCallback } from "node:stream";
+import { performance } from "node:perf_hooks";
+
+// Largest piece released at once; keeps a capped stream smooth, not bursty
+const SLICE = 16 * 1024;
+
+// Tokens a bucket may save up while idle, as seconds of its rate
+const BURST_SECONDS = 0.05;
+
+/** Delay before forwarding: `latency` ± up to `jitter` ms, never negative. */
+export function shapedDelay(latency: number, jitter: number): number {
+  return Math.max(0, latency + (Math.random() * 2 - 1) * jitter);
+}
+
+/**
+ * Bandwidth token bucket. Reservations may run the balance negative; the
+ * caller waits out the debt, so concurrent streams sharing a bucket are
+ * served in turn at the combined rate.
+ */
+export class TokenBucket {
+  private balance = 0;
+  private refilledAt = performance.now();
+
+  /** Take `bytes` at `rate` bytes/s; returns the ms to wait before sending them. */
+  reserve(bytes: number, rate: number): number {
+    if (rate <= 0) return 0;
+    const now = performance.now();
+    this.balance = Math.min(
+      Math.max(rate * BURST_SECONDS, SLICE),
+      this.balance + ((now - this.refilledAt) / 1000) * rate
+    );
+    this.refilledAt = now;
+    this.balance -= bytes;
+    return this.balance >= 0 ? 0 : (-this.balance / rate) * 1000;
+  }
+}
+
+/** Passes bytes through no faster than `rate()` bytes/s allows. */
+export class Throttle extends Transform {
+  private bucket: TokenBucket;
+  private rate: () => number;
+  private timer: NodeJS.Timeout | null = null;
+
+  constructor(bucket: TokenBucket, rate: () => number) {
+    super();
+    this.bucket = bucket;
+    this.rate = rate;
+  }
+
+  override _transform(chunk: Buffer, _encoding: BufferEncoding, callback: TransformCallback): void {
+    this.release(chunk, 0, callback);
+  }
+
+  override _destroy(err: Error | null, callback: (error?: Error | null) => void): void {
+    if (this.timer) clearTimeout(this.timer);
+    callback(err);
+  }
+
+  private release(chunk: Buffer, offset: number, callback: TransformCallback): void {
+    if (offset >= chunk.length) {
+      callback();
+      return;
+    }
+    const slice = chunk.subarray(offset, offset + SLICE);
+    const wait = this.bucket.reserve(slice.length, this.rate());
+    const send = () => {
+      this.timer = null;
+      this.push(slice);
+      this.release(chunk, offset + slice.length, callback);
+    };
+    if (wait > 0) {
+      this.timer = setTimeout(send, wait);
+    } else {
+      send();
+    }
+  }
+}
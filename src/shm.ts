@@ -0,0 +1,354 @@
+/**
+ * Shared-memory transport
+ *
+ * With `lohost --transport shm`, the client's Unix socket is served by
+ * native/lohost-relay instead of a Node proxy, and the relay offers a second
+ * "setup" socket next to it. The daemon connects there through the
+ * lohost_shm addon and receives a memory region of 64 channels, each a pair
+ * of single-producer single-consumer byte rings (native/linux/lohost_shm.h).
+ * Upstream HTTP requests are then written straight into the region and the
+ * relay moves them to the app's TCP port; the two sides wake each other
+ * through eventfds only when one of them has gone idle.
+ *
+ * The Unix socket stays: it carries requests while the region is not up
+ * (or has gone), when every channel is busy, and everything that is not a
+ * plain HTTP exchange (upgrades, splice, tcp-ports, mirrors).
+ */
+
+import { Agent, type ClientRequestArgs } from "node:http";
+import { createConnection } from "node:net";
+import { constants, platform } from "node:os";
+import { spawn, type ChildProcess } from "node:child_process";
+import { createRequire } from "node:module";
+import { createInterface } from "node:readline";
+import { existsSync } from "node:fs";
+import { Duplex } from "node:stream";
+import { findNativeFile } from "./client.js";
+import { findRelayBinary } from "./relay.js";
+
+export type Transport = "uds" | "shm";
+export const TRANSPORTS: readonly Transport[] = ["uds", "shm"];
+
+// cflags from lohost_shm.h; state() adds the relay's errno above bit 8
+const SHM_EOF = 1;
+const SHM_ABORT = 2;
+const SHM_CONNECTED = 4;
+const SHM_CHANNELS = 64;
+
+type Region = object;
+
+interface ShmAddon {
+  open(
+    path: string,
+    onReady: () => void,
+    onClose: () => void,
+    onChannels: (lo: number, hi: number) => void
+  ): Region;
+  connect(region: Region): number;
+  write(region: Region, ch: number, chunk: Buffer, offset: number): number;
+  read(region: Region, ch: number): Buffer | null;
+  state(region: Region, ch: number): number;
+  end(region: Region, ch: number): void;
+  abort(region: Region, ch: number): void;
+  release(region: Region, ch: number): void;
+  close(region: Region): void;
+}
+
+let addon: ShmAddon | null | undefined;
+
+/** The daemon's half of the transport: LOHOST_SHM_ADDON, else the native build. */
+function loadAddon(): ShmAddon | null {
+  if (addon !== undefined) return addon;
+  addon = null;
+  if (platform() !== "linux") return null;
+  const envFile = process.env.LOHOST_SHM_ADDON;
+  const file = envFile && existsSync(envFile) ? envFile : findNativeFile("lohost_shm.node");
+  if (!file) return null;
+  try {
+    addon = createRequire(import.meta.url)(file) as ShmAddon;
+  } catch (err) {
+    console.error(`[lohostd] Cannot load ${file}: ${(err as Error).message}`);
+  }
+  return addon;
+}
+
+const ERRNO_NAMES = new Map<number, string>(
+  Object.entries(constants.errno).map(([name, value]) => [value, name])
+);
+
+/** What net.Socket would have reported for the relay's errno. */
+function channelError(state: number, path: string): NodeJS.ErrnoException {
+  const errno = state >>> 8;
+  const code = ERRNO_NAMES.get(errno) ?? "ECONNRESET";
+  const syscall = state & SHM_CONNECTED ? "read" : "connect";
+  const err: NodeJS.ErrnoException = new Error(`${syscall} ${code} ${path} (shm)`);
+  err.code = code;
+  err.errno = -errno;
+  err.syscall = syscall;
+  return err;
+}
+
+/**
+ * One connection to the app over a channel, with as much of the net.Socket
+ * surface as http.ClientRequest and Agent use.
+ */
+class ShmSocket extends Duplex {
+  connecting = false;
+  timeout = 0;
+
+  private transport: ShmTransport;
+  private channel: number;
+  private reading = false;
+  private pending: Buffer | null = null;
+  private offset = 0;
+  private writeDone: ((err?: Error | null) => void) | null = null;
+  private timer: NodeJS.Timeout | null = null;
+
+  constructor(transport: ShmTransport, channel: number) {
+    // Like net.Socket: the app ending its side ends ours
+    super({ allowHalfOpen: false });
+    this.transport = transport;
+    this.channel = channel;
+  }
+
+  /** The relay posted the channel: bytes, room, or a change of state. */
+  update(): void {
+    if (this.destroyed) return;
+    this.touch();
+    if (this.pending) this.flush();
+    if (this.reading) {
+      this.pull();
+    } else if (this.pending) {
+      // Paused for backpressure, a reset would otherwise go unnoticed
+      const state = this.transport.addon.state(this.transport.region, this.channel);
+      if (state & SHM_ABORT) this.destroy(channelError(state, this.transport.path));
+    }
+  }
+
+  _write(chunk: Buffer, _encoding: BufferEncoding, callback: (err?: Error | null) => void): void {
+    this.touch();
+    this.pending = chunk;
+    this.offset = 0;
+    this.writeDone = callback;
+    this.flush();
+  }
+
+  _final(callback: (err?: Error | null) => void): void {
+    this.transport.addon.end(this.transport.region, this.channel);
+    callback();
+  }
+
+  _read(): void {
+    this.reading = true;
+    this.pull();
+  }
+
+  _destroy(err: Error | null, callback: (err?: Error | null) => void): void {
+    const { addon, region } = this.transport;
+    // A clean close needs nothing from the relay; anything else resets the app's connection
+    if (!this.readableEnded || !this.writableFinished) addon.abort(region, this.channel);
+    addon.release(region, this.channel);
+    this.transport.detach(this.channel, this);
+    if (this.timer) clearTimeout(this.timer);
+    callback(err);
+  }
+
+  setTimeout(ms: number, callback?: () => void): this {
+    this.timeout = ms;
+    if (callback) {
+      if (ms) this.once("timeout", callback);
+      else this.removeListener("timeout", callback);
+    }
+    if (this.timer) {
+      clearTimeout(this.timer);
+      this.timer = null;
+    }
+    this.touch();
+    return this;
+  }
+
+  setNoDelay(): this {
+    return this;
+  }
+
+  setKeepAlive(): this {
+    return this;
+  }
+
+  ref(): this {
+    return this;
+  }
+
+  unref(): this {
+    return this;
+  }
+
+  private flush(): void {
+    const chunk = this.pending!;
+    const { addon, region } = this.transport;
+    while (this.offset < chunk.length) {
+      const copied = addon.write(region, this.channel, chunk, this.offset);
+      if (copied === 0) return; // The relay posts the channel once there is room
+      this.offset += copied;
+    }
+    const done = this.writeDone!;
+    this.pending = this.writeDone = null;
+    done();
+  }
+
+  private pull(): void {
+    const { addon, region } = this.transport;
+    while (this.reading) {
+      // Flags first: bytes the relay wrote before setting them are then readable too
+      const state = addon.state(region, this.channel);
+      const chunk = addon.read(region, this.channel);
+      if (chunk) {
+        this.reading = this.push(chunk);
+      } else if (state & SHM_ABORT) {
+        this.destroy(channelError(state, this.transport.path));
+        return;
+      } else {
+        if (state & SHM_EOF) {
+          this.reading = false;
+          this.push(null);
+        }
+        return;
+      }
+    }
+  }
+
+  private touch(): void {
+    if (!this.timeout || this.destroyed) return;
+    if (this.timer) {
+      this.timer.refresh();
+    } else {
+      this.timer = setTimeout(() => this.emit("timeout"), this.timeout);
+      this.timer.unref();
+    }
+  }
+}
+
+/** Keep-alive pool whose new connections take a free channel when there is one. */
+class ShmAgent extends Agent {
+  private transport: ShmTransport;
+
+  constructor(transport: ShmTransport) {
+    // The options of Node's global agent, which the Unix socket path uses
+    super({ keepAlive: true, scheduling: "lifo", timeout: 5000 });
+    this.transport = transport;
+  }
+
+  createConnection(options: ClientRequestArgs): Duplex {
+    const channel = this.transport.ready ? this.transport.addon.connect(this.transport.region) : -1;
+    if (channel < 0) return createConnection({ path: options.socketPath! });
+    const socket = new ShmSocket(this.transport, channel);
+    this.transport.attach(channel, socket);
+    return socket;
+  }
+}
+
+/** The daemon's region with one client relay. */
+export class ShmTransport {
+  readonly addon: ShmAddon;
+  readonly path: string;
+  readonly region: Region;
+  ready = false;
+
+  private sockets: Array<ShmSocket | undefined> = new Array(SHM_CHANNELS);
+  private shmAgent: ShmAgent;
+  private closed = false;
+
+  /** Connect to a relay's setup socket; null when the addon is unavailable. */
+  static open(path: string, label: string): ShmTransport | null {
+    const shm = loadAddon();
+    if (!shm) return null;
+    try {
+      return new ShmTransport(shm, path, label);
+    } catch (err) {
+      console.error(`[lohostd] ${label}: no shared memory (${(err as Error).message})`);
+      return null;
+    }
+  }
+
+  private constructor(shm: ShmAddon, path: string, label: string) {
+    this.addon = shm;
+    this.path = path;
+    this.shmAgent = new ShmAgent(this);
+    this.region = shm.open(
+      path,
+      () => {
+        this.ready = true;
+        console.error(`[lohostd] ${label}: shared memory via ${path}`);
+      },
+      () => {
+        if (this.ready) console.error(`[lohostd] ${label}: shared memory closed; using the socket`);
+        this.close();
+      },
+      (lo, hi) => {
+        for (let mask = lo; mask; mask &= mask - 1) this.sockets[31 - Math.clz32(mask & -mask)]?.update();
+        for (let mask = hi; mask; mask &= mask - 1) this.sockets[63 - Math.clz32(mask & -mask)]?.update();
+      }
+    );
+  }
+
+  /** Agent for requests to this backend, while the region is up. */
+  get agent(): Agent | undefined {
+    return this.ready ? this.shmAgent : undefined;
+  }
+
+  /** How the services API shows it. */
+  toJSON(): { shm: string; ready: boolean } {
+    return { shm: this.path, ready: this.ready };
+  }
+
+  attach(channel: number, socket: ShmSocket): void {
+    this.sockets[channel] = socket;
+  }
+
+  detach(channel: number, socket: ShmSocket): void {
+    if (this.sockets[channel] === socket) this.sockets[channel] = undefined;
+  }
+
+  /** Drop the region; connections on it are reset. */
+  close(): void {
+    if (this.closed) return;
+    this.closed = true;
+    this.ready = false;
+    for (const socket of this.sockets) socket?.destroy();
+    this.shmAgent.destroy();
+    this.addon.close(this.region);
+  }
+}
+
+/**
+ * Client side: serve `socketPath` and the setup socket `shmPath` from
+ * lohost-relay, both forwarding to the app's port. Resolves to the relay
+ * process, or null when it is unavailable and the Node proxy should serve.
+ */
+export function startShmRelay(socketPath: string, shmPath: string, port: number): Promise<ChildProcess | null> {
+  const binary = platform() === "linux" ? findRelayBinary() : null;
+  if (!binary) return Promise.resolve(null);
+  // The app may listen on either loopback family; the relay tries both
+  const backends = `127.0.0.1:${port} [::1]:${port}`;
+  return new Promise((resolve) => {
+    const child = spawn(binary, ["--engine", "epoll"], { stdio: ["pipe", "pipe", "inherit"] });
+    let listening = 0;
+    let settled = false;
+    const settle = (result: ChildProcess | null) => {
+      if (settled) return;
+      settled = true;
+      if (!result) child.kill();
+      resolve(result);
+    };
+    createInterface({ input: child.stdout! }).on("line", (line) => {
+      if (line.startsWith("failed")) settle(null);
+      else if (line.startsWith("listening") && ++listening === 2) settle(child);
+    });
+    child.on("error", () => settle(null));
+    child.on("exit", () => settle(null));
+    child.stdin!.on("error", () => {
+      // Reported through "error"/"exit"
+    });
+    child.stdin!.write(`listen unix:${socketPath} ${backends}\nshm unix:${shmPath} ${backends}\n`);
+  });
+}
@@ -0,0 +1,117 @@
+/**
+ * Connection sniffing
+ *
+ * Reads just enough of a new connection to route it: the Host header of
+ * the first HTTP request, or the server name (SNI) in a TLS ClientHello.
+ * Services with the `splice` option are then relayed byte for byte for the
+ * connection's lifetime, with no HTTP parsing of later requests; browsers
+ * keep an HTTP/1.1 connection on a single origin, so the first Host header
+ * holds for the rest.
+ *
+ * A connection that opens with the HTTP/2 preface (h2c with prior
+ * knowledge, as gRPC clients send) is recognised too; its Host is inside
+ * compressed headers, so it goes to the daemon's HTTP/2 server instead.
+ */
+
+// Give up sniffing (and let the HTTP server answer) past this many bytes
+export const MAX_SNIFF_BYTES = 16 * 1024;
+
+const TLS_HANDSHAKE = 0x16;
+const CLIENT_HELLO = 0x01;
+const SERVER_NAME_EXTENSION = 0x0000;
+
+const HTTP2_PREFACE = Buffer.from("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n", "latin1");
+
+export interface Sniffed {
+  host: string | null;
+  tls: boolean;
+  /** Starts with the HTTP/2 connection preface; `host` is then null. */
+  h2: boolean;
+}
+
+/**
+ * Route key of the connection whose first bytes are `data`: `undefined`
+ * while more bytes are needed, `host: null` when there is none to find.
+ */
+export function sniff(data: Buffer): Sniffed | undefined {
+  if (data.length === 0) return undefined;
+  if (data[0] === TLS_HANDSHAKE) {
+    const host = sniffServerName(data);
+    return host === undefined ? undefined : { host, tls: true, h2: false };
+  }
+  const preface = Math.min(data.length, HTTP2_PREFACE.length);
+  if (data.compare(HTTP2_PREFACE, 0, preface, 0, preface) === 0) {
+    return preface < HTTP2_PREFACE.length ? undefined : { host: null, tls: false, h2: true };
+  }
+  const host = sniffHostHeader(data);
+  return host === undefined ? undefined : { host, tls: false, h2: false };
+}
+
+function sniffHostHeader(data: Buffer): string | null | undefined {
+  const end = data.indexOf("\r\n\r\n", 0, "latin1");
+  if (end === -1) return data.length >= MAX_SNIFF_BYTES ? null : undefined;
+
+  // Header names are case-insensitive; scan line starts only
+  let pos = data.indexOf("\r\n", 0, "latin1");
+  while (pos !== -1 && pos < end) {
+    const line = pos + 2;
+    if (
+      data.length > line + 5 &&
+      (data[line] | 0x20) === 0x68 && (data[line + 1] | 0x20) === 0x6f &&
+      (data[line + 2] | 0x20) === 0x73 && (data[line + 3] | 0x20) === 0x74 &&
+      data[line + 4] === 0x3a
+    ) {
+      const eol = data.indexOf("\r\n", line, "latin1");
+      return data.toString("latin1", line + 5, eol).trim() || null;
+    }
+    pos = data.indexOf("\r\n", line, "latin1");
+  }
+  return null;
+}
+
+/**
+ * The server_name extension of a ClientHello. Only the first TLS record is
+ * read; a ClientHello split across records is treated as having no name.
+ */
+function sniffServerName(data: Buffer): string | null | undefined {
+  if (data.length < 5) return undefined;
+  const recordEnd = 5 + data.readUInt16BE(3);
+  if (data.length < recordEnd) return recordEnd > MAX_SNIFF_BYTES ? null : undefined;
+
+  let o = 5;
+  const need = (n: number) => o + n <= recordEnd;
+  if (!need(4) || data[o] !== CLIENT_HELLO) return null;
+  o += 4;
+  // Version and random, then session id, cipher suites, compression methods
+  if (!need(34)) return null;
+  o += 34;
+  if (!need(1)) return null;
+  o += 1 + data[o];
+  if (!need(2)) return null;
+  o += 2 + data.readUInt16BE(o);
+  if (!need(1)) return null;
+  o += 1 + data[o];
+  if (!need(2)) return null;
+  const extensionsEnd = Math.min(recordEnd, o + 2 + data.readUInt16BE(o));
+  o += 2;
+
+  while (o + 4 <= extensionsEnd) {
+    const type = data.readUInt16BE(o);
+    const length = data.readUInt16BE(o + 2);
+    o += 4;
+    if (type === SERVER_NAME_EXTENSION) {
+      // List length, then entries of (type, length, name); type 0 is a hostname
+      let p = o + 2;
+      while (p + 3 <= o + length) {
+        const nameLength = data.readUInt16BE(p + 1);
+        if (data[p] === 0 && p + 3 + nameLength <= o + length) {
+          return data.toString("latin1", p + 3, p + 3 + nameLength);
+        }
+        p += 3 + nameLength;
+      }
+      return null;
+    }
+    o += length;
+  }
+  return null;
+}
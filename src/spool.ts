@@ -0,0 +1,178 @@
+/**
+ * Body spool for request/response buffering
+ *
+ * A FIFO of bytes that always accepts writes: chunks are kept in memory up
+ * to a limit, and anything beyond that is appended to an unlinked temp file.
+ * A single consumer drains it into a writable at that writable's own pace,
+ * either after the producer has finished (request buffering) or while it is
+ * still writing (response buffering), so the producer is never slowed down
+ * by the consumer.
+ */
+
+import { randomBytes } from "node:crypto";
+import { open, unlink, type FileHandle } from "node:fs/promises";
+import { tmpdir } from "node:os";
+import { join } from "node:path";
+import type { Writable } from "node:stream";
+
+// Size of each read back from the temp file
+const FILE_READ_SIZE = 64 * 1024;
+
+export class Spool {
+  /** Total bytes written so far. */
+  size = 0;
+
+  private memoryLimit: number;
+  private memory: Buffer[] = [];
+  private memoryBytes = 0;
+
+  // Temp file region [readOffset, writeOffset) holds bytes not yet drained.
+  // While it is non-empty every new chunk goes to the file to keep order.
+  private file: Promise<FileHandle> | null = null;
+  private fileWrites: Promise<unknown> = Promise.resolve();
+  private pendingFileBytes = 0;
+  private readOffset = 0;
+  private writeOffset = 0;
+
+  private ended = false;
+  private failed: Error | null = null;
+  private wake: (() => void) | null = null;
+
+  constructor(memoryLimit: number) {
+    this.memoryLimit = memoryLimit;
+  }
+
+  /** True once part of the body has gone to a temp file. */
+  get spilled(): boolean {
+    return this.file !== null;
+  }
+
+  write(chunk: Buffer): void {
+    this.size += chunk.length;
+    if (this.pendingFileBytes === 0 && this.writeOffset === this.readOffset &&
+        this.memoryBytes + chunk.length <= this.memoryLimit) {
+      this.memory.push(chunk);
+      this.memoryBytes += chunk.length;
+    } else {
+      this.writeFile(chunk);
+    }
+    this.notify();
+  }
+
+  end(): void {
+    this.ended = true;
+    this.notify();
+  }
+
+  /**
+   * Deliver everything written, in order, into `dest`, waiting on 'drain'
+   * whenever it pushes back. Resolves once `end()` has been called and all
+   * bytes are delivered; rejects if `dest` closes first or the file fails.
+   */
+  async drainTo(dest: Writable): Promise<void> {
+    for (;;) {
+      const chunk = await this.next();
+      if (chunk === null) return;
+      if (dest.destroyed) throw new Error("Destination closed");
+      if (!dest.write(chunk) && !(await waitForDrain(dest))) {
+        throw new Error("Destination closed");
+      }
+    }
+  }
+
+  /** Release the temp file, if one was created. */
+  dispose(): void {
+    this.memory = [];
+    this.memoryBytes = 0;
+    const file = this.file;
+    this.file = null;
+    if (file) {
+      this.fileWrites
+        .catch(() => {})
+        .then(() => file)
+        .then((handle) => handle.close())
+        .catch(() => {});
+    }
+  }
+
+  private async next(): Promise<Buffer | null> {
+    for (;;) {
+      if (this.failed) throw this.failed;
+
+      const chunk = this.memory.shift();
+      if (chunk) {
+        this.memoryBytes -= chunk.length;
+        return chunk;
+      }
+
+      if (this.readOffset < this.writeOffset && this.file) {
+        const handle = await this.file;
+        const length = Math.min(FILE_READ_SIZE, this.writeOffset - this.readOffset);
+        const buffer = Buffer.allocUnsafe(length);
+        const { bytesRead } = await handle.read(buffer, 0, length, this.readOffset);
+        this.readOffset += bytesRead;
+        if (this.readOffset === this.writeOffset && this.pendingFileBytes === 0) {
+          // Fully drained: rewind so the file doesn't grow without bound and
+          // let new chunks go back to memory.
+          this.readOffset = this.writeOffset = 0;
+        }
+        return buffer.subarray(0, bytesRead);
+      }
+
+      if (this.ended && this.pendingFileBytes === 0) return null;
+
+      await new Promise<void>((resolve) => (this.wake = resolve));
+    }
+  }
+
+  private writeFile(chunk: Buffer): void {
+    if (!this.file) {
+      this.file = openTempFile();
+    }
+    const file = this.file;
+    this.pendingFileBytes += chunk.length;
+    this.fileWrites = this.fileWrites
+      .then(() => file)
+      .then(async (handle) => {
+        const position = this.writeOffset;
+        await handle.write(chunk, 0, chunk.length, position);
+        this.pendingFileBytes -= chunk.length;
+        this.writeOffset = position + chunk.length;
+        this.notify();
+      })
+      .catch((err: Error) => {
+        this.failed ??= err;
+        this.notify();
+      });
+  }
+
+  private notify(): void {
+    const wake = this.wake;
+    this.wake = null;
+    wake?.();
+  }
+}
+
+// Opened then unlinked right away, so the space is reclaimed however the
+// daemon exits. The name is random and the open exclusive: in a shared
+// tmpdir, a file or symlink planted at a guessable name is never used.
+async function openTempFile(): Promise<FileHandle> {
+  const path = join(tmpdir(), `lohost-spool-${process.pid}-${randomBytes(8).toString("hex")}`);
+  const handle = await open(path, "wx+", 0o600);
+  await unlink(path).catch(() => {});
+  return handle;
+}
+
+function waitForDrain(dest: Writable): Promise<boolean> {
+  return new Promise((resolve) => {
+    const done = (ok: boolean) => {
+      dest.off("drain", onDrain);
+      dest.off("close", onClose);
+      resolve(ok);
+    };
+    const onDrain = () => done(true);
+    const onClose = () => done(false);
+    dest.on("drain", onDrain);
+    dest.on("close", onClose);
+  });
+}
@@ -0,0 +1,597 @@
+/**
+ * WebSocket-aware relaying
+ *
+ * Upgraded connections are normally piped as opaque bytes. With
+ * `-o websocket=frames` the daemon reads the frames going each way instead:
+ * they pass through unchanged, but every message is counted and sized, and
+ * each client is pinged every few seconds to measure its round trip (the
+ * pongs are not passed on). `websocket=deflate` also terminates
+ * permessage-deflate (RFC 7692): the daemon accepts the client's offer and
+ * withholds it from the backend, inflating what the client sends and
+ * compressing what the backend sends, so a dev server without compression
+ * still sends compact frames over a slow link.
+ */
+
+import { randomFillSync } from "node:crypto";
+import type { Socket } from "node:net";
+import { performance } from "node:perf_hooks";
+import {
+  constants as zlibConstants,
+  createDeflateRaw,
+  createInflateRaw,
+  type DeflateRaw,
+  type InflateRaw,
+} from "node:zlib";
+import { Histogram } from "./histogram.js";
+
+// Each client is pinged this often while its connection is open
+const PING_INTERVAL_MS = 5000;
+const PING_PREFIX = "lohost-rtt:";
+// Messages to the client worth compressing: smaller ones gain nothing, and
+// larger ones are streamed through uncompressed instead of held in memory
+const DEFLATE_MIN_BYTES = 64;
+const DEFLATE_MAX_BYTES = 4 * 1024 * 1024;
+// Largest compressed message from a client, before and after inflating
+const MAX_MESSAGE_BYTES = 64 * 1024 * 1024;
+// Ends every compressed message; not sent on the wire (RFC 7692 §7.2.1)
+const DEFLATE_TAIL = Buffer.from([0x00, 0x00, 0xff, 0xff]);
+const MAX_RESPONSE_HEAD = 16 * 1024;
+
+const OP_CONTINUATION = 0x0;
+const OP_PING = 0x9;
+const OP_PONG = 0xa;
+
+export interface WebSocketSnapshot {
+  /** Messages per second from clients (in) and to them (out). */
+  messagesInPerSec: number;
+  messagesOutPerSec: number;
+  /** Message sizes on the client's connection over the last window, in bytes. */
+  sizeP50: number;
+  sizeP99: number;
+  /** Round trip of the daemon's pings to clients, from the last window with replies, in milliseconds. */
+  pingP50: number;
+  pingP99: number;
+  /** Payload bytes per second that permessage-deflate kept off client connections. */
+  deflateSavedPerSec: number;
+}
+
+/** Per-service message counters, folded into a snapshot every metrics tick. */
+export class WebSocketStats {
+  private messagesIn = 0;
+  private messagesOut = 0;
+  private deflateSaved = 0;
+  private sizes = new Histogram();
+  private rtt = new Histogram();
+  private pingP50 = 0;
+  private pingP99 = 0;
+
+  message(inbound: boolean, size: number): void {
+    if (inbound) this.messagesIn++;
+    else this.messagesOut++;
+    this.sizes.record(size);
+  }
+
+  pong(ms: number): void {
+    this.rtt.record(ms * 1000);
+  }
+
+  saved(bytes: number): void {
+    this.deflateSaved += bytes;
+  }
+
+  snapshot(perSec: number): WebSocketSnapshot {
+    // Pings are seconds apart, so a window without replies keeps the last figures
+    if (this.rtt.count > 0) {
+      this.pingP50 = this.rtt.percentile(50) / 1000;
+      this.pingP99 = this.rtt.percentile(99) / 1000;
+      this.rtt.reset();
+    }
+    const snapshot: WebSocketSnapshot = {
+      messagesInPerSec: Math.round(this.messagesIn * perSec * 10) / 10,
+      messagesOutPerSec: Math.round(this.messagesOut * perSec * 10) / 10,
+      sizeP50: this.sizes.percentile(50),
+      sizeP99: this.sizes.percentile(99),
+      pingP50: this.pingP50,
+      pingP99: this.pingP99,
+      deflateSavedPerSec: Math.round(this.deflateSaved * perSec),
+    };
+    this.messagesIn = this.messagesOut = this.deflateSaved = 0;
+    this.sizes.reset();
+    return snapshot;
+  }
+}
+
+/** The permessage-deflate offer the daemon accepted from a client. */
+export interface DeflateParams {
+  /** LZ77 window for messages to the client (server_max_window_bits). */
+  windowBits: number;
+  /** Start every message to the client afresh (server_no_context_takeover). */
+  noContextTakeover: boolean;
+  /** Sec-WebSocket-Extensions value of the response. */
+  response: string;
+}
+
+/**
+ * Pick the first permessage-deflate offer in a Sec-WebSocket-Extensions
+ * request header that the daemon can take. The client's own window and
+ * context takeover need no answer: messages from it are inflated with the
+ * largest window and a context that is never reset.
+ */
+export function negotiateDeflate(header: string | undefined): DeflateParams | null {
+  if (!header) return null;
+  for (const offer of header.split(",")) {
+    const [name, ...params] = offer.split(";").map((p) => p.trim());
+    if (name.toLowerCase() !== "permessage-deflate") continue;
+    const accepted = { windowBits: 15, noContextTakeover: false, response: "permessage-deflate" };
+    const seen = new Set<string>();
+    for (const param of params) {
+      const eq = param.indexOf("=");
+      const key = (eq === -1 ? param : param.slice(0, eq)).trim().toLowerCase();
+      const value = eq === -1 ? null : param.slice(eq + 1).trim().replace(/^"(.*)"$/, "$1");
+      if (seen.has(key)) {
+        accepted.windowBits = 0;
+        break;
+      }
+      seen.add(key);
+      if (key === "server_no_context_takeover" && value === null) {
+        accepted.noContextTakeover = true;
+        accepted.response += "; server_no_context_takeover";
+      } else if (key === "server_max_window_bits" && value !== null && /^(9|1[0-5])$/.test(value)) {
+        // zlib cannot make raw deflate with an 8-bit window, so such offers are passed over
+        accepted.windowBits = Number(value);
+        accepted.response += `; server_max_window_bits=${value}`;
+      } else if (
+        !(key === "client_max_window_bits" && (value === null || /^([89]|1[0-5])$/.test(value))) &&
+        !(key === "client_no_context_takeover" && value === null)
+      ) {
+        accepted.windowBits = 0;
+        break;
+      }
+    }
+    if (accepted.windowBits) return accepted;
+  }
+  return null;
+}
+
+/**
+ * Take over a WebSocket connection whose upgrade request has been written
+ * to `backend`: pass the backend's handshake response on (announcing
+ * `deflate` to the client, if set), then relay frames. A backend that does
+ * not switch protocols gets its response passed on and the bytes piped.
+ * `head` holds what the client sent after its request.
+ */
+export function relayWebSocket(
+  client: Socket,
+  backend: Socket,
+  head: Buffer,
+  stats: WebSocketStats,
+  deflate: DeflateParams | null
+): void {
+  let received = Buffer.alloc(0);
+  const onData = (chunk: Buffer) => {
+    received = Buffer.concat([received, chunk]);
+    const end = received.indexOf("\r\n\r\n");
+    if (end === -1) {
+      if (received.length > MAX_RESPONSE_HEAD) backend.destroy();
+      return;
+    }
+    backend.off("data", onData);
+    backend.pause();
+    const response = received.subarray(0, end + 2).toString("latin1");
+    const rest = received.subarray(end + 4);
+    if (!/^HTTP\/1\.1 101 /.test(response)) {
+      client.write(received);
+      if (head.length > 0) backend.write(head);
+      client.pipe(backend);
+      backend.pipe(client);
+      return;
+    }
+    const extension = deflate ? `Sec-WebSocket-Extensions: ${deflate.response}\r\n` : "";
+    client.write(`${response}${extension}\r\n`);
+    new WebSocketRelay(client, backend, stats, deflate).start(head, rest);
+  };
+  backend.on("data", onData);
+}
+
+interface FrameHeader {
+  fin: boolean;
+  rsv1: boolean;
+  opcode: number;
+  mask: Buffer | null;
+  length: number;
+  /** The header bytes as received. */
+  raw: Buffer;
+}
+
+/** Frame header at `at`; undefined when incomplete, null when malformed. */
+function parseHeader(buf: Buffer, at: number): FrameHeader | null | undefined {
+  if (buf.length - at < 2) return undefined;
+  const b0 = buf[at];
+  const b1 = buf[at + 1];
+  let length = b1 & 0x7f;
+  const size = 2 + (length === 126 ? 2 : length === 127 ? 8 : 0) + (b1 & 0x80 ? 4 : 0);
+  if (buf.length - at < size) return undefined;
+  if (length === 126) {
+    length = buf.readUInt16BE(at + 2);
+  } else if (length === 127) {
+    const high = buf.readUInt32BE(at + 2);
+    if (high > 0x1fffff) return null;
+    length = high * 2 ** 32 + buf.readUInt32BE(at + 6);
+  }
+  const opcode = b0 & 0x0f;
+  // Control frames are short and never fragmented (RFC 6455 §5.5)
+  if (opcode >= 0x8 && (length > 125 || !(b0 & 0x80))) return null;
+  return {
+    fin: (b0 & 0x80) !== 0,
+    rsv1: (b0 & 0x40) !== 0,
+    opcode,
+    mask: b1 & 0x80 ? buf.subarray(at + size - 4, at + size) : null,
+    length,
+    raw: buf.subarray(at, at + size),
+  };
+}
+
+/** XOR `data` in place with `mask`, starting `position` bytes into the payload. */
+function applyMask(data: Buffer, mask: Buffer, position: number): void {
+  for (let i = 0; i < data.length; i++) data[i] ^= mask[(position + i) & 3];
+}
+
+/** One unfragmented frame; masked (as clients must) with a fresh key. */
+function encodeFrame(opcode: number, payload: Buffer, rsv1: boolean, masked: boolean): Buffer[] {
+  const length = payload.length;
+  const at = length < 126 ? 2 : length < 65536 ? 4 : 10;
+  const header = Buffer.allocUnsafe(at + (masked ? 4 : 0));
+  header[0] = 0x80 | (rsv1 ? 0x40 : 0) | opcode;
+  if (length < 126) {
+    header[1] = length;
+  } else if (length < 65536) {
+    header[1] = 126;
+    header.writeUInt16BE(length, 2);
+  } else {
+    header[1] = 127;
+    header.writeUInt32BE(Math.floor(length / 2 ** 32), 2);
+    header.writeUInt32BE(length >>> 0, 6);
+  }
+  if (masked) {
+    header[1] |= 0x80;
+    const mask = randomFillSync(header, at, 4).subarray(at, at + 4);
+    applyMask(payload, mask, 0);
+  }
+  return [header, payload];
+}
+
+interface Pending {
+  bytes: Buffer[] | null;
+}
+
+/**
+ * Writes to one side in order. A message still in zlib holds a slot, and
+ * what comes after it waits. Reading from the other side stops while
+ * anything waits or the socket is over its high-water mark.
+ */
+class Outbound {
+  /** Inside a frame being streamed through; nothing may be put in between. */
+  midFrame = false;
+  private socket: Socket;
+  private source: Socket;
+  private queue: Pending[] = [];
+  private ending = false;
+
+  constructor(socket: Socket, source: Socket) {
+    this.socket = socket;
+    this.source = source;
+    socket.on("drain", () => this.resume());
+  }
+
+  write(bytes: Buffer | Buffer[]): void {
+    if (this.queue.length > 0) {
+      this.queue.push({ bytes: Array.isArray(bytes) ? bytes : [bytes] });
+    } else if (Array.isArray(bytes)) {
+      for (const b of bytes) this.socket.write(b);
+    } else {
+      this.socket.write(bytes);
+    }
+  }
+
+  defer(): Pending {
+    const pending: Pending = { bytes: null };
+    this.queue.push(pending);
+    return pending;
+  }
+
+  fill(pending: Pending, bytes: Buffer[]): void {
+    pending.bytes = bytes;
+    while (this.queue.length > 0 && this.queue[0].bytes) {
+      for (const b of this.queue.shift()!.bytes!) this.socket.write(b);
+    }
+    if (this.queue.length > 0) return;
+    if (this.ending) this.socket.end();
+    else this.resume();
+  }
+
+  end(): void {
+    if (this.queue.length > 0) this.ending = true;
+    else this.socket.end();
+  }
+
+  /** After a chunk from the source went through. */
+  throttle(): void {
+    if (this.queue.length > 0 || this.socket.writableNeedDrain) this.source.pause();
+  }
+
+  private resume(): void {
+    if (this.queue.length === 0 && !this.socket.writableNeedDrain) this.source.resume();
+  }
+}
+
+/** A zlib stream taking one whole message at a time, as RFC 7692 frames them. */
+class MessageCodec {
+  private inflate: boolean;
+  private noContextTakeover: boolean;
+  private stream: DeflateRaw | InflateRaw;
+  private output: Buffer[] = [];
+  private size = 0;
+  private jobs: Array<{ input: Buffer[]; done: (out: Buffer | null) => void }> = [];
+  private busy = false;
+  private failed = false;
+
+  constructor(inflate: boolean, windowBits: number, noContextTakeover: boolean) {
+    this.inflate = inflate;
+    this.noContextTakeover = noContextTakeover;
+    this.stream = inflate ? createInflateRaw({ windowBits }) : createDeflateRaw({ windowBits });
+    this.stream.on("data", (chunk: Buffer) => {
+      this.size += chunk.length;
+      this.output.push(chunk);
+      if (this.size > MAX_MESSAGE_BYTES) this.fail();
+    });
+    this.stream.on("error", () => this.fail());
+  }
+
+  /** `done` gets the result, or null if the stream is broken (bad or oversized input). */
+  run(input: Buffer[], done: (out: Buffer | null) => void): void {
+    if (this.failed) {
+      done(null);
+      return;
+    }
+    this.jobs.push({ input, done });
+    if (!this.busy) this.next();
+  }
+
+  close(): void {
+    this.stream.close();
+  }
+
+  private next(): void {
+    const job = this.jobs[0];
+    if (!job) {
+      this.busy = false;
+      return;
+    }
+    this.busy = true;
+    for (const chunk of job.input) this.stream.write(chunk);
+    if (this.inflate) this.stream.write(DEFLATE_TAIL);
+    this.stream.flush(zlibConstants.Z_SYNC_FLUSH, () => {
+      if (this.failed) return;
+      this.jobs.shift();
+      let out = Buffer.concat(this.output, this.size);
+      this.output = [];
+      this.size = 0;
+      if (!this.inflate) out = out.subarray(0, out.length - DEFLATE_TAIL.length);
+      if (this.noContextTakeover) this.stream.reset();
+      job.done(out);
+      this.next();
+    });
+  }
+
+  private fail(): void {
+    if (this.failed) return;
+    this.failed = true;
+    for (const job of this.jobs.splice(0)) job.done(null);
+    this.stream.destroy();
+  }
+}
+
+/** Frames going one way: from the client (inbound) or to it. */
+class Direction {
+  readonly out: Outbound;
+  private relay: WebSocketRelay;
+  private inbound: boolean;
+  private codec: MessageCodec | null;
+  private partial: Buffer | null = null;
+  private frame: FrameHeader | null = null;
+  private position = 0;
+  /** Payload of the control frame being read, which is handled whole. */
+  private control: Buffer[] = [];
+  /** Unmasked payload of the message held for zlib. */
+  private held: Buffer[] = [];
+  /** Opcode and compression of the message in progress, and its size so far. */
+  private messageOpcode = 0;
+  private messageCompressed = false;
+  private messageBytes = 0;
+
+  constructor(relay: WebSocketRelay, inbound: boolean, to: Socket, from: Socket, codec: MessageCodec | null) {
+    this.relay = relay;
+    this.inbound = inbound;
+    this.codec = codec;
+    this.out = new Outbound(to, from);
+  }
+
+  /** Returns false on a malformed frame. */
+  push(chunk: Buffer): boolean {
+    if (this.partial) {
+      chunk = Buffer.concat([this.partial, chunk]);
+      this.partial = null;
+    }
+    let offset = 0;
+    while (offset < chunk.length) {
+      if (!this.frame) {
+        const frame = parseHeader(chunk, offset);
+        if (frame === undefined) {
+          this.partial = chunk.subarray(offset);
+          break;
+        }
+        if (frame === null || !this.startFrame(frame)) return false;
+        offset += frame.raw.length;
+        this.frame = frame;
+        this.position = 0;
+        if (frame.length === 0 && !this.endFrame()) return false;
+        continue;
+      }
+      const n = Math.min(this.frame.length - this.position, chunk.length - offset);
+      const piece = chunk.subarray(offset, offset + n);
+      if (this.frame.opcode >= 0x8 || this.messageCompressed) {
+        const copy = Buffer.from(piece);
+        if (this.frame.mask) applyMask(copy, this.frame.mask, this.position);
+        if (this.frame.opcode >= 0x8) {
+          this.control.push(copy);
+        } else {
+          this.held.push(copy);
+        }
+      } else {
+        this.out.write(piece);
+      }
+      this.position += n;
+      offset += n;
+      if (this.position === this.frame.length && !this.endFrame()) return false;
+    }
+    this.out.throttle();
+    return true;
+  }
+
+  /** Decide whether a frame streams through or is held; false if it breaks the protocol. */
+  private startFrame(frame: FrameHeader): boolean {
+    if (frame.opcode >= 0x8) return true;
+    if (frame.opcode !== OP_CONTINUATION) {
+      this.messageOpcode = frame.opcode;
+      this.messageBytes = 0;
+      this.messageCompressed = this.codec !== null && (this.inbound
+        ? frame.rsv1
+        : frame.fin && !frame.rsv1 && frame.length >= DEFLATE_MIN_BYTES && frame.length <= DEFLATE_MAX_BYTES);
+    }
+    this.messageBytes += frame.length;
+    if (this.messageCompressed) {
+      return !this.inbound || this.messageBytes <= MAX_MESSAGE_BYTES;
+    }
+    this.out.write(frame.raw);
+    this.out.midFrame = true;
+    return true;
+  }
+
+  private endFrame(): boolean {
+    const frame = this.frame!;
+    this.frame = null;
+    if (frame.opcode >= 0x8) {
+      const payload = Buffer.concat(this.control);
+      this.control = [];
+      if (!(this.inbound && frame.opcode === OP_PONG && this.relay.pong(payload))) {
+        // The payload was unmasked to read it; masking it again with the same key restores it
+        if (frame.mask) applyMask(payload, frame.mask, 0);
+        this.out.write([frame.raw, payload]);
+      }
+      return true;
+    }
+    if (!this.messageCompressed) {
+      this.out.midFrame = false;
+      if (!this.inbound) this.relay.framed();
+      if (frame.fin) this.relay.stats.message(this.inbound, this.messageBytes);
+      return true;
+    }
+    if (!frame.fin) return true;
+    const input = this.held;
+    const opcode = this.messageOpcode;
+    const size = this.messageBytes;
+    this.held = [];
+    const pending = this.out.defer();
+    this.codec!.run(input, (out) => {
+      if (!out) {
+        this.relay.destroy();
+        return;
+      }
+      // The client's side of the link always carries the compressed size
+      const stats = this.relay.stats;
+      stats.message(this.inbound, this.inbound ? size : out.length);
+      stats.saved(this.inbound ? out.length - size : size - out.length);
+      this.out.fill(pending, encodeFrame(opcode, out, !this.inbound, this.inbound));
+    });
+    return true;
+  }
+}
+
+class WebSocketRelay {
+  readonly stats: WebSocketStats;
+  private client: Socket;
+  private backend: Socket;
+  private fromClient: Direction;
+  private toClient: Direction;
+  private timer: NodeJS.Timeout | null = null;
+  private pings = 0;
+  private ping: Buffer | null = null;
+  private pingSentAt = 0;
+  private pingDue = false;
+
+  constructor(client: Socket, backend: Socket, stats: WebSocketStats, deflate: DeflateParams | null) {
+    this.client = client;
+    this.backend = backend;
+    this.stats = stats;
+    const inflater = deflate && new MessageCodec(true, 15, false);
+    const deflater = deflate && new MessageCodec(false, deflate.windowBits, deflate.noContextTakeover);
+    this.fromClient = new Direction(this, true, backend, client, inflater);
+    this.toClient = new Direction(this, false, client, backend, deflater);
+    client.once("close", () => {
+      if (this.timer) clearInterval(this.timer);
+      inflater?.close();
+      deflater?.close();
+    });
+  }
+
+  start(clientHead: Buffer, backendHead: Buffer): void {
+    const { client, backend } = this;
+    client.on("data", (chunk: Buffer) => {
+      if (!this.fromClient.push(chunk)) this.destroy();
+    });
+    backend.on("data", (chunk: Buffer) => {
+      if (!this.toClient.push(chunk)) this.destroy();
+    });
+    client.on("end", () => this.fromClient.out.end());
+    backend.on("end", () => this.toClient.out.end());
+    client.on("close", () => backend.destroy());
+    backend.on("close", () => client.destroy());
+    backend.on("error", () => client.destroy());
+    if (clientHead.length > 0 && !this.fromClient.push(clientHead)) this.destroy();
+    if (backendHead.length > 0 && !this.toClient.push(backendHead)) this.destroy();
+    backend.resume();
+    this.timer = setInterval(() => this.sendPing(), PING_INTERVAL_MS);
+    this.timer.unref();
+  }
+
+  /** A pong from the client: true if it answers the daemon's ping, which the backend never sent. */
+  pong(payload: Buffer): boolean {
+    if (!this.ping?.equals(payload)) return false;
+    this.stats.pong(performance.now() - this.pingSentAt);
+    this.ping = null;
+    return true;
+  }
+
+  /** A frame to the client is complete, so a ping may go in before the next. */
+  framed(): void {
+    if (this.pingDue) this.sendPing();
+  }
+
+  destroy(): void {
+    this.client.destroy();
+    this.backend.destroy();
+  }
+
+  private sendPing(): void {
+    const out = this.toClient.out;
+    if (out.midFrame) {
+      this.pingDue = true;
+      return;
+    }
+    this.pingDue = false;
+    // An unanswered ping is replaced; its pong would no longer count
+    this.ping = Buffer.from(`${PING_PREFIX}${++this.pings}`);
+    this.pingSentAt = performance.now();
+    out.write(encodeFrame(OP_PING, Buffer.from(this.ping), false, false));
+  }
+}